@@ -10,14 +10,26 @@
 #include "pnid_appwin.h"
 
 /* app_entries[]: pnid application actions */
+static void save_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
+static void undo_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
+static void redo_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static void pagesetup_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static void print_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static void preferences_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static void about_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static void help_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static void quit_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
+static void retained_changed(GSimpleAction *action, GVariant *state, gpointer app);
+static void profile_changed(GSimpleAction *action, GVariant *state, gpointer app);
+static void profile_dump_activated(GSimpleAction *action, GVariant *parameter, gpointer app);
 static GActionEntry app_entries[] =
 {
+    { "retained",    NULL,                  NULL, "false", retained_changed },
+    { "profile",     NULL,                  NULL, "false", profile_changed },
+    { "profile-dump", profile_dump_activated, NULL, NULL, NULL },
+    { "save",        save_activated,        NULL, NULL, NULL },
+    { "undo",        undo_activated,        NULL, NULL, NULL },
+    { "redo",        redo_activated,        NULL, NULL, NULL },
     { "pagesetup",   pagesetup_activated,   NULL, NULL, NULL },
     { "print",       print_activated,       NULL, NULL, NULL },
     { "preferences", preferences_activated, NULL, NULL, NULL },
@@ -31,6 +43,7 @@ struct _PnidApp {
     GtkApplication parent;
 
     /* instance members */
+    GdkTexture *logo;		/* decoded once, for the about dialogue */
 };
 G_DEFINE_TYPE(PnidApp, pnid_app, GTK_TYPE_APPLICATION);
 PnidApp *pnid_app_new(void);			      /* interface */
@@ -80,6 +93,8 @@ static void pnid_app_startup(GApplication *app)
     /* chain-up so parent's startup proceedure is performed first */
     G_APPLICATION_CLASS(pnid_app_parent_class)->startup(app);
 
+    PNID_APP(app)->logo = gdk_texture_new_from_resource("/cymru/ert/pnid/data/valve.png");
+
     /* register application wide actions */
     g_action_map_add_action_entries(G_ACTION_MAP(app),
 				    app_entries,
@@ -90,6 +105,21 @@ static void pnid_app_startup(GApplication *app)
     gtk_application_set_accels_for_action(GTK_APPLICATION(app),
 					  "app.quit",
 					  (const char *[]){ "<Ctrl>Q", NULL }); 
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app),
+					  "app.save",
+					  (const char *[]){ "<Ctrl>S", NULL }); 
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app),
+					  "app.print",
+					  (const char *[]){ "<Ctrl>P", NULL }); 
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app),
+					  "app.undo",
+					  (const char *[]){ "<Ctrl>Z", NULL }); 
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app),
+					  "app.redo",
+					  (const char *[]){ "<Ctrl><Shift>Z", "<Ctrl>Y", NULL }); 
+    gtk_application_set_accels_for_action(GTK_APPLICATION(app),
+					  "app.profile",
+					  (const char *[]){ "F12", NULL }); 
 }
 
 /* pnid_app_shutdown(): #GApplication::shutdown handler, received by
@@ -100,6 +130,8 @@ static void pnid_app_shutdown(GApplication *app)
 {
     // add save dialogue
 
+    g_clear_object(&PNID_APP(app)->logo);
+
     /* chain-up AFTER required actions are completed*/
     G_APPLICATION_CLASS(pnid_app_parent_class)->shutdown(app); 
 }
@@ -143,6 +175,39 @@ pnid_app_open(GApplication *app, GFile **files, int n_files, const char *hint)
     gtk_window_present(GTK_WINDOW(win));    
 }
 
+/* save_activated(): app.save action, save the drawing to its file */
+static void
+save_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
+{
+    GList *windows;
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_save(PNID_APP_WINDOW(windows->data));
+}
+
+/* undo_activated(): app.undo action, undo the last edit */
+static void
+undo_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
+{
+    GList *windows;
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_undo(PNID_APP_WINDOW(windows->data));
+}
+
+/* redo_activated(): app.redo action, redo the last edit undone */
+static void
+redo_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
+{
+    GList *windows;
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_redo(PNID_APP_WINDOW(windows->data));
+}
+
 /* pagesetup_activated(): app.pagesetup action, open a page setup
    dialogue and update page settings with any user changes. */
 static void
@@ -164,7 +229,11 @@ pagesetup_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
 static void
 print_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
 {
-    printf("print_activated\n");
+    GList *windows;
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_print(PNID_APP_WINDOW(windows->data));
 }
 
 /* preferences_activated(): app.preferences action, open preferences
@@ -183,7 +252,7 @@ about_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
 			   "program-name", "cymru.ert.pnid",
 			   "version",      "v0.0-alpha",
 			   "comments",     "Piping and instrumentation drawing canvas",
-			   "logo",         gdk_texture_new_from_resource("/cymru/ert/pnid/data/valve.png"),
+			   "logo",         PNID_APP(app)->logo,
 			   "authors",      (const char *[]){"Ellis Rhys Thomas <e.rhys.thomas@gmail.com>", NULL},
 			   "copyright",    "© 2021 Ellis Rhys Thomas",
 			   "license-type", GTK_LICENSE_GPL_3_0,
@@ -198,6 +267,48 @@ help_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
     printf("help_activated\n");
 }
 
+/* retained_changed(): app.retained stateful action, switch the
+   canvas between immediate and retained rendering */
+static void
+retained_changed(GSimpleAction *action, GVariant *state, gpointer app)
+{
+    GList *windows;
+
+    g_simple_action_set_state(action, state);
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_set_retained(PNID_APP_WINDOW(windows->data),
+				     g_variant_get_boolean(state));
+}
+
+/* profile_changed(): app.profile stateful action, show or hide the
+   canvas profiling overlay */
+static void
+profile_changed(GSimpleAction *action, GVariant *state, gpointer app)
+{
+    GList *windows;
+
+    g_simple_action_set_state(action, state);
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_set_profiling(PNID_APP_WINDOW(windows->data),
+				      g_variant_get_boolean(state));
+}
+
+/* profile_dump_activated(): app.profile-dump action, write the
+   recorded frame profile to the user's cache directory */
+static void
+profile_dump_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
+{
+    GList *windows;
+
+    windows = gtk_application_get_windows(GTK_APPLICATION(app));
+    if (windows)
+	pnid_app_window_dump_profile(PNID_APP_WINDOW(windows->data));
+}
+
 /* quit_activated(): app.quit action, exit application */
 static void
 quit_activated(GSimpleAction *action, GVariant *parameter, gpointer app)
@@ -5,9 +5,11 @@
 /* pnid_appwin.c - pnid application window class definition */
 
 #include <gtk/gtk.h>
+#include <errno.h>
 
 #include "pnid_app.h"
 #include "pnid_canvas.h"
+#include "pnid_minimap.h"
 #include "pnid_appwin.h"
 
 /* #PnidAppWin - pnid application window GObject class definition */
@@ -19,7 +21,14 @@ struct _PnidAppWindow {
     GtkPrintSettings *print_settings;
     GtkWidget        *headerbar;
     GtkWidget        *menu_button;
+    GtkWidget        *progress;	/* shown while a drawing loads */
+    GtkWidget        *cancel_button;
+    GCancellable     *cancellable;
+    GtkWidget        *overlay;
+    GtkWidget        *scroller;
     GtkWidget        *canvas; 
+    GtkWidget        *minimap;	/* overview in a corner of the canvas */
+    GFile            *file;	/* drawing file, NULL if never saved */
 };
 G_DEFINE_TYPE(PnidAppWindow, pnid_app_window, GTK_TYPE_APPLICATION_WINDOW);
 
@@ -27,9 +36,20 @@ G_DEFINE_TYPE(PnidAppWindow, pnid_app_window, GTK_TYPE_APPLICATION_WINDOW);
 PnidAppWindow *pnid_app_window_new(PnidApp *app);
 void pnid_app_window_empty(PnidAppWindow *self);
 void pnid_app_window_open(PnidAppWindow *win, GFile *file);
+void pnid_app_window_save(PnidAppWindow *self);
 /* Constructors */
 static void pnid_app_window_class_init(PnidAppWindowClass *class);
 static void pnid_app_window_init(PnidAppWindow *self);
+static void pnid_app_window_dispose(GObject *self);
+static void add_minimap(PnidAppWindow *self);
+/* Loading */
+static void load_progress(GObject *canvas, GParamSpec *pspec, gpointer self);
+static void load_cancel(GtkButton *button, gpointer self);
+static void load_ready(GObject *canvas, GAsyncResult *result, gpointer data);
+/* Printing */
+static void print_begin(GtkPrintOperation *op, GtkPrintContext *context, gpointer self);
+static void print_page(GtkPrintOperation *op, GtkPrintContext *context, int page,
+		       gpointer self);
     
 /* pnid_app_window_new(): interface for creating a new empty pnid
    application window. */
@@ -58,20 +78,27 @@ pnid_app_window_empty(PnidAppWindow *self)
     
     
     self->canvas = GTK_WIDGET(pnid_canvas_new(paper_size, 1));
-    gtk_window_set_child(GTK_WINDOW(self), GTK_WIDGET(self->canvas));
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(self->scroller), self->canvas);
+    add_minimap(self);
     gtk_widget_queue_draw(self->canvas);
 }
 
-/* pnid_app_window_open(): Open a pnid drawing file.
+/* pnid_app_window_open(): Open a pnid drawing file. The file is
+   loaded in the background, objects appearing on the canvas as they
+   are read while progress is shown in the header bar.
 
    -> #PnidAppWindow
-   --> #PnidCanvas
+   --> #GtkOverlay
+   ---> #GtkScrolledWindow
+   ----> #PnidCanvas
+   ---> #PnidMinimap
 
    Currently only supports opening a maximum of one file at any time. */
 void
 pnid_app_window_open(PnidAppWindow *self, GFile *file)
 {
     GtkPaperSize *paper_size;
+    char *path;
 
     g_assert(file);
     g_assert_null(self->canvas); /* remove when mutli files supported */
@@ -81,8 +108,72 @@ pnid_app_window_open(PnidAppWindow *self, GFile *file)
     paper_size =  gtk_page_setup_get_paper_size(self->page_setup);
     
     self->canvas = GTK_WIDGET(pnid_canvas_new(paper_size, 1));
-    gtk_window_set_child(GTK_WINDOW(self), GTK_WIDGET(self->canvas));
+    gtk_scrolled_window_set_child(GTK_SCROLLED_WINDOW(self->scroller), self->canvas);
+    add_minimap(self);
+
     gtk_widget_queue_draw(self->canvas);
+
+    if (!(path = g_file_get_path(file))) {
+	g_warning("Only local drawing files can be opened");
+	return;
+    }
+
+    self->file = g_object_ref(file);
+    self->cancellable = g_cancellable_new();
+    g_signal_connect(self->canvas, "notify::load-progress",
+		     G_CALLBACK(load_progress), self);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(self->progress), 0.0);
+    gtk_widget_set_visible(self->progress, TRUE);
+    gtk_widget_set_visible(self->cancel_button, TRUE);
+
+    pnid_canvas_load_async(PNID_CANVAS(self->canvas), path, self->cancellable,
+			   load_ready, g_object_ref(self));
+    g_free(path);
+}
+
+/* pnid_app_window_save(): make sure every edit to the drawing is on
+   disk. Edits are journalled next to the file as they are made, so
+   this only waits for the journal to be written. */
+void
+pnid_app_window_save(PnidAppWindow *self)
+{
+    int res;
+
+    if (!self->canvas)
+	return;
+    if (!self->file) {
+	g_message("Drawing has no file to save to");
+	return;
+    }
+    if (self->cancellable) {
+	g_message("Drawing is still loading");
+	return;
+    }
+
+    if ((res = pnid_canvas_sync(PNID_CANVAS(self->canvas))) == -ENOENT)
+	g_message("Imported drawings are not saved, convert with pnid-convert");
+    else if (res < 0)
+	g_warning("Failed to save %s: %s", g_file_peek_path(self->file), g_strerror(-res));
+}
+
+/* pnid_app_window_undo(): undo the last edit to the drawing */
+void
+pnid_app_window_undo(PnidAppWindow *self)
+{
+    if (!self->canvas)
+	return;
+    if (pnid_canvas_undo(PNID_CANVAS(self->canvas)) == -ENOENT)
+	g_message("Nothing to undo");
+}
+
+/* pnid_app_window_redo(): redo the last edit undone */
+void
+pnid_app_window_redo(PnidAppWindow *self)
+{
+    if (!self->canvas)
+	return;
+    if (pnid_canvas_redo(PNID_CANVAS(self->canvas)) == -ENOENT)
+	g_message("Nothing to redo");
 }
 
 /* pnid_app_window_page_setup(): open the page setup dialogue and
@@ -114,12 +205,99 @@ pnid_app_window_page_setup(PnidAppWindow *self)
     }
 }
 
+/* pnid_app_window_print(): open the print dialogue and print the
+   drawing with the window's page setup, keeping the print settings
+   chosen for next time. */
+void
+pnid_app_window_print(PnidAppWindow *self)
+{
+    GtkPrintOperation *op;
+    GtkPrintOperationResult res;
+    GError *error = NULL;
+
+    if (!self->canvas)
+	return;
+
+    op = gtk_print_operation_new();
+    if (self->print_settings)
+	gtk_print_operation_set_print_settings(op, self->print_settings);
+    if (self->page_setup)
+	gtk_print_operation_set_default_page_setup(op, self->page_setup);
+    gtk_print_operation_set_unit(op, GTK_UNIT_POINTS);
+    gtk_print_operation_set_embed_page_setup(op, TRUE);
+    g_signal_connect(op, "begin-print", G_CALLBACK(print_begin), self);
+    g_signal_connect(op, "draw-page", G_CALLBACK(print_page), self);
+
+    res = gtk_print_operation_run(op, GTK_PRINT_OPERATION_ACTION_PRINT_DIALOG,
+				  GTK_WINDOW(self), &error);
+    if (res == GTK_PRINT_OPERATION_RESULT_APPLY) {
+	g_clear_object(&self->print_settings);
+	self->print_settings = g_object_ref(gtk_print_operation_get_print_settings(op));
+    } else if (res == GTK_PRINT_OPERATION_RESULT_ERROR) {
+	g_warning("Failed to print: %s", error->message);
+	g_error_free(error);
+    }
+    g_object_unref(op);
+}
+
+/* pnid_app_window_set_retained(): switch the canvas between drawing
+   with cairo each frame and drawing with retained render nodes. */
+void
+pnid_app_window_set_retained(PnidAppWindow *self, gboolean retained)
+{
+    if (self->canvas)
+	g_object_set(self->canvas, "retained-mode", retained, NULL);
+}
+
+/* pnid_app_window_set_profiling(): show or hide the canvas profiling
+   overlay, frames are only recorded while it is shown. */
+void
+pnid_app_window_set_profiling(PnidAppWindow *self, gboolean profiling)
+{
+    if (self->canvas)
+	g_object_set(self->canvas, "profiling", profiling, NULL);
+}
+
+/* pnid_app_window_dump_profile(): write the canvas frame profile to
+   pnid-profile.csv in the user's cache directory. */
+void
+pnid_app_window_dump_profile(PnidAppWindow *self)
+{
+    char *path;
+    int res;
+
+    if (!self->canvas)
+	return;
+
+    path = g_build_filename(g_get_user_cache_dir(), "pnid-profile.csv", NULL);
+    if ((res = pnid_canvas_dump_profile(PNID_CANVAS(self->canvas), path)) < 0)
+	g_warning("Failed to write profile to %s: %s", path, g_strerror(-res));
+    else
+	g_message("Profile written to %s", path);
+    g_free(path);
+}
+
 /* pnid_app_window_class_init(): pnid application window class
    constructor, executed only once before the first instance is
    constructed. */
 static void
 pnid_app_window_class_init(PnidAppWindowClass *class)
 {
+    G_OBJECT_CLASS(class)->dispose = pnid_app_window_dispose;
+}
+
+/* pnid_app_window_dispose(): stop any load and release the drawing
+   file, may be called more than once. */
+static void
+pnid_app_window_dispose(GObject *self)
+{
+    if (PNID_APP_WINDOW(self)->cancellable)
+	g_cancellable_cancel(PNID_APP_WINDOW(self)->cancellable);
+    g_clear_object(&PNID_APP_WINDOW(self)->file);
+    PNID_APP_WINDOW(self)->progress = NULL; /* owned by the header bar */
+    PNID_APP_WINDOW(self)->cancel_button = NULL;
+
+    G_OBJECT_CLASS(pnid_app_window_parent_class)->dispose(self);
 }
 
 /* pnid_app_window_init(): Creates a new window, provides a state
@@ -127,11 +305,16 @@ pnid_app_window_class_init(PnidAppWindowClass *class)
    pnid_app_window_open().
 
    In the new window, a header bar contaning a menu button and window
-   controls is initialised. 
+   controls is initialised, along with an empty scrolled window to
+   hold the canvas. The canvas is a #GtkScrollable so is placed in the
+   scrolled window directly, without a #GtkViewport. The scrolled
+   window is overlaid so that a minimap can float above the canvas.
 
    -> #PnidAppWindow
    --> #GtkHeaderBar
    ---> #GtkMenuButton
+   --> #GtkOverlay
+   ---> #GtkScrolledWindow
 */
 static void
 pnid_app_window_init(PnidAppWindow *self)
@@ -145,9 +328,116 @@ pnid_app_window_init(PnidAppWindow *self)
     gtk_menu_button_set_menu_model(GTK_MENU_BUTTON(self->menu_button), menu);
     g_object_unref(builder);
 
+    self->progress = gtk_progress_bar_new();
+    gtk_widget_set_valign(self->progress, GTK_ALIGN_CENTER);
+    gtk_widget_set_visible(self->progress, FALSE);
+    self->cancel_button = gtk_button_new_from_icon_name("process-stop-symbolic");
+    gtk_widget_set_tooltip_text(self->cancel_button, "Stop loading");
+    gtk_widget_set_visible(self->cancel_button, FALSE);
+    g_signal_connect(self->cancel_button, "clicked", G_CALLBACK(load_cancel), self);
+
     self->headerbar = gtk_header_bar_new();
+    gtk_header_bar_pack_start(GTK_HEADER_BAR(self->headerbar), self->progress);
+    gtk_header_bar_pack_start(GTK_HEADER_BAR(self->headerbar), self->cancel_button);
     gtk_header_bar_pack_end(GTK_HEADER_BAR(self->headerbar), self->menu_button);
     gtk_window_set_titlebar(GTK_WINDOW(self), GTK_WIDGET(self->headerbar));
+
+    self->scroller = gtk_scrolled_window_new();
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(self->scroller),
+				   GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    self->overlay = gtk_overlay_new();
+    gtk_overlay_set_child(GTK_OVERLAY(self->overlay), self->scroller);
+    gtk_window_set_child(GTK_WINDOW(self), self->overlay);
     
     return; 
 }
+
+/* add_minimap(): float an overview of the canvas in the bottom
+   right corner of the window */
+static void
+add_minimap(PnidAppWindow *self)
+{
+    self->minimap = GTK_WIDGET(pnid_minimap_new(PNID_CANVAS(self->canvas)));
+    gtk_widget_set_size_request(self->minimap, 200, 150);
+    gtk_widget_set_halign(self->minimap, GTK_ALIGN_END);
+    gtk_widget_set_valign(self->minimap, GTK_ALIGN_END);
+    gtk_widget_set_margin_end(self->minimap, 12);
+    gtk_widget_set_margin_bottom(self->minimap, 12);
+    gtk_overlay_add_overlay(GTK_OVERLAY(self->overlay), self->minimap);
+}
+
+/*********************
+ * Loading
+*******************/
+
+/* load_progress(): #PnidCanvas::notify::load-progress handler */
+static void
+load_progress(GObject *canvas, GParamSpec *pspec, gpointer self)
+{
+    double fraction;
+
+    g_object_get(canvas, "load-progress", &fraction, NULL);
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(PNID_APP_WINDOW(self)->progress),
+				  fraction);
+}
+
+/* load_cancel(): cancel button #GtkButton::clicked handler, stop
+   loading and keep what has been read so far. */
+static void
+load_cancel(GtkButton *button, gpointer self)
+{
+    g_cancellable_cancel(PNID_APP_WINDOW(self)->cancellable);
+}
+
+/* load_ready(): the drawing has been loaded, cancelled or failed. A
+   drawing that was not completely loaded is not saved back over its
+   file. */
+static void
+load_ready(GObject *canvas, GAsyncResult *result, gpointer data)
+{
+    PnidAppWindow *self = data;
+    GError *error = NULL;
+
+    if (!pnid_canvas_load_finish(PNID_CANVAS(canvas), result, &error)) {
+	if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+	    g_warning("%s", error->message);
+	g_clear_object(&self->file);
+	g_error_free(error);
+    } else if (self->file) {
+	gtk_window_set_title(GTK_WINDOW(self), g_file_peek_path(self->file));
+    }
+
+    g_signal_handlers_disconnect_by_func(canvas, load_progress, self);
+    g_clear_object(&self->cancellable);
+    if (self->progress) {	/* not disposed while loading */
+	gtk_widget_set_visible(self->progress, FALSE);
+	gtk_widget_set_visible(self->cancel_button, FALSE);
+    }
+    g_object_unref(self);	/* held while loading */
+}
+
+/*********************
+ * Printing
+*******************/
+
+/* print_begin(): #GtkPrintOperation::begin-print handler, tile the
+   sheet over as many pages as it needs at full size */
+static void
+print_begin(GtkPrintOperation *op, GtkPrintContext *context, gpointer self)
+{
+    gtk_print_operation_set_n_pages(op,
+	pnid_canvas_print_pages(PNID_CANVAS(PNID_APP_WINDOW(self)->canvas),
+				gtk_print_context_get_width(context),
+				gtk_print_context_get_height(context)));
+}
+
+/* print_page(): #GtkPrintOperation::draw-page handler, draw the part
+   of the sheet on page */
+static void
+print_page(GtkPrintOperation *op, GtkPrintContext *context, int page, gpointer self)
+{
+    pnid_canvas_print_page(PNID_CANVAS(PNID_APP_WINDOW(self)->canvas),
+			   gtk_print_context_get_cairo_context(context), page,
+			   gtk_print_context_get_width(context),
+			   gtk_print_context_get_height(context));
+}
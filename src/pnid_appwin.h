@@ -24,6 +24,13 @@ G_DECLARE_FINAL_TYPE(PnidAppWindow, pnid_app_window, PNID, APP_WINDOW, GtkApplic
 PnidAppWindow *pnid_app_window_new         (PnidApp *app);
 void           pnid_app_window_empty       (PnidAppWindow *self);
 void           pnid_app_window_open        (PnidAppWindow *win, GFile *file);
+void           pnid_app_window_save        (PnidAppWindow *self);
+void           pnid_app_window_undo        (PnidAppWindow *self);
+void           pnid_app_window_redo        (PnidAppWindow *self);
 void           pnid_app_window_page_setup  (PnidAppWindow *self);
+void           pnid_app_window_print       (PnidAppWindow *self);
+void           pnid_app_window_set_retained(PnidAppWindow *self, gboolean retained);
+void           pnid_app_window_set_profiling(PnidAppWindow *self, gboolean profiling);
+void           pnid_app_window_dump_profile(PnidAppWindow *self);
 
 #endif /* __PNID_APPWIN_H */
@@ -0,0 +1,287 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_attrindex.c - an attribute column with a value index
+
+   Each distinct value is interned once as a numbered value, which
+   lists the handles of the objects holding it. The column holds, for
+   each slot of the object store, the number of its object's value and
+   the position of its handle in that list, so an object's value is
+   changed by swapping it out of one list and appending it to another.
+
+   Values are found by their string in an open addressing table of
+   value numbers, probed linearly and kept no more than half full.
+   Values are never removed, a value no longer held keeps an empty
+   list, so no probe sequence is ever broken. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_objstore.h"
+#include "pnid_attrindex.h"
+
+#define TABLEMIN 64		/* initial table size, a power of two */
+
+/* value: an interned value and the objects holding it */
+struct value {
+  char          *s;
+  uint32_t       hash;
+  uint32_t       n;
+  uint32_t       cap;
+  PnidObjHandle *objs;
+};
+
+/* cell: the value of the object in a slot */
+struct cell {
+  uint32_t value;		/* value number + 1, 0 for none */
+  uint32_t pos;			/* of handle in value's objs */
+};
+
+struct pnid_attrindex {
+  struct value *values;
+  uint32_t      nvalues;
+  uint32_t      capvalues;
+  uint32_t     *table;		/* value number + 1, 0 if empty */
+  uint32_t      size;		/* of table */
+  struct cell  *cells;		/* the column, by slot */
+  size_t        ncells;
+};
+
+static uint32_t hash(const char *s);
+static uint32_t *probe(const PnidAttrIndex *ix, const char *s, uint32_t h);
+static int       intern(PnidAttrIndex *ix, const char *s, uint32_t *value);
+static int       rehash(PnidAttrIndex *ix);
+
+/*********************
+ * Creation and Destruction
+*******************/
+
+/* pnid_attrindex_new(): create an empty index. Returns NULL if out
+   of memory. */
+PnidAttrIndex *
+pnid_attrindex_new(void)
+{
+  PnidAttrIndex *new;
+
+  if (!(new = calloc(1, sizeof *new)))
+    return NULL;
+  if (!(new->table = calloc(TABLEMIN, sizeof *new->table))) {
+    free(new);
+    return NULL;
+  }
+  new->size = TABLEMIN;
+
+  return new;
+}
+
+/* pnid_attrindex_destroy(): free ix and its values */
+void
+pnid_attrindex_destroy(PnidAttrIndex *ix)
+{
+  uint32_t i;
+
+  if (!ix)
+    return;
+
+  for (i = 0; i < ix->nvalues; i++) {
+    free(ix->values[i].s);
+    free(ix->values[i].objs);
+  }
+  free(ix->values);
+  free(ix->table);
+  free(ix->cells);
+  free(ix);
+}
+
+/*********************
+ * Values
+*******************/
+
+/* pnid_attrindex_set(): set the value of obj, replacing any it held
+   before. A NULL value removes obj from the index, as must be done
+   before it is released. Returns -ENOMEM or 0. */
+int
+pnid_attrindex_set(PnidAttrIndex *ix, PnidObjHandle obj, const char *value)
+{
+  struct cell *c, *cells;
+  struct value *v;
+  PnidObjHandle last;
+  PnidObjHandle *objs;
+  size_t n, i = PNID_OBJ_HANDLE_SLOT(obj);
+  uint32_t cap;
+  int res;
+
+  if (i >= ix->ncells) {
+    if (!value)
+      return 0;
+    n = ix->ncells ? ix->ncells : TABLEMIN;
+    while (n <= i)
+      n *= 2;
+    if (!(cells = realloc(ix->cells, n * sizeof *cells)))
+      return -ENOMEM;
+    memset(cells + ix->ncells, 0, (n - ix->ncells) * sizeof *cells);
+    ix->cells = cells;
+    ix->ncells = n;
+  }
+  c = &ix->cells[i];
+
+  if (c->value) {
+    v = &ix->values[c->value - 1];
+    if (value && strcmp(v->s, value) == 0) {
+      v->objs[c->pos] = obj;
+      return 0;
+    }
+    last = v->objs[--v->n];
+    v->objs[c->pos] = last;
+    ix->cells[PNID_OBJ_HANDLE_SLOT(last)].pos = c->pos;
+    c->value = 0;
+  }
+  if (!value)
+    return 0;
+
+  if ((res = intern(ix, value, &c->value)) < 0)
+    return res;
+  v = &ix->values[c->value - 1];
+  if (v->n == v->cap) {
+    cap = v->cap ? v->cap * 2 : 4;
+    if (!(objs = realloc(v->objs, cap * sizeof *objs))) {
+      c->value = 0;
+      return -ENOMEM;
+    }
+    v->objs = objs;
+    v->cap = cap;
+  }
+  c->pos = v->n;
+  v->objs[v->n++] = obj;
+
+  return 0;
+}
+
+/* pnid_attrindex_get(): the value of obj, or NULL if it has none */
+const char *
+pnid_attrindex_get(const PnidAttrIndex *ix, PnidObjHandle obj)
+{
+  const struct cell *c;
+  const struct value *v;
+
+  if (PNID_OBJ_HANDLE_SLOT(obj) >= ix->ncells
+      || !(c = &ix->cells[PNID_OBJ_HANDLE_SLOT(obj)])->value)
+    return NULL;
+  v = &ix->values[c->value - 1];
+
+  return v->objs[c->pos] == obj ? v->s : NULL;
+}
+
+/* pnid_attrindex_lookup(): point objs at the handles of the objects
+   whose value is value. Returns their number. */
+size_t
+pnid_attrindex_lookup(const PnidAttrIndex *ix, const char *value,
+		      const PnidObjHandle **objs)
+{
+  const struct value *v;
+  uint32_t *p;
+
+  p = probe(ix, value, hash(value));
+  if (!*p) {
+    *objs = NULL;
+    return 0;
+  }
+  v = &ix->values[*p - 1];
+  *objs = v->objs;
+
+  return v->n;
+}
+
+/*********************
+ * Utilities
+*******************/
+
+/* hash(): FNV-1a hash of s */
+static uint32_t
+hash(const char *s)
+{
+  uint32_t h = 2166136261u;
+
+  for (; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+
+  return h;
+}
+
+/* probe(): the table entry holding s, or the empty one where it
+   would be inserted */
+static uint32_t *
+probe(const PnidAttrIndex *ix, const char *s, uint32_t h)
+{
+  const struct value *v;
+  uint32_t i, mask = ix->size - 1;
+
+  for (i = h & mask; ix->table[i]; i = (i + 1) & mask) {
+    v = &ix->values[ix->table[i] - 1];
+    if (v->hash == h && strcmp(v->s, s) == 0)
+      break;
+  }
+
+  return &ix->table[i];
+}
+
+/* intern(): find or add the value s, storing its number + 1 in
+   value. Returns -ENOMEM or 0. */
+static int
+intern(PnidAttrIndex *ix, const char *s, uint32_t *value)
+{
+  struct value *values, *v;
+  uint32_t *p, h = hash(s), cap;
+  int res;
+
+  if (*(p = probe(ix, s, h))) {
+    *value = *p;
+    return 0;
+  }
+
+  if ((ix->nvalues + 1) * 2 > ix->size) {
+    if ((res = rehash(ix)) < 0)
+      return res;
+    p = probe(ix, s, h);
+  }
+  if (ix->nvalues == ix->capvalues) {
+    cap = ix->capvalues ? ix->capvalues * 2 : TABLEMIN;
+    if (!(values = realloc(ix->values, cap * sizeof *values)))
+      return -ENOMEM;
+    ix->values = values;
+    ix->capvalues = cap;
+  }
+  v = &ix->values[ix->nvalues];
+  memset(v, 0, sizeof *v);
+  if (!(v->s = strdup(s)))
+    return -ENOMEM;
+  v->hash = h;
+  *p = *value = ++ix->nvalues;
+
+  return 0;
+}
+
+/* rehash(): double the size of the table. Returns -ENOMEM or 0. */
+static int
+rehash(PnidAttrIndex *ix)
+{
+  uint32_t *table, i, j, mask = ix->size * 2 - 1;
+
+  if (!(table = calloc(ix->size * 2, sizeof *table)))
+    return -ENOMEM;
+  for (i = 0; i < ix->size; i++) {
+    if (!ix->table[i])
+      continue;
+    for (j = ix->values[ix->table[i] - 1].hash & mask; table[j]; j = (j + 1) & mask)
+      ;
+    table[j] = ix->table[i];
+  }
+  free(ix->table);
+  ix->table = table;
+  ix->size *= 2;
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_attrindex.h - an attribute column with a value index */
+
+#ifndef __PNID_ATTRINDEX_H
+#define __PNID_ATTRINDEX_H
+
+#include <stddef.h>
+
+#include "pnid_objstore.h"
+
+/* #PnidAttrIndex: the values of one attribute of the objects of a
+   #PnidObjStore, held by slot, and the objects holding each value */
+typedef struct pnid_attrindex PnidAttrIndex;
+
+/* Create and destroy an index */
+PnidAttrIndex *pnid_attrindex_new(void);
+void           pnid_attrindex_destroy(PnidAttrIndex *ix);
+
+/* Set the value of an object, NULL for none, and read it back */
+int            pnid_attrindex_set(PnidAttrIndex *ix, PnidObjHandle obj, const char *value);
+const char    *pnid_attrindex_get(const PnidAttrIndex *ix, PnidObjHandle obj);
+
+/* Find the objects with a value, the array returned is valid until
+   the index is next changed */
+size_t         pnid_attrindex_lookup(const PnidAttrIndex *ix, const char *value,
+				     const PnidObjHandle **objs);
+
+#endif /* __PNID_ATTRINDEX_H */
@@ -122,9 +122,9 @@ int
 pnid_box_is_separate(const struct pnid_box *a, const struct pnid_box *b)
 {
   return
-    pnid_box_get_left(a)   > pnid_box_get_right(b)  &&
-    pnid_box_get_top(a)    > pnid_box_get_bottom(b) &&
-    pnid_box_get_right(a)  < pnid_box_get_left(b)   &&
+    pnid_box_get_left(a)   > pnid_box_get_right(b)  ||
+    pnid_box_get_top(a)    > pnid_box_get_bottom(b) ||
+    pnid_box_get_right(a)  < pnid_box_get_left(b)   ||
     pnid_box_get_bottom(a) < pnid_box_get_top(b);
 }
 
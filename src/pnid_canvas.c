@@ -5,19 +5,139 @@
 /* pnid_canvas.c - pnid drawing canvas class definition  */
 
 #include <gtk/gtk.h>
+#include <errno.h>
 #include <math.h>
+#include <stdio.h>
 
-#include "pnid_draw.h"
+#include "pnid_obj.h"
+#include "pnid_objstore.h"
+#include "pnid_attrindex.h"
+#include "pnid_graph.h"
+#include "pnid_undo.h"
+#include "pnid_select.h"
+#include "pnid_symdef.h"
+#include "pnid_rtree.h"
+#include "pnid_symcache.h"
+#include "pnid_textcache.h"
+#include "pnid_prof.h"
+#include "pnid_file.h"
+#include "pnid_journal.h"
+#include "pnid_import.h"
+#include "pnid_pack.h"
+#include "pnid_sheet.h"
 #include "pnid_canvas.h"
 
 #define PNID_CANVAS_BACKGROUND_PT        10 /* Size of background behind page */
 #define PNID_CANVAS_MARGIN_LENGTH_PT     30 /* Length of margin lines */
+#define PNID_CANVAS_OBJECT_PAD_PT         1 /* Object node border for strokes */
+#define PNID_CANVAS_PROFILE_FRAMES     1024 /* Frames kept by the profiler */
+#define PNID_CANVAS_HUD_WIDTH           300 /* Profiling overlay width */
+#define PNID_CANVAS_HUD_LINE             14 /* Profiling overlay line height */
+#define PNID_CANVAS_HUD_LINES             4
+#define PNID_CANVAS_LOAD_BATCH         4096 /* Objects indexed per main loop turn */
+#define PNID_CANVAS_LOAD_PENDING          2 /* Batches queued before loader waits */
+#define PNID_CANVAS_COMPACT_S            60 /* Seconds between compaction checks */
+#define PNID_CANVAS_COMPACT_BYTES   (1 << 20) /* Journal size folded into base file */
+#define PNID_CANVAS_COMPACT_BATCH     65536 /* Slots copied per idle turn */
+#define PNID_CANVAS_MEMORY_BUDGET  (64 << 20) /* Default bytes of object payload held */
+#define PNID_CANVAS_UNDO_LIMIT      (4 << 20) /* Default bytes of edits kept to undo */
+#define PNID_CANVAS_HIT_PX                3 /* Pointer hit tolerance */
+#define PNID_CANVAS_TEXT_BYTES      (4 << 20) /* Shaped labels and their rasters kept */
+#define PNID_CANVAS_GRID_PT              10 /* Default drafting grid spacing */
+#define PNID_CANVAS_GRID_MIN_PX           4 /* Grid is hidden when finer */
+#define PNID_CANVAS_GRID_TILE_PX        256 /* Coarser grids are ruled line by line */
+#define PNID_CANVAS_PORT_PT               2 /* Line end distance joining a port */
 
-/* #PnidCanvas class definition */
+/* #PnidCanvas class definition
+
+   The canvas is a #GtkScrollable, its size is that of the visible
+   viewport rather than the drawing. The viewport is rendered into a
+   backing surface which is kept between frames, when the view is
+   panned the rendered pixels are blitted into place and only the
+   newly exposed strips are drawn. In retained mode the snapshot is
+   built from a render node kept for every object drawn instead, and
+   rebuilt only when that object or the zoom level changes. Either
+   way, an edit damages only the parts of the viewport it changed,
+   and each damaged region is emitted as #PnidCanvas::damaged for
+   views such as a #PnidMinimap.
+
+   The page is drawn by pnid_sheet.c, at less detail as it is zoomed
+   out, with a drafting grid which a dragged selection snaps to.
+   Objects are held in a #PnidObjStore, indexed by a #PnidRtree,
+   connected in a #PnidGraph and found by tag or line number in a
+   #PnidAttrIndex. Their selection is a #PnidSelect, drawn with the
+   band, lasso and dragged objects in an overlay above the rendered
+   viewport so that selecting and dragging leave it to be reused.
+   Pointer events only note the latest position, which a tick of the
+   frame clock acts on once a frame.
+
+   Drawings are loaded in batches by a worker thread, or read a chunk
+   at a time as they are viewed from a #PnidPack. Edits are recorded
+   in a #PnidJournal and a #PnidUndo, and the journal is periodically
+   folded back into the file. Pages are printed one at a time. The
+   modules named describe themselves, and the sections below the
+   canvas's use of them. */
 struct _PnidCanvas {
   GtkDrawingArea   parent;
   /* instance members */
-  cairo_surface_t *surface;
+  cairo_surface_t *surface;	/* rendered viewport */
+  cairo_surface_t *scratch;	/* back buffer for scroll blits */
+  double           surface_x;	/* document offset of surface origin */
+  double           surface_y;
+  gboolean         surface_valid;
+  GtkAdjustment   *hadjustment;
+  GtkAdjustment   *vadjustment;
+  guint            hscroll_policy : 1;
+  guint            vscroll_policy : 1;
+  PnidObjStore    *store;	/* drawing objects */
+  PnidRtree       *index;	/* of objects in store */
+  PnidFile        *file;	/* mapped drawing, holds object strings */
+  GStringChunk    *strings;	/* strings of objects edited since */
+  GHashTable      *ids;		/* object id -> PnidObj */
+  PnidAttrIndex   *tags;	/* tag numbers of objects in store */
+  PnidAttrIndex   *lines;	/* line numbers of objects in store */
+  PnidGraph       *graph;	/* connections of objects in store */
+  guint            next_id;
+  gboolean         loading;	/* objects still arriving, edits refused */
+  char            *path;	/* drawing file */
+  PnidJournal     *journal;
+  PnidUndo        *undo;
+  PnidSelect      *selection;	/* objects selected */
+  PnidSelect      *hits;	/* found by the last band or lasso */
+  gboolean         banding;	/* a band or lasso is being dragged */
+  gboolean         lasso;
+  enum pnid_select_op band_op;
+  double           band_x;	/* start of band, widget pixels */
+  double           band_y;
+  double           band_dx;	/* pointer offset from start */
+  double           band_dy;
+  GArray          *lasso_points; /* PnidCoord on the page */
+  guint            pointer_tick;	/* frame clock tick, while moving */
+  gboolean         pointer_moved;	/* since the last tick */
+  gboolean         band_moved;
+  double           pointer_x;	/* latest position, widget pixels */
+  double           pointer_y;
+  PnidObjHandle    hover;	/* object under the pointer */
+  gboolean         dragging;	/* the selection is being dragged */
+  GArray          *dragged;	/* PnidObjHandle selected when the drag began */
+  PnidCoord        drag_from;	/* corner of the object picked up */
+  cairo_pattern_t *grid;	/* repeating grid cell at zoom_level */
+  cairo_region_t  *damage;	/* of the rendered viewport, drawing pixels */
+  PnidPack        *pack;	/* packed drawing, read as viewed */
+  struct chunk    *chunks;	/* state of each chunk of pack */
+  guint64          payload_bytes; /* attribute strings held for chunks */
+  gint64           pack_frame;	/* frame of the last query */
+  gboolean         pack_pinned;	/* edited, payloads are kept */
+  gboolean         compacting;
+  guint            compact_source;
+  guint            compact_idle;
+  struct compact  *compact;	/* snapshot being copied */
+  PnidSymcache    *symbols;
+  PnidTextcache   *texts;
+  GHashTable      *nodes;	/* PnidObj -> GskRenderNode, retained mode */
+  GArray          *lod_fills;	/* cairo_rectangle_t, dots and summaries */
+  GPtrArray       *lod_objs;	/* PnidObj, drawn above a dot */
+  PnidProf        *prof;
   /* properties */
   gdouble          page_height;
   gdouble          page_width;
@@ -26,9 +146,38 @@ struct _PnidCanvas {
   gdouble          left_margin;
   gdouble          right_margin;
   uint             zoom_level;
+  gboolean         retained_mode;
+  gdouble          lod_object_px;
+  gdouble          lod_node_px;
+  gdouble          lod_line_scale;
+  gdouble          lod_text_scale;
+  gboolean         profiling;
+  gdouble          load_progress;
+  guint64          memory_budget;
+  guint64          payload_evictions;
+  guint64          payload_reloads;
+  guint64          undo_limit;
+  guint            grid_size;
+};
+
+/* chunk: a chunk of a packed drawing, absent until read */
+struct chunk {
+  enum {
+    CHUNK_ABSENT = 0,
+    CHUNK_PENDING,		/* being read by a worker */
+    CHUNK_RESIDENT,
+    CHUNK_EVICTED,		/* objects indexed, payload dropped */
+    CHUNK_RELOADING,		/* payload being reread */
+    CHUNK_FAILED
+  }             state;
+  gint64        used;		/* frame last viewed */
+  GArray       *ids;		/* guint object ids, in chunk order once read */
+  GStringChunk *strings;	/* payload, attributes of objs */
+  gsize         bytes;		/* of payload */
 };
 
-G_DEFINE_TYPE(PnidCanvas, pnid_canvas, GTK_TYPE_DRAWING_AREA);
+G_DEFINE_TYPE_WITH_CODE(PnidCanvas, pnid_canvas, GTK_TYPE_DRAWING_AREA,
+			G_IMPLEMENT_INTERFACE(GTK_TYPE_SCROLLABLE, NULL));
 
 typedef enum  {
   PROP_PAGE_HEIGHT = 1,
@@ -38,19 +187,142 @@ typedef enum  {
   PROP_LEFT_MARGIN,
   PROP_RIGHT_MARGIN,
   PROP_ZOOM_LEVEL,
-  N_PROPERTIES
+  PROP_RETAINED_MODE,
+  PROP_LOD_OBJECT_PX,
+  PROP_LOD_NODE_PX,
+  PROP_LOD_LINE_SCALE,
+  PROP_LOD_TEXT_SCALE,
+  PROP_PROFILING,
+  PROP_LOAD_PROGRESS,
+  PROP_MEMORY_BUDGET,
+  PROP_PAYLOAD_EVICTIONS,
+  PROP_PAYLOAD_RELOADS,
+  PROP_UNDO_LIMIT,
+  PROP_GRID_SIZE,
+  N_PROPERTIES,
+  /* #GtkScrollable properties are overridden, not installed */
+  PROP_HADJUSTMENT = N_PROPERTIES,
+  PROP_VADJUSTMENT,
+  PROP_HSCROLL_POLICY,
+  PROP_VSCROLL_POLICY
 } PnidCanvasProperty;
 
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
 
+enum {
+  SIGNAL_DAMAGED,
+  N_SIGNALS
+};
+
+static guint signals[N_SIGNALS] = { 0, };
+
 /* Constructors */
 static void pnid_canvas_class_init(PnidCanvasClass *class);
 static void pnid_canvas_init(PnidCanvas *self);
+static void pnid_canvas_dispose(GObject *self);
+static void pnid_canvas_finalize(GObject *self);
 /* Property getter/setter methods */
 static void pnid_canvas_get_property(GObject *self, guint property_id, GValue *value, GParamSpec *pspec);
 static void pnid_canvas_set_property(GObject *self, guint property_id, const GValue *value, GParamSpec *pspec);
+/* Scrolling */
+static void pnid_canvas_size_allocate(GtkWidget *widget, int width, int height, int baseline);
+static void set_adjustment(PnidCanvas *self, GtkAdjustment **adj, GtkAdjustment *new);
+static void clear_adjustment(PnidCanvas *self, GtkAdjustment **adj);
+static void configure_adjustment(GtkAdjustment *adj, double upper, double page_size);
+static void configure_adjustments(PnidCanvas *self);
+static void invalidate(PnidCanvas *self);
+static void damage(PnidCanvas *self, const PnidBox *box);
 /* Drawing */
 static void redraw(GtkDrawingArea *area, cairo_t *cr, int width, int height, gpointer data);
+static void render_strip(PnidCanvas *self, cairo_t *cr, double x, double y, double width, double height);
+static void draw_sheet(PnidCanvas *self, cairo_t *cr);
+static cairo_pattern_t *grid(PnidCanvas *self);
+static void             grid_rule(PnidCanvas *self, cairo_t *cr);
+static void draw_objects(PnidCanvas *self, cairo_t *cr);
+static void draw_object(PnidCanvas *self, cairo_t *cr, PnidObj *obj);
+static void repair(PnidCanvas *self, double x, double y, int width, int height);
+/* Level of detail */
+static void query(PnidCanvas *self, const PnidBox *region);
+static int  collect_node(const PnidBox *mbr, void *data);
+static void collect_object(PnidObj *obj, void *data);
+static void collect_fill(PnidCanvas *self, double x, double y, double width, double height);
+static enum pnid_sheet_lod lod_object(PnidCanvas *self, const PnidBox *bbox);
+static gboolean lod_summarise(PnidCanvas *self, const PnidBox *mbr);
+static void sheet(PnidCanvas *self, PnidSheet *sheet);
+/* Retained mode drawing */
+static void pnid_canvas_snapshot(GtkWidget *widget, GtkSnapshot *snapshot);
+static void snapshot_sheet(PnidCanvas *self, GtkSnapshot *snapshot, double x, double y, int width, int height);
+static void snapshot_objects(PnidCanvas *self, GtkSnapshot *snapshot, double x, double y, int width, int height);
+static GskRenderNode *object_node(PnidCanvas *self, PnidObj *obj);
+/* Profiling */
+static void snapshot_hud(PnidCanvas *self, GtkSnapshot *snapshot);
+/* Selection */
+static void select_object(PnidObj *tuple, void *data);
+static void select_apply(PnidCanvas *self, enum pnid_select_op op, int res);
+static void selected_object(uint32_t slot, void *data);
+static void band_begin(GtkGestureDrag *gesture, double x, double y, gpointer data);
+static void band_update(GtkGestureDrag *gesture, double dx, double dy, gpointer data);
+static void band_end(GtkGestureDrag *gesture, double dx, double dy, gpointer data);
+static void band_box(PnidCanvas *self, PnidBox *box);
+static void to_page(PnidCanvas *self, double x, double y, double *px, double *py);
+/* Pointer */
+static void pointer_motion(GtkEventControllerMotion *motion, double x, double y, gpointer data);
+static void pointer_leave(GtkEventControllerMotion *motion, gpointer data);
+static void pointer_schedule(PnidCanvas *self);
+static gboolean pointer_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data);
+static void band_grow(PnidCanvas *self);
+static PnidObjHandle hit(PnidCanvas *self, double x, double y);
+static void hit_object(PnidObj *tuple, void *data);
+/* Printing */
+static void print_tile(PnidCanvas *self, int page, double width, double height,
+		       PnidBox *region);
+static void print_chunk(unsigned chunk, void *data);
+/* Dragging */
+static void drag_begin(PnidCanvas *self, PnidObjHandle obj);
+static void drag_end(PnidCanvas *self);
+static void drag_offset(PnidCanvas *self, int *dx, int *dy);
+static int  drag_clamp(int d, int from, int lo, int hi, unsigned grid);
+static PnidObj *dragged_at(PnidCanvas *self, guint i);
+static int  snap(int v, unsigned grid);
+/* Selection overlay */
+static void snapshot_selection(PnidCanvas *self, GtkSnapshot *snapshot);
+static void overlay_object(uint32_t slot, void *data);
+/* Loading */
+static void load_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable);
+static int  load_import(PnidObj **objs, size_t n, GStringChunk *strings, double progress, void *data);
+static void load_post(GTask *task, PnidObj **objs, size_t n, GStringChunk *strings, double progress);
+static gboolean load_batch(gpointer data);
+static void load_batch_free(gpointer data);
+static void load_free(gpointer data);
+/* Packed drawings */
+static void pack_fetch(PnidCanvas *self, const PnidBox *region);
+static void pack_chunk(unsigned chunk, void *data);
+static void pack_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable);
+static void pack_ready(GObject *source, GAsyncResult *result, gpointer data);
+static void pack_read_free(gpointer data);
+static void pack_evict(PnidCanvas *self);
+static gsize payload_size(PnidObj *obj);
+/* Journalling */
+static void journal(PnidCanvas *self, enum pnid_journal_op op, PnidObj *obj);
+static void replay_entry(enum pnid_journal_op op, const PnidObj *obj, void *data);
+static void intern(PnidCanvas *self, PnidObj *obj);
+static void adopt(PnidCanvas *self, PnidObj *obj);
+static void reindex(PnidCanvas *self, PnidObj *obj);
+static void unindex(PnidCanvas *self, PnidObj *obj);
+static void join(PnidCanvas *self, PnidObj *obj);
+static void join_object(PnidObj *tuple, void *data);
+static int  ends_within(const PnidObj *line, const PnidObj *obj);
+static int  trace_object(PnidObjHandle obj, unsigned depth, void *data);
+static void undo_entry(enum pnid_undo_op op, const PnidObj *from, const PnidObj *to, void *data);
+static void record(PnidCanvas *self, int res);
+static int  take(PnidCanvas *self, PnidObj **objs, size_t n);
+static int  move(PnidCanvas *self, PnidObj *obj, const PnidBox *bbox);
+static void changed(PnidCanvas *self, PnidObj *obj);
+static gboolean compact_tick(gpointer data);
+static gboolean compact_copy(gpointer data);
+static void compact_thread(GTask *task, gpointer source, gpointer task_data, GCancellable *cancellable);
+static void compact_ready(GObject *source, GAsyncResult *result, gpointer data);
+static void compact_free(gpointer data);
 
 /* pnid_canvas_new(): interface for creating a new empty pnid canvas */
 PnidCanvas *
@@ -67,6 +339,507 @@ pnid_canvas_new(GtkPaperSize *paper_size, uint zoom_level)
 	     NULL);
 }
 
+/* pnid_canvas_insert(): add a copy of obj to the canvas, with a new
+   id. Returns the canvas's object, or NULL on error or while a
+   drawing is loading. */
+PnidObj *
+pnid_canvas_insert(PnidCanvas *self, const PnidObj *obj)
+{
+  PnidObj *new;
+
+  if (self->loading || !(new = pnid_objstore_add(self->store, obj)))
+    return NULL;
+  new->id = self->next_id;
+  intern(self, new);
+  if (pnid_rtree_insert(self->index, new) < 0) {
+    pnid_objstore_release(self->store, new);
+    return NULL;
+  }
+  adopt(self, new);
+  journal(self, PNID_JOURNAL_INSERT, new);
+  record(self, pnid_undo_insert(self->undo, new));
+  damage(self, &new->bbox);
+
+  return new;
+}
+
+/* pnid_canvas_place(): add an instance of symbol centred on x, y at
+   its nominal size, with its symbol's default attributes. Returns the
+   canvas's object, or NULL on error. */
+PnidObj *
+pnid_canvas_place(PnidCanvas *self, unsigned symbol, unsigned x, unsigned y)
+{
+  PnidObj obj = { 0 };
+
+  obj.type = PNID_OBJ_SYMBOL;
+  obj.symbol = symbol;
+  obj.bbox = pnid_symdef_place(symbol, x, y, 1.0);
+
+  return pnid_canvas_insert(self, &obj);
+}
+
+/* pnid_canvas_move(): move obj to bbox. Returns -EBUSY while a
+   drawing is loading, or less than zero on error. */
+int
+pnid_canvas_move(PnidCanvas *self, PnidObj *obj, const PnidBox *bbox)
+{
+  PnidBox from = obj->bbox;
+  int res;
+
+  if (self->loading)
+    return -EBUSY;
+  if ((res = move(self, obj, bbox)) < 0)
+    return res;
+  record(self, pnid_undo_move(self->undo, &obj, &from, 1, g_get_monotonic_time()));
+
+  return 0;
+}
+
+/* pnid_canvas_remove(): remove obj from the canvas and free it.
+   Returns -EBUSY while a drawing is loading, or less than zero on
+   error. */
+int
+pnid_canvas_remove(PnidCanvas *self, PnidObj *obj)
+{
+  int res;
+
+  if (self->loading)
+    return -EBUSY;
+  if ((res = pnid_rtree_remove(self->index, obj)) < 0)
+    return res;
+  g_hash_table_remove(self->nodes, obj);
+  g_hash_table_remove(self->ids, GUINT_TO_POINTER(obj->id));
+  journal(self, PNID_JOURNAL_DELETE, obj);
+  record(self, pnid_undo_delete(self->undo, obj));
+  damage(self, &obj->bbox);
+  unindex(self, obj);
+  pnid_graph_isolate(self->graph, pnid_objstore_handle(self->store, obj));
+  pnid_objstore_release(self->store, obj);
+
+  return 0;
+}
+
+/* pnid_canvas_sync(): wait until every edit has reached the drawing
+   file's journal on disk. Returns -ENOENT if the drawing has no file,
+   or less than zero on error. */
+int
+pnid_canvas_sync(PnidCanvas *self)
+{
+  if (!self->journal)
+    return -ENOENT;
+
+  return pnid_journal_sync(self->journal);
+}
+
+/* load: state of a pnid_canvas_load_async() worker, shared with the
+   main loop */
+struct load {
+  char     *path;
+  PnidFile *file;		/* mapped drawing, taken by finish */
+  PnidPack *pack;		/* or packed drawing */
+  int       res;		/* worker error, -errno */
+  GMutex    lock;
+  GCond     cond;
+  int       pending;		/* batches posted but not indexed */
+};
+
+/* batch: objects read by the worker, to be indexed by the main loop */
+struct batch {
+  GTask        *task;
+  PnidObj     **objs;
+  size_t        n;
+  GStringChunk *strings;	/* of imported objects, or NULL */
+  double        progress;
+};
+
+/* pnid_canvas_load_async(): load the drawing file at path into an
+   empty canvas on a worker thread. Objects are shown as they are
+   read, with the load-progress property updated after each batch.
+   Cancelling stops the load, leaving the objects read so far. Until
+   the load is finished the drawing may be viewed and selected from
+   but not edited, as new objects could take the ids of those yet to
+   be read and there is no journal yet to record the edits.
+
+   A DXF or SVG drawing is imported instead, see pnid_import(). It has
+   no file or journal, so edits to it are not saved. Nor are edits to
+   a packed drawing, of which only the index is read here.
+
+   pnid_canvas_load_finish() must be called from callback, even after
+   cancellation, as the canvas then takes the mapped file from which
+   its objects' attribute strings are read. */
+void
+pnid_canvas_load_async(PnidCanvas *self, const char *path,
+		       GCancellable *cancellable,
+		       GAsyncReadyCallback callback, gpointer data)
+{
+  struct load *load;
+  GTask *task;
+
+  task = g_task_new(self, cancellable, callback, data);
+  g_task_set_source_tag(task, pnid_canvas_load_async);
+  /* the file is returned even when cancelled part way through */
+  g_task_set_check_cancellable(task, FALSE);
+
+  if (self->path) {
+    g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_BUSY,
+			    "A drawing is already open");
+    g_object_unref(task);
+    return;
+  }
+
+  load = g_new0(struct load, 1);
+  load->path = g_strdup(path);
+  g_mutex_init(&load->lock);
+  g_cond_init(&load->cond);
+  g_task_set_task_data(task, load, load_free);
+
+  self->loading = TRUE;
+  self->path = g_strdup(path);
+  self->load_progress = 0.0;
+  g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_LOAD_PROGRESS]);
+
+  g_task_run_in_thread(task, load_thread);
+  g_object_unref(task);
+}
+
+/* pnid_canvas_load_finish(): complete a pnid_canvas_load_async(),
+   returns FALSE with error set if the load failed or was
+   cancelled. */
+gboolean
+pnid_canvas_load_finish(PnidCanvas *self, GAsyncResult *result, GError **error)
+{
+  struct load *load;
+  char *path;
+  int res;
+
+  g_return_val_if_fail(g_task_is_valid(result, self), FALSE);
+
+  self->loading = FALSE;
+  if (!g_task_propagate_boolean(G_TASK(result), error))
+    return FALSE;
+
+  load = g_task_get_task_data(G_TASK(result));
+  if (!self->index)		/* disposed while loading */
+    return !g_cancellable_set_error_if_cancelled(g_task_get_cancellable(G_TASK(result)),
+						 error);
+  self->file = g_steal_pointer(&load->file);
+  if ((self->pack = g_steal_pointer(&load->pack))) {
+    self->chunks = g_new0(struct chunk, pnid_pack_len(self->pack));
+    self->next_id = pnid_pack_next_id(self->pack);
+    self->load_progress = 1.0;
+    g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_LOAD_PROGRESS]);
+    damage(self, NULL);
+  }
+
+  if (load->res < 0) {
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-load->res),
+		"Failed to load %s: %s", load->path, g_strerror(-load->res));
+    return FALSE;
+  }
+  if (g_cancellable_set_error_if_cancelled(g_task_get_cancellable(G_TASK(result)),
+					   error))
+    return FALSE;
+  if (!self->file)		/* imported or packed */
+    return TRUE;
+
+  /* edits since the file was last compacted */
+  path = g_strconcat(self->path, ".journal", NULL);
+  res = pnid_journal_open(path, pnid_file_journal(self->file), replay_entry, self,
+			  &self->journal);
+  g_free(path);
+  if (res < 0) {
+    g_set_error(error, G_IO_ERROR, g_io_error_from_errno(-res),
+		"Failed to open journal of %s: %s", self->path, g_strerror(-res));
+    return FALSE;
+  }
+  self->compact_source = g_timeout_add_seconds(PNID_CANVAS_COMPACT_S,
+					       compact_tick, self);
+
+  return TRUE;
+}
+
+/* pnid_canvas_changed(): obj has been modified other than its
+   bounding box, which is changed with pnid_canvas_move(). Any
+   retained rendering of it is discarded. Objects must not be modified
+   while a drawing is loading. */
+void
+pnid_canvas_changed(PnidCanvas *self, PnidObj *obj)
+{
+  g_return_if_fail(!self->loading);
+
+  changed(self, obj);
+  damage(self, &obj->bbox);
+}
+
+/* pnid_canvas_set_attr(): set attribute attr of obj to a copy of
+   value, or unset it if NULL. Returns -EBUSY while a drawing is
+   loading, or 0. */
+int
+pnid_canvas_set_attr(PnidCanvas *self, PnidObj *obj, enum pnid_attr attr, const char *value)
+{
+  PnidObj before = *obj;
+
+  if (self->loading)
+    return -EBUSY;
+  obj->attr[attr] = value;
+  pnid_canvas_changed(self, obj);
+  record(self, pnid_undo_change(self->undo, &before, obj));
+
+  return 0;
+}
+
+/* pnid_canvas_undo(): undo the last edit made through the
+   canvas. Returns -ENOENT if there is none, -EBUSY while a drawing
+   is loading, or 0. */
+int
+pnid_canvas_undo(PnidCanvas *self)
+{
+  if (self->loading)
+    return -EBUSY;
+
+  return pnid_undo_undo(self->undo, undo_entry, self);
+}
+
+/* pnid_canvas_redo(): redo the last edit undone. Returns -ENOENT if
+   there is none, -EBUSY while a drawing is loading, or 0. */
+int
+pnid_canvas_redo(PnidCanvas *self)
+{
+  if (self->loading)
+    return -EBUSY;
+
+  return pnid_undo_redo(self->undo, undo_entry, self);
+}
+
+/* select: a pnid_canvas_select_box() or pnid_canvas_select_lasso()
+   in progress */
+struct select {
+  PnidCanvas           *canvas;
+  const PnidBox        *box;
+  enum pnid_select_mode mode;
+  const PnidCoord      *lasso;
+  size_t                n;
+  int                   res;
+};
+
+/* pnid_canvas_select_box(): combine the objects within box in mode
+   with the selection by op */
+void
+pnid_canvas_select_box(PnidCanvas *self, const PnidBox *box,
+		       enum pnid_select_mode mode, enum pnid_select_op op)
+{
+  struct select s = { self, box, mode };
+
+  pnid_select_clear(self->hits);
+  pnid_rtree_walk(self->index, box, NULL, select_object, &s);
+  select_apply(self, op, s.res);
+}
+
+/* pnid_canvas_select_lasso(): combine the objects wholly within the
+   polygon of the n points of lasso with the selection by op */
+void
+pnid_canvas_select_lasso(PnidCanvas *self, const PnidCoord *lasso, size_t n,
+			 enum pnid_select_op op)
+{
+  struct select s = { self, NULL, PNID_SELECT_CONTAIN, lasso, n };
+  PnidBox box;
+  size_t i;
+
+  pnid_select_clear(self->hits);
+  if (n >= 3) {
+    box.nw = box.se = lasso[0];
+    for (i = 1; i < n; i++) {
+      box.nw.x = MIN(box.nw.x, lasso[i].x);
+      box.nw.y = MIN(box.nw.y, lasso[i].y);
+      box.se.x = MAX(box.se.x, lasso[i].x);
+      box.se.y = MAX(box.se.y, lasso[i].y);
+    }
+    pnid_rtree_walk(self->index, &box, NULL, select_object, &s);
+  }
+  select_apply(self, op, s.res);
+}
+
+/* pnid_canvas_find(): find the objects whose attribute attr, which
+   must be PNID_ATTR_TAG or PNID_ATTR_LINE, is value. Returns a new
+   array of them. */
+GPtrArray *
+pnid_canvas_find(PnidCanvas *self, enum pnid_attr attr, const char *value)
+{
+  const PnidObjHandle *objs;
+  GPtrArray *found;
+  size_t i, n;
+
+  g_return_val_if_fail(attr == PNID_ATTR_TAG || attr == PNID_ATTR_LINE, NULL);
+
+  n = pnid_attrindex_lookup(attr == PNID_ATTR_TAG ? self->tags : self->lines, value, &objs);
+  found = g_ptr_array_sized_new(n);
+  for (i = 0; i < n; i++)
+    g_ptr_array_add(found, pnid_objstore_get(self->store, objs[i]));
+
+  return found;
+}
+
+/* trace: a pnid_canvas_trace() or join() in progress */
+struct trace {
+  PnidCanvas *canvas;
+  PnidObj    *start;
+  gboolean    isolate;
+  GPtrArray  *found;
+};
+
+/* pnid_canvas_trace(): find the objects connected to start, nearest
+   first. When isolate is set the trace stops at the valves it
+   reaches, which are included, finding what those valves would
+   isolate. Returns a new array of them, start first. */
+GPtrArray *
+pnid_canvas_trace(PnidCanvas *self, PnidObj *start, gboolean isolate)
+{
+  struct trace t = { self, start, isolate, g_ptr_array_new() };
+
+  if (pnid_graph_trace(self->graph, pnid_objstore_handle(self->store, start),
+		       PNID_GRAPH_BREADTH_FIRST, trace_object, &t) < 0)
+    g_warning("Failed to trace object %u: %s", start->id, g_strerror(ENOMEM));
+
+  return t.found;
+}
+
+/* pnid_canvas_selected(): the objects selected. Returns a new array
+   of them. */
+GPtrArray *
+pnid_canvas_selected(PnidCanvas *self)
+{
+  struct trace t = { self };
+
+  t.found = g_ptr_array_sized_new(pnid_select_len(self->selection));
+  pnid_select_foreach(self->selection, selected_object, &t);
+
+  return t.found;
+}
+
+/* pnid_canvas_dump_profile(): write the recorded frame profile to the
+   file at path. Returns less than zero on error. */
+int
+pnid_canvas_dump_profile(PnidCanvas *self, const char *path)
+{
+  FILE *f;
+  int res;
+
+  if (!(f = fopen(path, "w")))
+    return -errno;
+  res = pnid_prof_dump(self->prof, f);
+  if (fclose(f) && !res)
+    res = -errno;
+
+  return res;
+}
+
+/* print: a pnid_canvas_print_page() in progress */
+struct print {
+  PnidCanvas *canvas;
+  cairo_t    *cr;
+  PnidSheet   sheet;
+  PnidBox     region;		/* of the sheet on the page */
+};
+
+/* pnid_canvas_print_pages(): the number of pages of width by height
+   points the sheet is tiled over when printed, across then down. */
+int
+pnid_canvas_print_pages(PnidCanvas *self, double width, double height)
+{
+  int across, down;
+
+  if (width < 1 || height < 1)
+    return 1;
+  across = MAX(ceil(self->page_width / width), 1);
+  down = MAX(ceil(self->page_height / height), 1);
+
+  return across * down;
+}
+
+/* pnid_canvas_print_page(): draw page of the sheet, tiled over pages
+   of width by height points, onto the print context cr. Only the
+   objects found by a search of the index over the page are drawn,
+   along with those of any chunks of a packed drawing not yet read,
+   and the labels of those evicted, which are read for the page alone
+   and then freed. */
+void
+pnid_canvas_print_page(PnidCanvas *self, cairo_t *cr, int page,
+		       double width, double height)
+{
+  struct print p = { self, cr };
+
+  if (!self->index || !self->symbols)
+    return;
+
+  /* every object at its full detail, in points */
+  sheet(self, &p.sheet);
+  p.sheet.scale = 1.0;
+  p.sheet.lod_object_px = p.sheet.lod_node_px = p.sheet.lod_line_scale = 0;
+  p.sheet.lod_text_scale = 0;
+  p.sheet.vector = TRUE;
+  print_tile(self, page, width, height, &p.region);
+
+  cairo_save(cr);
+  cairo_rectangle(cr, 0, 0, width, height);
+  cairo_clip(cr);
+  cairo_translate(cr, -(double)pnid_box_get_left(&p.region),
+		  -(double)pnid_box_get_top(&p.region));
+  pnid_sheet_draw(&p.sheet, cr, self->index, self->symbols, &p.region);
+  if (self->pack) {
+    cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+    cairo_set_line_width(cr, 1.0);
+    pnid_pack_query(self->pack, &p.region, print_chunk, &p);
+  }
+  cairo_restore(cr);
+}
+
+/* pnid_canvas_draw_overview(): draw the page and the objects upon it
+   within region onto cr at scale device pixels per point, cr's origin
+   being the top left of the page. Unread chunks of a packed drawing
+   are left out rather than read for an overview. */
+void
+pnid_canvas_draw_overview(PnidCanvas *self, cairo_t *cr, double scale,
+			  const PnidBox *region)
+{
+  PnidSheet s;
+
+  sheet(self, &s);
+  s.scale = scale;
+
+  cairo_save(cr);
+  cairo_scale(cr, scale, scale);
+  pnid_sheet_draw_page(&s, cr);
+  if (self->index && self->symbols)
+    pnid_sheet_draw(&s, cr, self->index, self->symbols, region);
+  cairo_restore(cr);
+}
+
+/* pnid_canvas_get_viewport(): store the part of the page in view, in
+   points */
+void
+pnid_canvas_get_viewport(PnidCanvas *self, double *x, double *y,
+			 double *width, double *height)
+{
+  to_page(self, 0, 0, x, y);
+  *width = (double)gtk_widget_get_width(GTK_WIDGET(self)) / self->zoom_level;
+  *height = (double)gtk_widget_get_height(GTK_WIDGET(self)) / self->zoom_level;
+}
+
+/* pnid_canvas_scroll_to(): scroll the viewport to be centred on x, y
+   in points on the page, as near as the drawing's extent allows */
+void
+pnid_canvas_scroll_to(PnidCanvas *self, double x, double y)
+{
+  const double z = self->zoom_level;
+
+  if (self->hadjustment)
+    gtk_adjustment_set_value(self->hadjustment, (x + PNID_CANVAS_BACKGROUND_PT) * z
+			     - gtk_widget_get_width(GTK_WIDGET(self)) / 2.0);
+  if (self->vadjustment)
+    gtk_adjustment_set_value(self->vadjustment, (y + PNID_CANVAS_BACKGROUND_PT) * z
+			     - gtk_widget_get_height(GTK_WIDGET(self)) / 2.0);
+}
+
 /* pnid_canvas_set_property(): property setter */
 static void
 pnid_canvas_set_property(GObject      *self,
@@ -95,11 +868,69 @@ pnid_canvas_set_property(GObject      *self,
     break;
   case PROP_ZOOM_LEVEL:
     PNID_CANVAS(self)->zoom_level = g_value_get_uint(value);
+    g_hash_table_remove_all(PNID_CANVAS(self)->nodes);
+    break;
+  case PROP_RETAINED_MODE:
+    PNID_CANVAS(self)->retained_mode = g_value_get_boolean(value);
+    g_hash_table_remove_all(PNID_CANVAS(self)->nodes);
+    break;
+  case PROP_LOD_OBJECT_PX:
+    PNID_CANVAS(self)->lod_object_px = g_value_get_double(value);
+    break;
+  case PROP_LOD_NODE_PX:
+    PNID_CANVAS(self)->lod_node_px = g_value_get_double(value);
+    break;
+  case PROP_LOD_LINE_SCALE:
+    PNID_CANVAS(self)->lod_line_scale = g_value_get_double(value);
+    g_hash_table_remove_all(PNID_CANVAS(self)->nodes);
+    break;
+  case PROP_LOD_TEXT_SCALE:
+    PNID_CANVAS(self)->lod_text_scale = g_value_get_double(value);
+    g_hash_table_remove_all(PNID_CANVAS(self)->nodes);
+    break;
+  case PROP_PROFILING:
+    PNID_CANVAS(self)->profiling = g_value_get_boolean(value);
+    pnid_prof_enable(PNID_CANVAS(self)->prof, PNID_CANVAS(self)->profiling);
+    gtk_widget_queue_draw(GTK_WIDGET(self));
+    return;
+  case PROP_MEMORY_BUDGET:
+    PNID_CANVAS(self)->memory_budget = g_value_get_uint64(value);
+    if (PNID_CANVAS(self)->pack)
+      pack_evict(PNID_CANVAS(self));
+    return;
+  case PROP_UNDO_LIMIT:
+    if (pnid_undo_set_limit(PNID_CANVAS(self)->undo, g_value_get_uint64(value)) < 0) {
+      g_warning("Failed to set undo limit: %s", g_strerror(ENOMEM));
+      return;
+    }
+    PNID_CANVAS(self)->undo_limit = g_value_get_uint64(value);
+    return;
+  case PROP_GRID_SIZE:
+    PNID_CANVAS(self)->grid_size = g_value_get_uint(value);
     break;
+  case PROP_HADJUSTMENT:
+    set_adjustment(PNID_CANVAS(self), &PNID_CANVAS(self)->hadjustment,
+		   g_value_get_object(value));
+    return;
+  case PROP_VADJUSTMENT:
+    set_adjustment(PNID_CANVAS(self), &PNID_CANVAS(self)->vadjustment,
+		   g_value_get_object(value));
+    return;
+  case PROP_HSCROLL_POLICY:
+    PNID_CANVAS(self)->hscroll_policy = g_value_get_enum(value);
+    return;
+  case PROP_VSCROLL_POLICY:
+    PNID_CANVAS(self)->vscroll_policy = g_value_get_enum(value);
+    return;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(self, property_id, pspec);
-    break;
+    return;
   }
+
+  /* the page geometry or zoom has changed */
+  g_clear_pointer(&PNID_CANVAS(self)->grid, cairo_pattern_destroy);
+  configure_adjustments(PNID_CANVAS(self));
+  invalidate(PNID_CANVAS(self));
 }
 
 /* pnid_canvas_get_property(): property getter */
@@ -131,6 +962,54 @@ pnid_canvas_get_property(GObject      *self,
   case PROP_ZOOM_LEVEL:
     g_value_set_uint(value, PNID_CANVAS(self)->zoom_level);
     break;
+  case PROP_RETAINED_MODE:
+    g_value_set_boolean(value, PNID_CANVAS(self)->retained_mode);
+    break;
+  case PROP_LOD_OBJECT_PX:
+    g_value_set_double(value, PNID_CANVAS(self)->lod_object_px);
+    break;
+  case PROP_LOD_NODE_PX:
+    g_value_set_double(value, PNID_CANVAS(self)->lod_node_px);
+    break;
+  case PROP_LOD_LINE_SCALE:
+    g_value_set_double(value, PNID_CANVAS(self)->lod_line_scale);
+    break;
+  case PROP_LOD_TEXT_SCALE:
+    g_value_set_double(value, PNID_CANVAS(self)->lod_text_scale);
+    break;
+  case PROP_PROFILING:
+    g_value_set_boolean(value, PNID_CANVAS(self)->profiling);
+    break;
+  case PROP_LOAD_PROGRESS:
+    g_value_set_double(value, PNID_CANVAS(self)->load_progress);
+    break;
+  case PROP_MEMORY_BUDGET:
+    g_value_set_uint64(value, PNID_CANVAS(self)->memory_budget);
+    break;
+  case PROP_PAYLOAD_EVICTIONS:
+    g_value_set_uint64(value, PNID_CANVAS(self)->payload_evictions);
+    break;
+  case PROP_PAYLOAD_RELOADS:
+    g_value_set_uint64(value, PNID_CANVAS(self)->payload_reloads);
+    break;
+  case PROP_UNDO_LIMIT:
+    g_value_set_uint64(value, PNID_CANVAS(self)->undo_limit);
+    break;
+  case PROP_GRID_SIZE:
+    g_value_set_uint(value, PNID_CANVAS(self)->grid_size);
+    break;
+  case PROP_HADJUSTMENT:
+    g_value_set_object(value, PNID_CANVAS(self)->hadjustment);
+    break;
+  case PROP_VADJUSTMENT:
+    g_value_set_object(value, PNID_CANVAS(self)->vadjustment);
+    break;
+  case PROP_HSCROLL_POLICY:
+    g_value_set_enum(value, PNID_CANVAS(self)->hscroll_policy);
+    break;
+  case PROP_VSCROLL_POLICY:
+    g_value_set_enum(value, PNID_CANVAS(self)->vscroll_policy);
+    break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(self, property_id, pspec);
     break;
@@ -144,7 +1023,11 @@ pnid_canvas_class_init(PnidCanvasClass *class)
 {
   G_OBJECT_CLASS(class)->set_property = pnid_canvas_set_property;
   G_OBJECT_CLASS(class)->get_property = pnid_canvas_get_property;
-    
+  G_OBJECT_CLASS(class)->dispose      = pnid_canvas_dispose;
+  G_OBJECT_CLASS(class)->finalize     = pnid_canvas_finalize;
+  GTK_WIDGET_CLASS(class)->size_allocate = pnid_canvas_size_allocate;
+  GTK_WIDGET_CLASS(class)->snapshot      = pnid_canvas_snapshot;
+
   obj_properties[PROP_PAGE_WIDTH] =
     g_param_spec_double("page-width", "Page width",
 			"Width of the page in points",
@@ -180,10 +1063,82 @@ pnid_canvas_class_init(PnidCanvasClass *class)
 		      "Zoom level to view the canvas",
 		      1, 5, 2,
 		      G_PARAM_READWRITE);
+  obj_properties[PROP_RETAINED_MODE] =
+    g_param_spec_boolean("retained-mode", "Retained mode",
+			 "Draw with cached render nodes instead of cairo",
+			 FALSE,
+			 G_PARAM_READWRITE);
+  obj_properties[PROP_LOD_OBJECT_PX] =
+    g_param_spec_double("lod-object-px", "Object detail threshold",
+			"Objects smaller than this in device pixels are drawn as a dot",
+			0.0, 1000.0, 3.0, /* min, max, default */
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  obj_properties[PROP_LOD_NODE_PX] =
+    g_param_spec_double("lod-node-px", "Index node detail threshold",
+			"Index subtrees smaller than this in device pixels are drawn as one rectangle",
+			0.0, 1000.0, 2.0, /* min, max, default */
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  obj_properties[PROP_LOD_LINE_SCALE] =
+    g_param_spec_double("lod-line-scale", "Line detail scale",
+			"Symbols are drawn as outlines below this scale",
+			0.0, 100.0, 1.0, /* min, max, default */
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  obj_properties[PROP_LOD_TEXT_SCALE] =
+    g_param_spec_double("lod-text-scale", "Text detail scale",
+			"Labels are not drawn below this scale",
+			0.0, 100.0, 1.0, /* min, max, default */
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  obj_properties[PROP_PROFILING] =
+    g_param_spec_boolean("profiling", "Profiling",
+			 "Record frame timings and show them in an overlay",
+			 FALSE,
+			 G_PARAM_READWRITE);
+  obj_properties[PROP_LOAD_PROGRESS] =
+    g_param_spec_double("load-progress", "Load progress",
+			"Fraction of the drawing file loaded",
+			0.0, 1.0, 0.0, /* min, max, default */
+			G_PARAM_READABLE);
+  obj_properties[PROP_MEMORY_BUDGET] =
+    g_param_spec_uint64("memory-budget", "Memory budget",
+			"Bytes of object attributes held for a packed drawing",
+			0, G_MAXUINT64, PNID_CANVAS_MEMORY_BUDGET, /* min, max, default */
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  obj_properties[PROP_PAYLOAD_EVICTIONS] =
+    g_param_spec_uint64("payload-evictions", "Payload evictions",
+			"Chunks whose attributes were dropped to stay within budget",
+			0, G_MAXUINT64, 0, /* min, max, default */
+			G_PARAM_READABLE);
+  obj_properties[PROP_PAYLOAD_RELOADS] =
+    g_param_spec_uint64("payload-reloads", "Payload reloads",
+			"Chunks whose attributes were reread after being dropped",
+			0, G_MAXUINT64, 0, /* min, max, default */
+			G_PARAM_READABLE);
+  obj_properties[PROP_UNDO_LIMIT] =
+    g_param_spec_uint64("undo-limit", "Undo limit",
+			"Bytes of edits kept to be undone, oldest dropped first",
+			0, G_MAXUINT64, PNID_CANVAS_UNDO_LIMIT, /* min, max, default */
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  obj_properties[PROP_GRID_SIZE] =
+    g_param_spec_uint("grid-size", "Grid size",
+		      "Spacing of the drafting grid in points, 0 for none",
+		      0, 1000, PNID_CANVAS_GRID_PT, /* min, max, default */
+		      G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
 
   g_object_class_install_properties(G_OBJECT_CLASS(class),
 				    N_PROPERTIES,
 				    obj_properties);
+
+  g_object_class_override_property(G_OBJECT_CLASS(class), PROP_HADJUSTMENT, "hadjustment");
+  g_object_class_override_property(G_OBJECT_CLASS(class), PROP_VADJUSTMENT, "vadjustment");
+  g_object_class_override_property(G_OBJECT_CLASS(class), PROP_HSCROLL_POLICY, "hscroll-policy");
+  g_object_class_override_property(G_OBJECT_CLASS(class), PROP_VSCROLL_POLICY, "vscroll-policy");
+
+  /* #PnidCanvas::damaged: the objects within a #PnidBox in points
+     on the page have changed, or those of the whole drawing if it is
+     NULL */
+  signals[SIGNAL_DAMAGED] =
+    g_signal_new("damaged", G_TYPE_FROM_CLASS(class), G_SIGNAL_RUN_LAST,
+		 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_POINTER);
 }
 
 /* pnid_canvas_init(): pnid canvas object constructor, instantiates
@@ -192,48 +1147,2278 @@ pnid_canvas_class_init(PnidCanvasClass *class)
 static void
 pnid_canvas_init(PnidCanvas *self)
 {
+  GtkEventController *motion;
+  GtkGesture *drag;
+
   gtk_drawing_area_set_draw_func(GTK_DRAWING_AREA(self), redraw, NULL, NULL);
+  self->store = pnid_objstore_new();
+  self->tags = pnid_attrindex_new();
+  self->lines = pnid_attrindex_new();
+  self->graph = pnid_graph_new();
+  self->undo = pnid_undo_new(0);
+  self->index = pnid_rtree_new();
+  self->symbols = pnid_symcache_new();
+  self->texts = pnid_textcache_new(PNID_CANVAS_TEXT_BYTES);
+  self->nodes = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+				      (GDestroyNotify)gsk_render_node_unref);
+  self->lod_fills = g_array_new(FALSE, FALSE, sizeof(cairo_rectangle_t));
+  self->lod_objs = g_ptr_array_new();
+  self->prof = pnid_prof_new(PNID_CANVAS_PROFILE_FRAMES);
+  self->strings = g_string_chunk_new(4096);
+  self->ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+  self->selection = pnid_select_new();
+  self->hits = pnid_select_new();
+  self->lasso_points = g_array_new(FALSE, FALSE, sizeof(PnidCoord));
+  self->damage = cairo_region_create();
+
+  drag = gtk_gesture_drag_new();
+  gtk_gesture_single_set_button(GTK_GESTURE_SINGLE(drag), GDK_BUTTON_PRIMARY);
+  g_signal_connect(drag, "drag-begin", G_CALLBACK(band_begin), self);
+  g_signal_connect(drag, "drag-update", G_CALLBACK(band_update), self);
+  g_signal_connect(drag, "drag-end", G_CALLBACK(band_end), self);
+  gtk_widget_add_controller(GTK_WIDGET(self), GTK_EVENT_CONTROLLER(drag));
+
+  motion = gtk_event_controller_motion_new();
+  g_signal_connect(motion, "motion", G_CALLBACK(pointer_motion), self);
+  g_signal_connect(motion, "leave", G_CALLBACK(pointer_leave), self);
+  gtk_widget_add_controller(GTK_WIDGET(self), motion);
+}
+
+/* pnid_canvas_dispose(): release the adjustments, backing surfaces
+   and drawing, writing out the journal. May be called more than
+   once. */
+static void
+pnid_canvas_dispose(GObject *self)
+{
+  PnidCanvas *canvas = PNID_CANVAS(self);
+  int res;
+
+  g_clear_handle_id(&canvas->compact_source, g_source_remove);
+  g_clear_handle_id(&canvas->compact_idle, g_source_remove);
+  g_clear_pointer(&canvas->compact, compact_free);
+  if (canvas->pointer_tick)
+    gtk_widget_remove_tick_callback(GTK_WIDGET(canvas), canvas->pointer_tick);
+  canvas->pointer_tick = 0;
+  if (canvas->journal && (res = pnid_journal_close(canvas->journal)) < 0)
+    g_warning("Failed to write journal of %s: %s", canvas->path, g_strerror(-res));
+  canvas->journal = NULL;
+
+  clear_adjustment(canvas, &canvas->hadjustment);
+  clear_adjustment(canvas, &canvas->vadjustment);
+  g_clear_pointer(&canvas->surface, cairo_surface_destroy);
+  g_clear_pointer(&canvas->scratch, cairo_surface_destroy);
+  g_clear_pointer(&canvas->nodes, g_hash_table_destroy);
+  g_clear_pointer(&canvas->lod_fills, g_array_unref);
+  g_clear_pointer(&canvas->lod_objs, g_ptr_array_unref);
+  g_clear_pointer(&canvas->prof, pnid_prof_destroy);
+  g_clear_pointer(&canvas->ids, g_hash_table_destroy);
+  g_clear_pointer(&canvas->index, pnid_rtree_free);
+  g_clear_pointer(&canvas->tags, pnid_attrindex_destroy);
+  g_clear_pointer(&canvas->lines, pnid_attrindex_destroy);
+  g_clear_pointer(&canvas->graph, pnid_graph_destroy);
+  g_clear_pointer(&canvas->undo, pnid_undo_destroy);
+  g_clear_pointer(&canvas->selection, pnid_select_destroy);
+  g_clear_pointer(&canvas->hits, pnid_select_destroy);
+  g_clear_pointer(&canvas->lasso_points, g_array_unref);
+  g_clear_pointer(&canvas->dragged, g_array_unref);
+  g_clear_pointer(&canvas->damage, cairo_region_destroy);
+  g_clear_pointer(&canvas->grid, cairo_pattern_destroy);
+  g_clear_pointer(&canvas->store, pnid_objstore_destroy);
+  g_clear_pointer(&canvas->symbols, pnid_symcache_destroy);
+  g_clear_pointer(&canvas->texts, pnid_textcache_destroy);
+
+  G_OBJECT_CLASS(pnid_canvas_parent_class)->dispose(self);
+}
+
+/* pnid_canvas_finalize(): release the object strings, which a
+   compaction still running after dispose may be reading, and the
+   packed drawing, which chunk readers may be. */
+static void
+pnid_canvas_finalize(GObject *self)
+{
+  PnidCanvas *canvas = PNID_CANVAS(self);
+  unsigned i;
+
+  for (i = 0; canvas->pack && i < pnid_pack_len(canvas->pack); i++) {
+    if (canvas->chunks[i].ids)
+      g_array_unref(canvas->chunks[i].ids);
+    if (canvas->chunks[i].strings)
+      g_string_chunk_free(canvas->chunks[i].strings);
+  }
+  g_free(canvas->chunks);
+  pnid_pack_close(canvas->pack);
+  pnid_file_unmap(canvas->file);
+  g_string_chunk_free(canvas->strings);
+  g_free(canvas->path);
+
+  G_OBJECT_CLASS(pnid_canvas_parent_class)->finalize(self);
+}
+
+/*********************
+ * Scrolling
+*******************/
+
+/* pnid_canvas_size_allocate(): the viewport has been resized, update
+   the page size of each adjustment. */
+static void
+pnid_canvas_size_allocate(GtkWidget *widget, int width, int height, int baseline)
+{
+  GTK_WIDGET_CLASS(pnid_canvas_parent_class)->size_allocate(widget, width, height, baseline);
+
+  configure_adjustments(PNID_CANVAS(widget));
+}
+
+/* set_adjustment(): replace the adjustment at adj with new, or with
+   a new adjustment when new is NULL. */
+static void
+set_adjustment(PnidCanvas *self, GtkAdjustment **adj, GtkAdjustment *new)
+{
+  if (*adj && *adj == new)
+    return;
+
+  clear_adjustment(self, adj);
+  if (!new)
+    new = gtk_adjustment_new(0.0, 0.0, 0.0, 0.0, 0.0, 0.0);
+
+  *adj = g_object_ref_sink(new);
+  g_signal_connect_swapped(new, "value-changed",
+			   G_CALLBACK(gtk_widget_queue_draw), self);
+  configure_adjustments(self);
+}
+
+/* clear_adjustment(): disconnect from and release the adjustment at
+   adj. */
+static void
+clear_adjustment(PnidCanvas *self, GtkAdjustment **adj)
+{
+  if (!*adj)
+    return;
+
+  g_signal_handlers_disconnect_by_func(*adj, gtk_widget_queue_draw, self);
+  g_clear_object(adj);
+}
+
+/* configure_adjustment(): set the extent of adj in device pixels
+   while keeping the current value in range. */
+static void
+configure_adjustment(GtkAdjustment *adj, double upper, double page_size)
+{
+  double value;
+
+  if (!adj)
+    return;
+
+  upper = MAX(upper, page_size);
+  value = CLAMP(gtk_adjustment_get_value(adj), 0.0, upper - page_size);
+  gtk_adjustment_configure(adj, value, 0.0, upper,
+			   page_size * 0.1, page_size * 0.9, page_size);
+}
+
+/* configure_adjustments(): match the adjustments to the drawing size
+   at the current zoom level and the size of the viewport. */
+static void
+configure_adjustments(PnidCanvas *self)
+{
+  double width, height;		/* drawing extent in pixels */
+
+  width  = (self->page_width  + 2 * PNID_CANVAS_BACKGROUND_PT) * self->zoom_level;
+  height = (self->page_height + 2 * PNID_CANVAS_BACKGROUND_PT) * self->zoom_level;
+
+  configure_adjustment(self->hadjustment, width,
+		       gtk_widget_get_width(GTK_WIDGET(self)));
+  configure_adjustment(self->vadjustment, height,
+		       gtk_widget_get_height(GTK_WIDGET(self)));
+}
+
+/* invalidate(): discard the rendered viewport so that the next frame
+   is drawn in full. */
+static void
+invalidate(PnidCanvas *self)
+{
+  self->surface_valid = FALSE;
+  gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+/* damage(): discard the rendered pixels of box, in points on the
+   page, so that they are drawn again in the next frame, or of the
+   whole drawing if box is NULL. #PnidCanvas::damaged is emitted for
+   anything else showing the drawing. */
+static void
+damage(PnidCanvas *self, const PnidBox *box)
+{
+  const double z = self->zoom_level;
+  const double pad = MAX(PNID_CANVAS_OBJECT_PAD_PT, PNID_SHEET_LABEL_PAD_PT);
+  cairo_rectangle_int_t r;
+
+  g_signal_emit(self, signals[SIGNAL_DAMAGED], 0, box);
+  if (!box) {
+    invalidate(self);
+    return;
+  }
+
+  r.x = floor((PNID_CANVAS_BACKGROUND_PT + pnid_box_get_left(box) - pad) * z);
+  r.y = floor((PNID_CANVAS_BACKGROUND_PT + pnid_box_get_top(box) - pad) * z);
+  r.width = ceil((pnid_box_width(box) + 2 * pad) * z) + 1;
+  r.height = ceil((pnid_box_height(box) + 2 * pad) * z) + 1;
+  cairo_region_union_rectangle(self->damage, &r);
+  gtk_widget_queue_draw(GTK_WIDGET(self));
 }
 
-/* redraw(): redraw the rectangle between width and height */
+/*********************
+ * Drawing
+*******************/
+
+/* redraw(): draw the viewport of width by height pixels.
+
+   The backing surface is scrolled to the current adjustment values,
+   reusing any pixels which remain visible, and only the strips which
+   have been exposed are rendered before painting it to cr. */
 static void
 redraw(GtkDrawingArea *area,
        cairo_t        *cr,
        int             width, int height,
        gpointer        data)
 {
-  PnidCanvas *self = PNID_CANVAS(area); 
+  PnidCanvas *self = PNID_CANVAS(area);
+  cairo_surface_t *tmp;
+  cairo_t *scr;
+  double x, y;			/* viewport origin in the drawing */
+  double dx, dy;		/* scroll since last frame */
+  int scale;
 
-  #ifndef G_DISABLE_ASSERT
-  fputs("==== #PnidCanvas::redraw() callback ====\n", stderr);  
-  fprintf(stderr, "#PnidCanvas::redraw(width=%d, height=%d)\n", width, height);
-  fprintf(stderr, "#PnidCanvas:page_height=%gpt\n", self->page_height);  
-  fprintf(stderr, "#PnidCanvas:page_width=%gpt\n", self->page_width);  
-  fprintf(stderr, "#PnidCanvas:top_margin=%gpt\n", self->top_margin);  
-  fprintf(stderr, "#PnidCanvas:bottom_margin=%gpt\n", self->bottom_margin);
-  fprintf(stderr, "#PnidCanvas:left_margin=%gpt\n", self->left_margin);
-  fprintf(stderr, "#PnidCanvas:right_margin=%gpt\n", self->right_margin);  
-  fprintf(stderr, "#PnidCanvas:zoom_level=%u\n", self->zoom_level);  
-  fputc('\n', stderr);
-  #endif
+  x = self->hadjustment ? round(gtk_adjustment_get_value(self->hadjustment)) : 0;
+  y = self->vadjustment ? round(gtk_adjustment_get_value(self->vadjustment)) : 0;
+  scale = gtk_widget_get_scale_factor(GTK_WIDGET(self));
 
-  cairo_scale(cr, self->zoom_level, self->zoom_level); 
+  /* a resized viewport is rendered again from scratch */
+  if (!self->surface
+      || cairo_image_surface_get_width(self->surface)  != width * scale
+      || cairo_image_surface_get_height(self->surface) != height * scale) {
+    g_clear_pointer(&self->surface, cairo_surface_destroy);
+    g_clear_pointer(&self->scratch, cairo_surface_destroy);
+    self->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width * scale, height * scale);
+    self->scratch = cairo_image_surface_create(CAIRO_FORMAT_RGB24, width * scale, height * scale);
+    cairo_surface_set_device_scale(self->surface, scale, scale);
+    cairo_surface_set_device_scale(self->scratch, scale, scale);
+    self->surface_valid = FALSE;
+  }
+
+  dx = x - self->surface_x;
+  dy = y - self->surface_y;
+  self->surface_x = x;
+  self->surface_y = y;
+
+  if (!self->surface_valid || fabs(dx) >= width || fabs(dy) >= height) {
+    PNID_PROF_COUNT(self->prof, PNID_PROF_TILE_MISS, 1);
+    cairo_region_subtract(self->damage, self->damage);
+    scr = cairo_create(self->surface);
+    render_strip(self, scr, x, y, width, height);
+    cairo_destroy(scr);
+  } else if (dx || dy) {
+    /* blit the retained pixels into the back buffer then swap */
+    PNID_PROF_COUNT(self->prof, PNID_PROF_TILE_HIT, 1);
+    PNID_PROF_BEGIN(self->prof, PNID_PROF_COMPOSITE);
+    scr = cairo_create(self->scratch);
+    cairo_set_operator(scr, CAIRO_OPERATOR_SOURCE);
+    cairo_set_source_surface(scr, self->surface, -dx, -dy);
+    cairo_paint(scr);
+    PNID_PROF_END(self->prof, PNID_PROF_COMPOSITE);
+
+    if (dx > 0)
+      render_strip(self, scr, x + width - dx, y, dx, height);
+    else if (dx < 0)
+      render_strip(self, scr, x, y, -dx, height);
+    if (dy > 0)
+      render_strip(self, scr, x, y + height - dy, width, dy);
+    else if (dy < 0)
+      render_strip(self, scr, x, y, width, -dy);
+    cairo_destroy(scr);
+
+    tmp = self->surface;
+    self->surface = self->scratch;
+    self->scratch = tmp;
+  } else {
+    PNID_PROF_COUNT(self->prof, PNID_PROF_TILE_HIT, 1);
+  }
+
+  self->surface_valid = TRUE;
+  repair(self, x, y, width, height);
+
+  PNID_PROF_BEGIN(self->prof, PNID_PROF_COMPOSITE);
+  cairo_set_source_surface(cr, self->surface, 0, 0);
+  cairo_paint(cr);
+  PNID_PROF_END(self->prof, PNID_PROF_COMPOSITE);
+}
+
+/* repair(): render the damaged parts of the viewport at x, y of
+   width by height pixels into the backing surface, forgetting the
+   damage. */
+static void
+repair(PnidCanvas *self, double x, double y, int width, int height)
+{
+  cairo_rectangle_int_t r;
+  cairo_t *scr;
+  int i, n;
+
+  cairo_region_intersect_rectangle(self->damage,
+				   &(cairo_rectangle_int_t){ x, y, width, height });
+  if (!(n = cairo_region_num_rectangles(self->damage)))
+    return;
+
+  scr = cairo_create(self->surface);
+  for (i = 0; i < n; i++) {
+    cairo_region_get_rectangle(self->damage, i, &r);
+    render_strip(self, scr, r.x, r.y, r.width, r.height);
+  }
+  cairo_destroy(scr);
+  cairo_region_subtract(self->damage, self->damage);
+}
+
+/* render_strip(): render the region of the drawing at x, y of width
+   by height pixels into the backing surface context cr, whose origin
+   lies at the current viewport origin. */
+static void
+render_strip(PnidCanvas *self,
+	     cairo_t    *cr,
+	     double      x,     double y,
+	     double      width, double height)
+{
+  cairo_save(cr);
+  cairo_translate(cr, -self->surface_x, -self->surface_y);
+  cairo_rectangle(cr, x, y, width, height);
+  cairo_clip(cr);
+  cairo_scale(cr, self->zoom_level, self->zoom_level);
+  draw_sheet(self, cr);
+  cairo_restore(cr);
+}
+
+/* draw_sheet(): draw the page, its margins and the objects upon it in
+   points, cr should be clipped to the region to be drawn. */
+static void
+draw_sheet(PnidCanvas *self, cairo_t *cr)
+{
+  PnidSheet s;
+  double px;
+
+  PNID_PROF_BEGIN(self->prof, PNID_PROF_BACKGROUND);
 
   /* Background */
   cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
-  cairo_rectangle(cr, 0, 0, width, height);
-  cairo_fill(cr);
+  cairo_paint(cr);
 
-  /* Outside page */
-  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  /* Page, ruled by the grid tile, and margins */
+  sheet(self, &s);
   cairo_translate(cr, PNID_CANVAS_BACKGROUND_PT, PNID_CANVAS_BACKGROUND_PT);
-  cairo_rectangle(cr, 0, 0, self->page_width, self->page_height);
-  cairo_fill(cr);
-  
-  cairo_set_source_rgb(cr, 0.75, 0.75, 0.75);
-  cairo_translate(cr, self->left_margin, self->top_margin);
-  cairo_rectangle(cr, 0, 0,
-		  self->page_width - self->left_margin - self->right_margin,
-		  self->page_height - self->top_margin - self->bottom_margin);
-  cairo_stroke(cr);
+  px = self->grid_size * self->zoom_level * gtk_widget_get_scale_factor(GTK_WIDGET(self));
+  if (px >= PNID_CANVAS_GRID_MIN_PX && px <= PNID_CANVAS_GRID_TILE_PX) {
+    cairo_save(cr);
+    cairo_set_source(cr, grid(self));
+    cairo_rectangle(cr, 0, 0, self->page_width, self->page_height);
+    cairo_fill(cr);
+    cairo_restore(cr);
+  } else {
+    pnid_sheet_draw_page(&s, cr);
+    if (px > PNID_CANVAS_GRID_TILE_PX)
+      grid_rule(self, cr);
+  }
+  pnid_sheet_draw_margins(&s, cr);
+
+  PNID_PROF_END(self->prof, PNID_PROF_BACKGROUND);
+
+  draw_objects(self, cr);
+}
+
+/* grid(): the pattern ruling the page with the grid, a single cell
+   of white page with a line along its top and left edges rendered
+   for the zoom level and repeated from the page's origin. The cell
+   is at most PNID_CANVAS_GRID_TILE_PX device pixels across. */
+static cairo_pattern_t *
+grid(PnidCanvas *self)
+{
+  const double scale = self->zoom_level * gtk_widget_get_scale_factor(GTK_WIDGET(self));
+  const int px = self->grid_size * scale;
+  cairo_surface_t *tile;
+  cairo_t *cr;
+
+  if (self->grid) {
+    cairo_pattern_get_surface(self->grid, &tile);
+    if (cairo_image_surface_get_width(tile) == px)
+      return self->grid;
+    g_clear_pointer(&self->grid, cairo_pattern_destroy); /* rescaled display */
+  }
+
+  tile = cairo_image_surface_create(CAIRO_FORMAT_RGB24, px, px);
+  cr = cairo_create(tile);
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_paint(cr);
+  cairo_set_source_rgb(cr, 0.88, 0.9, 0.95);
+  cairo_rectangle(cr, 0, 0, px, 1);
+  cairo_rectangle(cr, 0, 0, 1, px);
+  cairo_fill(cr);
+  cairo_destroy(cr);
+  cairo_surface_set_device_scale(tile, scale, scale);
+
+  self->grid = cairo_pattern_create_for_surface(tile);
+  cairo_pattern_set_extend(self->grid, CAIRO_EXTEND_REPEAT);
+  cairo_pattern_set_filter(self->grid, CAIRO_FILTER_NEAREST);
+  cairo_surface_destroy(tile);
+
+  return self->grid;
+}
+
+/* grid_rule(): rule the lines of the grid crossing the clip of cr
+   one by one, for cells too large to be worth a tile */
+static void
+grid_rule(PnidCanvas *self, cairo_t *cr)
+{
+  const double w = 1.0 / (self->zoom_level * gtk_widget_get_scale_factor(GTK_WIDGET(self)));
+  const double g = self->grid_size;
+  double x0, y0, x1, y1, v;
+
+  cairo_clip_extents(cr, &x0, &y0, &x1, &y1);
+  x0 = MAX(x0, 0), y0 = MAX(y0, 0);
+  x1 = MIN(x1, self->page_width), y1 = MIN(y1, self->page_height);
+  if (x0 >= x1 || y0 >= y1)
+    return;
+
+  cairo_save(cr);
+  cairo_set_source_rgb(cr, 0.88, 0.9, 0.95);
+  for (v = floor(x0 / g) * g; v < x1; v += g)
+    cairo_rectangle(cr, v, y0, w, y1 - y0);
+  for (v = floor(y0 / g) * g; v < y1; v += g)
+    cairo_rectangle(cr, x0, v, x1 - x0, w);
+  cairo_fill(cr);
+  cairo_restore(cr);
+}
+
+/* draw_objects(): draw every object overlapping the clip region of
+   cr, whose origin is at the top left of the page. Dots and subtree
+   summaries are filled together. */
+static void
+draw_objects(PnidCanvas *self, cairo_t *cr)
+{
+  double x1, y1, x2, y2;	/* clip extents */
+  PnidBox region;
+  cairo_rectangle_t *r;
+  guint i;
+
+  if (!self->index || !self->symbols)
+    return;
+
+  cairo_clip_extents(cr, &x1, &y1, &x2, &y2);
+  if (x2 < 0 || y2 < 0)
+    return;
+  pnid_box_set_left(&region, floor(MAX(x1, 0)));
+  pnid_box_set_top(&region, floor(MAX(y1, 0)));
+  pnid_box_set_right(&region, ceil(x2));
+  pnid_box_set_bottom(&region, ceil(y2));
+
+  query(self, &region);
+
+  PNID_PROF_BEGIN(self->prof, PNID_PROF_OBJECTS);
+  cairo_save(cr);
+  cairo_new_path(cr);
+  for (r = (cairo_rectangle_t *)self->lod_fills->data;
+       r < (cairo_rectangle_t *)self->lod_fills->data + self->lod_fills->len; r++)
+    cairo_rectangle(cr, r->x, r->y, r->width, r->height);
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+  cairo_fill(cr);
+
+  cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+  cairo_set_line_width(cr, 1.0 / self->zoom_level);
+  for (i = 0; i < self->lod_objs->len; i++)
+    draw_object(self, cr, g_ptr_array_index(self->lod_objs, i));
+  cairo_restore(cr);
+  PNID_PROF_END(self->prof, PNID_PROF_OBJECTS);
+}
+
+/* draw_object(): draw obj at its level of detail with the source and
+   line width of cr. */
+static void
+draw_object(PnidCanvas *self, cairo_t *cr, PnidObj *obj)
+{
+  PnidSheet s;
+
+  sheet(self, &s);
+  pnid_sheet_draw_object(&s, cr, self->symbols, obj);
+}
+
+/*********************
+ * Level of Detail
+*******************/
+
+/* query(): walk the index over region, collecting the objects to be
+   drawn into lod_objs and the dots and subtree summaries to be filled
+   in their place into lod_fills. */
+static void
+query(PnidCanvas *self, const PnidBox *region)
+{
+  PnidBox search = *region;
+  int nodes;
+
+  g_array_set_size(self->lod_fills, 0);
+  g_ptr_array_set_size(self->lod_objs, 0);
+  if (self->pack)
+    pack_fetch(self, region);
+
+  /* labels overhang the objects they belong to */
+  if (self->texts && self->zoom_level >= self->lod_text_scale)
+    pnid_sheet_label_region(&search);
+
+  PNID_PROF_BEGIN(self->prof, PNID_PROF_QUERY);
+  nodes = pnid_rtree_walk(self->index, &search, collect_node, collect_object, self);
+  PNID_PROF_END(self->prof, PNID_PROF_QUERY);
+  PNID_PROF_COUNT(self->prof, PNID_PROF_NODES, nodes);
+}
+
+/* collect_node(): #PnidRtreeNodeFunc, a subtree too small to resolve
+   is summarised by its mbr rather than being entered. */
+static int
+collect_node(const PnidBox *mbr, void *data)
+{
+  PnidCanvas *self = data;
+
+  if (!lod_summarise(self, mbr))
+    return 1;
+
+  collect_fill(self, pnid_box_get_left(mbr), pnid_box_get_top(mbr),
+	       pnid_box_width(mbr), pnid_box_height(mbr));
+  return 0;
+}
+
+/* collect_object(): #PnidRtreeTupleFunc, an object too small to
+   resolve is reduced to a dot, one being dragged is left out. */
+static void
+collect_object(PnidObj *obj, void *data)
+{
+  PnidCanvas *self = data;
+
+  /* drawn in the overlay while dragged */
+  if (self->dragging
+      && pnid_select_has(self->selection, pnid_objstore_handle(self->store, obj)))
+    return;
+
+  PNID_PROF_COUNT(self->prof, PNID_PROF_DRAWN, 1);
+
+  if (lod_object(self, &obj->bbox) == PNID_SHEET_DOT)
+    collect_fill(self,
+		 pnid_box_get_left(&obj->bbox) + pnid_box_width(&obj->bbox) / 2.0,
+		 pnid_box_get_top(&obj->bbox) + pnid_box_height(&obj->bbox) / 2.0,
+		 0, 0);
+  else
+    g_ptr_array_add(self->lod_objs, obj);
+}
+
+/* collect_fill(): add a rectangle in points, at least one device
+   pixel in size, to be filled. */
+static void
+collect_fill(PnidCanvas *self, double x, double y, double width, double height)
+{
+  cairo_rectangle_t r;
+
+  r.x = x;
+  r.y = y;
+  r.width = MAX(width, 1.0 / self->zoom_level);
+  r.height = MAX(height, 1.0 / self->zoom_level);
+  g_array_append_val(self->lod_fills, r);
+}
+
+/* lod_object(): the level of detail to draw an object bounded by bbox
+   at the current zoom level. */
+static enum pnid_sheet_lod
+lod_object(PnidCanvas *self, const PnidBox *bbox)
+{
+  PnidSheet s;
+
+  sheet(self, &s);
+  return pnid_sheet_lod(&s, bbox);
+}
+
+/* lod_summarise(): true when a subtree bounded by mbr is too small
+   at the current zoom level for its contents to be drawn. */
+static gboolean
+lod_summarise(PnidCanvas *self, const PnidBox *mbr)
+{
+  PnidSheet s;
+
+  sheet(self, &s);
+  return pnid_sheet_summarise(&s, mbr);
+}
+
+/* sheet(): describe the page and detail the canvas draws at to the
+   #PnidSheet drawing code */
+static void
+sheet(PnidCanvas *self, PnidSheet *sheet)
+{
+  sheet->page_width = self->page_width;
+  sheet->page_height = self->page_height;
+  sheet->top_margin = self->top_margin;
+  sheet->bottom_margin = self->bottom_margin;
+  sheet->left_margin = self->left_margin;
+  sheet->right_margin = self->right_margin;
+  sheet->scale = self->zoom_level;
+  sheet->lod_object_px = self->lod_object_px;
+  sheet->lod_node_px = self->lod_node_px;
+  sheet->lod_line_scale = self->lod_line_scale;
+  sheet->lod_text_scale = self->lod_text_scale;
+  sheet->vector = FALSE;
+  sheet->texts = self->texts;
+}
+
+/*********************
+ * Retained Mode Drawing
+*******************/
+
+/* pnid_canvas_snapshot(): #GtkWidget::snapshot handler, in immediate
+   mode the drawing area's draw function is used. Otherwise the
+   viewport is assembled from colour nodes for the sheet and the
+   retained node of each visible object. The profiling overlay is
+   appended last in either mode, above the selection overlay. */
+static void
+pnid_canvas_snapshot(GtkWidget *widget, GtkSnapshot *snapshot)
+{
+  PnidCanvas *self = PNID_CANVAS(widget);
+  double x, y;			/* viewport origin in the drawing */
+  int width, height;
+
+  PNID_PROF_FRAME_BEGIN(self->prof);
+
+  if (!self->retained_mode) {
+    GTK_WIDGET_CLASS(pnid_canvas_parent_class)->snapshot(widget, snapshot);
+  } else {
+    x = self->hadjustment ? round(gtk_adjustment_get_value(self->hadjustment)) : 0;
+    y = self->vadjustment ? round(gtk_adjustment_get_value(self->vadjustment)) : 0;
+    width = gtk_widget_get_width(widget);
+    height = gtk_widget_get_height(widget);
+
+    gtk_snapshot_push_clip(snapshot, &GRAPHENE_RECT_INIT(0, 0, width, height));
+    gtk_snapshot_save(snapshot);
+    gtk_snapshot_translate(snapshot, &GRAPHENE_POINT_INIT(-x, -y));
+    snapshot_sheet(self, snapshot, x, y, width, height);
+    snapshot_objects(self, snapshot, x, y, width, height);
+    gtk_snapshot_restore(snapshot);
+    gtk_snapshot_pop(snapshot);
+
+    /* the whole viewport has been assembled, so nothing remains
+       damaged, but the backing surface missed the changes */
+    cairo_region_subtract(self->damage, self->damage);
+    self->surface_valid = FALSE;
+  }
+  snapshot_selection(self, snapshot);
+
+  PNID_PROF_FRAME_END(self->prof);
+
+  if (PNID_PROF_ENABLED(self->prof))
+    snapshot_hud(self, snapshot);
+}
+
+/* snapshot_sheet(): append the background, page and margins to
+   snapshot in device pixels, x, y, width and height are the
+   viewport. */
+static void
+snapshot_sheet(PnidCanvas *self, GtkSnapshot *snapshot,
+	       double x, double y, int width, int height)
+{
+  const GdkRGBA background = { 0.8, 0.8, 0.8, 1.0 };
+  const GdkRGBA page = { 1.0, 1.0, 1.0, 1.0 };
+  const GdkRGBA margin = { 0.75, 0.75, 0.75, 1.0 };
+  const GdkRGBA rule = { 0.88, 0.9, 0.95, 1.0 };
+  const float z = self->zoom_level;
+  const float g = self->grid_size * z;
+  GskRoundedRect border;
+
+  PNID_PROF_BEGIN(self->prof, PNID_PROF_BACKGROUND);
+
+  gtk_snapshot_append_color(snapshot, &background,
+			    &GRAPHENE_RECT_INIT(x, y, width, height));
+  gtk_snapshot_append_color(snapshot, &page,
+			    &GRAPHENE_RECT_INIT(PNID_CANVAS_BACKGROUND_PT * z,
+						PNID_CANVAS_BACKGROUND_PT * z,
+						self->page_width * z,
+						self->page_height * z));
+  if (g * gtk_widget_get_scale_factor(GTK_WIDGET(self)) >= PNID_CANVAS_GRID_MIN_PX) {
+    /* one cell, repeated over the page by GSK */
+    gtk_snapshot_push_repeat(snapshot,
+			     &GRAPHENE_RECT_INIT(PNID_CANVAS_BACKGROUND_PT * z,
+						 PNID_CANVAS_BACKGROUND_PT * z,
+						 self->page_width * z,
+						 self->page_height * z),
+			     &GRAPHENE_RECT_INIT(PNID_CANVAS_BACKGROUND_PT * z,
+						 PNID_CANVAS_BACKGROUND_PT * z, g, g));
+    gtk_snapshot_append_color(snapshot, &rule,
+			      &GRAPHENE_RECT_INIT(PNID_CANVAS_BACKGROUND_PT * z,
+						  PNID_CANVAS_BACKGROUND_PT * z, g, 1));
+    gtk_snapshot_append_color(snapshot, &rule,
+			      &GRAPHENE_RECT_INIT(PNID_CANVAS_BACKGROUND_PT * z,
+						  PNID_CANVAS_BACKGROUND_PT * z, 1, g));
+    gtk_snapshot_pop(snapshot);
+  }
+
+  gsk_rounded_rect_init_from_rect(&border,
+				  &GRAPHENE_RECT_INIT((PNID_CANVAS_BACKGROUND_PT + self->left_margin) * z,
+						      (PNID_CANVAS_BACKGROUND_PT + self->top_margin) * z,
+						      (self->page_width - self->left_margin - self->right_margin) * z,
+						      (self->page_height - self->top_margin - self->bottom_margin) * z),
+				  0);
+  gtk_snapshot_append_border(snapshot, &border,
+			     (const float[4]){ z, z, z, z },
+			     (const GdkRGBA[4]){ margin, margin, margin, margin });
+
+  PNID_PROF_END(self->prof, PNID_PROF_BACKGROUND);
+}
+
+/* snapshot_objects(): append every object within the viewport at its
+   level of detail, building the nodes which are not already
+   retained. */
+static void
+snapshot_objects(PnidCanvas *self, GtkSnapshot *snapshot,
+		 double x, double y, int width, int height)
+{
+  const float z = self->zoom_level;
+  PnidBox region;
+  GskRenderNode *node;
+  cairo_rectangle_t *r;
+  PnidObj *obj;
+  guint i;
+
+  if (!self->index || !self->symbols)
+    return;
+
+  /* viewport in points on the page */
+  pnid_box_set_left(&region, MAX(floor(x / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+  pnid_box_set_top(&region, MAX(floor(y / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+  pnid_box_set_right(&region, MAX(ceil((x + width) / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+  pnid_box_set_bottom(&region, MAX(ceil((y + height) / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+
+  query(self, &region);
+
+  PNID_PROF_BEGIN(self->prof, PNID_PROF_COMPOSITE);
+  for (r = (cairo_rectangle_t *)self->lod_fills->data;
+       r < (cairo_rectangle_t *)self->lod_fills->data + self->lod_fills->len; r++)
+    gtk_snapshot_append_color(snapshot, &(GdkRGBA){ 0.0, 0.0, 0.0, 0.5 },
+			      &GRAPHENE_RECT_INIT((PNID_CANVAS_BACKGROUND_PT + r->x) * z,
+						  (PNID_CANVAS_BACKGROUND_PT + r->y) * z,
+						  r->width * z, r->height * z));
+  PNID_PROF_END(self->prof, PNID_PROF_COMPOSITE);
+
+  for (i = 0; i < self->lod_objs->len; i++) {
+    obj = g_ptr_array_index(self->lod_objs, i);
+    if (!(node = g_hash_table_lookup(self->nodes, obj))) {
+      PNID_PROF_COUNT(self->prof, PNID_PROF_TILE_MISS, 1);
+      PNID_PROF_BEGIN(self->prof, PNID_PROF_OBJECTS);
+      node = object_node(self, obj);
+      g_hash_table_insert(self->nodes, obj, node);
+      PNID_PROF_END(self->prof, PNID_PROF_OBJECTS);
+    } else {
+      PNID_PROF_COUNT(self->prof, PNID_PROF_TILE_HIT, 1);
+    }
+    gtk_snapshot_append_node(snapshot, node);
+  }
+}
+
+/* object_node(): build a cairo node drawing obj at the current zoom
+   level, positioned in device pixels on the drawing. */
+static GskRenderNode *
+object_node(PnidCanvas *self, PnidObj *obj)
+{
+  const double z = self->zoom_level;
+  const double pad = MAX(PNID_CANVAS_OBJECT_PAD_PT, PNID_SHEET_LABEL_PAD_PT);
+  GskRenderNode *node;
+  cairo_t *cr;
+
+  node = gsk_cairo_node_new(&GRAPHENE_RECT_INIT((PNID_CANVAS_BACKGROUND_PT
+						 + pnid_box_get_left(&obj->bbox) - pad) * z,
+						(PNID_CANVAS_BACKGROUND_PT
+						 + pnid_box_get_top(&obj->bbox) - pad) * z,
+						(pnid_box_width(&obj->bbox) + 2 * pad) * z,
+						(pnid_box_height(&obj->bbox) + 2 * pad) * z));
+
+  cr = gsk_cairo_node_get_draw_context(node);
+  cairo_scale(cr, z, z);
+  cairo_translate(cr, PNID_CANVAS_BACKGROUND_PT, PNID_CANVAS_BACKGROUND_PT);
+  cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+  cairo_set_line_width(cr, 1.0 / z);
+  draw_object(self, cr, obj);
+  cairo_destroy(cr);
+
+  return node;
+}
+
+/*********************
+ * Selection
+*******************/
+
+/* Objects are selected by dragging out a rubber band, which selects
+   those wholly within it when dragged to the right and those it
+   touches when dragged to the left, or with Alt held a lasso. Shift
+   adds to the selection, Ctrl toggles and both subtract. Dragging a
+   selected object drags the whole selection, which is left out of
+   the rendered viewport until it is dropped. */
+
+/* select_object(): pnid_rtree_walk() callback, add tuple to the hits
+   of a selection if it lies within the band or lasso */
+static void
+select_object(PnidObj *tuple, void *data)
+{
+  struct select *s = data;
+  int res;
+
+  if (!(s->lasso ? pnid_select_hit_lasso(tuple, s->lasso, s->n)
+	: pnid_select_hit_box(tuple, s->box, s->mode)))
+    return;
+  if ((res = pnid_select_add(s->canvas->hits, pnid_objstore_handle(s->canvas->store, tuple))) < 0)
+    s->res = res;
+}
+
+/* select_apply(): combine the hits with the selection by op, and
+   redraw the overlay */
+static void
+select_apply(PnidCanvas *self, enum pnid_select_op op, int res)
+{
+  if (res < 0 || (res = pnid_select_apply(self->selection, self->hits, op)) < 0)
+    g_warning("Failed to select objects: %s", g_strerror(-res));
+  gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+/* selected_object(): #PnidSelectFunc, add the object in slot to those
+   found */
+static void
+selected_object(uint32_t slot, void *data)
+{
+  struct trace *t = data;
+  PnidObj *obj;
+
+  if ((obj = pnid_objstore_at(t->canvas->store, slot)))
+    g_ptr_array_add(t->found, obj);
+}
+
+/* band_begin(): #GtkGestureDrag::drag-begin handler, start dragging
+   the object at x, y, or else a rubber band or lasso, combined with
+   the selection as the modifiers held say */
+static void
+band_begin(GtkGestureDrag *gesture, double x, double y, gpointer data)
+{
+  PnidCanvas *self = data;
+  GdkModifierType state;
+  PnidObjHandle h;
+  PnidCoord at;
+  double px, py;
+
+  state = gtk_event_controller_get_current_event_state(GTK_EVENT_CONTROLLER(gesture));
+  self->band_x = x;
+  self->band_y = y;
+  self->band_dx = self->band_dy = 0;
+  if (!(state & (GDK_SHIFT_MASK | GDK_CONTROL_MASK | GDK_ALT_MASK)) && !self->loading
+      && (h = hit(self, x, y)) != PNID_OBJ_HANDLE_NONE) {
+    drag_begin(self, h);
+    return;
+  }
+
+  if ((state & GDK_SHIFT_MASK) && (state & GDK_CONTROL_MASK))
+    self->band_op = PNID_SELECT_SUBTRACT;
+  else if (state & GDK_SHIFT_MASK)
+    self->band_op = PNID_SELECT_ADD;
+  else if (state & GDK_CONTROL_MASK)
+    self->band_op = PNID_SELECT_TOGGLE;
+  else
+    self->band_op = PNID_SELECT_REPLACE;
+
+  self->banding = TRUE;
+  self->lasso = (state & GDK_ALT_MASK) != 0;
+  g_array_set_size(self->lasso_points, 0);
+  if (self->lasso) {
+    to_page(self, x, y, &px, &py);
+    at.x = MAX(px, 0);
+    at.y = MAX(py, 0);
+    g_array_append_val(self->lasso_points, at);
+  }
+}
+
+/* band_update(): #GtkGestureDrag::drag-update handler, note the
+   pointer at dx, dy from the start for the next frame */
+static void
+band_update(GtkGestureDrag *gesture, double dx, double dy, gpointer data)
+{
+  PnidCanvas *self = data;
+
+  if (!self->banding && !self->dragging)
+    return;
+
+  self->band_dx = dx;
+  self->band_dy = dy;
+  self->band_moved = TRUE;
+  pointer_schedule(self);
+}
+
+/* band_end(): #GtkGestureDrag::drag-end handler, drop the objects
+   dragged or select those within the band or lasso */
+static void
+band_end(GtkGestureDrag *gesture, double dx, double dy, gpointer data)
+{
+  PnidCanvas *self = data;
+  PnidBox box;
+
+  if (self->dragging) {
+    self->band_dx = dx;
+    self->band_dy = dy;
+    self->band_moved = FALSE;
+    drag_end(self);
+    return;
+  }
+  if (!self->banding)
+    return;
+
+  self->band_dx = dx;
+  self->band_dy = dy;
+  band_grow(self);
+  self->banding = FALSE;
+  if (self->lasso) {
+    pnid_canvas_select_lasso(self, (PnidCoord *)self->lasso_points->data,
+			     self->lasso_points->len, self->band_op);
+  } else {
+    band_box(self, &box);
+    pnid_canvas_select_box(self, &box,
+			   self->band_dx > 0 ? PNID_SELECT_CONTAIN : PNID_SELECT_OVERLAP,
+			   self->band_op);
+  }
+}
+
+/* band_grow(): follow the pointer with the band, adding its position
+   to a lasso */
+static void
+band_grow(PnidCanvas *self)
+{
+  PnidCoord at, *last;
+  double px, py;
+
+  self->band_moved = FALSE;
+  if (self->lasso) {
+    to_page(self, self->band_x + self->band_dx, self->band_y + self->band_dy, &px, &py);
+    at.x = MAX(px, 0);
+    at.y = MAX(py, 0);
+    last = &g_array_index(self->lasso_points, PnidCoord, self->lasso_points->len - 1);
+    if (at.x != last->x || at.y != last->y)
+      g_array_append_val(self->lasso_points, at);
+  }
+  gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+/* pointer_motion(): #GtkEventControllerMotion::motion handler, note
+   the pointer at x, y for the next frame */
+static void
+pointer_motion(GtkEventControllerMotion *motion, double x, double y, gpointer data)
+{
+  PnidCanvas *self = data;
+
+  self->pointer_x = x;
+  self->pointer_y = y;
+  self->pointer_moved = TRUE;
+  pointer_schedule(self);
+}
+
+/* pointer_leave(): #GtkEventControllerMotion::leave handler, nothing
+   is under the pointer */
+static void
+pointer_leave(GtkEventControllerMotion *motion, gpointer data)
+{
+  PnidCanvas *self = data;
+
+  self->pointer_moved = FALSE;
+  if (self->hover != PNID_OBJ_HANDLE_NONE) {
+    self->hover = PNID_OBJ_HANDLE_NONE;
+    gtk_widget_queue_draw(GTK_WIDGET(self));
+  }
+}
+
+/* pointer_schedule(): handle pointer movement on the next frame */
+static void
+pointer_schedule(PnidCanvas *self)
+{
+  if (!self->pointer_tick)
+    self->pointer_tick = gtk_widget_add_tick_callback(GTK_WIDGET(self), pointer_tick,
+						      NULL, NULL);
+}
+
+/* pointer_tick(): #GtkTickCallback, act on the latest pointer
+   position once for the frame, growing the band or finding the object
+   under the pointer. Pointer events arrive far faster than frames are
+   drawn, and the positions the tick never sees cost nothing. Stops
+   ticking once the pointer is still. */
+static gboolean
+pointer_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer data)
+{
+  PnidCanvas *self = PNID_CANVAS(widget);
+  PnidObjHandle h;
+
+  if (!self->band_moved && !self->pointer_moved) {
+    self->pointer_tick = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  if (self->band_moved)
+    band_grow(self);
+  if (self->pointer_moved) {
+    self->pointer_moved = FALSE;
+    h = self->banding || self->dragging ? PNID_OBJ_HANDLE_NONE
+      : hit(self, self->pointer_x, self->pointer_y);
+    if (h != self->hover) {
+      self->hover = h;
+      gtk_widget_queue_draw(widget);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* drag_begin(): start dragging the selection from obj, selecting
+   only obj first if it is not selected. The selection is left out of
+   the rendered viewport until it is dropped. */
+static void
+drag_begin(PnidCanvas *self, PnidObjHandle obj)
+{
+  PnidObjHandle h;
+  GPtrArray *selected;
+  PnidObj *from;
+  guint i;
+
+  if (!pnid_select_has(self->selection, obj)) {
+    pnid_select_clear(self->hits);
+    select_apply(self, PNID_SELECT_REPLACE, pnid_select_add(self->hits, obj));
+  }
+
+  /* held by handle, an edit during the drag may release any of them */
+  g_clear_pointer(&self->dragged, g_array_unref);
+  selected = pnid_canvas_selected(self);
+  self->dragged = g_array_sized_new(FALSE, FALSE, sizeof(PnidObjHandle), selected->len);
+  for (i = 0; i < selected->len; i++) {
+    h = pnid_objstore_handle(self->store, g_ptr_array_index(selected, i));
+    g_array_append_val(self->dragged, h);
+    damage(self, &((PnidObj *)g_ptr_array_index(selected, i))->bbox);
+  }
+  g_ptr_array_unref(selected);
+  if ((from = pnid_objstore_get(self->store, obj)))
+    self->drag_from = from->bbox.nw;
+  self->dragging = TRUE;
+  self->lasso = FALSE;
+  self->hover = PNID_OBJ_HANDLE_NONE;
+}
+
+/* drag_end(): drop the objects dragged at the pointer, as one edit to
+   be undone. Those released since the drag began are skipped. */
+static void
+drag_end(PnidCanvas *self)
+{
+  PnidBox *from, to;
+  GPtrArray *moved;
+  PnidObj *obj;
+  int dx, dy;
+  guint i;
+
+  self->dragging = FALSE;
+  drag_offset(self, &dx, &dy);
+  moved = g_ptr_array_sized_new(self->dragged->len);
+  from = g_new(PnidBox, self->dragged->len);
+  for (i = 0; i < self->dragged->len; i++) {
+    if (!(obj = dragged_at(self, i)))
+      continue;
+    to = obj->bbox;
+    if (!dx && !dy) {
+      damage(self, &obj->bbox);
+      continue;
+    }
+    to.nw.x += dx, to.se.x += dx;
+    to.nw.y += dy, to.se.y += dy;
+    from[moved->len] = obj->bbox;
+    if (move(self, obj, &to) < 0) {
+      g_warning("Failed to move object %u", obj->id);
+      continue;
+    }
+    g_ptr_array_add(moved, obj);
+  }
+  if (moved->len)
+    record(self, pnid_undo_move(self->undo, (PnidObj *const *)moved->pdata,
+				from, moved->len, g_get_monotonic_time()));
+  g_free(from);
+  g_ptr_array_unref(moved);
+  g_clear_pointer(&self->dragged, g_array_unref);
+}
+
+/* drag_offset(): store how far the selection has been dragged in
+   whole points, landing the object it was picked up by on the grid,
+   no further than keeps it on the page */
+static void
+drag_offset(PnidCanvas *self, int *dx, int *dy)
+{
+  int left = G_MININT, top = G_MININT, right = G_MAXINT, bottom = G_MAXINT;
+  PnidObj *obj;
+  guint i;
+
+  for (i = 0; self->dragged && i < self->dragged->len; i++) {
+    if (!(obj = dragged_at(self, i)))
+      continue;
+    left = MAX(left, -(int)obj->bbox.nw.x);
+    top = MAX(top, -(int)obj->bbox.nw.y);
+    right = MIN(right, (int)self->page_width - (int)obj->bbox.se.x);
+    bottom = MIN(bottom, (int)self->page_height - (int)obj->bbox.se.y);
+  }
+  *dx = drag_clamp(lround(self->band_dx / self->zoom_level), self->drag_from.x,
+		   left, right, self->grid_size);
+  *dy = drag_clamp(lround(self->band_dy / self->zoom_level), self->drag_from.y,
+		   top, bottom, self->grid_size);
+}
+
+/* drag_clamp(): d limited to lo to hi, landing from + d on the grid
+   if it has one and a line lies within the limits. A selection
+   larger than the page is kept on it from the top left. */
+static int
+drag_clamp(int d, int from, int lo, int hi, unsigned grid)
+{
+  int s;
+
+  hi = MAX(hi, lo);
+  d = CLAMP(d, lo, hi);
+  if (!grid)
+    return d;
+
+  s = snap(from + d, grid) - from;
+  if (s < lo)
+    s += grid;
+  else if (s > hi)
+    s -= grid;
+
+  return s >= lo && s <= hi ? s : d;
+}
+
+/* dragged_at(): the i'th object being dragged, or NULL if it has been
+   released since the drag began */
+static PnidObj *
+dragged_at(PnidCanvas *self, guint i)
+{
+  return pnid_objstore_get(self->store, g_array_index(self->dragged, PnidObjHandle, i));
+}
+
+/* snap(): v rounded to the nearest multiple of grid */
+static int
+snap(int v, unsigned grid)
+{
+  return (int)lround((double)v / grid) * (int)grid;
+}
+
+/* hit: a hit() in progress */
+struct hit {
+  const PnidBox *box;
+  PnidObj       *found;
+};
+
+/* hit(): find the smallest object drawn within PNID_CANVAS_HIT_PX of
+   x, y in widget pixels. Returns its handle, or PNID_OBJ_HANDLE_NONE
+   if there is none. */
+static PnidObjHandle
+hit(PnidCanvas *self, double x, double y)
+{
+  const double r = PNID_CANVAS_HIT_PX / (double)self->zoom_level;
+  struct hit h = { NULL, NULL };
+  double px, py;
+  PnidBox box;
+
+  if (!self->index)
+    return PNID_OBJ_HANDLE_NONE;
+
+  to_page(self, x, y, &px, &py);
+  if (px + r < 0 || py + r < 0)
+    return PNID_OBJ_HANDLE_NONE;
+  pnid_box_set_left(&box, floor(MAX(px - r, 0)));
+  pnid_box_set_top(&box, floor(MAX(py - r, 0)));
+  pnid_box_set_right(&box, ceil(px + r));
+  pnid_box_set_bottom(&box, ceil(py + r));
+  h.box = &box;
+  pnid_rtree_walk(self->index, &box, NULL, hit_object, &h);
+
+  return h.found ? pnid_objstore_handle(self->store, h.found) : PNID_OBJ_HANDLE_NONE;
+}
+
+/* hit_object(): pnid_rtree_walk() callback, keep tuple if it is
+   drawn within the box of a hit() and smaller than any kept */
+static void
+hit_object(PnidObj *tuple, void *data)
+{
+  struct hit *h = data;
+
+  if (pnid_select_hit_box(tuple, h->box, PNID_SELECT_OVERLAP)
+      && (!h->found || pnid_box_area(&tuple->bbox) < pnid_box_area(&h->found->bbox)))
+    h->found = tuple;
+}
+
+/* band_box(): store the rubber band being dragged in box, in points
+   on the page */
+static void
+band_box(PnidCanvas *self, PnidBox *box)
+{
+  double x0, y0, x1, y1;
+
+  to_page(self, self->band_x, self->band_y, &x0, &y0);
+  to_page(self, self->band_x + self->band_dx, self->band_y + self->band_dy, &x1, &y1);
+  pnid_box_set_left(box, floor(MAX(MIN(x0, x1), 0)));
+  pnid_box_set_top(box, floor(MAX(MIN(y0, y1), 0)));
+  pnid_box_set_right(box, ceil(MAX(MAX(x0, x1), 0)));
+  pnid_box_set_bottom(box, ceil(MAX(MAX(y0, y1), 0)));
+}
+
+/* to_page(): convert x, y in widget pixels to px, py in points on
+   the page */
+static void
+to_page(PnidCanvas *self, double x, double y, double *px, double *py)
+{
+  x += self->hadjustment ? round(gtk_adjustment_get_value(self->hadjustment)) : 0;
+  y += self->vadjustment ? round(gtk_adjustment_get_value(self->vadjustment)) : 0;
+  *px = x / self->zoom_level - PNID_CANVAS_BACKGROUND_PT;
+  *py = y / self->zoom_level - PNID_CANVAS_BACKGROUND_PT;
+}
+
+/* overlay: the selection overlay being drawn */
+struct overlay {
+  PnidCanvas *canvas;
+  cairo_t    *cr;
+  PnidBox     region;		/* viewport, points on the page */
+};
+
+/* snapshot_selection(): append an overlay highlighting the selected
+   objects within the viewport, the object under the pointer and the
+   band or lasso being dragged. Objects being dragged are drawn in it
+   at the pointer. */
+static void
+snapshot_selection(PnidCanvas *self, GtkSnapshot *snapshot)
+{
+  const double z = self->zoom_level;
+  struct overlay o = { self };
+  PnidCoord *p;
+  PnidObj *obj;
+  PnidBox band;
+  double x, y;
+  int width, height, dx, dy;
+  guint i;
+
+  if (!self->selection
+      || (!self->banding && !self->dragging && self->hover == PNID_OBJ_HANDLE_NONE
+	  && !pnid_select_len(self->selection)))
+    return;
+
+  x = self->hadjustment ? round(gtk_adjustment_get_value(self->hadjustment)) : 0;
+  y = self->vadjustment ? round(gtk_adjustment_get_value(self->vadjustment)) : 0;
+  width = gtk_widget_get_width(GTK_WIDGET(self));
+  height = gtk_widget_get_height(GTK_WIDGET(self));
+  pnid_box_set_left(&o.region, MAX(floor(x / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+  pnid_box_set_top(&o.region, MAX(floor(y / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+  pnid_box_set_right(&o.region, MAX(ceil((x + width) / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+  pnid_box_set_bottom(&o.region, MAX(ceil((y + height) / z) - PNID_CANVAS_BACKGROUND_PT, 0));
+
+  o.cr = gtk_snapshot_append_cairo(snapshot, &GRAPHENE_RECT_INIT(0, 0, width, height));
+  cairo_translate(o.cr, -x, -y);
+  cairo_scale(o.cr, z, z);
+  cairo_translate(o.cr, PNID_CANVAS_BACKGROUND_PT, PNID_CANVAS_BACKGROUND_PT);
+  /* the selection is drawn where it is being dragged to */
+  if (self->dragging) {
+    drag_offset(self, &dx, &dy);
+    cairo_translate(o.cr, dx, dy);
+    pnid_box_set_left(&o.region, MAX((int)pnid_box_get_left(&o.region) - dx, 0));
+    pnid_box_set_top(&o.region, MAX((int)pnid_box_get_top(&o.region) - dy, 0));
+    pnid_box_set_right(&o.region, MAX((int)pnid_box_get_right(&o.region) - dx, 0));
+    pnid_box_set_bottom(&o.region, MAX((int)pnid_box_get_bottom(&o.region) - dy, 0));
+    cairo_set_source_rgb(o.cr, 0.0, 0.0, 0.0);
+    cairo_set_line_width(o.cr, 1.0 / z);
+    for (i = 0; i < self->dragged->len; i++)
+      if ((obj = dragged_at(self, i)) && !pnid_box_is_separate(&obj->bbox, &o.region))
+	draw_object(self, o.cr, obj);
+  }
+
+  cairo_set_line_width(o.cr, 2.0 / z);
+  pnid_select_foreach(self->selection, overlay_object, &o);
+  cairo_set_source_rgba(o.cr, 0.2, 0.4, 1.0, 0.8);
+  cairo_stroke(o.cr);
+
+  if (pnid_objstore_get(self->store, self->hover)) {
+    overlay_object(PNID_OBJ_HANDLE_SLOT(self->hover), &o);
+    cairo_set_source_rgba(o.cr, 0.2, 0.4, 1.0, 0.4);
+    cairo_stroke(o.cr);
+  }
+
+  if (self->banding) {
+    if (self->lasso) {
+      for (i = 0, p = (PnidCoord *)self->lasso_points->data; i < self->lasso_points->len; i++)
+	cairo_line_to(o.cr, p[i].x, p[i].y);
+      cairo_close_path(o.cr);
+    } else {
+      band_box(self, &band);
+      cairo_rectangle(o.cr, pnid_box_get_left(&band), pnid_box_get_top(&band),
+		      pnid_box_width(&band), pnid_box_height(&band));
+      /* a band selecting what it touches is dashed */
+      if (self->band_dx <= 0)
+	cairo_set_dash(o.cr, (const double[]){ 4.0 / z }, 1, 0);
+    }
+    cairo_set_source_rgba(o.cr, 0.2, 0.4, 1.0, 0.15);
+    cairo_fill_preserve(o.cr);
+    cairo_set_source_rgba(o.cr, 0.2, 0.4, 1.0, 0.8);
+    cairo_set_line_width(o.cr, 1.0 / z);
+    cairo_stroke(o.cr);
+  }
+  cairo_destroy(o.cr);
+}
+
+/* overlay_object(): #PnidSelectFunc, add the highlight of the object
+   in slot to the overlay's path if it is within the viewport */
+static void
+overlay_object(uint32_t slot, void *data)
+{
+  struct overlay *o = data;
+  const double pad = PNID_CANVAS_OBJECT_PAD_PT;
+  PnidObj *obj;
+  PnidBox *b;
+
+  if (!(obj = pnid_objstore_at(o->canvas->store, slot))
+      || pnid_box_is_separate(&obj->bbox, &o->region))
+    return;
+
+  b = &obj->bbox;
+  if (obj->type == PNID_OBJ_LINE) {
+    cairo_move_to(o->cr, b->nw.x, b->nw.y);
+    cairo_line_to(o->cr, b->se.x, b->se.y);
+  } else if (obj->type == PNID_OBJ_LINE_RISE) {
+    cairo_move_to(o->cr, b->nw.x, b->se.y);
+    cairo_line_to(o->cr, b->se.x, b->nw.y);
+  } else {
+    cairo_rectangle(o->cr, b->nw.x - pad, b->nw.y - pad,
+		    pnid_box_width(b) + 2 * pad, pnid_box_height(b) + 2 * pad);
+  }
+}
+
+/*********************
+ * Profiling
+*******************/
+
+/* snapshot_hud(): append an overlay in the top left of the viewport
+   showing the last profiled frame and the mean of the recorded
+   frames, times are in milliseconds. */
+static void
+snapshot_hud(PnidCanvas *self, GtkSnapshot *snapshot)
+{
+  const struct pnid_prof_frame *f;
+  struct pnid_prof_frame mean;
+  char line[PNID_CANVAS_HUD_LINES][128];
+  cairo_t *cr;
+  int i;
+
+  if (!(f = pnid_prof_last(self->prof)) || pnid_prof_mean(self->prof, &mean) < 0)
+    return;
+
+  snprintf(line[0], sizeof line[0], "frame %.2f  mean %.2f  max %.1f fps",
+	   f->total / 1e3, mean.total / 1e3, mean.total > 0 ? 1e6 / mean.total : 0);
+  snprintf(line[1], sizeof line[1], "background %.2f  query %.2f",
+	   f->phase[PNID_PROF_BACKGROUND] / 1e3, f->phase[PNID_PROF_QUERY] / 1e3);
+  snprintf(line[2], sizeof line[2], "objects %.2f  composite %.2f",
+	   f->phase[PNID_PROF_OBJECTS] / 1e3, f->phase[PNID_PROF_COMPOSITE] / 1e3);
+  snprintf(line[3], sizeof line[3], "drawn %lu  nodes %lu  tiles %lu/%lu",
+	   f->count[PNID_PROF_DRAWN], f->count[PNID_PROF_NODES],
+	   f->count[PNID_PROF_TILE_HIT],
+	   f->count[PNID_PROF_TILE_HIT] + f->count[PNID_PROF_TILE_MISS]);
+
+  cr = gtk_snapshot_append_cairo(snapshot,
+				 &GRAPHENE_RECT_INIT(0, 0, PNID_CANVAS_HUD_WIDTH,
+						     PNID_CANVAS_HUD_LINES * PNID_CANVAS_HUD_LINE + 4));
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.6);
+  cairo_paint(cr);
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_select_font_face(cr, "monospace", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+  cairo_set_font_size(cr, PNID_CANVAS_HUD_LINE - 3);
+  for (i = 0; i < PNID_CANVAS_HUD_LINES; i++) {
+    cairo_move_to(cr, 4, (i + 1) * PNID_CANVAS_HUD_LINE);
+    cairo_show_text(cr, line[i]);
+  }
+  cairo_destroy(cr);
+}
+
+/*********************
+ * Printing
+*******************/
+
+/* print_tile(): store the region of the sheet printed on page, when
+   tiled over pages of width by height points across then down */
+static void
+print_tile(PnidCanvas *self, int page, double width, double height, PnidBox *region)
+{
+  int across = MAX(ceil(self->page_width / MAX(width, 1)), 1);
+  double x = page % across * width, y = page / across * height;
+
+  pnid_box_set_left(region, floor(x));
+  pnid_box_set_top(region, floor(y));
+  pnid_box_set_right(region, ceil(x + width));
+  pnid_box_set_bottom(region, ceil(y + height));
+}
+
+/* print_chunk(): #PnidPackFunc, draw the objects of a chunk on the
+   page being printed if they are not indexed, reading the chunk and
+   freeing it again. The objects of an evicted chunk are indexed
+   without their attributes, so only the labels they lack are drawn,
+   from the chunk read. */
+static void
+print_chunk(unsigned chunk, void *data)
+{
+  struct print *p = data;
+  PnidCanvas *self = p->canvas;
+  struct chunk *c = &self->chunks[chunk];
+  GStringChunk *strings;
+  PnidObj **objs, *obj, lent;
+  gboolean evicted;
+  size_t i, n;
+  int k, res;
+
+  evicted = c->state == CHUNK_EVICTED || c->state == CHUNK_RELOADING;
+  if (!evicted && c->state != CHUNK_ABSENT && c->state != CHUNK_PENDING
+      && c->state != CHUNK_FAILED)
+    return;
+  if ((res = pnid_pack_read(self->pack, chunk, &objs, &n, &strings)) < 0) {
+    g_warning("Failed to read %s: %s", self->path, g_strerror(-res));
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!evicted) {
+      if (!pnid_box_is_separate(&objs[i]->bbox, &p->region))
+	pnid_sheet_draw_object(&p->sheet, p->cr, self->symbols, objs[i]);
+    } else if ((obj = g_hash_table_lookup(self->ids, GUINT_TO_POINTER(objs[i]->id)))
+	       && !pnid_box_is_separate(&obj->bbox, &p->region)) {
+      /* objects edited since keep the label they were given */
+      k = obj->type == PNID_OBJ_SYMBOL ? PNID_ATTR_TAG : PNID_ATTR_LINE;
+      if (!obj->attr[k] && objs[i]->attr[k]) {
+	lent = *obj;
+	lent.attr[k] = objs[i]->attr[k];
+	pnid_sheet_draw_label(&p->sheet, p->cr, &lent);
+      }
+    }
+    pnid_obj_delete(objs[i]);
+  }
+  g_free(objs);
+  g_string_chunk_free(strings);
+}
+
+/*********************
+ * Loading
+*******************/
+
+/* load_thread(): worker thread, map the drawing file and read its
+   objects in batches for the main loop to index, or import them from
+   another format. The mapped file is kept for the main loop, whether
+   or not every object was read. */
+static void
+load_thread(GTask *task, gpointer source, gpointer task_data,
+	    GCancellable *cancellable)
+{
+  struct load *load = task_data;
+  PnidFile *file;
+  PnidObj **objs;
+  size_t i, j, n, len;
+  int res;
+
+  if (g_str_has_suffix(load->path, PNID_PACK_EXT)) {
+    if ((res = pnid_pack_open(load->path, &load->pack)) < 0) {
+      g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(-res),
+			      "Failed to open %s: %s", load->path, g_strerror(-res));
+      return;
+    }
+    goto out;
+  }
+  if (pnid_import_format(load->path)) {
+    if ((res = pnid_import(load->path, 0, load_import, task)) < 0 && res != -ECANCELED)
+      load->res = res;
+    goto out;
+  }
+
+  if ((res = pnid_file_map(load->path, &file)) < 0) {
+    g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(-res),
+			    "Failed to open %s: %s", load->path, g_strerror(-res));
+    return;
+  }
+
+  n = pnid_file_len(file);
+  for (i = 0; i < n && !g_cancellable_is_cancelled(cancellable); i += len) {
+    len = MIN(n - i, PNID_CANVAS_LOAD_BATCH);
+    if (!(objs = g_try_new(PnidObj *, len))) {
+      load->res = -ENOMEM;
+      break;
+    }
+    for (j = 0; j < len; j++) {
+      if (!(objs[j] = pnid_obj_new()))
+	break;
+      pnid_file_obj(file, i + j, objs[j]);
+    }
+    if (j < len) {
+      while (j--)
+	pnid_obj_delete(objs[j]);
+      g_free(objs);
+      load->res = -ENOMEM;
+      break;
+    }
+    load_post(task, objs, len, NULL, (double)(i + len) / n);
+  }
+  load->file = file;
+
+ out:
+  /* return only once every batch is indexed, so the caller sees the
+     whole of what was read */
+  g_mutex_lock(&load->lock);
+  while (load->pending)
+    g_cond_wait(&load->cond, &load->lock);
+  g_mutex_unlock(&load->lock);
+
+  g_task_return_boolean(task, TRUE);
+}
+
+/* load_import(): #PnidImportFunc, post a batch of imported objects
+   unless the load has been cancelled */
+static int
+load_import(PnidObj **objs, size_t n, GStringChunk *strings, double progress, void *data)
+{
+  GTask *task = data;
+  size_t i;
+
+  if (g_cancellable_is_cancelled(g_task_get_cancellable(task))) {
+    for (i = 0; i < n; i++)
+      pnid_obj_delete(objs[i]);
+    g_free(objs);
+    g_string_chunk_free(strings);
+    return -ECANCELED;
+  }
+
+  load_post(task, objs, n, strings, progress);
+  return 0;
+}
+
+/* load_post(): hand a batch of objects to the main loop, waiting
+   first while too many batches are queued so the worker cannot run
+   far ahead of the index */
+static void
+load_post(GTask *task, PnidObj **objs, size_t n, GStringChunk *strings, double progress)
+{
+  struct load *load = g_task_get_task_data(task);
+  struct batch *batch;
+
+  g_mutex_lock(&load->lock);
+  while (load->pending >= PNID_CANVAS_LOAD_PENDING)
+    g_cond_wait(&load->cond, &load->lock);
+  load->pending++;
+  g_mutex_unlock(&load->lock);
+
+  batch = g_new(struct batch, 1);
+  batch->task = g_object_ref(task);
+  batch->objs = objs;
+  batch->n = n;
+  batch->strings = strings;
+  batch->progress = progress;
+
+  /* below redraw priority, so frames are drawn between batches */
+  g_main_context_invoke_full(g_task_get_context(task), G_PRIORITY_DEFAULT_IDLE,
+			     load_batch, batch, load_batch_free);
+}
+
+/* load_batch(): main loop, index a batch of objects and redraw where
+   they lie, so the first objects are shown after a single batch
+   however large the file. The batch is discarded if the load has been
+   cancelled or the canvas disposed. */
+static gboolean
+load_batch(gpointer data)
+{
+  struct batch *batch = data;
+  PnidCanvas *self = g_task_get_source_object(batch->task);
+  struct load *load = g_task_get_task_data(batch->task);
+  PnidBox mbr;			/* of the batch */
+  size_t i;
+  int res;
+
+  if (!self->index || g_cancellable_is_cancelled(g_task_get_cancellable(batch->task))) {
+    for (i = 0; i < batch->n; i++)
+      pnid_obj_delete(batch->objs[i]);
+  } else if ((res = take(self, batch->objs, batch->n)) < 0
+	     || (res = pnid_rtree_load(self->index, batch->objs, batch->n)) < 0) {
+    /* objects taken are freed with the store */
+    load->res = res;
+    g_cancellable_cancel(g_task_get_cancellable(batch->task));
+  } else {
+    for (i = 0; i < batch->n; i++) {
+      if (batch->strings)
+	intern(self, batch->objs[i]);
+      adopt(self, batch->objs[i]);
+      mbr = i ? pnid_box_mbr(&mbr, &batch->objs[i]->bbox) : batch->objs[i]->bbox;
+    }
+    self->load_progress = batch->progress;
+    g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_LOAD_PROGRESS]);
+    if (batch->n)
+      damage(self, &mbr);
+  }
+
+  g_mutex_lock(&load->lock);
+  load->pending--;
+  g_cond_signal(&load->cond);
+  g_mutex_unlock(&load->lock);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* load_batch_free(): free a batch once it has been indexed */
+static void
+load_batch_free(gpointer data)
+{
+  struct batch *batch = data;
+
+  g_object_unref(batch->task);
+  g_free(batch->objs);
+  if (batch->strings)
+    g_string_chunk_free(batch->strings);
+  g_free(batch);
+}
+
+/* load_free(): free the state of a load once it has completed */
+static void
+load_free(gpointer data)
+{
+  struct load *load = data;
+
+  if (load->file)		/* not taken by finish */
+    pnid_file_unmap(load->file);
+  if (load->pack)
+    pnid_pack_close(load->pack);
+  g_mutex_clear(&load->lock);
+  g_cond_clear(&load->cond);
+  g_free(load->path);
+  g_free(load);
+}
+
+/*********************
+ * Packed drawings
+*******************/
+
+/* Each query of the index first looks up the chunks of the pack
+   overlapping the region, and those not yet read are decompressed by
+   worker threads and indexed as they arrive. An indexed object's box
+   stays resident, but the attribute strings of each chunk are its
+   payload and are held only within memory-budget, those of the least
+   recently viewed chunks out of view being dropped until a query
+   touches them again. Packed drawings are read only, and once edited
+   their payloads are no longer dropped. */
+
+/* pack_read: a chunk being read by a worker */
+struct pack_read {
+  unsigned      chunk;
+  int           res;
+  PnidObj     **objs;
+  size_t        n;
+  GStringChunk *strings;
+};
+
+/* pack_fetch(): start reading the chunks of the packed drawing which
+   overlap region and are not yet held, marking each as viewed this
+   frame */
+static void
+pack_fetch(PnidCanvas *self, const PnidBox *region)
+{
+  GdkFrameClock *clock;
+
+  clock = gtk_widget_get_frame_clock(GTK_WIDGET(self));
+  self->pack_frame = clock ? gdk_frame_clock_get_frame_counter(clock) : 0;
+  pnid_pack_query(self->pack, region, pack_chunk, self);
+}
+
+/* pack_chunk(): #PnidPackFunc, a chunk is in view */
+static void
+pack_chunk(unsigned chunk, void *data)
+{
+  PnidCanvas *self = data;
+  struct chunk *c = &self->chunks[chunk];
+  struct pack_read *r;
+  GTask *task;
+
+  c->used = self->pack_frame;
+  if (c->state == CHUNK_ABSENT)
+    c->state = CHUNK_PENDING;
+  else if (c->state == CHUNK_EVICTED)
+    c->state = CHUNK_RELOADING;
+  else
+    return;
+
+  r = g_new0(struct pack_read, 1);
+  r->chunk = chunk;
+  task = g_task_new(self, NULL, pack_ready, NULL);
+  g_task_set_task_data(task, r, pack_read_free);
+  g_task_run_in_thread(task, pack_thread);
+  g_object_unref(task);
+}
+
+/* pack_thread(): worker thread, read and decompress a chunk */
+static void
+pack_thread(GTask *task, gpointer source, gpointer task_data,
+	    GCancellable *cancellable)
+{
+  PnidCanvas *self = source;
+  struct pack_read *r = task_data;
+
+  r->res = pnid_pack_read(self->pack, r->chunk, &r->objs, &r->n, &r->strings);
+  g_task_return_boolean(task, TRUE);
+}
+
+/* pack_ready(): main loop, index the objects of a chunk which has
+   been read, or restore the payload of one which was evicted, then
+   evict others to stay within budget */
+static void
+pack_ready(GObject *source, GAsyncResult *result, gpointer data)
+{
+  PnidCanvas *self = PNID_CANVAS(source);
+  struct pack_read *r = g_task_get_task_data(G_TASK(result));
+  struct chunk *c = &self->chunks[r->chunk];
+  PnidObj *obj;
+  PnidBox mbr;			/* of the chunk's objects */
+  size_t i;
+  int k, res;
+
+  if (!self->index)		/* disposed */
+    return;
+  if (r->res < 0) {
+    g_warning("Failed to read %s: %s", self->path, g_strerror(-r->res));
+    c->state = c->state == CHUNK_RELOADING ? CHUNK_EVICTED : CHUNK_FAILED;
+    return;
+  }
+
+  if (c->state == CHUNK_RELOADING) {
+    /* the new objects only lend their attributes, and are freed with
+       the read. Objects since removed are skipped, and those edited
+       keep the attributes they were given. */
+    for (i = 0; i < r->n; i++) {
+      if (!(obj = g_hash_table_lookup(self->ids, GUINT_TO_POINTER(r->objs[i]->id))))
+	continue;
+      for (k = 0; k < PNID_N_ATTRS; k++)
+	if (!obj->attr[k])
+	  obj->attr[k] = r->objs[i]->attr[k];
+      reindex(self, obj);
+    }
+    self->payload_reloads++;
+    g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_PAYLOAD_RELOADS]);
+  } else {
+    if ((res = take(self, r->objs, r->n)) < 0) {
+      g_warning("Failed to read %s: %s", self->path, g_strerror(-res));
+      r->n = 0;
+      c->state = CHUNK_FAILED;
+      return;
+    }
+    if ((res = pnid_rtree_load(self->index, r->objs, r->n)) < 0) {
+      /* as by load_batch(), objects taken are freed with the store,
+	 and the strings they point to with the chunk */
+      g_warning("Failed to index %s: %s", self->path, g_strerror(-res));
+      r->n = 0;
+      c->strings = g_steal_pointer(&r->strings);
+      c->state = CHUNK_FAILED;
+      return;
+    }
+    c->ids = g_array_sized_new(FALSE, FALSE, sizeof(guint), r->n);
+    for (i = 0; i < r->n; i++) {
+      adopt(self, r->objs[i]);
+      g_array_append_val(c->ids, r->objs[i]->id);
+      mbr = i ? pnid_box_mbr(&mbr, &r->objs[i]->bbox) : r->objs[i]->bbox;
+    }
+    if (r->n)
+      damage(self, &mbr);
+    r->n = 0;
+  }
+
+  c->strings = g_steal_pointer(&r->strings);
+  c->bytes = 0;
+  for (i = 0; i < c->ids->len; i++)
+    if ((obj = g_hash_table_lookup(self->ids,
+				   GUINT_TO_POINTER(g_array_index(c->ids, guint, i)))))
+      c->bytes += payload_size(obj);
+  self->payload_bytes += c->bytes;
+  c->state = CHUNK_RESIDENT;
+
+  pack_evict(self);
+}
+
+/* pack_read_free(): free a chunk read, with any objects not taken */
+static void
+pack_read_free(gpointer data)
+{
+  struct pack_read *r = data;
+  size_t i;
+
+  for (i = 0; i < r->n; i++)
+    pnid_obj_delete(r->objs[i]);
+  g_free(r->objs);
+  if (r->strings)
+    g_string_chunk_free(r->strings);
+  g_free(r);
+}
+
+/* pack_evict(): drop the payloads of the least recently viewed
+   chunks out of view until those held are within budget */
+static void
+pack_evict(PnidCanvas *self)
+{
+  struct chunk *c, *lru;
+  PnidObj *obj;
+  unsigned i;
+
+  while (!self->pack_pinned && self->payload_bytes > self->memory_budget) {
+    lru = NULL;
+    for (i = 0; i < pnid_pack_len(self->pack); i++) {
+      c = &self->chunks[i];
+      if (c->state == CHUNK_RESIDENT && c->used < self->pack_frame
+	  && (!lru || c->used < lru->used))
+	lru = c;
+    }
+    if (!lru)			/* all in view */
+      return;
+
+    for (i = 0; i < lru->ids->len; i++)
+      if ((obj = g_hash_table_lookup(self->ids,
+				     GUINT_TO_POINTER(g_array_index(lru->ids, guint, i)))))
+	memset(obj->attr, 0, sizeof obj->attr);
+    g_clear_pointer(&lru->strings, g_string_chunk_free);
+    self->payload_bytes -= lru->bytes;
+    lru->bytes = 0;
+    lru->state = CHUNK_EVICTED;
+    self->payload_evictions++;
+    g_object_notify_by_pspec(G_OBJECT(self), obj_properties[PROP_PAYLOAD_EVICTIONS]);
+  }
+}
+
+/* payload_size(): bytes of attribute strings held for obj */
+static gsize
+payload_size(PnidObj *obj)
+{
+  gsize n = 0;
+  int k;
+
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (obj->attr[k])
+      n += strlen(obj->attr[k]) + 1;
+  return n;
+}
+
+/*********************
+ * Journalling
+*******************/
+
+/* Once loaded, every edit is journalled and replayed on top of the
+   file when next opened. Undoing or redoing an edit applies it as a
+   replayed one is, updating the index and connections of only the
+   objects it touched. Edits reported with pnid_canvas_changed()
+   cannot be undone, as their previous state is not known. */
+
+/* compact: a snapshot of the drawing being written to its file */
+struct compact {
+  char     *path;
+  GArray   *objs;		/* PnidObj */
+  uint64_t  seq;		/* last journal entry in snapshot */
+  uint32_t  next;		/* store slot to copy from next */
+};
+
+/* journal(): record an edit to obj, a failure is reported but the
+   edit stands */
+static void
+journal(PnidCanvas *self, enum pnid_journal_op op, PnidObj *obj)
+{
+  int res;
+
+  self->pack_pinned = TRUE;
+  if (self->journal && (res = pnid_journal_append(self->journal, op, obj)) < 0)
+    g_warning("Failed to record edit to %s: %s", self->path, g_strerror(-res));
+}
+
+/* replay_entry(): #PnidJournalFunc, apply an edit read back from the
+   journal when a drawing is opened */
+static void
+replay_entry(enum pnid_journal_op op, const PnidObj *obj, void *data)
+{
+  PnidCanvas *self = data;
+  PnidObj *cur;
+  PnidBox from;
+
+  cur = g_hash_table_lookup(self->ids, GUINT_TO_POINTER(obj->id));
+  switch (op) {
+  case PNID_JOURNAL_INSERT:
+    if (cur || !(cur = pnid_objstore_add(self->store, obj)))
+      return;
+    intern(self, cur);
+    if (pnid_rtree_insert(self->index, cur) < 0) {
+      pnid_objstore_release(self->store, cur);
+      return;
+    }
+    adopt(self, cur);
+    damage(self, &cur->bbox);
+    break;
+  case PNID_JOURNAL_UPDATE:
+    if (!cur || pnid_rtree_remove(self->index, cur) < 0)
+      return;
+    from = cur->bbox;
+    *cur = *obj;
+    intern(self, cur);
+    pnid_graph_isolate(self->graph, pnid_objstore_handle(self->store, cur));
+    damage(self, &from);
+    if (pnid_rtree_insert(self->index, cur) < 0) {
+      g_hash_table_remove(self->ids, GUINT_TO_POINTER(obj->id));
+      unindex(self, cur);
+      pnid_objstore_release(self->store, cur);
+      return;
+    }
+    reindex(self, cur);
+    join(self, cur);
+    g_hash_table_remove(self->nodes, cur);
+    damage(self, &cur->bbox);
+    break;
+  case PNID_JOURNAL_DELETE:
+    if (!cur || pnid_rtree_remove(self->index, cur) < 0)
+      return;
+    g_hash_table_remove(self->ids, GUINT_TO_POINTER(obj->id));
+    g_hash_table_remove(self->nodes, cur);
+    damage(self, &cur->bbox);
+    unindex(self, cur);
+    pnid_graph_isolate(self->graph, pnid_objstore_handle(self->store, cur));
+    pnid_objstore_release(self->store, cur);
+    break;
+  }
+}
+
+/* intern(): give the canvas its own copy of obj's attribute strings */
+static void
+intern(PnidCanvas *self, PnidObj *obj)
+{
+  int k;
+
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (obj->attr[k])
+      obj->attr[k] = g_string_chunk_insert_const(self->strings, obj->attr[k]);
+}
+
+/* adopt(): obj has been indexed, make it findable by its id */
+static void
+adopt(PnidCanvas *self, PnidObj *obj)
+{
+  g_hash_table_insert(self->ids, GUINT_TO_POINTER(obj->id), obj);
+  self->next_id = MAX(self->next_id, obj->id + 1);
+  reindex(self, obj);
+  join(self, obj);
+}
+
+/* reindex(): bring the tag and line number indexes up to date with
+   obj's attributes, or those its symbol gives it */
+static void
+reindex(PnidCanvas *self, PnidObj *obj)
+{
+  PnidObjHandle h = pnid_objstore_handle(self->store, obj);
+
+  if (pnid_attrindex_set(self->tags, h, pnid_symdef_attr(obj, PNID_ATTR_TAG)) < 0
+      || pnid_attrindex_set(self->lines, h, pnid_symdef_attr(obj, PNID_ATTR_LINE)) < 0)
+    g_warning("Failed to index object %u: %s", obj->id, g_strerror(ENOMEM));
+}
+
+/* join(): connect obj, which has been indexed, to the objects it
+   meets. Either the end of a line lies within the other object, or at
+   one of its ports, so each lies within obj's bounding box. */
+static void
+join(PnidCanvas *self, PnidObj *obj)
+{
+  struct trace t = { self, obj };
+
+  pnid_rtree_walk(self->index, &obj->bbox, NULL, join_object, &t);
+}
+
+/* join_object(): pnid_rtree_walk() callback, connect the object
+   of a join() to tuple if they meet */
+static void
+join_object(PnidObj *tuple, void *data)
+{
+  struct trace *t = data;
+  PnidObjStore *store = t->canvas->store;
+  int res;
+
+  if (tuple == t->start
+      || !(ends_within(tuple, t->start) || ends_within(t->start, tuple)))
+    return;
+  res = pnid_graph_connect(t->canvas->graph, pnid_objstore_handle(store, t->start),
+			   pnid_objstore_handle(store, tuple));
+  if (res < 0 && res != -EEXIST)
+    g_warning("Failed to connect object %u: %s", t->start->id, g_strerror(-res));
+}
+
+/* ends_within(): non-zero if line is a line with an end within obj.
+   A symbol defining ports is met only at one of them. */
+static int
+ends_within(const PnidObj *line, const PnidObj *obj)
+{
+  const PnidBox *b = &line->bbox, *box = &obj->bbox;
+  PnidCoord at;
+  unsigned y0, y1, i;
+
+  if (line->type == PNID_OBJ_LINE) {
+    y0 = b->nw.y;
+    y1 = b->se.y;
+  } else if (line->type == PNID_OBJ_LINE_RISE) {
+    y0 = b->se.y;
+    y1 = b->nw.y;
+  } else {
+    return 0;
+  }
+
+#define NEAR(x, y) (ABS((long)(x) - (long)at.x) <= PNID_CANVAS_PORT_PT \
+		    && ABS((long)(y) - (long)at.y) <= PNID_CANVAS_PORT_PT)
+  if (obj->type == PNID_OBJ_SYMBOL && pnid_symdef_get(obj->symbol)->nports) {
+    for (i = 0; pnid_symdef_port(obj, i, &at) == 0; i++)
+      if (NEAR(b->nw.x, y0) || NEAR(b->se.x, y1))
+	return 1;
+    return 0;
+  }
+#undef NEAR
+
+#define WITHIN(x, y) ((x) >= box->nw.x && (x) <= box->se.x && (y) >= box->nw.y && (y) <= box->se.y)
+  return WITHIN(b->nw.x, y0) || WITHIN(b->se.x, y1);
+#undef WITHIN
+}
+
+/* trace_object(): #PnidGraphFunc, add obj to the objects found by a
+   trace, passing through it unless it is a valve bounding the
+   trace */
+static int
+trace_object(PnidObjHandle obj, unsigned depth, void *data)
+{
+  struct trace *t = data;
+  PnidObj *o = pnid_objstore_get(t->canvas->store, obj);
+
+  g_ptr_array_add(t->found, o);
+
+  return !t->isolate || o == t->start
+    || o->type != PNID_OBJ_SYMBOL || o->symbol != PNID_SYMBOL_VALVE;
+}
+
+/* undo_entry(): #PnidUndoFunc, bring the object of an edit being
+   undone or redone from its state from to its state to, as the
+   journal's edits are replayed, and journal it */
+static void
+undo_entry(enum pnid_undo_op op, const PnidObj *from, const PnidObj *to, void *data)
+{
+  PnidCanvas *self = data;
+  PnidObj *cur, obj;
+
+  cur = g_hash_table_lookup(self->ids, GUINT_TO_POINTER((to ? to : from)->id));
+  if (!to) {
+    if (cur) {
+      journal(self, PNID_JOURNAL_DELETE, cur);
+      replay_entry(PNID_JOURNAL_DELETE, cur, self);
+    }
+    return;
+  }
+
+  if (!cur) {
+    replay_entry(PNID_JOURNAL_INSERT, to, self);
+  } else if (op == PNID_UNDO_MOVE) {
+    obj = *cur;
+    obj.bbox = to->bbox;
+    replay_entry(PNID_JOURNAL_UPDATE, &obj, self);
+  } else {
+    replay_entry(PNID_JOURNAL_UPDATE, to, self);
+  }
+  if ((cur = g_hash_table_lookup(self->ids, GUINT_TO_POINTER(to->id))))
+    journal(self, from ? PNID_JOURNAL_UPDATE : PNID_JOURNAL_INSERT, cur);
+}
+
+/* move(): move obj to bbox, connecting it anew, and damage only the
+   union of where it was and is. Returns less than zero on error, when
+   obj is left where it was. */
+static int
+move(PnidCanvas *self, PnidObj *obj, const PnidBox *bbox)
+{
+  PnidBox from = obj->bbox, mbr = pnid_box_mbr(&obj->bbox, bbox);
+  int res;
+
+  if ((res = pnid_rtree_remove(self->index, obj)) < 0)
+    return res;
+  obj->bbox = *bbox;
+  if ((res = pnid_rtree_insert(self->index, obj)) < 0) {
+    obj->bbox = from;
+    if (pnid_rtree_insert(self->index, obj) < 0)
+      g_warning("Object %u lost from the index", obj->id);
+    return res;
+  }
+  pnid_graph_isolate(self->graph, pnid_objstore_handle(self->store, obj));
+  join(self, obj);
+  changed(self, obj);
+  damage(self, &mbr);
+
+  return 0;
+}
+
+/* changed(): bring the canvas up to date with a change to obj,
+   leaving what must be drawn again to the caller */
+static void
+changed(PnidCanvas *self, PnidObj *obj)
+{
+  intern(self, obj);
+  reindex(self, obj);
+  g_hash_table_remove(self->nodes, obj);
+  journal(self, PNID_JOURNAL_UPDATE, obj);
+}
+
+/* record(): report a failure to record an edit to be undone */
+static void
+record(PnidCanvas *self, int res)
+{
+  if (res < 0)
+    g_warning("Edit too large to be undone: %s", g_strerror(-res));
+}
+
+/* unindex(): remove obj from the tag and line number indexes and the
+   selection, before it is released */
+static void
+unindex(PnidCanvas *self, PnidObj *obj)
+{
+  PnidObjHandle h = pnid_objstore_handle(self->store, obj);
+
+  pnid_attrindex_set(self->tags, h, NULL);
+  pnid_attrindex_set(self->lines, h, NULL);
+  pnid_select_remove(self->selection, h);
+}
+
+/* take(): move the n objects of objs, read by a worker, into the
+   store, replacing each with the canvas's copy. The originals are
+   freed even if they cannot be taken. Returns less than zero on
+   error. */
+static int
+take(PnidCanvas *self, PnidObj **objs, size_t n)
+{
+  PnidObj *obj;
+  size_t i;
+  int res;
+
+  if ((res = pnid_objstore_reserve(self->store, n)) < 0) {
+    for (i = 0; i < n; i++)
+      pnid_obj_delete(objs[i]);
+    return res;
+  }
+  for (i = 0; i < n; i++) {
+    obj = pnid_objstore_add(self->store, objs[i]);
+    pnid_obj_delete(objs[i]);
+    objs[i] = obj;
+  }
+
+  return 0;
+}
+
+/* compact_tick(): periodic timeout, once the journal has grown large
+   begin copying a snapshot of the drawing to write to its file */
+static gboolean
+compact_tick(gpointer data)
+{
+  PnidCanvas *self = data;
+  struct compact *c;
+
+  if (self->compacting
+      || pnid_journal_size(self->journal) < PNID_CANVAS_COMPACT_BYTES)
+    return G_SOURCE_CONTINUE;
+
+  c = g_new0(struct compact, 1);
+  c->path = g_strdup(self->path);
+  c->objs = g_array_sized_new(FALSE, FALSE, sizeof(PnidObj),
+			      g_hash_table_size(self->ids));
+  c->seq = pnid_journal_seq(self->journal);
+  self->compact = c;
+  self->compacting = TRUE;
+  self->compact_idle = g_idle_add(compact_copy, self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* compact_copy(): idle callback, copy the next
+   PNID_CANVAS_COMPACT_BATCH slots of the store into the snapshot, a
+   copy of the whole drawing being too long a stall for one turn of
+   the main loop. An edit between turns starts the copy again, so the
+   snapshot is of the drawing at its sequence number. Once every slot
+   is copied the snapshot is written on a worker thread. Its strings
+   are held by the canvas until finalized. */
+static gboolean
+compact_copy(gpointer data)
+{
+  PnidCanvas *self = data;
+  struct compact *c = self->compact;
+  uint32_t end = pnid_objstore_slots(self->store);
+  PnidObj *obj;
+  GTask *task;
+
+  if (c->seq != pnid_journal_seq(self->journal)) {
+    g_array_set_size(c->objs, 0);
+    c->seq = pnid_journal_seq(self->journal);
+    c->next = 0;
+  }
+  for (end = MIN(end, c->next + PNID_CANVAS_COMPACT_BATCH); c->next < end; c->next++)
+    if ((obj = pnid_objstore_at(self->store, c->next))
+	&& g_hash_table_lookup(self->ids, GUINT_TO_POINTER(obj->id)) == obj)
+      g_array_append_val(c->objs, *obj);
+  if (c->next < pnid_objstore_slots(self->store))
+    return G_SOURCE_CONTINUE;
+
+  self->compact_idle = 0;
+  task = g_task_new(self, NULL, compact_ready, NULL);
+  g_task_set_task_data(task, g_steal_pointer(&self->compact), compact_free);
+  g_task_run_in_thread(task, compact_thread);
+  g_object_unref(task);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* compact_thread(): worker thread, stream the snapshot out to the
+   drawing file, which then includes the journal up to its sequence
+   number */
+static void
+compact_thread(GTask *task, gpointer source, gpointer task_data,
+	       GCancellable *cancellable)
+{
+  struct compact *c = task_data;
+  PnidFileWriter *w;
+  guint i;
+  int res;
+
+  if ((res = pnid_file_writer_open(c->path, &w)) < 0) {
+    g_task_return_int(task, res);
+    return;
+  }
+  for (i = 0; i < c->objs->len; i++)
+    if ((res = pnid_file_writer_add(w, &g_array_index(c->objs, PnidObj, i))) < 0) {
+      pnid_file_writer_abort(w);
+      g_task_return_int(task, res);
+      return;
+    }
+
+  g_task_return_int(task, pnid_file_writer_close(w, c->seq));
+}
+
+/* compact_ready(): the snapshot has been written, the journal entries
+   it includes are discarded unless edits have been made since */
+static void
+compact_ready(GObject *source, GAsyncResult *result, gpointer data)
+{
+  PnidCanvas *self = PNID_CANVAS(source);
+  struct compact *c = g_task_get_task_data(G_TASK(result));
+  int res;
+
+  self->compacting = FALSE;
+  if ((res = g_task_propagate_int(G_TASK(result), NULL)) < 0)
+    g_warning("Failed to compact %s: %s", c->path, g_strerror(-res));
+  else if (self->journal
+	   && (res = pnid_journal_truncate(self->journal, c->seq)) < 0
+	   && res != -EAGAIN)
+    g_warning("Failed to truncate journal of %s: %s", c->path, g_strerror(-res));
+}
+
+/* compact_free(): free a snapshot once written */
+static void
+compact_free(gpointer data)
+{
+  struct compact *c = data;
+
+  g_array_unref(c->objs);
+  g_free(c->path);
+  g_free(c);
 }
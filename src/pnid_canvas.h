@@ -9,6 +9,9 @@
 
 #include <gtk/gtk.h>
 
+#include "pnid_obj.h"
+#include "pnid_select.h"
+
 /*
   #PnidCanvas GObject class declaration
 */
@@ -20,5 +23,35 @@ G_DECLARE_FINAL_TYPE(PnidCanvas, pnid_canvas, PNID, CANVAS, GtkDrawingArea);
   #PnidCanvas interface
 */
 PnidCanvas *pnid_canvas_new(GtkPaperSize *paper_size, uint zoom_level); 
+void        pnid_canvas_load_async(PnidCanvas *self, const char *path,
+				   GCancellable *cancellable,
+				   GAsyncReadyCallback callback, gpointer data);
+gboolean    pnid_canvas_load_finish(PnidCanvas *self, GAsyncResult *result, GError **error);
+int         pnid_canvas_sync(PnidCanvas *self);
+PnidObj    *pnid_canvas_insert(PnidCanvas *self, const PnidObj *obj);
+PnidObj    *pnid_canvas_place(PnidCanvas *self, unsigned symbol, unsigned x, unsigned y);
+int         pnid_canvas_move(PnidCanvas *self, PnidObj *obj, const PnidBox *bbox);
+int         pnid_canvas_remove(PnidCanvas *self, PnidObj *obj);
+void        pnid_canvas_changed(PnidCanvas *self, PnidObj *obj);
+int         pnid_canvas_set_attr(PnidCanvas *self, PnidObj *obj, enum pnid_attr attr,
+				 const char *value);
+int         pnid_canvas_undo(PnidCanvas *self);
+int         pnid_canvas_redo(PnidCanvas *self);
+void        pnid_canvas_select_box(PnidCanvas *self, const PnidBox *box,
+				   enum pnid_select_mode mode, enum pnid_select_op op);
+void        pnid_canvas_select_lasso(PnidCanvas *self, const PnidCoord *lasso, size_t n,
+				     enum pnid_select_op op);
+GPtrArray  *pnid_canvas_selected(PnidCanvas *self);
+GPtrArray  *pnid_canvas_find(PnidCanvas *self, enum pnid_attr attr, const char *value);
+GPtrArray  *pnid_canvas_trace(PnidCanvas *self, PnidObj *start, gboolean isolate);
+int         pnid_canvas_dump_profile(PnidCanvas *self, const char *path);
+int         pnid_canvas_print_pages(PnidCanvas *self, double width, double height);
+void        pnid_canvas_print_page(PnidCanvas *self, cairo_t *cr, int page,
+				   double width, double height);
+void        pnid_canvas_draw_overview(PnidCanvas *self, cairo_t *cr, double scale,
+				      const PnidBox *region);
+void        pnid_canvas_get_viewport(PnidCanvas *self, double *x, double *y,
+				     double *width, double *height);
+void        pnid_canvas_scroll_to(PnidCanvas *self, double x, double y);
 
 #endif /* __PNID_CANVAS_H */
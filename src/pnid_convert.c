@@ -0,0 +1,208 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_convert.c - convert DXF and SVG drawings to pnid files
+
+   pnid-convert [-j JOBS] [-s SCALE] [-z] FILE...
+
+   Each FILE is imported and streamed into FILE with its extension
+   replaced by .pnid, without a display or building an index, so that
+   large drawings can be converted ahead of being opened. With -z the
+   result is packed into a chunked, compressed .pnidz file instead,
+   through a private intermediate which is removed afterwards, and
+   .pnid files given are packed as they are. Files whose results
+   would be written to the same place are refused. */
+
+#include <errno.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pnid_obj.h"
+#include "pnid_file.h"
+#include "pnid_import.h"
+#include "pnid_pack.h"
+
+static char *output(const char *path);
+static void convert(gpointer data, gpointer user_data);
+static int  import(const char *path, const char *out);
+static int  pack(const char *path, const char *out);
+static int  write_batch(PnidObj **objs, size_t n, GStringChunk *strings, double progress, void *data);
+
+static int    jobs = 0;
+static double scale = 0;
+static int    packed = 0;
+static int    failed = 0;
+
+static GOptionEntry entries[] = {
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Convert N files at once", "N" },
+    { "scale", 's', 0, G_OPTION_ARG_DOUBLE, &scale, "Points per drawing unit", "SCALE" },
+    { "pack", 'z', 0, G_OPTION_ARG_NONE, &packed, "Write chunked, compressed files", NULL },
+    { NULL }
+};
+
+int main
+(int argc, char **argv)
+{
+    GOptionContext *context;
+    GThreadPool *pool;
+    GHashTable *outputs;
+    GError *error = NULL;
+    char *path, *out;
+    int i;
+
+    context = g_option_context_new("FILE... - convert drawings to pnid files");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+	g_option_context_free(context);
+	return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (jobs <= 0)
+	jobs = g_get_num_processors();
+    pool = g_thread_pool_new(convert, NULL, jobs, TRUE, NULL);
+    outputs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    for (i = 1; i < argc; i++) {
+	if (!(path = output(argv[i]))) {
+	    g_printerr("%s: not a DXF or SVG drawing\n", argv[i]);
+	    g_atomic_int_inc(&failed);
+	    continue;
+	}
+	out = g_canonicalize_filename(path, NULL);
+	g_free(path);
+	if (g_hash_table_contains(outputs, out)) {
+	    g_printerr("%s: %s is also written from %s\n", argv[i], out,
+		       (char *)g_hash_table_lookup(outputs, out));
+	    g_atomic_int_inc(&failed);
+	    g_free(out);
+	} else {
+	    g_hash_table_insert(outputs, out, argv[i]);
+	    g_thread_pool_push(pool, argv[i], NULL);
+	}
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_hash_table_destroy(outputs);
+
+    return g_atomic_int_get(&failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* output(): the file path is converted into, NULL if it cannot be */
+static char *
+output(const char *path)
+{
+    const char *ext;
+
+    if (packed && g_str_has_suffix(path, ".pnid"))
+	return g_strconcat(path, "z", NULL);
+    if (!pnid_import_format(path))
+	return NULL;
+    ext = strrchr(path, '.');
+
+    return g_strdup_printf("%.*s.%s", (int)(ext - path), path, packed ? "pnidz" : "pnid");
+}
+
+/* convert(): #GFunc, convert the file at path data on a pool thread */
+static void
+convert(gpointer data, gpointer user_data)
+{
+    const char *path = data;
+    char *out, *tmp;
+    int fd, res;
+
+    out = output(path);
+    if (packed && g_str_has_suffix(path, ".pnid")) {
+	if ((res = pack(path, out)) < 0) {
+	    g_printerr("%s: %s\n", out, g_strerror(-res));
+	    g_atomic_int_inc(&failed);
+	}
+    } else if (!packed) {
+	if (import(path, out) < 0)
+	    g_atomic_int_inc(&failed);
+    } else {
+	/* the unpacked drawing is only an intermediate, written to a
+	   file of its own beside the output rather than any .pnid */
+	tmp = g_strconcat(out, ".XXXXXX", NULL);
+	if ((fd = g_mkstemp(tmp)) < 0) {
+	    g_printerr("%s: %s\n", tmp, g_strerror(errno));
+	    g_atomic_int_inc(&failed);
+	} else {
+	    close(fd);
+	    if (import(path, tmp) < 0) {
+		g_atomic_int_inc(&failed);
+	    } else if ((res = pack(tmp, out)) < 0) {
+		g_printerr("%s: %s\n", out, g_strerror(-res));
+		g_atomic_int_inc(&failed);
+	    }
+	    g_unlink(tmp);
+	}
+	g_free(tmp);
+    }
+    g_free(out);
+}
+
+/* import(): import the drawing at path into the drawing file out,
+   reporting any error. Returns less than zero on error. */
+static int
+import(const char *path, const char *out)
+{
+    PnidFileWriter *writer;
+    int res;
+
+    if ((res = pnid_file_writer_open(out, &writer)) < 0) {
+	g_printerr("%s: %s\n", out, g_strerror(-res));
+	return res;
+    }
+
+    if ((res = pnid_import(path, scale, write_batch, writer)) < 0) {
+	g_printerr("%s: %s\n", path, g_strerror(-res));
+	pnid_file_writer_abort(writer);
+	return res;
+    }
+    if (res)
+	g_printerr("%s: skipped %d unsupported entities\n", path, res);
+    if ((res = pnid_file_writer_close(writer, 0)) < 0)
+	g_printerr("%s: %s\n", out, g_strerror(-res));
+
+    return res;
+}
+
+/* pack(): pack the drawing file at path into out */
+static int
+pack(const char *path, const char *out)
+{
+    PnidFile *file;
+    int res;
+
+    if ((res = pnid_file_map(path, &file)) < 0)
+	return res;
+    res = pnid_pack_write(file, out);
+    pnid_file_unmap(file);
+
+    return res;
+}
+
+/* write_batch(): #PnidImportFunc, write a batch of objects to the
+   writer in data and free them */
+static int
+write_batch(PnidObj **objs, size_t n, GStringChunk *strings, double progress, void *data)
+{
+    PnidFileWriter *writer = data;
+    size_t i;
+    int res = 0;
+
+    for (i = 0; i < n; i++) {
+	if (!res)
+	    res = pnid_file_writer_add(writer, objs[i]);
+	pnid_obj_delete(objs[i]);
+    }
+    g_free(objs);
+    g_string_chunk_free(strings);
+
+    return res;
+}
@@ -7,6 +7,9 @@
 #include <cairo.h>
 #include <glib.h>
 
+#include "pnid_obj.h"
+#include "pnid_draw.h"
+
 void
 pnid_draw_circle(cairo_t *cr, int width, int height)
 {
@@ -16,4 +19,75 @@ pnid_draw_circle(cairo_t *cr, int width, int height)
 	      0, 2 * G_PI);
 }
 
+/* pnid_draw_symbol(): append the path of symbol to cr */
+void
+pnid_draw_symbol(cairo_t *cr, unsigned symbol, double width, double height)
+{
+    switch ((enum pnid_symbol)symbol) {
+    case PNID_SYMBOL_VALVE:
+	pnid_draw_valve(cr, width, height);
+	break;
+    case PNID_SYMBOL_INSTRUMENT:
+	pnid_draw_instrument(cr, width, height);
+	break;
+    case PNID_SYMBOL_PUMP:
+	pnid_draw_pump(cr, width, height);
+	break;
+    case PNID_SYMBOL_NONE:
+    case PNID_N_SYMBOLS:
+	cairo_rectangle(cr, 0, 0, width, height);
+	break;
+    }
+}
+
+/* pnid_draw_line(): a line of type across its box, pipework or a
+   signal imported from another drawing */
+void
+pnid_draw_line(cairo_t *cr, unsigned type, double width, double height)
+{
+    if (type == PNID_OBJ_LINE_RISE) {
+	cairo_move_to(cr, 0, height);
+	cairo_line_to(cr, width, 0);
+    } else {
+	cairo_move_to(cr, 0, 0);
+	cairo_line_to(cr, width, height);
+    }
+}
+
+/* pnid_draw_valve(): gate valve, two triangles meeting at their
+   apexes in the centre of the box */
+void
+pnid_draw_valve(cairo_t *cr, double width, double height)
+{
+    cairo_move_to(cr, 0, 0);
+    cairo_line_to(cr, width, height);
+    cairo_line_to(cr, width, 0);
+    cairo_line_to(cr, 0, height);
+    cairo_close_path(cr);
+}
+
+/* pnid_draw_instrument(): instrument bubble */
+void
+pnid_draw_instrument(cairo_t *cr, double width, double height)
+{
+    cairo_new_sub_path(cr);
+    cairo_arc(cr,
+	      width / 2, height / 2,
+	      MIN(width, height) / 2,
+	      0, 2 * G_PI);
+    cairo_close_path(cr);
+}
+
+/* pnid_draw_pump(): centrifugal pump, a casing with a tangential
+   discharge from its top to the right */
+void
+pnid_draw_pump(cairo_t *cr, double width, double height)
+{
+    double r = MIN(width, height) / 2;
+
+    pnid_draw_instrument(cr, width, height);
+    cairo_move_to(cr, width / 2, height / 2 - r);
+    cairo_line_to(cr, width, height / 2 - r);
+}
+
 /* pnid_draw_vessel(): draw a vessel */
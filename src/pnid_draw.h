@@ -11,4 +11,12 @@
 
 void pnid_draw_circle(cairo_t *cr, int width, int height);
 
+/* Symbol paths, each is appended to the current path of cr within a
+   box of width by height at the origin. */
+void pnid_draw_symbol     (cairo_t *cr, unsigned symbol, double width, double height);
+void pnid_draw_line       (cairo_t *cr, unsigned type, double width, double height);
+void pnid_draw_valve      (cairo_t *cr, double width, double height);
+void pnid_draw_instrument (cairo_t *cr, double width, double height);
+void pnid_draw_pump       (cairo_t *cr, double width, double height);
+
 #endif /* __PNID_DRAW_H */
@@ -0,0 +1,434 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_file.c - native pnid drawing file format
+
+   A drawing file is a fixed header, an array of fixed size records
+   and a table of nul terminated strings. Everything is written in
+   native byte order and alignment, so that a file is mapped into
+   memory and its records are read in place without being parsed. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_file.h"
+
+#define ALIGN     8		/* alignment of record array and strings */
+#define HASHMIN   1024		/* initial slots in string hash */
+#define STRINGMIN 4096		/* initial bytes in string table */
+
+struct pnid_file {
+  void                          *map;
+  size_t                         size;
+  const struct pnid_file_header *hdr;
+  const struct pnid_file_record *records;
+  const char                    *strings;
+};
+
+struct pnid_file_writer {
+  FILE     *fp;
+  char     *path;
+  char     *tmp;		/* written here, renamed to path */
+  uint64_t  nrecords;
+  char     *strings;		/* string table */
+  size_t    slen;
+  size_t    scap;
+  uint32_t *hash;		/* string offsets, zero is empty */
+  size_t    hlen;
+  size_t    hcap;
+};
+
+static int      validate(const struct pnid_file_header *hdr, size_t size);
+static uint32_t intern(struct pnid_file_writer *w, const char *s);
+static int      rehash(struct pnid_file_writer *w);
+static size_t   strhash(const char *s);
+static int      writepad(FILE *fp, long *pos);
+
+/*********************
+ * Reading
+*******************/
+
+/* pnid_file_map(): map the file at path into memory, returns 0 or
+   -errno, -EPROTO if it is not a drawing file this build reads */
+int
+pnid_file_map(const char *path, PnidFile **file)
+{
+  struct pnid_file *f;
+  struct stat st;
+  int fd, res;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -errno;
+  if (fstat(fd, &st) < 0) {
+    res = -errno;
+    close(fd);
+    return res;
+  }
+  if ((size_t)st.st_size < sizeof(struct pnid_file_header)) {
+    close(fd);
+    return -EPROTO;
+  }
+  if (!(f = calloc(1, sizeof *f))) {
+    close(fd);
+    return -ENOMEM;
+  }
+
+  f->size = st.st_size;
+  f->map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  res = -errno;
+  close(fd);
+  if (f->map == MAP_FAILED) {
+    free(f);
+    return res;
+  }
+
+  f->hdr = f->map;
+  if ((res = validate(f->hdr, f->size)) < 0) {
+    munmap(f->map, f->size);
+    free(f);
+    return res;
+  }
+  f->records = (const void *)((const char *)f->map + f->hdr->records);
+  f->strings = (const char *)f->map + f->hdr->strings;
+  madvise(f->map, f->size, MADV_WILLNEED);
+
+  *file = f;
+  return 0;
+}
+
+/* pnid_file_unmap(): unmap file, strings from it are then invalid */
+void
+pnid_file_unmap(PnidFile *file)
+{
+  if (!file)
+    return;
+  munmap(file->map, file->size);
+  free(file);
+}
+
+/* pnid_file_len(): number of records in file */
+size_t
+pnid_file_len(const PnidFile *file)
+{
+  return file->hdr->nrecords;
+}
+
+/* pnid_file_journal(): sequence number of the last journal entry
+   folded into file, entries up to it are not to be replayed */
+uint64_t
+pnid_file_journal(const PnidFile *file)
+{
+  return file->hdr->journal;
+}
+
+/* pnid_file_record(): the ith record of file */
+const struct pnid_file_record *
+pnid_file_record(const PnidFile *file, size_t i)
+{
+  return file->records + i;
+}
+
+/* pnid_file_string(): string at offset in the string table, NULL for
+   offset zero or an offset outside the table */
+const char *
+pnid_file_string(const PnidFile *file, uint32_t offset)
+{
+  if (!offset || offset >= file->hdr->strings_size)
+    return NULL;
+  return file->strings + offset;
+}
+
+/* pnid_file_obj(): fill obj from the ith record, its attributes point
+   into the mapped file */
+void
+pnid_file_obj(const PnidFile *file, size_t i, PnidObj *obj)
+{
+  const struct pnid_file_record *r;
+  int k;
+
+  r = file->records + i;
+  obj->bbox = (PnidBox){{r->left, r->top}, {r->right, r->bottom}};
+  obj->id = r->id;
+  obj->type = r->type;
+  obj->symbol = r->symbol;
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    obj->attr[k] = pnid_file_string(file, r->attr[k]);
+}
+
+/* validate(): check the header describes a file of size bytes, so
+   that nothing read through it lies outside the mapping, and that
+   every record is of a known type and symbol */
+static int
+validate(const struct pnid_file_header *hdr, size_t size)
+{
+  const struct pnid_file_record *r;
+  const char *strings;
+  uint64_t i;
+
+  if (memcmp(hdr->magic, PNID_FILE_MAGIC, sizeof hdr->magic))
+    return -EPROTO;
+  if (hdr->version != PNID_FILE_VERSION
+      || hdr->byteorder != PNID_FILE_BYTEORDER
+      || hdr->record_size != sizeof(struct pnid_file_record))
+    return -EPROTO;
+
+  if (hdr->records % ALIGN || hdr->records > size
+      || hdr->nrecords > (size - hdr->records) / hdr->record_size)
+    return -EPROTO;
+  if (hdr->strings > size || hdr->strings_size > size - hdr->strings
+      || hdr->strings_size < 1 || hdr->strings_size > UINT32_MAX)
+    return -EPROTO;
+
+  /* terminated, so any offset into the table is a string */
+  strings = (const char *)hdr + hdr->strings;
+  if (strings[0] || strings[hdr->strings_size - 1])
+    return -EPROTO;
+
+  r = (const void *)((const char *)hdr + hdr->records);
+  for (i = 0; i < hdr->nrecords; i++, r++)
+    if (r->type >= PNID_N_OBJ_TYPES || r->symbol >= PNID_N_SYMBOLS)
+      return -EPROTO;
+
+  return 0;
+}
+
+/*********************
+ * Writing
+*******************/
+
+/* pnid_file_writer_open(): start writing a drawing file to path,
+   returns 0 or -errno */
+int
+pnid_file_writer_open(const char *path, PnidFileWriter **writer)
+{
+  struct pnid_file_writer *w;
+  struct pnid_file_header hdr = {0};
+  size_t len;
+  int res;
+
+  if (!(w = calloc(1, sizeof *w)))
+    return -ENOMEM;
+
+  len = strlen(path);
+  w->path = strdup(path);
+  w->tmp = malloc(len + sizeof ".tmp");
+  w->strings = malloc(STRINGMIN);
+  w->hash = calloc(HASHMIN, sizeof *w->hash);
+  if (!w->path || !w->tmp || !w->strings || !w->hash) {
+    pnid_file_writer_abort(w);
+    return -ENOMEM;
+  }
+  memcpy(w->tmp, path, len);
+  memcpy(w->tmp + len, ".tmp", sizeof ".tmp");
+  w->scap = STRINGMIN;
+  w->slen = 1;
+  w->strings[0] = '\0';
+  w->hcap = HASHMIN;
+
+  if (!(w->fp = fopen(w->tmp, "wbe"))) {
+    res = -errno;
+    pnid_file_writer_abort(w);
+    return res;
+  }
+
+  /* placeholder, completed by pnid_file_writer_close() */
+  if (fwrite(&hdr, sizeof hdr, 1, w->fp) != 1) {
+    pnid_file_writer_abort(w);
+    return -EIO;
+  }
+
+  *writer = w;
+  return 0;
+}
+
+/* pnid_file_writer_add(): append obj to the file, returns 0 or
+   -errno, the writer should then be aborted */
+int
+pnid_file_writer_add(PnidFileWriter *w, const PnidObj *obj)
+{
+  struct pnid_file_record r = {0};
+  int k;
+
+  r.left = obj->bbox.nw.x;
+  r.top = obj->bbox.nw.y;
+  r.right = obj->bbox.se.x;
+  r.bottom = obj->bbox.se.y;
+  r.id = obj->id;
+  r.type = obj->type;
+  r.symbol = obj->symbol;
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (obj->attr[k] && obj->attr[k][0]
+	&& !(r.attr[k] = intern(w, obj->attr[k])))
+      return -ENOMEM;
+
+  if (fwrite(&r, sizeof r, 1, w->fp) != 1)
+    return -EIO;
+  w->nrecords++;
+
+  return 0;
+}
+
+/* pnid_file_writer_close(): write the string table and header, then
+   replace path with the new file. Journal is the sequence number of
+   the last journal entry included in the file, or zero. The writer is
+   freed whatever the result, returns 0 or -errno. */
+int
+pnid_file_writer_close(PnidFileWriter *w, uint64_t journal)
+{
+  struct pnid_file_header hdr = {0};
+  long pos;
+  int res;
+
+  memcpy(hdr.magic, PNID_FILE_MAGIC, sizeof hdr.magic);
+  hdr.version = PNID_FILE_VERSION;
+  hdr.byteorder = PNID_FILE_BYTEORDER;
+  hdr.record_size = sizeof(struct pnid_file_record);
+  hdr.nrecords = w->nrecords;
+  hdr.records = sizeof hdr;
+  hdr.strings_size = w->slen;
+  hdr.journal = journal;
+
+  if ((res = writepad(w->fp, &pos)) < 0)
+    goto fail;
+  hdr.strings = pos;
+  if (fwrite(w->strings, 1, w->slen, w->fp) != w->slen
+      || fseek(w->fp, 0, SEEK_SET) < 0
+      || fwrite(&hdr, sizeof hdr, 1, w->fp) != 1
+      || fflush(w->fp) == EOF) {
+    res = -EIO;
+    goto fail;
+  }
+  if (fsync(fileno(w->fp)) < 0 || fclose(w->fp) == EOF) {
+    res = -errno;
+    w->fp = NULL;
+    goto fail;
+  }
+  w->fp = NULL;
+  if (rename(w->tmp, w->path) < 0) {
+    res = -errno;
+    goto fail;
+  }
+
+  w->tmp[0] = '\0';		/* nothing left to remove */
+  pnid_file_writer_abort(w);
+  return 0;
+
+ fail:
+  pnid_file_writer_abort(w);
+  return res;
+}
+
+/* pnid_file_writer_abort(): discard the file being written */
+void
+pnid_file_writer_abort(PnidFileWriter *w)
+{
+  if (!w)
+    return;
+  if (w->fp)
+    fclose(w->fp);
+  if (w->tmp && w->tmp[0])
+    unlink(w->tmp);
+  free(w->path);
+  free(w->tmp);
+  free(w->strings);
+  free(w->hash);
+  free(w);
+}
+
+/* intern(): offset of s in the string table, adding s if it is not
+   already present. Returns zero on failure. */
+static uint32_t
+intern(struct pnid_file_writer *w, const char *s)
+{
+  size_t i, len;
+  uint32_t off;
+  char *tmp;
+
+  if (w->hlen * 2 >= w->hcap && rehash(w) < 0)
+    return 0;
+
+  for (i = strhash(s) & (w->hcap - 1); (off = w->hash[i]);
+       i = (i + 1) & (w->hcap - 1))
+    if (!strcmp(w->strings + off, s))
+      return off;
+
+  len = strlen(s) + 1;
+  if (len > UINT32_MAX - w->slen)
+    return 0;
+  if (w->slen + len > w->scap) {
+    while (w->slen + len > w->scap)
+      w->scap *= 2;
+    if (!(tmp = realloc(w->strings, w->scap)))
+      return 0;
+    w->strings = tmp;
+  }
+
+  off = w->slen;
+  memcpy(w->strings + off, s, len);
+  w->slen += len;
+  w->hash[i] = off;
+  w->hlen++;
+
+  return off;
+}
+
+/* rehash(): double the slots in the string hash */
+static int
+rehash(struct pnid_file_writer *w)
+{
+  uint32_t *hash, off;
+  size_t i, j, cap;
+
+  cap = w->hcap * 2;
+  if (!(hash = calloc(cap, sizeof *hash)))
+    return -ENOMEM;
+  for (i = 0; i < w->hcap; i++) {
+    if (!(off = w->hash[i]))
+      continue;
+    for (j = strhash(w->strings + off) & (cap - 1); hash[j];
+	 j = (j + 1) & (cap - 1))
+      ;
+    hash[j] = off;
+  }
+  free(w->hash);
+  w->hash = hash;
+  w->hcap = cap;
+
+  return 0;
+}
+
+/* strhash(): FNV-1a hash of s */
+static size_t
+strhash(const char *s)
+{
+  size_t h = 2166136261u;
+
+  while (*s)
+    h = (h ^ (unsigned char)*s++) * 16777619u;
+  return h;
+}
+
+/* writepad(): pad file to ALIGN bytes, storing the new position */
+static int
+writepad(FILE *fp, long *pos)
+{
+  static const char zero[ALIGN];
+  long p;
+
+  if ((p = ftell(fp)) < 0)
+    return -errno;
+  if (p % ALIGN && fwrite(zero, ALIGN - p % ALIGN, 1, fp) != 1)
+    return -EIO;
+  *pos = p + (p % ALIGN ? ALIGN - p % ALIGN : 0);
+
+  return 0;
+}
@@ -0,0 +1,73 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_file.h - native pnid drawing file format */
+
+#ifndef __PNID_FILE_H
+#define __PNID_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pnid_obj.h"
+
+#define PNID_FILE_MAGIC     "PNID"
+#define PNID_FILE_VERSION   1
+#define PNID_FILE_BYTEORDER 0x01020304 /* written in native order */
+
+/* pnid_file_header: at the start of the file, all offsets are in
+   bytes from the start of the file. */
+struct pnid_file_header {
+  char     magic[4];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t record_size;		/* sizeof(struct pnid_file_record) */
+  uint64_t nrecords;
+  uint64_t records;		/* offset of record array */
+  uint64_t strings;		/* offset of string table */
+  uint64_t strings_size;
+  uint64_t journal;		/* last journal entry folded in */
+  uint64_t reserved;
+};
+
+/* pnid_file_record: a single object. Attributes are offsets into the
+   string table, where offset zero is the empty string and means the
+   attribute is not set. */
+struct pnid_file_record {
+  uint32_t left;
+  uint32_t top;
+  uint32_t right;
+  uint32_t bottom;
+  uint32_t type;		/* enum pnid_obj_type */
+  uint32_t symbol;		/* enum pnid_symbol */
+  uint32_t attr[PNID_N_ATTRS];
+  uint32_t id;			/* unique within the drawing */
+};
+
+/* #PnidFile: a drawing file mapped into memory read only. */
+typedef struct pnid_file PnidFile;
+
+/* #PnidFileWriter: a drawing file being written one record at a
+   time. */
+typedef struct pnid_file_writer PnidFileWriter;
+
+/* Map and unmap a file, the records and strings are used in place */
+int         pnid_file_map(const char *path, PnidFile **file);
+void        pnid_file_unmap(PnidFile *file);
+
+/* Read the mapped records */
+size_t                         pnid_file_len(const PnidFile *file);
+uint64_t                       pnid_file_journal(const PnidFile *file);
+const struct pnid_file_record *pnid_file_record(const PnidFile *file, size_t i);
+const char                    *pnid_file_string(const PnidFile *file, uint32_t offset);
+void                           pnid_file_obj(const PnidFile *file, size_t i, PnidObj *obj);
+
+/* Stream objects out to a new file, which replaces any file at path
+   only once it has been closed successfully. */
+int         pnid_file_writer_open(const char *path, PnidFileWriter **writer);
+int         pnid_file_writer_add(PnidFileWriter *writer, const PnidObj *obj);
+int         pnid_file_writer_close(PnidFileWriter *writer, uint64_t journal);
+void        pnid_file_writer_abort(PnidFileWriter *writer);
+
+#endif /* __PNID_FILE_H */
@@ -0,0 +1,378 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_graph.c - connectivity of pnid drawing objects
+
+   Connections are held in compressed sparse row form, the neighbours
+   of the object in each store slot lying together in one array, with
+   changes made since held as deltas beside it. A broken connection is
+   blanked where it lies, a new one is added to a list of extra
+   neighbours for each slot. Once the deltas outnumber the
+   connections in the rows, the rows are rebuilt with them folded in,
+   so the cost of rebuilding is spread over the changes that caused
+   it.
+
+   A trace marks the slots it reaches with the number of the trace,
+   so that nothing need be cleared before the next. It only touches
+   the objects it reaches and their connections. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_objstore.h"
+#include "pnid_graph.h"
+
+#define DELTAMIN 4096		/* deltas held before any rebuild */
+
+/* extra: a neighbour added since the rows were built */
+struct extra {
+  PnidObjHandle to;
+  uint32_t      next;		/* extra + 1, 0 at end */
+};
+
+/* visit: an object waiting to be visited by a trace */
+struct visit {
+  PnidObjHandle obj;
+  unsigned      depth;
+};
+
+struct pnid_graph {
+  uint32_t      *rows;		/* first neighbour of each slot, nrows + 1 */
+  uint32_t       nrows;
+  PnidObjHandle *adj;		/* neighbours, NONE once disconnected */
+  uint32_t       nblank;	/* of adj */
+  struct extra  *extras;
+  uint32_t       nextras;
+  uint32_t       capextras;
+  uint32_t      *heads;		/* extra + 1 of each slot, 0 if none */
+  uint32_t       nheads;
+  uint32_t      *marks;		/* trace last reaching each slot */
+  uint32_t       nmarks;
+  uint32_t       trace;
+  size_t         len;		/* connections */
+};
+
+static int      link_extra(PnidGraph *g, PnidObjHandle from, PnidObjHandle to);
+static int      drop(PnidGraph *g, PnidObjHandle from, PnidObjHandle to);
+static int      connected(const PnidGraph *g, PnidObjHandle a, PnidObjHandle b);
+static int      rebuild(PnidGraph *g);
+static int      grow(uint32_t **a, uint32_t *n, size_t min);
+
+/*********************
+ * Creation and Destruction
+*******************/
+
+/* pnid_graph_new(): create a graph without connections. Returns NULL
+   if out of memory. */
+PnidGraph *
+pnid_graph_new(void)
+{
+  PnidGraph *new;
+
+  if (!(new = calloc(1, sizeof *new)))
+    return NULL;
+  if (!(new->rows = calloc(1, sizeof *new->rows))) {
+    free(new);
+    return NULL;
+  }
+
+  return new;
+}
+
+/* pnid_graph_destroy(): free g */
+void
+pnid_graph_destroy(PnidGraph *g)
+{
+  if (!g)
+    return;
+
+  free(g->rows);
+  free(g->adj);
+  free(g->extras);
+  free(g->heads);
+  free(g->marks);
+  free(g);
+}
+
+/*********************
+ * Connections
+*******************/
+
+/* pnid_graph_connect(): connect a and b. Returns -EINVAL if they are
+   the same object, -EEXIST if already connected, -ENOMEM or 0. */
+int
+pnid_graph_connect(PnidGraph *g, PnidObjHandle a, PnidObjHandle b)
+{
+  int res;
+
+  if (a == b || a == PNID_OBJ_HANDLE_NONE || b == PNID_OBJ_HANDLE_NONE)
+    return -EINVAL;
+  if (connected(g, a, b))
+    return -EEXIST;
+
+  if ((res = link_extra(g, a, b)) < 0)
+    return res;
+  if ((res = link_extra(g, b, a)) < 0) {
+    drop(g, a, b);
+    return res;
+  }
+  g->len++;
+
+  /* should rebuilding fail, the deltas are simply kept */
+  if (g->nextras + g->nblank > DELTAMIN + g->rows[g->nrows])
+    rebuild(g);
+  return 0;
+}
+
+/* pnid_graph_disconnect(): break the connection between a and
+   b. Returns -ENOENT if they are not connected, or 0. */
+int
+pnid_graph_disconnect(PnidGraph *g, PnidObjHandle a, PnidObjHandle b)
+{
+  if (!drop(g, a, b))
+    return -ENOENT;
+  drop(g, b, a);
+  g->len--;
+
+  return 0;
+}
+
+/* pnid_graph_isolate(): break every connection of obj, as must be
+   done before it is released */
+void
+pnid_graph_isolate(PnidGraph *g, PnidObjHandle obj)
+{
+  uint32_t i, s = PNID_OBJ_HANDLE_SLOT(obj), e;
+
+  for (i = s < g->nrows ? g->rows[s] : 0; s < g->nrows && i < g->rows[s + 1]; i++)
+    if (g->adj[i] != PNID_OBJ_HANDLE_NONE) {
+      drop(g, g->adj[i], obj);
+      g->adj[i] = PNID_OBJ_HANDLE_NONE;
+      g->nblank++;
+      g->len--;
+    }
+  for (e = s < g->nheads ? g->heads[s] : 0; e; e = g->extras[e - 1].next) {
+    drop(g, g->extras[e - 1].to, obj);
+    g->len--;
+  }
+  if (s < g->nheads)
+    g->heads[s] = 0;
+}
+
+/* pnid_graph_degree(): the number of connections of obj */
+size_t
+pnid_graph_degree(const PnidGraph *g, PnidObjHandle obj)
+{
+  uint32_t i, s = PNID_OBJ_HANDLE_SLOT(obj), e;
+  size_t n = 0;
+
+  for (i = s < g->nrows ? g->rows[s] : 0; s < g->nrows && i < g->rows[s + 1]; i++)
+    n += g->adj[i] != PNID_OBJ_HANDLE_NONE;
+  for (e = s < g->nheads ? g->heads[s] : 0; e; e = g->extras[e - 1].next)
+    n++;
+
+  return n;
+}
+
+/* pnid_graph_len(): the number of connections in g */
+size_t
+pnid_graph_len(const PnidGraph *g)
+{
+  return g->len;
+}
+
+/*********************
+ * Tracing
+*******************/
+
+/* pnid_graph_trace(): visit start and every object connected to it,
+   breadth or depth first, calling func with each once. Objects for
+   which func returns zero are visited but not passed through. Returns
+   the number of objects visited, or -ENOMEM. */
+int
+pnid_graph_trace(PnidGraph *g, PnidObjHandle start, enum pnid_graph_order order,
+		 PnidGraphFunc func, void *data)
+{
+  struct visit *todo, *tmp, v;
+  size_t head = 0, len = 0, cap = 64;
+  uint32_t i, s, e;
+  PnidObjHandle to;
+  int n = 0, res = 0;
+
+  if (++g->trace == 0) {	/* wrapped, forget every mark */
+    memset(g->marks, 0, g->nmarks * sizeof *g->marks);
+    g->trace = 1;
+  }
+  if (!(todo = malloc(cap * sizeof *todo)))
+    return -ENOMEM;
+  todo[len++] = (struct visit){ start, 0 };
+
+  while (head < len) {
+    v = order == PNID_GRAPH_DEPTH_FIRST ? todo[--len] : todo[head++];
+    s = PNID_OBJ_HANDLE_SLOT(v.obj);
+    if (s >= g->nmarks && grow(&g->marks, &g->nmarks, s + 1) < 0) {
+      res = -ENOMEM;
+      break;
+    }
+    if (g->marks[s] == g->trace)
+      continue;
+    g->marks[s] = g->trace;
+    n++;
+    if (!func(v.obj, v.depth, data))
+      continue;
+
+    /* queue the unmarked neighbours, rows then extras */
+    i = s < g->nrows ? g->rows[s] : 0;
+    e = s < g->nheads ? g->heads[s] : 0;
+    for (;;) {
+      if (s < g->nrows && i < g->rows[s + 1])
+	to = g->adj[i++];
+      else if (e)
+	to = g->extras[e - 1].to, e = g->extras[e - 1].next;
+      else
+	break;
+      if (to == PNID_OBJ_HANDLE_NONE
+	  || (PNID_OBJ_HANDLE_SLOT(to) < g->nmarks
+	      && g->marks[PNID_OBJ_HANDLE_SLOT(to)] == g->trace))
+	continue;
+      if (len == cap) {
+	if (!(tmp = realloc(todo, cap * 2 * sizeof *todo))) {
+	  res = -ENOMEM;
+	  goto out;
+	}
+	todo = tmp;
+	cap *= 2;
+      }
+      todo[len++] = (struct visit){ to, v.depth + 1 };
+    }
+  }
+
+ out:
+  free(todo);
+  return res < 0 ? res : n;
+}
+
+/*********************
+ * Utilities
+*******************/
+
+/* link_extra(): add to as an extra neighbour of from. Returns -ENOMEM
+   or 0. */
+static int
+link_extra(PnidGraph *g, PnidObjHandle from, PnidObjHandle to)
+{
+  struct extra *extras;
+  uint32_t s = PNID_OBJ_HANDLE_SLOT(from), cap;
+  int res;
+
+  if (s >= g->nheads && (res = grow(&g->heads, &g->nheads, s + 1)) < 0)
+    return res;
+  if (g->nextras == g->capextras) {
+    cap = g->capextras ? g->capextras * 2 : 64;
+    if (!(extras = realloc(g->extras, cap * sizeof *extras)))
+      return -ENOMEM;
+    g->extras = extras;
+    g->capextras = cap;
+  }
+  g->extras[g->nextras] = (struct extra){ to, g->heads[s] };
+  g->heads[s] = ++g->nextras;
+
+  return 0;
+}
+
+/* drop(): remove to from the neighbours of from. Returns non-zero
+   if it was found. An unlinked extra is left unused until the rows
+   are next rebuilt. */
+static int
+drop(PnidGraph *g, PnidObjHandle from, PnidObjHandle to)
+{
+  uint32_t i, s = PNID_OBJ_HANDLE_SLOT(from), *e;
+
+  for (i = s < g->nrows ? g->rows[s] : 0; s < g->nrows && i < g->rows[s + 1]; i++)
+    if (g->adj[i] == to) {
+      g->adj[i] = PNID_OBJ_HANDLE_NONE;
+      g->nblank++;
+      return 1;
+    }
+  for (e = s < g->nheads ? &g->heads[s] : NULL; e && *e; e = &g->extras[*e - 1].next)
+    if (g->extras[*e - 1].to == to) {
+      *e = g->extras[*e - 1].next;
+      return 1;
+    }
+
+  return 0;
+}
+
+/* connected(): non-zero if a and b are connected */
+static int
+connected(const PnidGraph *g, PnidObjHandle a, PnidObjHandle b)
+{
+  uint32_t i, s = PNID_OBJ_HANDLE_SLOT(a), e;
+
+  for (i = s < g->nrows ? g->rows[s] : 0; s < g->nrows && i < g->rows[s + 1]; i++)
+    if (g->adj[i] == b)
+      return 1;
+  for (e = s < g->nheads ? g->heads[s] : 0; e; e = g->extras[e - 1].next)
+    if (g->extras[e - 1].to == b)
+      return 1;
+
+  return 0;
+}
+
+/* rebuild(): fold the deltas into new rows. Returns -ENOMEM, leaving
+   the deltas in place, or 0. */
+static int
+rebuild(PnidGraph *g)
+{
+  uint32_t *rows, n = g->nrows > g->nheads ? g->nrows : g->nheads, s, i, j, e;
+  PnidObjHandle *adj;
+
+  if (!(rows = calloc(n + 1, sizeof *rows))
+      || !(adj = malloc((g->len ? g->len * 2 : 1) * sizeof *adj))) {
+    free(rows);
+    return -ENOMEM;
+  }
+
+  for (s = j = 0; s < n; s++) {
+    rows[s] = j;
+    for (i = s < g->nrows ? g->rows[s] : 0; s < g->nrows && i < g->rows[s + 1]; i++)
+      if (g->adj[i] != PNID_OBJ_HANDLE_NONE)
+	adj[j++] = g->adj[i];
+    for (e = s < g->nheads ? g->heads[s] : 0; e; e = g->extras[e - 1].next)
+      adj[j++] = g->extras[e - 1].to;
+  }
+  rows[n] = j;
+
+  free(g->rows);
+  free(g->adj);
+  g->rows = rows;
+  g->nrows = n;
+  g->adj = adj;
+  g->nblank = 0;
+  g->nextras = 0;
+  memset(g->heads, 0, g->nheads * sizeof *g->heads);
+
+  return 0;
+}
+
+/* grow(): grow the zeroed array a of n to at least min, doubling.
+   Returns -ENOMEM or 0. */
+static int
+grow(uint32_t **a, uint32_t *n, size_t min)
+{
+  uint32_t *new;
+  size_t len = *n ? *n : 64;
+
+  while (len < min)
+    len *= 2;
+  if (!(new = realloc(*a, len * sizeof *new)))
+    return -ENOMEM;
+  memset(new + *n, 0, (len - *n) * sizeof *new);
+  *a = new;
+  *n = len;
+
+  return 0;
+}
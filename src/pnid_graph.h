@@ -0,0 +1,44 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_graph.h - connectivity of pnid drawing objects */
+
+#ifndef __PNID_GRAPH_H
+#define __PNID_GRAPH_H
+
+#include <stddef.h>
+
+#include "pnid_objstore.h"
+
+/* pnid_graph_order: the order in which a trace visits objects */
+enum pnid_graph_order {
+  PNID_GRAPH_BREADTH_FIRST = 0,
+  PNID_GRAPH_DEPTH_FIRST
+};
+
+/* #PnidGraph: undirected connections between the objects of a
+   #PnidObjStore, by handle */
+typedef struct pnid_graph PnidGraph;
+
+/* pnid_graph_func(): called with each object reached by a trace and
+   the number of connections from the start. Returning zero stops the
+   trace passing through obj, so that it bounds the trace. */
+typedef int (*PnidGraphFunc) (PnidObjHandle obj, unsigned depth, void *data);
+
+/* Create and destroy a graph */
+PnidGraph *pnid_graph_new(void);
+void       pnid_graph_destroy(PnidGraph *g);
+
+/* Make and break connections */
+int        pnid_graph_connect(PnidGraph *g, PnidObjHandle a, PnidObjHandle b);
+int        pnid_graph_disconnect(PnidGraph *g, PnidObjHandle a, PnidObjHandle b);
+void       pnid_graph_isolate(PnidGraph *g, PnidObjHandle obj);
+size_t     pnid_graph_degree(const PnidGraph *g, PnidObjHandle obj);
+size_t     pnid_graph_len(const PnidGraph *g);
+
+/* Visit the objects connected to start, start included */
+int        pnid_graph_trace(PnidGraph *g, PnidObjHandle start, enum pnid_graph_order order,
+			    PnidGraphFunc func, void *data);
+
+#endif /* __PNID_GRAPH_H */
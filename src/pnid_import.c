@@ -0,0 +1,1117 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_import.c - streaming import of drawings in other formats
+
+   Files are read front to back and each entity is turned into a
+   #PnidObj as soon as it is complete, so memory use is bounded by
+   the batch size and a table of block extents rather than the size
+   of the file. Objects are handed to the caller in batches of
+   PNID_IMPORT_BATCH, to be bulk loaded into an index or written out.
+
+   DXF group code pairs are read a line at a time. Block definitions
+   are reduced to their extents, so that block references become
+   symbols with a bounding box, named after the block. The drawing's
+   extents are taken from its header, or from a first pass over the
+   file if the header has none, so that the y axis can be flipped.
+
+   SVG is read in chunks with a #GMarkupParseContext, which keeps only
+   the stack of open elements. Lines, polylines, polygons, rectangles
+   and straight path segments become lines and <use> references
+   become symbols, each under the transforms of its ancestors.
+
+   Anything else is counted as skipped. */
+
+#include <ctype.h>
+#include <errno.h>
+#include <glib.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_import.h"
+
+#define DXF_LINE        4096	/* longest dxf line read */
+#define DXF_MM          (72.0 / 25.4) /* points per millimetre */
+#define DXF_INSERT_SIZE 5.0	/* size of a reference to an unknown block */
+#define SVG_PX          0.75	/* points per css pixel */
+#define SVG_CHUNK       65536	/* bytes parsed at once */
+#define SVG_USE_SIZE    20.0	/* size of a <use> without width or height */
+
+typedef struct import Import;
+
+/* import: state shared by every format, mapping drawing units to
+   points on the page and collecting objects into batches */
+struct import {
+  PnidImportFunc  func;
+  void           *data;
+  FILE           *fp;
+  long            size;		/* of file, for progress */
+  PnidObj       **objs;		/* batch being filled */
+  size_t          n;
+  GStringChunk   *strings;	/* attribute strings of batch */
+  unsigned        id;		/* next object id */
+  double          scale;	/* points per drawing unit */
+  double          ox, oy;	/* drawing origin */
+  int             flip;		/* y axis points up */
+  int             measure;	/* find extents, emit nothing */
+  double          ext[4];	/* extents found, left top right bottom */
+  int             have_ext;
+  int             skipped;	/* unsupported entities */
+  int             res;		/* first error */
+};
+
+/* affine: a transformation, x' = xx * x + xy * y + x0 */
+struct affine {
+  double xx, yx, xy, yy, x0, y0;
+};
+
+/* extent: bounds of a dxf block about its base point */
+struct extent {
+  double x1, y1, x2, y2;
+  double bx, by;
+  int    empty;
+};
+
+/* dxf_section: part of a dxf file being read */
+enum dxf_section {
+  DXF_NONE = 0,
+  DXF_HEADER,
+  DXF_BLOCKS,
+  DXF_ENTITIES,
+  DXF_OTHER
+};
+
+/* dxf: state of a dxf file being read */
+struct dxf {
+  Import           *im;
+  int               code;
+  char              value[DXF_LINE];
+  enum dxf_section  section;
+  char              var[64];	/* header variable */
+  int               units;	/* $INSUNITS */
+  int               header_ext;	/* both extents in header */
+  int               ext_seen;	/* header extents read, bit per value */
+  GHashTable       *blocks;	/* name -> struct extent */
+  struct extent    *block;	/* block being defined */
+  struct {			/* entity being read */
+    char    type[32];
+    double  x[2], y[2];
+    double  r, sx, sy, rot;
+    char    name[256];
+    char    tag[64];
+    char   *text;
+    int     flags;
+    int     follows;		/* attributes follow an insert */
+    double  vx;			/* lwpolyline vertex x */
+  } e;
+  struct {			/* insert awaiting its attributes */
+    int      active;
+    unsigned symbol;
+    double   box[4];
+    char    *attr[PNID_N_ATTRS];
+  } insert;
+  struct {			/* polyline being read */
+    int    active;
+    int    closed;
+    int    n;
+    double fx, fy, px, py;
+  } poly;
+};
+
+/* svg: state of an svg file being read */
+struct svg {
+  Import *im;
+  GArray *stack;		/* struct affine of each open element */
+  int     defs;			/* depth within undrawn definitions */
+};
+
+static PnidObj *emit(Import *im, double x1, double y1, double x2, double y2);
+static void     emit_line(Import *im, double x1, double y1, double x2, double y2);
+static void     emit_symbol(Import *im, unsigned symbol, const double box[4],
+			    char *const attr[PNID_N_ATTRS]);
+static void     flush(Import *im);
+static void     extend(double ext[4], int *have, double x, double y);
+static unsigned coord(double v);
+static unsigned symbol_name(const char *name);
+static int      attr_name(const char *name);
+
+static int      dxf_import(Import *im);
+static int      dxf_parse(struct dxf *d);
+static int      dxf_next(struct dxf *d);
+static void     dxf_field(struct dxf *d);
+static void     dxf_header(struct dxf *d);
+static void     dxf_start(struct dxf *d);
+static void     dxf_finish(struct dxf *d);
+static void     dxf_vertex(struct dxf *d, double x, double y);
+static void     dxf_segment(struct dxf *d, double x1, double y1, double x2, double y2);
+static void     dxf_insert_box(struct dxf *d, double box[4]);
+static void     dxf_insert_emit(struct dxf *d);
+
+static int      svg_import(Import *im);
+static void     svg_start(GMarkupParseContext *ctx, const char *name, const char **names,
+			  const char **values, gpointer data, GError **error);
+static void     svg_end(GMarkupParseContext *ctx, const char *name, gpointer data,
+			GError **error);
+static void     svg_line(struct svg *svg, const struct affine *m,
+			 double x1, double y1, double x2, double y2);
+static void     svg_points(struct svg *svg, const struct affine *m, const char *s, int close);
+static void     svg_path(struct svg *svg, const struct affine *m, const char *d);
+static void     svg_use(struct svg *svg, const struct affine *m, const char **names,
+			const char **values);
+static const char *svg_attr(const char **names, const char **values, const char *name);
+static double   svg_length(const char **names, const char **values, const char *name,
+			   double def);
+static int      numbers(const char **s, double *v, int max);
+static void     transform(struct affine *m, const char *s);
+static void     multiply(struct affine *r, const struct affine *a, const struct affine *b);
+static void     apply(const struct affine *m, double *x, double *y);
+
+/*********************
+ * Interface
+*******************/
+
+/* pnid_import_format(): the format of the file at path, by its
+   extension */
+enum pnid_import_format
+pnid_import_format(const char *path)
+{
+  const char *ext;
+
+  if (!(ext = strrchr(path, '.')))
+    return PNID_IMPORT_NONE;
+  if (!g_ascii_strcasecmp(ext, ".dxf"))
+    return PNID_IMPORT_DXF;
+  if (!g_ascii_strcasecmp(ext, ".svg"))
+    return PNID_IMPORT_SVG;
+  return PNID_IMPORT_NONE;
+}
+
+/* pnid_import(): import the file at path, handing objects to func in
+   batches. Returns the number of entities skipped as unsupported, or
+   -errno on error, -ENOTSUP if the format is not known and -EPROTO if
+   the file is malformed. */
+int
+pnid_import(const char *path, double scale, PnidImportFunc func, void *data)
+{
+  Import im = { 0 };
+  enum pnid_import_format format;
+  struct stat st;
+  size_t i;
+  int res;
+
+  if (!(format = pnid_import_format(path)))
+    return -ENOTSUP;
+  if (!(im.fp = fopen(path, "rbe")))
+    return -errno;
+  if (fstat(fileno(im.fp), &st) < 0) {
+    res = -errno;
+    fclose(im.fp);
+    return res;
+  }
+
+  im.func = func;
+  im.data = data;
+  im.size = st.st_size;
+  im.scale = scale;
+  im.objs = g_new(PnidObj *, PNID_IMPORT_BATCH);
+  im.strings = g_string_chunk_new(1024);
+
+  res = format == PNID_IMPORT_DXF ? dxf_import(&im) : svg_import(&im);
+  if (!res)
+    flush(&im);
+  if (!res)
+    res = im.res;
+
+  for (i = 0; i < im.n; i++)	/* left by an error */
+    pnid_obj_delete(im.objs[i]);
+  g_free(im.objs);
+  g_string_chunk_free(im.strings);
+  fclose(im.fp);
+
+  return res < 0 ? res : im.skipped;
+}
+
+/*********************
+ * Objects
+*******************/
+
+/* emit(): a new object covering x1, y1 to x2, y2 in drawing units, or
+   NULL when measuring or on error. The batch is handed over first if
+   it is full, so the object can be completed by the caller. */
+static PnidObj *
+emit(Import *im, double x1, double y1, double x2, double y2)
+{
+  PnidObj *obj;
+
+  if (im->res < 0)
+    return NULL;
+  if (im->measure) {
+    extend(im->ext, &im->have_ext, x1, y1);
+    extend(im->ext, &im->have_ext, x2, y2);
+    return NULL;
+  }
+  if (im->n == PNID_IMPORT_BATCH && (flush(im), im->res < 0))
+    return NULL;
+  if (!(obj = pnid_obj_new())) {
+    im->res = -ENOMEM;
+    return NULL;
+  }
+
+  x1 = (x1 - im->ox) * im->scale;
+  x2 = (x2 - im->ox) * im->scale;
+  y1 = (im->flip ? im->oy - y1 : y1 - im->oy) * im->scale;
+  y2 = (im->flip ? im->oy - y2 : y2 - im->oy) * im->scale;
+  pnid_box_set_left(&obj->bbox, coord(MIN(x1, x2)));
+  pnid_box_set_top(&obj->bbox, coord(MIN(y1, y2)));
+  pnid_box_set_right(&obj->bbox, coord(MAX(x1, x2)));
+  pnid_box_set_bottom(&obj->bbox, coord(MAX(y1, y2)));
+  obj->id = im->id++;
+  im->objs[im->n++] = obj;
+
+  return obj;
+}
+
+/* emit_line(): a line from x1, y1 to x2, y2 in drawing units */
+static void
+emit_line(Import *im, double x1, double y1, double x2, double y2)
+{
+  PnidObj *obj;
+  double slope;
+
+  if (!(obj = emit(im, x1, y1, x2, y2)))
+    return;
+  slope = (x2 - x1) * (y2 - y1);
+  obj->type = (im->flip ? -slope : slope) < 0 ? PNID_OBJ_LINE_RISE : PNID_OBJ_LINE;
+}
+
+/* emit_symbol(): a symbol filling box, in drawing units, with
+   attributes attr where not NULL */
+static void
+emit_symbol(Import *im, unsigned symbol, const double box[4],
+	    char *const attr[PNID_N_ATTRS])
+{
+  PnidObj *obj;
+  int k;
+
+  if (!(obj = emit(im, box[0], box[1], box[2], box[3])))
+    return;
+  obj->type = PNID_OBJ_SYMBOL;
+  obj->symbol = symbol;
+  for (k = 0; attr && k < PNID_N_ATTRS; k++)
+    if (attr[k])
+      obj->attr[k] = g_string_chunk_insert_const(im->strings, attr[k]);
+}
+
+/* flush(): hand the batch to the caller and start another */
+static void
+flush(Import *im)
+{
+  double progress;
+  int res;
+
+  if (!im->n || im->res < 0)
+    return;
+
+  progress = im->size ? (double)ftell(im->fp) / im->size : 1.0;
+  res = im->func(im->objs, im->n, im->strings, CLAMP(progress, 0.0, 1.0), im->data);
+  im->objs = g_new(PnidObj *, PNID_IMPORT_BATCH);
+  im->strings = g_string_chunk_new(1024);
+  im->n = 0;
+  if (res < 0)
+    im->res = res;
+}
+
+/* extend(): grow extents ext to include x, y */
+static void
+extend(double ext[4], int *have, double x, double y)
+{
+  if (!*have) {
+    ext[0] = ext[2] = x;
+    ext[1] = ext[3] = y;
+    *have = 1;
+    return;
+  }
+  ext[0] = MIN(ext[0], x);
+  ext[1] = MIN(ext[1], y);
+  ext[2] = MAX(ext[2], x);
+  ext[3] = MAX(ext[3], y);
+}
+
+/* coord(): a page coordinate in points, clamped to the page */
+static unsigned
+coord(double v)
+{
+  if (!(v > 0))
+    return 0;
+  if (v >= UINT_MAX)
+    return UINT_MAX;
+  return lround(v);
+}
+
+/* symbol_name(): the symbol a block or svg symbol named name is
+   taken to be, PNID_SYMBOL_NONE if unrecognised */
+static unsigned
+symbol_name(const char *name)
+{
+  char *s;
+  unsigned symbol;
+
+  s = g_ascii_strdown(name, -1);
+  if (strstr(s, "valve") || strstr(s, "vlv"))
+    symbol = PNID_SYMBOL_VALVE;
+  else if (strstr(s, "pump"))
+    symbol = PNID_SYMBOL_PUMP;
+  else if (strstr(s, "inst") || strstr(s, "bubble"))
+    symbol = PNID_SYMBOL_INSTRUMENT;
+  else
+    symbol = PNID_SYMBOL_NONE;
+  g_free(s);
+
+  return symbol;
+}
+
+/* attr_name(): the attribute a dxf attribute tag or svg data
+   attribute named name holds, less than zero if none */
+static int
+attr_name(const char *name)
+{
+  static const char *const prefix[PNID_N_ATTRS] = {
+    [PNID_ATTR_TAG]     = "tag",
+    [PNID_ATTR_LINE]    = "line",
+    [PNID_ATTR_SERVICE] = "service",
+    [PNID_ATTR_SIZE]    = "size",
+    [PNID_ATTR_SPEC]    = "spec",
+  };
+  int k;
+
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (!g_ascii_strncasecmp(name, prefix[k], strlen(prefix[k])))
+      return k;
+  return -1;
+}
+
+/*********************
+ * DXF
+*******************/
+
+/* dxf_import(): read a dxf file, twice if its header has no
+   extents */
+static int
+dxf_import(Import *im)
+{
+  struct dxf d = { 0 };
+  int k, res;
+
+  d.im = im;
+  d.blocks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+  im->measure = 1;
+  if ((res = dxf_parse(&d)) < 0)
+    goto out;
+  if (!im->have_ext)		/* empty drawing */
+    goto out;
+
+  if (!im->scale) {
+    switch (d.units) {
+    case 1:  im->scale = 72.0;          break; /* inches */
+    case 2:  im->scale = 72.0 * 12;     break; /* feet */
+    case 5:  im->scale = DXF_MM * 10;   break; /* centimetres */
+    case 6:  im->scale = DXF_MM * 1000; break; /* metres */
+    default: im->scale = DXF_MM;        break; /* millimetres */
+    }
+  }
+  im->ox = im->ext[0];
+  im->oy = im->ext[3];
+  im->flip = 1;
+  im->measure = 0;
+  im->skipped = 0;
+
+  rewind(im->fp);
+  g_hash_table_remove_all(d.blocks);
+  memset(&d.e, 0, sizeof d.e);
+  d.section = DXF_NONE;
+  d.block = NULL;
+  d.poly.active = 0;
+  res = dxf_parse(&d);
+
+ out:
+  g_free(d.e.text);
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    g_free(d.insert.attr[k]);
+  g_hash_table_destroy(d.blocks);
+  return res;
+}
+
+/* dxf_parse(): read group code pairs to the end of the file. When
+   measuring, stops after the header if it gave the extents. */
+static int
+dxf_parse(struct dxf *d)
+{
+  int res;
+
+  while ((res = dxf_next(d)) > 0 && d->im->res >= 0) {
+    if (d->code == 0) {
+      dxf_finish(d);
+      if (!strcmp(d->value, "EOF"))
+	break;
+      if (!strcmp(d->value, "ENDSEC")) {
+	if (d->section == DXF_HEADER && d->im->measure && d->header_ext)
+	  return 0;
+	d->section = DXF_NONE;
+      }
+      g_strlcpy(d->e.type, d->value, sizeof d->e.type);
+      dxf_start(d);
+    } else if (d->section == DXF_HEADER) {
+      dxf_header(d);
+    } else {
+      dxf_field(d);
+    }
+  }
+  if (res < 0)
+    return res;
+  dxf_finish(d);
+  if (d->insert.active)
+    dxf_insert_emit(d);
+
+  return 0;
+}
+
+/* dxf_next(): read the next group code and value, returns 1, 0 at the
+   end of the file or -EPROTO */
+static int
+dxf_next(struct dxf *d)
+{
+  char line[DXF_LINE], *end;
+  long code;
+
+  if (!fgets(line, sizeof line, d->im->fp))
+    return 0;
+  if (g_str_has_prefix(line, "AutoCAD Binary DXF"))
+    return -ENOTSUP;
+  code = strtol(line, &end, 10);
+  if (end == line || *g_strchug(end))
+    return -EPROTO;
+  if (!fgets(d->value, sizeof d->value, d->im->fp))
+    return -EPROTO;
+  g_strstrip(d->value);
+  d->code = code;
+
+  return 1;
+}
+
+/* dxf_header(): a header variable and its values, read only when
+   measuring */
+static void
+dxf_header(struct dxf *d)
+{
+  double v = g_ascii_strtod(d->value, NULL);
+
+  if (!d->im->measure)
+    return;
+  if (d->code == 9) {
+    g_strlcpy(d->var, d->value, sizeof d->var);
+    return;
+  }
+  if (!strcmp(d->var, "$INSUNITS") && d->code == 70) {
+    d->units = atoi(d->value);
+  } else if (!strcmp(d->var, "$EXTMIN") && (d->code == 10 || d->code == 20)) {
+    d->im->ext[d->code == 10 ? 0 : 1] = v;
+    d->ext_seen |= d->code == 10 ? 1 : 2;
+  } else if (!strcmp(d->var, "$EXTMAX") && (d->code == 10 || d->code == 20)) {
+    d->im->ext[d->code == 10 ? 2 : 3] = v;
+    d->ext_seen |= d->code == 10 ? 4 : 8;
+  }
+
+  /* an empty drawing has inverted extents */
+  if (d->ext_seen == 15 && d->im->ext[0] <= d->im->ext[2] && d->im->ext[1] <= d->im->ext[3])
+    d->im->have_ext = d->header_ext = 1;
+}
+
+/* dxf_start(): a new entity has begun */
+static void
+dxf_start(struct dxf *d)
+{
+  /* an insert's attributes end at the first other entity */
+  if (d->insert.active && strcmp(d->e.type, "ATTRIB") && strcmp(d->e.type, "SEQEND"))
+    dxf_insert_emit(d);
+
+  d->e.x[0] = d->e.x[1] = d->e.y[0] = d->e.y[1] = 0;
+  d->e.r = d->e.rot = 0;
+  d->e.sx = d->e.sy = 1;
+  d->e.name[0] = d->e.tag[0] = '\0';
+  g_clear_pointer(&d->e.text, g_free);
+  d->e.flags = d->e.follows = 0;
+
+  if (!strcmp(d->e.type, "LWPOLYLINE")) {
+    d->poly.n = 0;
+    d->poly.active = 0;
+  }
+}
+
+/* dxf_field(): a group code and value of the current entity */
+static void
+dxf_field(struct dxf *d)
+{
+  double v = g_ascii_strtod(d->value, NULL);
+  int lw = !strcmp(d->e.type, "LWPOLYLINE");
+
+  switch (d->code) {
+  case 1:
+    g_free(d->e.text);
+    d->e.text = g_strdup(d->value);
+    break;
+  case 2:
+    if (!strcmp(d->e.type, "SECTION")) {
+      d->section = !strcmp(d->value, "HEADER") ? DXF_HEADER
+	: !strcmp(d->value, "BLOCKS") ? DXF_BLOCKS
+	: !strcmp(d->value, "ENTITIES") ? DXF_ENTITIES
+	: DXF_OTHER;
+      if (d->section == DXF_HEADER)
+	d->var[0] = '\0';
+    }
+    if (!strcmp(d->e.type, "ATTRIB"))
+      g_strlcpy(d->e.tag, d->value, sizeof d->e.tag);
+    else
+      g_strlcpy(d->e.name, d->value, sizeof d->e.name);
+    break;
+  case 10:
+    if (lw)
+      d->e.vx = v;
+    else
+      d->e.x[0] = v;
+    break;
+  case 20:
+    if (lw)
+      dxf_vertex(d, d->e.vx, v);
+    else
+      d->e.y[0] = v;
+    break;
+  case 11: d->e.x[1] = v; break;
+  case 21: d->e.y[1] = v; break;
+  case 40: d->e.r = v; break;
+  case 41: d->e.sx = v; break;
+  case 42: d->e.sy = v; break;
+  case 50: d->e.rot = v; break;
+  case 66: d->e.follows = atoi(d->value); break;
+  case 70: d->e.flags = atoi(d->value); break;
+  }
+}
+
+/* dxf_finish(): the current entity is complete */
+static void
+dxf_finish(struct dxf *d)
+{
+  const char *t = d->e.type;
+  struct extent *b;
+  double box[4];
+  int k;
+
+  if (!t[0] || !strcmp(t, "SECTION")
+      || (d->section != DXF_BLOCKS && d->section != DXF_ENTITIES))
+    return;
+
+  if (!strcmp(t, "BLOCK")) {
+    b = g_new(struct extent, 1);
+    b->bx = d->e.x[0];
+    b->by = d->e.y[0];
+    b->empty = 1;
+    g_hash_table_replace(d->blocks, g_strdup(d->e.name), b);
+    d->block = b;
+  } else if (!strcmp(t, "ENDBLK")) {
+    d->block = NULL;
+  } else if (!strcmp(t, "LINE")) {
+    dxf_segment(d, d->e.x[0], d->e.y[0], d->e.x[1], d->e.y[1]);
+  } else if (!strcmp(t, "LWPOLYLINE")) {
+    if (d->e.flags & 1 && d->poly.n > 2)
+      dxf_segment(d, d->poly.px, d->poly.py, d->poly.fx, d->poly.fy);
+  } else if (!strcmp(t, "POLYLINE")) {
+    d->poly.active = 1;
+    d->poly.closed = d->e.flags & 1;
+    d->poly.n = 0;
+  } else if (!strcmp(t, "VERTEX")) {
+    if (d->poly.active)
+      dxf_vertex(d, d->e.x[0], d->e.y[0]);
+  } else if (!strcmp(t, "SEQEND")) {
+    if (d->poly.active && d->poly.closed && d->poly.n > 2)
+      dxf_segment(d, d->poly.px, d->poly.py, d->poly.fx, d->poly.fy);
+    d->poly.active = 0;
+    if (d->insert.active)
+      dxf_insert_emit(d);
+  } else if (!strcmp(t, "INSERT")) {
+    dxf_insert_box(d, box);
+    if (d->block) {
+      for (k = 0; k < 4; k += 2)
+	dxf_segment(d, box[k], box[k + 1], box[k], box[k + 1]);
+    } else {
+      d->insert.active = 1;
+      d->insert.symbol = symbol_name(d->e.name);
+      memcpy(d->insert.box, box, sizeof box);
+      if (!d->e.follows)
+	dxf_insert_emit(d);
+    }
+  } else if (!strcmp(t, "ATTRIB")) {
+    if (d->insert.active && d->e.text && (k = attr_name(d->e.tag)) >= 0) {
+      g_free(d->insert.attr[k]);
+      d->insert.attr[k] = g_strdup(d->e.text);
+    }
+  } else if (d->block && (!strcmp(t, "CIRCLE") || !strcmp(t, "ARC"))) {
+    dxf_segment(d, d->e.x[0] - d->e.r, d->e.y[0] - d->e.r,
+		d->e.x[0] + d->e.r, d->e.y[0] + d->e.r);
+  } else if (!d->block && d->section == DXF_ENTITIES) {
+    d->im->skipped++;
+  }
+  d->e.type[0] = '\0';
+}
+
+/* dxf_vertex(): the next vertex of a polyline */
+static void
+dxf_vertex(struct dxf *d, double x, double y)
+{
+  if (d->poly.n++) {
+    dxf_segment(d, d->poly.px, d->poly.py, x, y);
+  } else {
+    d->poly.fx = x;
+    d->poly.fy = y;
+  }
+  d->poly.px = x;
+  d->poly.py = y;
+}
+
+/* dxf_segment(): a line, in a block definition it grows the block's
+   extent instead */
+static void
+dxf_segment(struct dxf *d, double x1, double y1, double x2, double y2)
+{
+  struct extent *b = d->block;
+  double ext[4];
+  int have;
+
+  if (!b) {
+    if (d->section == DXF_ENTITIES)
+      emit_line(d->im, x1, y1, x2, y2);
+    return;
+  }
+
+  have = !b->empty;
+  ext[0] = b->x1, ext[1] = b->y1, ext[2] = b->x2, ext[3] = b->y2;
+  extend(ext, &have, x1, y1);
+  extend(ext, &have, x2, y2);
+  b->x1 = ext[0], b->y1 = ext[1], b->x2 = ext[2], b->y2 = ext[3];
+  b->empty = 0;
+}
+
+/* dxf_insert_box(): the extent of the current insert entity, its
+   block's extent scaled, rotated and moved to its insertion point */
+static void
+dxf_insert_box(struct dxf *d, double box[4])
+{
+  struct extent *b;
+  double c, s, x, y, cx[4], cy[4];
+  int i, have = 0;
+
+  b = g_hash_table_lookup(d->blocks, d->e.name);
+  if (!b || b->empty) {
+    box[0] = d->e.x[0] - DXF_INSERT_SIZE / 2;
+    box[1] = d->e.y[0] - DXF_INSERT_SIZE / 2;
+    box[2] = d->e.x[0] + DXF_INSERT_SIZE / 2;
+    box[3] = d->e.y[0] + DXF_INSERT_SIZE / 2;
+    return;
+  }
+
+  c = cos(d->e.rot * G_PI / 180);
+  s = sin(d->e.rot * G_PI / 180);
+  cx[0] = cx[3] = b->x1 - b->bx;
+  cx[1] = cx[2] = b->x2 - b->bx;
+  cy[0] = cy[1] = b->y1 - b->by;
+  cy[2] = cy[3] = b->y2 - b->by;
+  for (i = 0; i < 4; i++) {
+    x = cx[i] * d->e.sx;
+    y = cy[i] * d->e.sy;
+    extend(box, &have, d->e.x[0] + c * x - s * y, d->e.y[0] + s * x + c * y);
+  }
+}
+
+/* dxf_insert_emit(): the pending insert and its attributes are
+   complete */
+static void
+dxf_insert_emit(struct dxf *d)
+{
+  int k;
+
+  emit_symbol(d->im, d->insert.symbol, d->insert.box, d->insert.attr);
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    g_clear_pointer(&d->insert.attr[k], g_free);
+  d->insert.active = 0;
+}
+
+/*********************
+ * SVG
+*******************/
+
+/* svg_import(): read an svg file a chunk at a time */
+static int
+svg_import(Import *im)
+{
+  static const GMarkupParser parser = { svg_start, svg_end, NULL, NULL, NULL };
+  const struct affine identity = { 1, 0, 0, 1, 0, 0 };
+  GMarkupParseContext *ctx;
+  struct svg svg = { 0 };
+  GError *error = NULL;
+  char *buf;
+  size_t n;
+  int res = 0;
+
+  if (!im->scale)
+    im->scale = SVG_PX;
+  svg.im = im;
+  svg.stack = g_array_new(FALSE, FALSE, sizeof(struct affine));
+  g_array_append_val(svg.stack, identity);
+
+  buf = g_malloc(SVG_CHUNK);
+  ctx = g_markup_parse_context_new(&parser, 0, &svg, NULL);
+  while (im->res >= 0 && (n = fread(buf, 1, SVG_CHUNK, im->fp)) > 0)
+    if (!g_markup_parse_context_parse(ctx, buf, n, &error))
+      break;
+  if (!error && ferror(im->fp))
+    res = -EIO;
+  else if (!error && im->res >= 0)
+    g_markup_parse_context_end_parse(ctx, &error);
+  if (error) {
+    res = -EPROTO;
+    g_error_free(error);
+  }
+
+  g_markup_parse_context_free(ctx);
+  g_array_unref(svg.stack);
+  g_free(buf);
+
+  return res;
+}
+
+/* svg_start(): #GMarkupParser start_element */
+static void
+svg_start(GMarkupParseContext *ctx, const char *name, const char **names,
+	  const char **values, gpointer data, GError **error)
+{
+  struct svg *svg = data;
+  struct affine m;
+  const char *s;
+  double x, y, w, h, v[4];
+
+  m = g_array_index(svg->stack, struct affine, svg->stack->len - 1);
+  if ((s = svg_attr(names, values, "transform")))
+    transform(&m, s);
+  g_array_append_val(svg->stack, m);
+
+  if (svg->defs || !strcmp(name, "defs") || !strcmp(name, "symbol")
+      || !strcmp(name, "clipPath") || !strcmp(name, "mask")
+      || !strcmp(name, "marker") || !strcmp(name, "pattern")) {
+    svg->defs++;
+    return;
+  }
+
+  if (!strcmp(name, "svg")) {
+    if (svg->stack->len == 2 && (s = svg_attr(names, values, "viewBox"))
+	&& numbers(&s, v, 4) == 4) {
+      svg->im->ox = v[0];
+      svg->im->oy = v[1];
+    }
+  } else if (!strcmp(name, "line")) {
+    svg_line(svg, &m,
+	     svg_length(names, values, "x1", 0), svg_length(names, values, "y1", 0),
+	     svg_length(names, values, "x2", 0), svg_length(names, values, "y2", 0));
+  } else if (!strcmp(name, "polyline") || !strcmp(name, "polygon")) {
+    if ((s = svg_attr(names, values, "points")))
+      svg_points(svg, &m, s, !strcmp(name, "polygon"));
+  } else if (!strcmp(name, "rect")) {
+    x = svg_length(names, values, "x", 0);
+    y = svg_length(names, values, "y", 0);
+    w = svg_length(names, values, "width", 0);
+    h = svg_length(names, values, "height", 0);
+    svg_line(svg, &m, x, y, x + w, y);
+    svg_line(svg, &m, x + w, y, x + w, y + h);
+    svg_line(svg, &m, x + w, y + h, x, y + h);
+    svg_line(svg, &m, x, y + h, x, y);
+  } else if (!strcmp(name, "path")) {
+    if ((s = svg_attr(names, values, "d")))
+      svg_path(svg, &m, s);
+  } else if (!strcmp(name, "use")) {
+    svg_use(svg, &m, names, values);
+  } else if (strcmp(name, "g") && strcmp(name, "title") && strcmp(name, "desc")
+	     && strcmp(name, "metadata")) {
+    svg->im->skipped++;
+  }
+}
+
+/* svg_end(): #GMarkupParser end_element */
+static void
+svg_end(GMarkupParseContext *ctx, const char *name, gpointer data, GError **error)
+{
+  struct svg *svg = data;
+
+  g_array_set_size(svg->stack, svg->stack->len - 1);
+  if (svg->defs)
+    svg->defs--;
+}
+
+/* svg_line(): a line in user units transformed by m */
+static void
+svg_line(struct svg *svg, const struct affine *m,
+	 double x1, double y1, double x2, double y2)
+{
+  apply(m, &x1, &y1);
+  apply(m, &x2, &y2);
+  emit_line(svg->im, x1, y1, x2, y2);
+}
+
+/* svg_points(): the lines joining a list of points, and the last to
+   the first when closed */
+static void
+svg_points(struct svg *svg, const struct affine *m, const char *s, int close)
+{
+  double v[2], fx = 0, fy = 0, px = 0, py = 0;
+  int n;
+
+  for (n = 0; numbers(&s, v, 2) == 2; n++) {
+    if (n)
+      svg_line(svg, m, px, py, v[0], v[1]);
+    else
+      fx = v[0], fy = v[1];
+    px = v[0];
+    py = v[1];
+  }
+  if (close && n > 2)
+    svg_line(svg, m, px, py, fx, fy);
+}
+
+/* svg_path(): the straight segments of path data d, curves are
+   skipped over */
+static void
+svg_path(struct svg *svg, const struct affine *m, const char *d)
+{
+  double cx = 0, cy = 0, sx = 0, sy = 0, x, y, v[7];
+  int n, rel, curves = 0;
+  char cmd = 0;
+
+  while (*d) {
+    while (isspace((unsigned char)*d) || *d == ',')
+      d++;
+    if (!*d)
+      break;
+    if (isalpha((unsigned char)*d)) {
+      cmd = *d++;
+      if (cmd == 'Z' || cmd == 'z') {
+	svg_line(svg, m, cx, cy, sx, sy);
+	cx = sx;
+	cy = sy;
+      }
+      continue;
+    }
+
+    switch (g_ascii_toupper(cmd)) {
+    case 'M': case 'L': case 'T': n = 2; break;
+    case 'H': case 'V':           n = 1; break;
+    case 'S': case 'Q':           n = 4; break;
+    case 'C':                     n = 6; break;
+    case 'A':                     n = 7; break;
+    default:                      return;
+    }
+    if (numbers(&d, v, n) != n)
+      return;
+    rel = g_ascii_islower(cmd);
+
+    switch (g_ascii_toupper(cmd)) {
+    case 'H':
+      x = v[0] + (rel ? cx : 0);
+      y = cy;
+      break;
+    case 'V':
+      x = cx;
+      y = v[0] + (rel ? cy : 0);
+      break;
+    default:			/* end point is the last pair */
+      x = v[n - 2] + (rel ? cx : 0);
+      y = v[n - 1] + (rel ? cy : 0);
+      break;
+    }
+
+    switch (g_ascii_toupper(cmd)) {
+    case 'M':
+      sx = x;
+      sy = y;
+      cmd = rel ? 'l' : 'L';	/* further pairs are lines */
+      break;
+    case 'L': case 'H': case 'V':
+      svg_line(svg, m, cx, cy, x, y);
+      break;
+    default:
+      curves++;
+      break;
+    }
+    cx = x;
+    cy = y;
+  }
+
+  if (curves)
+    svg->im->skipped++;
+}
+
+/* svg_use(): a reference to a symbol, named by its target */
+static void
+svg_use(struct svg *svg, const struct affine *m, const char **names,
+	const char **values)
+{
+  char *attr[PNID_N_ATTRS] = { NULL };
+  const char *href;
+  double box[4] = { 0 }, x, y, w, h, cx, cy;
+  int i, k, have = 0;
+
+  if (!(href = svg_attr(names, values, "href"))
+      && !(href = svg_attr(names, values, "xlink:href")))
+    return;
+
+  x = svg_length(names, values, "x", 0);
+  y = svg_length(names, values, "y", 0);
+  w = svg_length(names, values, "width", SVG_USE_SIZE);
+  h = svg_length(names, values, "height", SVG_USE_SIZE);
+  for (i = 0; i < 4; i++) {
+    cx = x + (i & 1 ? w : 0);
+    cy = y + (i & 2 ? h : 0);
+    apply(m, &cx, &cy);
+    extend(box, &have, cx, cy);
+  }
+
+  /* attributes are given as data-tag="FV-1203" and so on */
+  for (i = 0; names[i]; i++)
+    if (g_str_has_prefix(names[i], "data-") && (k = attr_name(names[i] + 5)) >= 0)
+      attr[k] = (char *)values[i];
+
+  emit_symbol(svg->im, symbol_name(href[0] == '#' ? href + 1 : href), box, attr);
+}
+
+/* svg_attr(): value of attribute name, or NULL */
+static const char *
+svg_attr(const char **names, const char **values, const char *name)
+{
+  int i;
+
+  for (i = 0; names[i]; i++)
+    if (!strcmp(names[i], name))
+      return values[i];
+  return NULL;
+}
+
+/* svg_length(): value of attribute name in user units, or def if it
+   is missing or not a plain number */
+static double
+svg_length(const char **names, const char **values, const char *name, double def)
+{
+  const char *s;
+  double v;
+
+  if (!(s = svg_attr(names, values, name)) || numbers(&s, &v, 1) != 1)
+    return def;
+  return v;
+}
+
+/* numbers(): read up to max numbers separated by spaces or commas
+   from *s, which is advanced past them. Returns the number read. */
+static int
+numbers(const char **s, double *v, int max)
+{
+  char *end;
+  int n;
+
+  for (n = 0; n < max; n++) {
+    while (isspace((unsigned char)**s) || **s == ',')
+      (*s)++;
+    v[n] = g_ascii_strtod(*s, &end);
+    if (end == *s)
+      break;
+    *s = end;
+  }
+  return n;
+}
+
+/* transform(): apply the svg transform list s to m */
+static void
+transform(struct affine *m, const char *s)
+{
+  struct affine t;
+  double v[6], c, sn;
+  char name[16];
+  size_t len;
+  int n;
+
+  for (;;) {
+    while (isspace((unsigned char)*s) || *s == ',')
+      s++;
+    for (len = 0; g_ascii_isalpha(s[len]); len++)
+      ;
+    if (!len || len >= sizeof name)
+      return;
+    memcpy(name, s, len);
+    name[len] = '\0';
+    for (s += len; isspace((unsigned char)*s); s++)
+      ;
+    if (*s++ != '(')
+      return;
+    n = numbers(&s, v, 6);
+    while (isspace((unsigned char)*s))
+      s++;
+    if (*s++ != ')')
+      return;
+
+    t = (struct affine){ 1, 0, 0, 1, 0, 0 };
+    if (!strcmp(name, "matrix") && n == 6) {
+      t = (struct affine){ v[0], v[1], v[2], v[3], v[4], v[5] };
+    } else if (!strcmp(name, "translate") && n >= 1) {
+      t.x0 = v[0];
+      t.y0 = n > 1 ? v[1] : 0;
+    } else if (!strcmp(name, "scale") && n >= 1) {
+      t.xx = v[0];
+      t.yy = n > 1 ? v[1] : v[0];
+    } else if (!strcmp(name, "rotate") && n >= 1) {
+      c = cos(v[0] * G_PI / 180);
+      sn = sin(v[0] * G_PI / 180);
+      t = (struct affine){ c, sn, -sn, c, 0, 0 };
+      if (n == 3) {		/* about a centre */
+	t.x0 = v[1] - c * v[1] + sn * v[2];
+	t.y0 = v[2] - sn * v[1] - c * v[2];
+      }
+    }
+    multiply(m, m, &t);
+  }
+}
+
+/* multiply(): r = a b, transforming by b then a */
+static void
+multiply(struct affine *r, const struct affine *a, const struct affine *b)
+{
+  struct affine t;
+
+  t.xx = a->xx * b->xx + a->xy * b->yx;
+  t.yx = a->yx * b->xx + a->yy * b->yx;
+  t.xy = a->xx * b->xy + a->xy * b->yy;
+  t.yy = a->yx * b->xy + a->yy * b->yy;
+  t.x0 = a->xx * b->x0 + a->xy * b->y0 + a->x0;
+  t.y0 = a->yx * b->x0 + a->yy * b->y0 + a->y0;
+  *r = t;
+}
+
+/* apply(): transform the point x, y by m */
+static void
+apply(const struct affine *m, double *x, double *y)
+{
+  double tx = *x;
+
+  *x = m->xx * tx + m->xy * *y + m->x0;
+  *y = m->yx * tx + m->yy * *y + m->y0;
+}
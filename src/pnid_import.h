@@ -0,0 +1,37 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_import.h - streaming import of drawings in other formats */
+
+#ifndef __PNID_IMPORT_H
+#define __PNID_IMPORT_H
+
+#include <glib.h>
+
+#include "pnid_obj.h"
+
+#define PNID_IMPORT_BATCH 4096	/* objects handed over at once */
+
+/* pnid_import_format: formats read by the importer */
+enum pnid_import_format {
+  PNID_IMPORT_NONE = 0,
+  PNID_IMPORT_DXF,		/* AutoCAD drawing exchange, ASCII */
+  PNID_IMPORT_SVG
+};
+
+/* pnid_import_func(): receives each batch of imported objects. It
+   takes ownership of the objects, of the objs array allocated with
+   g_malloc() and of strings, which holds the objects' attribute
+   strings. Progress is the fraction of the file read. Returning less
+   than zero stops the import, which then returns the same value. */
+typedef int (*PnidImportFunc) (PnidObj **objs, size_t n, GStringChunk *strings,
+			       double progress, void *data);
+
+/* Import the file at path, scale is the number of points per drawing
+   unit or zero for the format's default */
+enum pnid_import_format pnid_import_format(const char *path);
+int                     pnid_import(const char *path, double scale,
+				    PnidImportFunc func, void *data);
+
+#endif /* __PNID_IMPORT_H */
@@ -0,0 +1,471 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_journal.c - append only journal of drawing edits
+
+   Every edit to a drawing is appended to a journal kept next to its
+   base file, so saving costs as much as the edit rather than the
+   drawing. Entries are queued in memory and written by a background
+   thread, which takes everything queued while its previous write was
+   being synced and writes it at once with a single fdatasync(), a
+   group commit.
+
+   On opening a drawing the journal is replayed on top of the base
+   file. The base file records the last entry folded into it, so
+   entries that were folded in by a compaction are skipped, and
+   replay stops at the first entry torn by a crash. A journal may also
+   be replayed without being opened for writing, by a reader which
+   must leave it as it is for the editor that may still be writing
+   it. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_file.h"
+#include "pnid_journal.h"
+
+#define BUFMIN 4096		/* initial bytes in a queue buffer */
+#define HEAD   offsetof(struct pnid_journal_entry, seq) /* unsummed */
+
+struct pnid_journal {
+  int             fd;
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;		/* queued, written or quit */
+  char           *buf;		/* queued entries */
+  size_t          len;
+  size_t          cap;
+  char           *spare;	/* entries being written */
+  size_t          scap;
+  uint64_t        seq;		/* last entry queued */
+  uint64_t        durable;	/* last entry synced */
+  size_t          size;		/* bytes on disk */
+  int             err;		/* first write error, -errno */
+  int             quit;
+};
+
+static void    *flusher(void *data);
+static int      replay(int fd, uint64_t after, PnidJournalFunc func, void *data,
+		       uint64_t *seq, size_t *whole);
+static int      readall(int fd, char **buf, size_t *len);
+static int      writeall(int fd, const char *buf, size_t len);
+static uint32_t checksum(const char *p, size_t len);
+
+/*********************
+ * Interface
+*******************/
+
+/* pnid_journal_open(): open the journal at path, creating it if need
+   be, and start its writer. Entries already in it after sequence
+   number after are replayed through func. Returns 0 or -errno. */
+int
+pnid_journal_open(const char *path, uint64_t after, PnidJournalFunc func,
+		  void *data, PnidJournal **journal)
+{
+  struct pnid_journal *j;
+  struct stat st;
+  int res;
+
+  if (!(j = calloc(1, sizeof *j)))
+    return -ENOMEM;
+  j->buf = malloc(BUFMIN);
+  j->spare = malloc(BUFMIN);
+  if (!j->buf || !j->spare) {
+    res = -ENOMEM;
+    goto fail;
+  }
+  j->cap = j->scap = BUFMIN;
+
+  if ((j->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+    res = -errno;
+    goto fail;
+  }
+  if ((res = replay(j->fd, after, func, data, &j->seq, &j->size)) < 0)
+    goto fail_fd;
+  /* cut off anything torn following the last whole entry */
+  if (fstat(j->fd, &st) < 0
+      || ((size_t)st.st_size > j->size && ftruncate(j->fd, j->size) < 0)) {
+    res = -errno;
+    goto fail_fd;
+  }
+  j->durable = j->seq;
+
+  pthread_mutex_init(&j->lock, NULL);
+  pthread_cond_init(&j->cond, NULL);
+  if ((res = -pthread_create(&j->thread, NULL, flusher, j)) < 0) {
+    pthread_mutex_destroy(&j->lock);
+    pthread_cond_destroy(&j->cond);
+    goto fail_fd;
+  }
+
+  *journal = j;
+  return 0;
+
+ fail_fd:
+  close(j->fd);
+ fail:
+  free(j->buf);
+  free(j->spare);
+  free(j);
+  return res;
+}
+
+/* pnid_journal_replay(): replay the entries of the journal at path
+   after sequence number after through func, if there is one, opening
+   it only to read. Anything torn is skipped but left in place, as it
+   may be an entry still being written. Returns 0 or -errno. */
+int
+pnid_journal_replay(const char *path, uint64_t after, PnidJournalFunc func, void *data)
+{
+  uint64_t seq;
+  size_t whole;
+  int fd, res;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return errno == ENOENT ? 0 : -errno;
+  res = replay(fd, after, func, data, &seq, &whole);
+  close(fd);
+
+  return res;
+}
+
+/* pnid_journal_close(): write out any queued entries and close the
+   journal. Returns the first error writing it, or 0. */
+int
+pnid_journal_close(PnidJournal *j)
+{
+  int res;
+
+  if (!j)
+    return 0;
+
+  pthread_mutex_lock(&j->lock);
+  j->quit = 1;
+  pthread_cond_broadcast(&j->cond);
+  pthread_mutex_unlock(&j->lock);
+  pthread_join(j->thread, NULL);
+
+  res = j->err;
+  if (close(j->fd) < 0 && !res)
+    res = -errno;
+  pthread_mutex_destroy(&j->lock);
+  pthread_cond_destroy(&j->cond);
+  free(j->buf);
+  free(j->spare);
+  free(j);
+
+  return res;
+}
+
+/* pnid_journal_append(): queue an entry recording op on obj, only the
+   id of a deleted object is used. Returns 0, or -errno if this or an
+   earlier entry could not be written. */
+int
+pnid_journal_append(PnidJournal *j, enum pnid_journal_op op, const PnidObj *obj)
+{
+  struct pnid_journal_entry e = {0};
+  size_t size, len[PNID_N_ATTRS] = {0};
+  char *p, *tmp;
+  int k, res;
+
+  size = sizeof e - sizeof e.size;
+  e.op = op;
+  e.rec.id = obj->id;
+  if (op != PNID_JOURNAL_DELETE) {
+    e.rec.left = obj->bbox.nw.x;
+    e.rec.top = obj->bbox.nw.y;
+    e.rec.right = obj->bbox.se.x;
+    e.rec.bottom = obj->bbox.se.y;
+    e.rec.type = obj->type;
+    e.rec.symbol = obj->symbol;
+    for (k = 0; k < PNID_N_ATTRS; k++)
+      if (obj->attr[k]) {
+	e.rec.attr[k] = 1;
+	size += len[k] = strlen(obj->attr[k]) + 1;
+      }
+  }
+  e.size = size;
+
+  pthread_mutex_lock(&j->lock);
+  if ((res = j->err) < 0)
+    goto out;
+  if (j->len + sizeof e.size + size > j->cap) {
+    size_t cap = j->cap;
+    while (j->len + sizeof e.size + size > cap)
+      cap *= 2;
+    if (!(tmp = realloc(j->buf, cap))) {
+      res = -ENOMEM;
+      goto out;
+    }
+    j->buf = tmp;
+    j->cap = cap;
+  }
+
+  e.seq = ++j->seq;
+  p = j->buf + j->len;
+  memcpy(p, &e, sizeof e);
+  for (p += sizeof e, k = 0; k < PNID_N_ATTRS; k++)
+    if (len[k]) {
+      memcpy(p, obj->attr[k], len[k]);
+      p += len[k];
+    }
+  e.sum = checksum(j->buf + j->len + HEAD, sizeof e.size + size - HEAD);
+  memcpy(j->buf + j->len + offsetof(struct pnid_journal_entry, sum),
+	 &e.sum, sizeof e.sum);
+  j->len += sizeof e.size + size;
+  pthread_cond_broadcast(&j->cond);
+
+ out:
+  pthread_mutex_unlock(&j->lock);
+  return res;
+}
+
+/* pnid_journal_sync(): wait until every entry queued so far is on
+   disk. Returns 0 or -errno. */
+int
+pnid_journal_sync(PnidJournal *j)
+{
+  uint64_t seq;
+  int res;
+
+  pthread_mutex_lock(&j->lock);
+  seq = j->seq;
+  while (j->durable < seq && !j->err)
+    pthread_cond_wait(&j->cond, &j->lock);
+  res = j->err;
+  pthread_mutex_unlock(&j->lock);
+
+  return res;
+}
+
+/* pnid_journal_seq(): sequence number of the last entry queued */
+uint64_t
+pnid_journal_seq(PnidJournal *j)
+{
+  uint64_t seq;
+
+  pthread_mutex_lock(&j->lock);
+  seq = j->seq;
+  pthread_mutex_unlock(&j->lock);
+
+  return seq;
+}
+
+/* pnid_journal_size(): bytes of entries written to the journal */
+size_t
+pnid_journal_size(PnidJournal *j)
+{
+  size_t size;
+
+  pthread_mutex_lock(&j->lock);
+  size = j->size;
+  pthread_mutex_unlock(&j->lock);
+
+  return size;
+}
+
+/* pnid_journal_truncate(): empty the journal once every entry up to
+   seq has been folded into the base file. Returns -EAGAIN, leaving the
+   journal untouched, if entries have been queued since. */
+int
+pnid_journal_truncate(PnidJournal *j, uint64_t seq)
+{
+  int res = 0;
+
+  pthread_mutex_lock(&j->lock);
+  if (j->seq != seq) {
+    res = -EAGAIN;
+    goto out;
+  }
+  while (j->durable < seq && !j->err)
+    pthread_cond_wait(&j->cond, &j->lock);
+  if ((res = j->err) < 0)
+    goto out;
+  if (ftruncate(j->fd, 0) < 0 || fdatasync(j->fd) < 0)
+    res = -errno;
+  else
+    j->size = 0;
+
+ out:
+  pthread_mutex_unlock(&j->lock);
+  return res;
+}
+
+/*********************
+ * Writing
+*******************/
+
+/* flusher(): journal writer thread, write and sync everything queued
+   until told to quit */
+static void *
+flusher(void *data)
+{
+  struct pnid_journal *j = data;
+  uint64_t seq;
+  size_t len, cap;
+  char *buf;
+  int res;
+
+  pthread_mutex_lock(&j->lock);
+  for (;;) {
+    while (!j->len && !j->quit)
+      pthread_cond_wait(&j->cond, &j->lock);
+    if (!j->len)
+      break;
+
+    /* take the queue, appends continue into the spare buffer */
+    buf = j->buf;
+    cap = j->cap;
+    len = j->len;
+    seq = j->seq;
+    j->buf = j->spare;
+    j->cap = j->scap;
+    j->spare = buf;
+    j->scap = cap;
+    j->len = 0;
+    pthread_mutex_unlock(&j->lock);
+
+    if (!(res = writeall(j->fd, buf, len)) && fdatasync(j->fd) < 0)
+      res = -errno;
+
+    pthread_mutex_lock(&j->lock);
+    if (res < 0 && !j->err)
+      j->err = res;
+    if (!res) {
+      j->durable = seq;
+      j->size += len;
+    }
+    pthread_cond_broadcast(&j->cond);
+  }
+  pthread_mutex_unlock(&j->lock);
+
+  return NULL;
+}
+
+/* writeall(): write len bytes of buf to fd, returns 0 or -errno */
+static int
+writeall(int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len) {
+    if ((n = write(fd, buf, len)) < 0) {
+      if (errno == EINTR)
+	continue;
+      return -errno;
+    }
+    buf += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+/*********************
+ * Replay
+*******************/
+
+/* replay(): call func for each whole entry in the journal fd after
+   sequence number after, storing the last sequence number seen in seq
+   and the length of the whole entries in whole. Returns 0 or
+   -errno. */
+static int
+replay(int fd, uint64_t after, PnidJournalFunc func, void *data,
+       uint64_t *seq, size_t *whole)
+{
+  struct pnid_journal_entry e;
+  PnidObj obj;
+  const char *p, *end;
+  size_t len, off;
+  char *buf;
+  int k, res;
+
+  if ((res = readall(fd, &buf, &len)) < 0)
+    return res;
+
+  *seq = after;
+  for (off = 0; len - off >= sizeof e; off += sizeof e.size + e.size) {
+    memcpy(&e, buf + off, sizeof e);
+    if (e.size < sizeof e - sizeof e.size
+	|| e.size > len - off - sizeof e.size
+	|| e.sum != checksum(buf + off + HEAD, sizeof e.size + e.size - HEAD))
+      break;
+
+    memset(&obj, 0, sizeof obj);
+    obj.bbox = (PnidBox){{e.rec.left, e.rec.top}, {e.rec.right, e.rec.bottom}};
+    obj.id = e.rec.id;
+    obj.type = e.rec.type;
+    obj.symbol = e.rec.symbol;
+    p = buf + off + sizeof e;
+    end = buf + off + sizeof e.size + e.size;
+    for (k = 0; k < PNID_N_ATTRS && p; k++) {
+      if (!e.rec.attr[k])
+	continue;
+      obj.attr[k] = p;
+      if ((p = memchr(p, '\0', end - p)))
+	p++;
+    }
+    if (!p)
+      break;
+
+    if (e.seq > after)
+      func(e.op, &obj, data);
+    if (e.seq > *seq)
+      *seq = e.seq;
+  }
+
+  free(buf);
+  *whole = off;
+
+  return 0;
+}
+
+/* readall(): read the whole of fd into a new buffer, returns 0 or
+   -errno */
+static int
+readall(int fd, char **buf, size_t *len)
+{
+  struct stat st;
+  ssize_t n;
+  size_t off;
+
+  if (fstat(fd, &st) < 0)
+    return -errno;
+  if (!(*buf = malloc(st.st_size + 1)))
+    return -ENOMEM;
+
+  for (off = 0; off < (size_t)st.st_size; off += n) {
+    if ((n = pread(fd, *buf + off, st.st_size - off, off)) < 0) {
+      if (errno == EINTR) {
+	n = 0;
+	continue;
+      }
+      free(*buf);
+      return -errno;
+    }
+    if (!n)
+      break;
+  }
+  *len = off;
+
+  return 0;
+}
+
+/* checksum(): FNV-1a hash of len bytes at p */
+static uint32_t
+checksum(const char *p, size_t len)
+{
+  uint32_t h = 2166136261u;
+
+  while (len--)
+    h = (h ^ (unsigned char)*p++) * 16777619u;
+  return h;
+}
@@ -0,0 +1,67 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_journal.h - append only journal of drawing edits */
+
+#ifndef __PNID_JOURNAL_H
+#define __PNID_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pnid_obj.h"
+#include "pnid_file.h"
+
+/* pnid_journal_op: the edit an entry records */
+enum pnid_journal_op {
+  PNID_JOURNAL_INSERT = 1,
+  PNID_JOURNAL_UPDATE,
+  PNID_JOURNAL_DELETE
+};
+
+/* pnid_journal_entry: each entry starts with this header and is
+   followed by the attribute strings set in rec, nul terminated and in
+   attribute order. In rec an attribute is non-zero when it is
+   set. The checksum covers everything after it, so an entry torn by a
+   crash is detected and it and anything after it is discarded. */
+struct pnid_journal_entry {
+  uint32_t                size;	/* bytes following this member */
+  uint32_t                sum;
+  uint64_t                seq;
+  uint32_t                op;	/* enum pnid_journal_op */
+  uint32_t                pad;
+  struct pnid_file_record rec;
+};
+
+/* #PnidJournal: a journal open for appending, written to disk by a
+   background thread. */
+typedef struct pnid_journal PnidJournal;
+
+/* pnid_journal_func(): called for each entry replayed from a
+   journal, the attribute strings of obj are valid only for the
+   duration of the call. */
+typedef void (*PnidJournalFunc) (enum pnid_journal_op op, const PnidObj *obj, void *data);
+
+/* Open, replaying entries after a base file, and close */
+int      pnid_journal_open(const char *path, uint64_t after, PnidJournalFunc func,
+			   void *data, PnidJournal **journal);
+int      pnid_journal_close(PnidJournal *journal);
+
+/* Replay entries after a base file without opening it for writing */
+int      pnid_journal_replay(const char *path, uint64_t after, PnidJournalFunc func,
+			     void *data);
+
+/* Record edits, returned once queued */
+int      pnid_journal_append(PnidJournal *journal, enum pnid_journal_op op,
+			     const PnidObj *obj);
+
+/* Wait for the queued edits to reach disk */
+int      pnid_journal_sync(PnidJournal *journal);
+
+/* Compaction, discard entries up to seq once folded into a base file */
+uint64_t pnid_journal_seq(PnidJournal *journal);
+size_t   pnid_journal_size(PnidJournal *journal);
+int      pnid_journal_truncate(PnidJournal *journal, uint64_t seq);
+
+#endif /* __PNID_JOURNAL_H */
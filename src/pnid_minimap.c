@@ -0,0 +1,430 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_minimap.c - overview of a whole pnid drawing class definition  */
+
+#include <gtk/gtk.h>
+#include <math.h>
+
+#include "pnid_box.h"
+#include "pnid_canvas.h"
+#include "pnid_minimap.h"
+
+#define PNID_MINIMAP_PAD_PX     4 /* Border around the page */
+
+/* #PnidMinimap class definition
+
+   The minimap shows the whole page of a #PnidCanvas scaled to fit,
+   with the part of it in the canvas's viewport outlined. Dragging
+   over the minimap scrolls the canvas to be centred on the pointer.
+
+   The page is rendered once into a backing surface at the minimap's
+   scale, so small that the canvas draws most of its index as the
+   summaries of subtrees rather than visiting their objects. Edits
+   are followed from #PnidCanvas::damaged, the boxes damaged being
+   collected in a region of the surface and only those rendered again
+   in the next frame. Scrolling and zooming the canvas only moves the
+   outline, leaving the surface as it is. */
+struct _PnidMinimap {
+  GtkDrawingArea   parent;
+  /* instance members */
+  PnidCanvas      *canvas;
+  GtkAdjustment   *hadjustment;	/* of the canvas, watched for scrolling */
+  GtkAdjustment   *vadjustment;
+  cairo_surface_t *surface;	/* rendered page */
+  gboolean         surface_valid;
+  double           surface_x;	/* widget offset of surface origin */
+  double           surface_y;
+  double           scale;	/* pixels per point */
+  cairo_region_t  *damage;	/* of the surface, rendered next frame */
+  double           drag_x;	/* start of a drag */
+  double           drag_y;
+};
+
+G_DEFINE_TYPE(PnidMinimap, pnid_minimap, GTK_TYPE_DRAWING_AREA);
+
+typedef enum {
+  PROP_CANVAS = 1,
+  N_PROPERTIES
+} PnidMinimapProperty;
+
+static GParamSpec *obj_properties[N_PROPERTIES] = { NULL, };
+
+/* Constructors */
+static void pnid_minimap_class_init(PnidMinimapClass *class);
+static void pnid_minimap_init(PnidMinimap *self);
+static void pnid_minimap_constructed(GObject *self);
+static void pnid_minimap_dispose(GObject *self);
+/* Property getter/setter methods */
+static void pnid_minimap_get_property(GObject *self, guint property_id, GValue *value, GParamSpec *pspec);
+static void pnid_minimap_set_property(GObject *self, guint property_id, const GValue *value, GParamSpec *pspec);
+/* Following the canvas */
+static void watch_adjustments(PnidMinimap *self);
+static void clear_adjustment(PnidMinimap *self, GtkAdjustment **adj);
+static void canvas_damaged(PnidCanvas *canvas, const PnidBox *box, gpointer data);
+static void canvas_resized(GObject *canvas, GParamSpec *pspec, gpointer data);
+static void canvas_scrollable(GObject *canvas, GParamSpec *pspec, gpointer data);
+/* Drawing */
+static void redraw(GtkDrawingArea *area, cairo_t *cr, int width, int height, gpointer data);
+static void render(PnidMinimap *self, cairo_t *cr, const cairo_rectangle_int_t *r);
+static void repair(PnidMinimap *self);
+static void draw_viewport(PnidMinimap *self, cairo_t *cr);
+/* Navigation */
+static void drag_begin(GtkGestureDrag *gesture, double x, double y, gpointer data);
+static void drag_update(GtkGestureDrag *gesture, double dx, double dy, gpointer data);
+static void centre(PnidMinimap *self, double x, double y);
+
+/* pnid_minimap_new(): create an overview of canvas */
+PnidMinimap *
+pnid_minimap_new(PnidCanvas *canvas)
+{
+  return g_object_new(PNID_MINIMAP_TYPE, "canvas", canvas, NULL);
+}
+
+/* pnid_minimap_set_property(): property setter */
+static void
+pnid_minimap_set_property(GObject      *self,
+			  guint         property_id,
+			  const GValue *value,
+			  GParamSpec   *pspec)
+{
+  switch ((PnidMinimapProperty)property_id) {
+  case PROP_CANVAS:
+    PNID_MINIMAP(self)->canvas = g_value_dup_object(value);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(self, property_id, pspec);
+    break;
+  }
+}
+
+/* pnid_minimap_get_property(): property getter */
+static void
+pnid_minimap_get_property(GObject    *self,
+			  guint       property_id,
+			  GValue     *value,
+			  GParamSpec *pspec)
+{
+  switch ((PnidMinimapProperty)property_id) {
+  case PROP_CANVAS:
+    g_value_set_object(value, PNID_MINIMAP(self)->canvas);
+    break;
+  default:
+    G_OBJECT_WARN_INVALID_PROPERTY_ID(self, property_id, pspec);
+    break;
+  }
+}
+
+/*********************
+ * Constructors
+*******************/
+
+/* pnid_minimap_class_init(): class initialisation */
+static void
+pnid_minimap_class_init(PnidMinimapClass *class)
+{
+  G_OBJECT_CLASS(class)->set_property = pnid_minimap_set_property;
+  G_OBJECT_CLASS(class)->get_property = pnid_minimap_get_property;
+  G_OBJECT_CLASS(class)->constructed  = pnid_minimap_constructed;
+  G_OBJECT_CLASS(class)->dispose      = pnid_minimap_dispose;
+
+  obj_properties[PROP_CANVAS] =
+    g_param_spec_object("canvas", "Canvas",
+			"The canvas shown in overview",
+			PNID_CANVAS_TYPE,
+			G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  g_object_class_install_properties(G_OBJECT_CLASS(class),
+				    N_PROPERTIES,
+				    obj_properties);
+}
+
+/* pnid_minimap_init(): pnid minimap object constructor */
+static void
+pnid_minimap_init(PnidMinimap *self)
+{
+  GtkGesture *drag;
+
+  gtk_drawing_area_set_draw_func(GTK_DRAWING_AREA(self), redraw, NULL, NULL);
+  self->damage = cairo_region_create();
+
+  drag = gtk_gesture_drag_new();
+  gtk_gesture_single_set_button(GTK_GESTURE_SINGLE(drag), GDK_BUTTON_PRIMARY);
+  g_signal_connect(drag, "drag-begin", G_CALLBACK(drag_begin), self);
+  g_signal_connect(drag, "drag-update", G_CALLBACK(drag_update), self);
+  gtk_widget_add_controller(GTK_WIDGET(self), GTK_EVENT_CONTROLLER(drag));
+}
+
+/* pnid_minimap_constructed(): follow the canvas once it is set */
+static void
+pnid_minimap_constructed(GObject *self)
+{
+  PnidMinimap *minimap = PNID_MINIMAP(self);
+
+  G_OBJECT_CLASS(pnid_minimap_parent_class)->constructed(self);
+
+  g_signal_connect(minimap->canvas, "damaged", G_CALLBACK(canvas_damaged), minimap);
+  g_signal_connect(minimap->canvas, "notify::page-width", G_CALLBACK(canvas_resized), minimap);
+  g_signal_connect(minimap->canvas, "notify::page-height", G_CALLBACK(canvas_resized), minimap);
+  g_signal_connect(minimap->canvas, "notify::hadjustment", G_CALLBACK(canvas_scrollable), minimap);
+  g_signal_connect(minimap->canvas, "notify::vadjustment", G_CALLBACK(canvas_scrollable), minimap);
+  watch_adjustments(minimap);
+}
+
+/* pnid_minimap_dispose(): stop following the canvas, may be called
+   more than once */
+static void
+pnid_minimap_dispose(GObject *self)
+{
+  PnidMinimap *minimap = PNID_MINIMAP(self);
+
+  clear_adjustment(minimap, &minimap->hadjustment);
+  clear_adjustment(minimap, &minimap->vadjustment);
+  if (minimap->canvas)
+    g_signal_handlers_disconnect_by_data(minimap->canvas, minimap);
+  g_clear_object(&minimap->canvas);
+  g_clear_pointer(&minimap->surface, cairo_surface_destroy);
+  g_clear_pointer(&minimap->damage, cairo_region_destroy);
+
+  G_OBJECT_CLASS(pnid_minimap_parent_class)->dispose(self);
+}
+
+/*********************
+ * Following the Canvas
+*******************/
+
+/* watch_adjustments(): redraw the viewport outline whenever the
+   canvas's current adjustments scroll or are reconfigured by a zoom
+   or resize */
+static void
+watch_adjustments(PnidMinimap *self)
+{
+  GtkAdjustment *h, *v;
+
+  clear_adjustment(self, &self->hadjustment);
+  clear_adjustment(self, &self->vadjustment);
+  g_object_get(self->canvas, "hadjustment", &h, "vadjustment", &v, NULL);
+
+  if ((self->hadjustment = h)) {
+    g_signal_connect_swapped(h, "value-changed", G_CALLBACK(gtk_widget_queue_draw), self);
+    g_signal_connect_swapped(h, "changed", G_CALLBACK(gtk_widget_queue_draw), self);
+  }
+  if ((self->vadjustment = v)) {
+    g_signal_connect_swapped(v, "value-changed", G_CALLBACK(gtk_widget_queue_draw), self);
+    g_signal_connect_swapped(v, "changed", G_CALLBACK(gtk_widget_queue_draw), self);
+  }
+  gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+/* clear_adjustment(): stop watching adj and release it */
+static void
+clear_adjustment(PnidMinimap *self, GtkAdjustment **adj)
+{
+  if (!*adj)
+    return;
+
+  g_signal_handlers_disconnect_by_func(*adj, gtk_widget_queue_draw, self);
+  g_clear_object(adj);
+}
+
+/* canvas_damaged(): #PnidCanvas::damaged handler, add box to the
+   damage of the surface or discard it all if box is NULL */
+static void
+canvas_damaged(PnidCanvas *canvas, const PnidBox *box, gpointer data)
+{
+  PnidMinimap *self = data;
+  cairo_rectangle_int_t r;
+
+  if (!box) {
+    self->surface_valid = FALSE;
+  } else if (self->surface_valid) {
+    r.x = floor(pnid_box_get_left(box) * self->scale) - 1;
+    r.y = floor(pnid_box_get_top(box) * self->scale) - 1;
+    r.width = ceil(pnid_box_width(box) * self->scale) + 3;
+    r.height = ceil(pnid_box_height(box) * self->scale) + 3;
+    cairo_region_union_rectangle(self->damage, &r);
+  }
+  gtk_widget_queue_draw(GTK_WIDGET(self));
+}
+
+/* canvas_resized(): #PnidCanvas::notify::page-width and page-height
+   handler, the page is rendered again at its new scale */
+static void
+canvas_resized(GObject *canvas, GParamSpec *pspec, gpointer data)
+{
+  PNID_MINIMAP(data)->surface_valid = FALSE;
+  gtk_widget_queue_draw(GTK_WIDGET(data));
+}
+
+/* canvas_scrollable(): #GtkScrollable::notify::hadjustment and
+   vadjustment handler, follow the canvas's new adjustments */
+static void
+canvas_scrollable(GObject *canvas, GParamSpec *pspec, gpointer data)
+{
+  watch_adjustments(PNID_MINIMAP(data));
+}
+
+/*********************
+ * Drawing
+*******************/
+
+/* redraw(): draw the page scaled to fit width by height pixels and
+   the outline of the canvas's viewport upon it.
+
+   The backing surface is rendered in full only when it is first
+   drawn, resized or discarded, otherwise only its damaged parts are
+   rendered again before painting it to cr. */
+static void
+redraw(GtkDrawingArea *area,
+       cairo_t        *cr,
+       int             width, int height,
+       gpointer        data)
+{
+  PnidMinimap *self = PNID_MINIMAP(area);
+  cairo_rectangle_int_t all = { 0 };
+  cairo_t *scr;
+  double page_width, page_height, scale;
+  int factor;
+
+  g_object_get(self->canvas, "page-width", &page_width, "page-height", &page_height, NULL);
+  scale = MIN((width - 2 * PNID_MINIMAP_PAD_PX) / page_width,
+	      (height - 2 * PNID_MINIMAP_PAD_PX) / page_height);
+  if (scale <= 0)
+    return;
+  all.width = ceil(page_width * scale);
+  all.height = ceil(page_height * scale);
+  factor = gtk_widget_get_scale_factor(GTK_WIDGET(self));
+
+  /* a resized minimap is rendered again from scratch */
+  if (!self->surface || scale != self->scale
+      || cairo_image_surface_get_width(self->surface) != all.width * factor) {
+    g_clear_pointer(&self->surface, cairo_surface_destroy);
+    self->surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+					       all.width * factor, all.height * factor);
+    cairo_surface_set_device_scale(self->surface, factor, factor);
+    self->scale = scale;
+    self->surface_valid = FALSE;
+  }
+
+  if (!self->surface_valid) {
+    cairo_region_subtract(self->damage, self->damage);
+    scr = cairo_create(self->surface);
+    render(self, scr, &all);
+    cairo_destroy(scr);
+    self->surface_valid = TRUE;
+  } else {
+    cairo_region_intersect_rectangle(self->damage, &all);
+    repair(self);
+  }
+
+  self->surface_x = floor((width - all.width) / 2.0);
+  self->surface_y = floor((height - all.height) / 2.0);
+
+  cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+  cairo_paint(cr);
+  cairo_set_source_surface(cr, self->surface, self->surface_x, self->surface_y);
+  cairo_paint(cr);
+  draw_viewport(self, cr);
+}
+
+/* render(): draw the page within r, in pixels of the surface, into
+   the surface with cr */
+static void
+render(PnidMinimap *self, cairo_t *cr, const cairo_rectangle_int_t *r)
+{
+  PnidBox region;
+
+  pnid_box_set_left(&region, floor(r->x / self->scale));
+  pnid_box_set_top(&region, floor(r->y / self->scale));
+  pnid_box_set_right(&region, ceil((r->x + r->width) / self->scale));
+  pnid_box_set_bottom(&region, ceil((r->y + r->height) / self->scale));
+
+  cairo_save(cr);
+  cairo_rectangle(cr, r->x, r->y, r->width, r->height);
+  cairo_clip(cr);
+  cairo_set_source_rgb(cr, 0.8, 0.8, 0.8);
+  cairo_paint(cr);
+  pnid_canvas_draw_overview(self->canvas, cr, self->scale, &region);
+  cairo_restore(cr);
+}
+
+/* repair(): render the damaged parts of the surface, forgetting the
+   damage */
+static void
+repair(PnidMinimap *self)
+{
+  cairo_rectangle_int_t r;
+  cairo_t *cr;
+  int i, n;
+
+  if (!(n = cairo_region_num_rectangles(self->damage)))
+    return;
+
+  cr = cairo_create(self->surface);
+  for (i = 0; i < n; i++) {
+    cairo_region_get_rectangle(self->damage, i, &r);
+    render(self, cr, &r);
+  }
+  cairo_destroy(cr);
+  cairo_region_subtract(self->damage, self->damage);
+}
+
+/* draw_viewport(): outline the part of the page in the canvas's
+   viewport */
+static void
+draw_viewport(PnidMinimap *self, cairo_t *cr)
+{
+  double x, y, width, height;
+
+  pnid_canvas_get_viewport(self->canvas, &x, &y, &width, &height);
+
+  cairo_save(cr);
+  cairo_translate(cr, self->surface_x, self->surface_y);
+  cairo_rectangle(cr, floor(x * self->scale) + 0.5, floor(y * self->scale) + 0.5,
+		  round(width * self->scale), round(height * self->scale));
+  cairo_set_source_rgba(cr, 0.2, 0.4, 1.0, 0.15);
+  cairo_fill_preserve(cr);
+  cairo_set_source_rgba(cr, 0.2, 0.4, 1.0, 0.8);
+  cairo_set_line_width(cr, 1.0);
+  cairo_stroke(cr);
+  cairo_restore(cr);
+}
+
+/*********************
+ * Navigation
+*******************/
+
+/* drag_begin(): #GtkGestureDrag::drag-begin handler, centre the
+   canvas on the point pressed */
+static void
+drag_begin(GtkGestureDrag *gesture, double x, double y, gpointer data)
+{
+  PnidMinimap *self = data;
+
+  self->drag_x = x;
+  self->drag_y = y;
+  centre(self, x, y);
+}
+
+/* drag_update(): #GtkGestureDrag::drag-update handler, keep the
+   canvas centred on the pointer */
+static void
+drag_update(GtkGestureDrag *gesture, double dx, double dy, gpointer data)
+{
+  PnidMinimap *self = data;
+
+  centre(self, self->drag_x + dx, self->drag_y + dy);
+}
+
+/* centre(): scroll the canvas to be centred on x, y in the minimap */
+static void
+centre(PnidMinimap *self, double x, double y)
+{
+  if (!self->surface_valid)
+    return;
+
+  pnid_canvas_scroll_to(self->canvas,
+			(x - self->surface_x) / self->scale,
+			(y - self->surface_y) / self->scale);
+}
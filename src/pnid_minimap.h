@@ -0,0 +1,26 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_minimap.h - overview of a whole pnid drawing class definition */
+
+#ifndef __PNID_MINIMAP_H
+#define __PNID_MINIMAP_H
+
+#include <gtk/gtk.h>
+
+#include "pnid_canvas.h"
+
+/*
+  #PnidMinimap GObject class declaration
+*/
+
+#define PNID_MINIMAP_TYPE (pnid_minimap_get_type())
+G_DECLARE_FINAL_TYPE(PnidMinimap, pnid_minimap, PNID, MINIMAP, GtkDrawingArea);
+
+/*
+  #PnidMinimap interface
+*/
+PnidMinimap *pnid_minimap_new(PnidCanvas *canvas);
+
+#endif /* __PNID_MINIMAP_H */
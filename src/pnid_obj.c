@@ -15,7 +15,7 @@ pnid_obj_new(void)
 {
   PnidObj *new;
 
-  if (!(new = malloc(sizeof *new)))
+  if (!(new = calloc(1, sizeof *new)))
     return NULL;
 
   return new;
@@ -11,8 +11,42 @@
 
 typedef struct pnid_obj PnidObj; 
 
+/* pnid_symbol: the symbol drawn to represent an object */
+enum pnid_symbol {
+  PNID_SYMBOL_NONE = 0,
+  PNID_SYMBOL_VALVE,
+  PNID_SYMBOL_INSTRUMENT,
+  PNID_SYMBOL_PUMP,
+  PNID_N_SYMBOLS
+};
+
+/* pnid_obj_type: the kind of drawing object */
+enum pnid_obj_type {
+  PNID_OBJ_SYMBOL = 0,
+  PNID_OBJ_LINE,		/* top left to bottom right of bbox */
+  PNID_OBJ_LINE_RISE,		/* bottom left to top right of bbox */
+  PNID_N_OBJ_TYPES
+};
+
+/* pnid_attr: engineering attributes of an object */
+enum pnid_attr {
+  PNID_ATTR_TAG = 0,		/* tag number, e.g. FV-1203 */
+  PNID_ATTR_LINE,		/* line number, e.g. 6"-P-1001 */
+  PNID_ATTR_SERVICE,
+  PNID_ATTR_SIZE,
+  PNID_ATTR_SPEC,
+  PNID_N_ATTRS
+};
+
+/* pnid_obj: a drawing object. Attribute strings are not owned by
+   the object, they are held by the file or table they came from and
+   are NULL when not set. */
 struct pnid_obj {
-  PnidBox bbox;
+  PnidBox     bbox;
+  unsigned    id;		/* unique within a drawing */
+  unsigned    type;		/* enum pnid_obj_type */
+  unsigned    symbol;		/* enum pnid_symbol */
+  const char *attr[PNID_N_ATTRS];
 };
 
 /* Create and destroy pnid objects */
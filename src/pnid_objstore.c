@@ -0,0 +1,274 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_objstore.c - slab allocated pnid objects with handles
+
+   Objects are held in slots within slabs of 1 << PNID_OBJSTORE_SLAB_BITS,
+   each slab allocated once and never moved, so objects can be
+   referred to by address as well as by handle. Released slots are
+   reused most recent first, before the next slab is touched, so a
+   store stays dense and visiting its objects walks memory in
+   order. Freeing a store frees its slabs, not each object.
+
+   A slot's link holds its own index while in use and the next free
+   slot otherwise, which is never its own, so that a handle is checked
+   against both the slot's generation and that it is in use. */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_obj.h"
+#include "pnid_objstore.h"
+
+#define SLAB     (1u << PNID_OBJSTORE_SLAB_BITS)
+#define NIL      UINT32_MAX	/* end of the free list */
+#define GENMASK  ((1u << (32 - PNID_OBJSTORE_INDEX_BITS)) - 1)
+
+/* slot: an object and its bookkeeping */
+struct slot {
+  PnidObj  obj;			/* OBJ MUST BE FIRST ELEMENT */
+  uint32_t gen;			/* never 0 once used */
+  uint32_t link;		/* own index or next free */
+};
+
+struct pnid_objstore {
+  struct slot **slabs;
+  size_t        nslabs;
+  size_t        cap;		/* of slabs */
+  uint32_t      top;		/* slots ever used */
+  uint32_t      free;		/* head of free list */
+  size_t        nfree;
+  size_t        len;		/* objects held */
+};
+
+static int          grow(PnidObjStore *store);
+static struct slot *slot(const PnidObjStore *store, uint32_t i);
+
+/*********************
+ * Creation and Destruction
+*******************/
+
+/* pnid_objstore_new(): create an empty store. Returns NULL if out of
+   memory. */
+PnidObjStore *
+pnid_objstore_new(void)
+{
+  PnidObjStore *new;
+
+  if (!(new = calloc(1, sizeof *new)))
+    return NULL;
+  new->free = NIL;
+
+  return new;
+}
+
+/* pnid_objstore_destroy(): free store and every object held in it */
+void
+pnid_objstore_destroy(PnidObjStore *store)
+{
+  size_t i;
+
+  if (!store)
+    return;
+
+  for (i = 0; i < store->nslabs; i++)
+    free(store->slabs[i]);
+  free(store->slabs);
+  free(store);
+}
+
+/*********************
+ * Allocation
+*******************/
+
+/* pnid_objstore_reserve(): make room for n more objects, so that
+   allocating them cannot fail. Returns -ENOMEM, -ENOSPC if the store
+   would exceed PNID_OBJSTORE_MAX objects, or 0. */
+int
+pnid_objstore_reserve(PnidObjStore *store, size_t n)
+{
+  int res;
+
+  while (store->nfree + store->nslabs * SLAB - store->top < n)
+    if ((res = grow(store)) < 0)
+      return res;
+
+  return 0;
+}
+
+/* pnid_objstore_alloc(): allocate a zeroed object. Returns NULL if
+   out of memory or the store is full. */
+PnidObj *
+pnid_objstore_alloc(PnidObjStore *store)
+{
+  struct slot *s;
+  uint32_t i;
+
+  if (store->free != NIL) {
+    i = store->free;
+    s = slot(store, i);
+    store->free = s->link;
+    store->nfree--;
+  } else {
+    if (store->top == store->nslabs * SLAB && grow(store) < 0)
+      return NULL;
+    i = store->top++;
+    s = slot(store, i);
+    s->gen = 0;
+  }
+
+  memset(&s->obj, 0, sizeof s->obj);
+  if (!(s->gen = (s->gen + 1) & GENMASK))
+    s->gen = 1;
+  s->link = i;
+  store->len++;
+
+  return &s->obj;
+}
+
+/* pnid_objstore_add(): allocate a copy of obj. Returns NULL if out
+   of memory or the store is full. */
+PnidObj *
+pnid_objstore_add(PnidObjStore *store, const PnidObj *obj)
+{
+  PnidObj *new;
+
+  if ((new = pnid_objstore_alloc(store)))
+    *new = *obj;
+
+  return new;
+}
+
+/* pnid_objstore_release(): return obj, which must be held by store,
+   for reuse. Its handles go stale. */
+void
+pnid_objstore_release(PnidObjStore *store, PnidObj *obj)
+{
+  struct slot *s = (struct slot *)obj;
+  uint32_t i;
+
+  if (!obj)
+    return;
+
+  i = s->link;
+  s->link = store->free;
+  store->free = i;
+  store->nfree++;
+  store->len--;
+}
+
+/*********************
+ * Handles
+*******************/
+
+/* pnid_objstore_handle(): the handle of obj, which must be held by
+   store */
+PnidObjHandle
+pnid_objstore_handle(const PnidObjStore *store, const PnidObj *obj)
+{
+  const struct slot *s = (const struct slot *)obj;
+
+  return s->gen << PNID_OBJSTORE_INDEX_BITS | s->link;
+}
+
+/* pnid_objstore_get(): the object handle refers to. Returns NULL if
+   it has been released. */
+PnidObj *
+pnid_objstore_get(const PnidObjStore *store, PnidObjHandle handle)
+{
+  uint32_t i = PNID_OBJ_HANDLE_SLOT(handle);
+  struct slot *s;
+
+  if (handle == PNID_OBJ_HANDLE_NONE || i >= store->top)
+    return NULL;
+  s = slot(store, i);
+  if (s->link != i || s->gen != handle >> PNID_OBJSTORE_INDEX_BITS)
+    return NULL;
+
+  return &s->obj;
+}
+
+/* pnid_objstore_at(): the object held in slot i, whatever its
+   generation. Returns NULL if the slot is free. */
+PnidObj *
+pnid_objstore_at(const PnidObjStore *store, uint32_t i)
+{
+  struct slot *s;
+
+  if (i >= store->top)
+    return NULL;
+  s = slot(store, i);
+
+  return s->link == i ? &s->obj : NULL;
+}
+
+/*********************
+ * Iteration
+*******************/
+
+/* pnid_objstore_len(): the number of objects held */
+size_t
+pnid_objstore_len(const PnidObjStore *store)
+{
+  return store->len;
+}
+
+/* pnid_objstore_slots(): one past the highest slot ever used, the
+   bound of the slots pnid_objstore_at() may find an object in */
+uint32_t
+pnid_objstore_slots(const PnidObjStore *store)
+{
+  return store->top;
+}
+
+/* pnid_objstore_foreach(): call func with each object held, slab by
+   slab */
+void
+pnid_objstore_foreach(PnidObjStore *store, PnidObjStoreFunc func, void *data)
+{
+  struct slot *s;
+  uint32_t i, j, n;
+
+  for (i = 0; i < store->nslabs; i++) {
+    n = i * SLAB + SLAB > store->top ? store->top - i * SLAB : SLAB;
+    for (j = 0, s = store->slabs[i]; j < n; j++, s++)
+      if (s->link == i * SLAB + j)
+	func(&s->obj, data);
+  }
+}
+
+/*********************
+ * Utilities
+*******************/
+
+/* grow(): add a slab. Returns -ENOMEM, -ENOSPC or 0. */
+static int
+grow(PnidObjStore *store)
+{
+  struct slot **slabs;
+  size_t cap;
+
+  if (store->nslabs * SLAB >= PNID_OBJSTORE_MAX)
+    return -ENOSPC;
+  if (store->nslabs == store->cap) {
+    cap = store->cap ? store->cap * 2 : 16;
+    if (!(slabs = realloc(store->slabs, cap * sizeof *slabs)))
+      return -ENOMEM;
+    store->slabs = slabs;
+    store->cap = cap;
+  }
+  if (!(store->slabs[store->nslabs] = malloc(SLAB * sizeof(struct slot))))
+    return -ENOMEM;
+  store->nslabs++;
+
+  return 0;
+}
+
+/* slot(): the slot numbered i */
+static struct slot *
+slot(const PnidObjStore *store, uint32_t i)
+{
+  return &store->slabs[i >> PNID_OBJSTORE_SLAB_BITS][i & (SLAB - 1)];
+}
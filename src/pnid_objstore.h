@@ -0,0 +1,54 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_objstore.h - slab allocated pnid objects with handles */
+
+#ifndef __PNID_OBJSTORE_H
+#define __PNID_OBJSTORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pnid_obj.h"
+
+#define PNID_OBJSTORE_SLAB_BITS  12 /* log2 objects per slab */
+#define PNID_OBJSTORE_INDEX_BITS 24 /* log2 objects per store */
+#define PNID_OBJSTORE_MAX        (1u << PNID_OBJSTORE_INDEX_BITS)
+
+/* PnidObjHandle: a 32 bit reference to an object of a store, the
+   slot index in the low PNID_OBJSTORE_INDEX_BITS and the slot's
+   generation above. A handle goes stale once its object is released,
+   even if the slot is reused, until the generation wraps. */
+typedef uint32_t PnidObjHandle;
+#define PNID_OBJ_HANDLE_NONE 0
+#define PNID_OBJ_HANDLE_SLOT(h) ((h) & (PNID_OBJSTORE_MAX - 1))
+
+/* #PnidObjStore: objects allocated from contiguous slabs, whose
+   addresses do not change while they are held */
+typedef struct pnid_objstore PnidObjStore;
+
+/* pnid_objstore_func(): called with each object held in a store */
+typedef void (*PnidObjStoreFunc) (PnidObj *obj, void *data);
+
+/* Create and destroy a store, and every object held in it */
+PnidObjStore  *pnid_objstore_new(void);
+void           pnid_objstore_destroy(PnidObjStore *store);
+
+/* Allocate and release objects */
+int            pnid_objstore_reserve(PnidObjStore *store, size_t n);
+PnidObj       *pnid_objstore_alloc(PnidObjStore *store);
+PnidObj       *pnid_objstore_add(PnidObjStore *store, const PnidObj *obj);
+void           pnid_objstore_release(PnidObjStore *store, PnidObj *obj);
+
+/* Convert between objects and handles */
+PnidObjHandle  pnid_objstore_handle(const PnidObjStore *store, const PnidObj *obj);
+PnidObj       *pnid_objstore_get(const PnidObjStore *store, PnidObjHandle handle);
+PnidObj       *pnid_objstore_at(const PnidObjStore *store, uint32_t i);
+
+/* Visit the objects held, in memory order */
+size_t         pnid_objstore_len(const PnidObjStore *store);
+uint32_t       pnid_objstore_slots(const PnidObjStore *store);
+void           pnid_objstore_foreach(PnidObjStore *store, PnidObjStoreFunc func, void *data);
+
+#endif /* __PNID_OBJSTORE_H */
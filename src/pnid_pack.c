@@ -0,0 +1,513 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_pack.c - chunked, compressed pnid drawing files
+
+   A packed drawing holds the records of a drawing file in chunks of
+   PNID_PACK_CHUNK objects, each compressed separately with zlib. The
+   objects are sorted into chunks by sort-tile-recursive packing, as
+   the leaves of a bulk loaded r-tree are, so that each chunk covers a
+   small, compact area of the drawing. An index of the chunks'
+   bounding boxes follows them, which is read into an r-tree when the
+   file is opened. Only the chunks overlapping a region need then be
+   read and decompressed to show it, so a drawing far larger than
+   memory opens at once.
+
+   Each chunk carries its own string table, of no more than
+   PNID_PACK_STRINGS bytes, so that it can be read without any
+   other. */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_rtree.h"
+#include "pnid_file.h"
+#include "pnid_pack.h"
+
+#define ALIGN  8		/* alignment of chunk index */
+#define BUFLEN 65536		/* bytes converted at once */
+
+struct pnid_pack {
+  int                     fd;
+  struct pnid_pack_header hdr;
+  struct pnid_pack_entry *entries;
+  PnidRtree              *index;	/* of chunk proxies, id is chunk */
+};
+
+/* query: a pnid_pack_query() in progress */
+struct query {
+  PnidPackFunc  func;
+  void         *data;
+};
+
+static int      write_chunk(const PnidFile *file, const size_t *recs, size_t n, FILE *fp,
+			    struct pnid_pack_entry *e);
+static int      convert(GConverter *conv, const void *in, size_t len, GByteArray *out,
+			size_t max);
+static int      validate(const struct pnid_pack_header *hdr, const struct pnid_pack_entry *e,
+			 size_t size);
+static void     query_chunk(PnidObj *proxy, void *data);
+static int      cmpx(gconstpointer a, gconstpointer b, gpointer data);
+static int      cmpy(gconstpointer a, gconstpointer b, gpointer data);
+
+/*********************
+ * Writing
+*******************/
+
+/* pnid_pack_write(): pack the records of file into a new packed
+   drawing at path, replacing any file there once it is complete.
+   Returns 0 or -errno, -EFBIG if a chunk's strings will not fit. */
+int
+pnid_pack_write(const PnidFile *file, const char *path)
+{
+  struct pnid_pack_header hdr = { 0 };
+  struct pnid_pack_entry *entries;
+  size_t i, j, n, chunks, slabs, slab, len;
+  size_t *recs;
+  char *tmp;
+  FILE *fp;
+  long pos;
+  int res = 0;
+
+  n = pnid_file_len(file);
+  chunks = (n + PNID_PACK_CHUNK - 1) / PNID_PACK_CHUNK;
+  if (chunks > UINT32_MAX)
+    return -EFBIG;
+  recs = g_new(size_t, MAX(n, 1));
+  entries = g_new0(struct pnid_pack_entry, MAX(chunks, 1));
+  for (i = 0; i < n; i++)
+    recs[i] = i;
+
+  /* sort-tile-recursive: vertical slabs of whole chunks by centre x,
+     each sorted by centre y and cut into chunks */
+  slabs = ceil(sqrt(chunks));
+  slab = slabs ? ((chunks + slabs - 1) / slabs) * PNID_PACK_CHUNK : n;
+  g_qsort_with_data(recs, n, sizeof *recs, cmpx, (gpointer)file);
+  for (i = 0; i < n; i += slab)
+    g_qsort_with_data(recs + i, MIN(slab, n - i), sizeof *recs, cmpy, (gpointer)file);
+
+  tmp = g_strconcat(path, ".tmp", NULL);
+  if (!(fp = fopen(tmp, "wbe"))) {
+    res = -errno;
+    goto out;
+  }
+
+  /* placeholder, completed once the chunks are written */
+  if (fwrite(&hdr, sizeof hdr, 1, fp) != 1) {
+    res = -EIO;
+    goto fail;
+  }
+  for (i = j = 0; i < n; i += len, j++) {
+    len = MIN(PNID_PACK_CHUNK, n - i);
+    if ((res = write_chunk(file, recs + i, len, fp, &entries[j])) < 0)
+      goto fail;
+  }
+
+  if ((pos = ftell(fp)) < 0) {
+    res = -errno;
+    goto fail;
+  }
+  pos += (ALIGN - pos % ALIGN) % ALIGN;
+  memcpy(hdr.magic, PNID_PACK_MAGIC, sizeof hdr.magic);
+  hdr.version = PNID_PACK_VERSION;
+  hdr.byteorder = PNID_PACK_BYTEORDER;
+  hdr.entry_size = sizeof(struct pnid_pack_entry);
+  hdr.record_size = sizeof(struct pnid_file_record);
+  hdr.nchunks = chunks;
+  for (i = 0; i < n; i++)
+    hdr.next_id = MAX(hdr.next_id, pnid_file_record(file, i)->id + 1);
+  hdr.nobjs = n;
+  hdr.index = pos;
+  if (fseek(fp, pos, SEEK_SET) < 0
+      || fwrite(entries, sizeof *entries, chunks, fp) != chunks
+      || fseek(fp, 0, SEEK_SET) < 0
+      || fwrite(&hdr, sizeof hdr, 1, fp) != 1
+      || fflush(fp) == EOF) {
+    res = -EIO;
+    goto fail;
+  }
+  if (fsync(fileno(fp)) < 0) {
+    res = -errno;
+    goto fail;
+  }
+  if (fclose(fp) == EOF) {
+    res = -errno;
+    fp = NULL;
+    goto fail;
+  }
+  fp = NULL;
+  if (rename(tmp, path) < 0) {
+    res = -errno;
+    goto fail;
+  }
+  goto out;
+
+ fail:
+  if (fp)
+    fclose(fp);
+  unlink(tmp);
+ out:
+  g_free(tmp);
+  g_free(entries);
+  g_free(recs);
+  return res;
+}
+
+/* write_chunk(): compress the n records numbered in recs, with their
+   strings, and append them to fp, filling in their index entry */
+static int
+write_chunk(const PnidFile *file, const size_t *recs, size_t n, FILE *fp,
+	    struct pnid_pack_entry *e)
+{
+  struct pnid_pack_chunk chunk = { 0 };
+  struct pnid_file_record *out;
+  const struct pnid_file_record *r;
+  GByteArray *raw, *strings, *packed;
+  GHashTable *offsets;		/* string -> offset + 1 */
+  GZlibCompressor *zlib;
+  const char *s;
+  gpointer off;
+  size_t i;
+  long pos;
+  int k, res = 0;
+
+  raw = g_byte_array_new();
+  strings = g_byte_array_new();
+  packed = g_byte_array_new();
+  offsets = g_hash_table_new(g_str_hash, g_str_equal);
+  g_byte_array_append(strings, (const guint8 *)"", 1);
+
+  chunk.n = n;
+  g_byte_array_append(raw, (const guint8 *)&chunk, sizeof chunk);
+  g_byte_array_set_size(raw, sizeof chunk + n * sizeof *out);
+  out = (struct pnid_file_record *)(raw->data + sizeof chunk);
+  for (i = 0; i < n; i++) {
+    r = pnid_file_record(file, recs[i]);
+    out[i] = *r;
+    for (k = 0; k < PNID_N_ATTRS; k++) {
+      if (!(s = pnid_file_string(file, r->attr[k]))) {
+	out[i].attr[k] = 0;
+      } else if ((off = g_hash_table_lookup(offsets, s))) {
+	out[i].attr[k] = GPOINTER_TO_UINT(off) - 1;
+      } else {
+	out[i].attr[k] = strings->len;
+	g_hash_table_insert(offsets, (gpointer)s, GUINT_TO_POINTER(strings->len + 1));
+	g_byte_array_append(strings, (const guint8 *)s, strlen(s) + 1);
+      }
+    }
+    if (i) {
+      e->left = MIN(e->left, r->left);
+      e->top = MIN(e->top, r->top);
+      e->right = MAX(e->right, r->right);
+      e->bottom = MAX(e->bottom, r->bottom);
+    } else {
+      e->left = r->left;
+      e->top = r->top;
+      e->right = r->right;
+      e->bottom = r->bottom;
+    }
+  }
+  if (strings->len > PNID_PACK_STRINGS) {
+    res = -EFBIG;
+    goto out;
+  }
+  ((struct pnid_pack_chunk *)raw->data)->strings_size = strings->len;
+  g_byte_array_append(raw, strings->data, strings->len);
+
+  zlib = g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB, -1);
+  res = convert(G_CONVERTER(zlib), raw->data, raw->len, packed, G_MAXSIZE);
+  g_object_unref(zlib);
+  if (res < 0)
+    goto out;
+
+  if ((pos = ftell(fp)) < 0) {
+    res = -errno;
+    goto out;
+  }
+  e->offset = pos;
+  e->size = packed->len;
+  e->usize = raw->len;
+  e->n = n;
+  if (fwrite(packed->data, 1, packed->len, fp) != packed->len)
+    res = -EIO;
+
+ out:
+  g_hash_table_destroy(offsets);
+  g_byte_array_unref(packed);
+  g_byte_array_unref(strings);
+  g_byte_array_unref(raw);
+  return res;
+}
+
+/* convert(): run the len bytes at in through conv to its end,
+   appending the output to out. Returns 0 or -EPROTO, also if the
+   output would grow out beyond max bytes. */
+static int
+convert(GConverter *conv, const void *in, size_t len, GByteArray *out, size_t max)
+{
+  GConverterResult r;
+  GError *error = NULL;
+  gsize read, written;
+  guint8 buf[BUFLEN];
+
+  do {
+    r = g_converter_convert(conv, in, len, buf, sizeof buf, G_CONVERTER_INPUT_AT_END,
+			    &read, &written, &error);
+    if (r == G_CONVERTER_ERROR) {
+      g_error_free(error);
+      return -EPROTO;
+    }
+    if (written > max - out->len)
+      return -EPROTO;
+    in = (const char *)in + read;
+    len -= read;
+    g_byte_array_append(out, buf, written);
+  } while (r != G_CONVERTER_FINISHED);
+
+  return 0;
+}
+
+/* cmpx(): order record numbers by the centre x of their records */
+static int
+cmpx(gconstpointer a, gconstpointer b, gpointer data)
+{
+  const struct pnid_file_record *ra, *rb;
+
+  ra = pnid_file_record(data, *(const size_t *)a);
+  rb = pnid_file_record(data, *(const size_t *)b);
+  return ((uint64_t)ra->left + ra->right > (uint64_t)rb->left + rb->right)
+    - ((uint64_t)ra->left + ra->right < (uint64_t)rb->left + rb->right);
+}
+
+/* cmpy(): order record numbers by the centre y of their records */
+static int
+cmpy(gconstpointer a, gconstpointer b, gpointer data)
+{
+  const struct pnid_file_record *ra, *rb;
+
+  ra = pnid_file_record(data, *(const size_t *)a);
+  rb = pnid_file_record(data, *(const size_t *)b);
+  return ((uint64_t)ra->top + ra->bottom > (uint64_t)rb->top + rb->bottom)
+    - ((uint64_t)ra->top + ra->bottom < (uint64_t)rb->top + rb->bottom);
+}
+
+/*********************
+ * Reading
+*******************/
+
+/* pnid_pack_open(): open the packed drawing at path and read its
+   chunk index, returns 0 or -errno, -EPROTO if it is not a packed
+   drawing this build reads */
+int
+pnid_pack_open(const char *path, PnidPack **pack)
+{
+  struct pnid_pack *p;
+  struct stat st;
+  PnidObj **proxies;
+  size_t len;
+  unsigned i;
+  int res;
+
+  p = g_new0(struct pnid_pack, 1);
+  if ((p->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+    res = -errno;
+    g_free(p);
+    return res;
+  }
+  if (fstat(p->fd, &st) < 0) {
+    res = -errno;
+    goto fail;
+  }
+  if (pread(p->fd, &p->hdr, sizeof p->hdr, 0) != sizeof p->hdr
+      || (res = validate(&p->hdr, NULL, st.st_size)) < 0) {
+    res = -EPROTO;
+    goto fail;
+  }
+
+  len = (size_t)p->hdr.nchunks * sizeof *p->entries;
+  p->entries = g_new(struct pnid_pack_entry, MAX(p->hdr.nchunks, 1));
+  if (pread(p->fd, p->entries, len, p->hdr.index) != (ssize_t)len) {
+    res = -EPROTO;
+    goto fail;
+  }
+  for (i = 0; i < p->hdr.nchunks; i++)
+    if ((res = validate(&p->hdr, &p->entries[i], st.st_size)) < 0)
+      goto fail;
+
+  /* the chunks' boxes are indexed as objects standing in for them */
+  p->index = pnid_rtree_new();
+  proxies = g_new(PnidObj *, MAX(p->hdr.nchunks, 1));
+  for (i = 0; i < p->hdr.nchunks; i++) {
+    proxies[i] = pnid_obj_new();
+    proxies[i]->bbox = (PnidBox){{p->entries[i].left, p->entries[i].top},
+				 {p->entries[i].right, p->entries[i].bottom}};
+    proxies[i]->id = i;
+  }
+  res = pnid_rtree_load(p->index, proxies, p->hdr.nchunks);
+  g_free(proxies);
+  if (res < 0)
+    goto fail;
+
+  *pack = p;
+  return 0;
+
+ fail:
+  pnid_pack_close(p);
+  return res;
+}
+
+/* pnid_pack_close(): close pack, objects read from it remain valid */
+void
+pnid_pack_close(PnidPack *pack)
+{
+  if (!pack)
+    return;
+  close(pack->fd);
+  if (pack->index)
+    pnid_rtree_destroy(pack->index);
+  g_free(pack->entries);
+  g_free(pack);
+}
+
+/* pnid_pack_len(): number of chunks in pack */
+unsigned
+pnid_pack_len(const PnidPack *pack)
+{
+  return pack->hdr.nchunks;
+}
+
+/* pnid_pack_objects(): number of objects in pack */
+size_t
+pnid_pack_objects(const PnidPack *pack)
+{
+  return pack->hdr.nobjs;
+}
+
+/* pnid_pack_next_id(): an id above that of every object in pack, so
+   that new objects do not collide with those of unread chunks */
+unsigned
+pnid_pack_next_id(const PnidPack *pack)
+{
+  return pack->hdr.next_id;
+}
+
+/* pnid_pack_query(): call func with each chunk whose objects may
+   overlap region. Returns the number of index nodes entered. Not to
+   be called from more than one thread at once. */
+int
+pnid_pack_query(PnidPack *pack, const PnidBox *region, PnidPackFunc func, void *data)
+{
+  struct query q = { func, data };
+
+  return pnid_rtree_walk(pack->index, region, NULL, query_chunk, &q);
+}
+
+/* query_chunk(): #PnidRtreeTupleFunc, a chunk's proxy was found */
+static void
+query_chunk(PnidObj *proxy, void *data)
+{
+  struct query *q = data;
+
+  q->func(proxy->id, q->data);
+}
+
+/* pnid_pack_read(): read and decompress a chunk into new objects,
+   their attributes in strings. Returns 0 or -errno, -EPROTO if the
+   chunk is corrupt. */
+int
+pnid_pack_read(PnidPack *pack, unsigned chunk, PnidObj ***objs, size_t *n,
+	       GStringChunk **strings)
+{
+  const struct pnid_pack_entry *e;
+  const struct pnid_pack_chunk *c;
+  const struct pnid_file_record *r;
+  GZlibDecompressor *zlib;
+  GByteArray *raw;
+  const char *table;
+  guint8 *packed;
+  PnidObj **o;
+  size_t i;
+  int k, res;
+
+  g_return_val_if_fail(chunk < pack->hdr.nchunks, -EINVAL);
+  e = &pack->entries[chunk];
+
+  packed = g_malloc(e->size);
+  if (pread(pack->fd, packed, e->size, e->offset) != (ssize_t)e->size) {
+    g_free(packed);
+    return -EIO;
+  }
+  raw = g_byte_array_sized_new(e->usize);
+  zlib = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+  res = convert(G_CONVERTER(zlib), packed, e->size, raw, e->usize);
+  g_object_unref(zlib);
+  g_free(packed);
+
+  c = (const void *)raw->data;
+  if (res < 0 || raw->len != e->usize || raw->len < sizeof *c || c->n != e->n
+      || raw->len != sizeof *c + (size_t)c->n * sizeof *r + c->strings_size
+      || !c->strings_size) {
+    g_byte_array_unref(raw);
+    return -EPROTO;
+  }
+  r = (const void *)(c + 1);
+  table = (const char *)(r + c->n);
+  if (table[0] || table[c->strings_size - 1]) {
+    g_byte_array_unref(raw);
+    return -EPROTO;
+  }
+
+  o = g_new(PnidObj *, MAX(c->n, 1));
+  *strings = g_string_chunk_new(MAX(c->strings_size, 64));
+  for (i = 0; i < c->n; i++, r++) {
+    o[i] = pnid_obj_new();
+    o[i]->bbox = (PnidBox){{r->left, r->top}, {r->right, r->bottom}};
+    o[i]->id = r->id;
+    o[i]->type = r->type;
+    o[i]->symbol = r->symbol;
+    for (k = 0; k < PNID_N_ATTRS; k++)
+      if (r->attr[k] && r->attr[k] < c->strings_size)
+	o[i]->attr[k] = g_string_chunk_insert_const(*strings, table + r->attr[k]);
+  }
+  *objs = o;
+  *n = c->n;
+
+  g_byte_array_unref(raw);
+  return 0;
+}
+
+/* validate(): check the header, or an entry e if not NULL, describes
+   a file of size bytes */
+static int
+validate(const struct pnid_pack_header *hdr, const struct pnid_pack_entry *e,
+	 size_t size)
+{
+  if (e)
+    return e->offset > size || e->size > size - e->offset || !e->size
+      || e->n > PNID_PACK_CHUNK
+      || e->usize > sizeof(struct pnid_pack_chunk)
+		    + e->n * sizeof(struct pnid_file_record) + PNID_PACK_STRINGS
+      ? -EPROTO : 0;
+
+  if (memcmp(hdr->magic, PNID_PACK_MAGIC, sizeof hdr->magic)
+      || hdr->version != PNID_PACK_VERSION
+      || hdr->byteorder != PNID_PACK_BYTEORDER
+      || hdr->entry_size != sizeof(struct pnid_pack_entry)
+      || hdr->record_size != sizeof(struct pnid_file_record))
+    return -EPROTO;
+  if (hdr->index % ALIGN || hdr->index > size
+      || hdr->nchunks > (size - hdr->index) / hdr->entry_size)
+    return -EPROTO;
+
+  return 0;
+}
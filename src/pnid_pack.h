@@ -0,0 +1,87 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_pack.h - chunked, compressed pnid drawing files */
+
+#ifndef __PNID_PACK_H
+#define __PNID_PACK_H
+
+#include <glib.h>
+#include <stdint.h>
+
+#include "pnid_obj.h"
+#include "pnid_file.h"
+
+#define PNID_PACK_MAGIC     "PNIZ"
+#define PNID_PACK_VERSION   1
+#define PNID_PACK_BYTEORDER PNID_FILE_BYTEORDER
+#define PNID_PACK_EXT       ".pnidz"
+#define PNID_PACK_CHUNK     1024 /* objects per chunk */
+#define PNID_PACK_STRINGS   (16u << 20) /* string bytes per chunk */
+
+/* pnid_pack_header: at the start of the file, offsets are in bytes
+   from the start of the file */
+struct pnid_pack_header {
+  char     magic[4];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t entry_size;		/* sizeof(struct pnid_pack_entry) */
+  uint32_t record_size;		/* sizeof(struct pnid_file_record) */
+  uint32_t nchunks;
+  uint32_t next_id;		/* above every object id */
+  uint32_t reserved;
+  uint64_t nobjs;
+  uint64_t index;		/* offset of entry array */
+};
+
+/* pnid_pack_entry: the index entry of a chunk, the bounding box of
+   its objects and where its compressed data lies */
+struct pnid_pack_entry {
+  uint32_t left;
+  uint32_t top;
+  uint32_t right;
+  uint32_t bottom;
+  uint64_t offset;
+  uint32_t size;		/* compressed */
+  uint32_t usize;		/* uncompressed */
+  uint32_t n;			/* objects */
+  uint32_t pad;
+};
+
+/* pnid_pack_chunk: the start of a chunk once decompressed, followed by
+   n records as in a drawing file and a string table of strings_size
+   bytes, to which their attributes are offsets */
+struct pnid_pack_chunk {
+  uint32_t n;
+  uint32_t strings_size;
+};
+
+/* #PnidPack: a packed drawing open for reading chunks on demand. The
+   chunk index is held in memory, chunks are read and decompressed by
+   pnid_pack_read(), which may be called from any thread. */
+typedef struct pnid_pack PnidPack;
+
+/* pnid_pack_func(): called with each chunk found by a query */
+typedef void (*PnidPackFunc) (unsigned chunk, void *data);
+
+/* Pack a drawing file into spatially coherent chunks */
+int      pnid_pack_write(const PnidFile *file, const char *path);
+
+/* Open and close a packed drawing */
+int      pnid_pack_open(const char *path, PnidPack **pack);
+void     pnid_pack_close(PnidPack *pack);
+
+/* The chunk index */
+unsigned pnid_pack_len(const PnidPack *pack);
+size_t   pnid_pack_objects(const PnidPack *pack);
+unsigned pnid_pack_next_id(const PnidPack *pack);
+int      pnid_pack_query(PnidPack *pack, const PnidBox *region, PnidPackFunc func,
+			 void *data);
+
+/* Read the objects of a chunk, the caller owns the objects, the objs
+   array and strings, which holds their attributes */
+int      pnid_pack_read(PnidPack *pack, unsigned chunk, PnidObj ***objs, size_t *n,
+			GStringChunk **strings);
+
+#endif /* __PNID_PACK_H */
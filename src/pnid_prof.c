@@ -0,0 +1,185 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_prof.c - frame profiler recording phase times and event
+   counts into a ring buffer of the most recent frames. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include "pnid_prof.h"
+
+static double now(void);
+
+static const char *phase_names[PNID_PROF_N_PHASES] = {
+  "background", "query", "objects", "composite"
+};
+static const char *counter_names[PNID_PROF_N_COUNTERS] = {
+  "drawn", "tile_hit", "tile_miss", "nodes"
+};
+
+/* pnid_prof_new(): create a disabled profiler keeping the last len
+   frames. Returns NULL on error. */
+PnidProf *
+pnid_prof_new(size_t len)
+{
+  PnidProf *p;
+
+  if (!len || !(p = calloc(1, sizeof *p)))
+    return NULL;
+  if (!(p->frames = calloc(len, sizeof *p->frames))) {
+    free(p);
+    return NULL;
+  }
+  p->len = len;
+  p->epoch = now();
+
+  return p;
+}
+
+/* pnid_prof_destroy(): free the profiler and its frames */
+void
+pnid_prof_destroy(PnidProf *p)
+{
+  if (!p)
+    return;
+  free(p->frames);
+  free(p);
+}
+
+/* pnid_prof_enable(): start or stop recording frames, a frame in
+   progress is abandoned when disabled. */
+void
+pnid_prof_enable(PnidProf *p, int enabled)
+{
+  p->enabled = enabled;
+  p->in_frame = 0;
+}
+
+/* pnid_prof_frame_begin(): start recording a new frame into the
+   ring, replacing the oldest when it is full. */
+void
+pnid_prof_frame_begin(PnidProf *p)
+{
+  struct pnid_prof_frame *f = &p->frames[p->head];
+
+  memset(f, 0, sizeof *f);
+  f->start = now() - p->epoch;
+  p->in_frame = 1;
+}
+
+/* pnid_prof_frame_end(): complete the current frame */
+void
+pnid_prof_frame_end(PnidProf *p)
+{
+  if (!p->in_frame)
+    return;
+
+  p->frames[p->head].total = now() - p->epoch - p->frames[p->head].start;
+  p->head = (p->head + 1) % p->len;
+  if (p->n < p->len)
+    p->n++;
+  p->in_frame = 0;
+}
+
+/* pnid_prof_begin(): start timing phase, the time until the matching
+   pnid_prof_end() is added to the phase's total for the frame. */
+void
+pnid_prof_begin(PnidProf *p, enum pnid_prof_phase phase)
+{
+  p->t0[phase] = now();
+}
+
+/* pnid_prof_end(): stop timing phase */
+void
+pnid_prof_end(PnidProf *p, enum pnid_prof_phase phase)
+{
+  if (p->in_frame)
+    p->frames[p->head].phase[phase] += now() - p->t0[phase];
+}
+
+/* pnid_prof_count(): add n events to counter for the frame */
+void
+pnid_prof_count(PnidProf *p, enum pnid_prof_counter counter, unsigned long n)
+{
+  if (p->in_frame)
+    p->frames[p->head].count[counter] += n;
+}
+
+/* pnid_prof_last(): the most recently completed frame, NULL if none
+   have been recorded. */
+const struct pnid_prof_frame *
+pnid_prof_last(const PnidProf *p)
+{
+  return p->n ? &p->frames[(p->head + p->len - 1) % p->len] : NULL;
+}
+
+/* pnid_prof_mean(): the mean of every frame in the ring. Returns less
+   than zero if none have been recorded. */
+int
+pnid_prof_mean(const PnidProf *p, struct pnid_prof_frame *mean)
+{
+  size_t i, j;
+
+  if (!p->n)
+    return -ENODATA;
+
+  memset(mean, 0, sizeof *mean);
+  for (i = 0; i < p->n; i++) {
+    mean->total += p->frames[i].total;
+    for (j = 0; j < PNID_PROF_N_PHASES; j++)
+      mean->phase[j] += p->frames[i].phase[j];
+    for (j = 0; j < PNID_PROF_N_COUNTERS; j++)
+      mean->count[j] += p->frames[i].count[j];
+  }
+
+  mean->total /= p->n;
+  for (j = 0; j < PNID_PROF_N_PHASES; j++)
+    mean->phase[j] /= p->n;
+  for (j = 0; j < PNID_PROF_N_COUNTERS; j++)
+    mean->count[j] /= p->n;
+
+  return 0;
+}
+
+/* pnid_prof_dump(): write the ring to f as comma separated values,
+   oldest frame first. Returns less than zero on error. */
+int
+pnid_prof_dump(const PnidProf *p, FILE *f)
+{
+  const struct pnid_prof_frame *fr;
+  size_t i, j;
+
+  fputs("start_us,total_us", f);
+  for (j = 0; j < PNID_PROF_N_PHASES; j++)
+    fprintf(f, ",%s_us", phase_names[j]);
+  for (j = 0; j < PNID_PROF_N_COUNTERS; j++)
+    fprintf(f, ",%s", counter_names[j]);
+  fputc('\n', f);
+
+  for (i = 0; i < p->n; i++) {
+    fr = &p->frames[(p->head + p->len - p->n + i) % p->len];
+    fprintf(f, "%.0f,%.1f", fr->start, fr->total);
+    for (j = 0; j < PNID_PROF_N_PHASES; j++)
+      fprintf(f, ",%.1f", fr->phase[j]);
+    for (j = 0; j < PNID_PROF_N_COUNTERS; j++)
+      fprintf(f, ",%lu", fr->count[j]);
+    fputc('\n', f);
+  }
+
+  return ferror(f) ? -EIO : 0;
+}
+
+/* now(): monotonic time in microseconds */
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
@@ -0,0 +1,81 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_prof.h - frame profiling of the drawing hot paths */
+
+#ifndef __PNID_PROF_H
+#define __PNID_PROF_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* pnid_prof_phase: timed stages of a frame */
+enum pnid_prof_phase {
+  PNID_PROF_BACKGROUND = 0,	/* page and background painting */
+  PNID_PROF_QUERY,		/* spatial index query */
+  PNID_PROF_OBJECTS,		/* object drawing */
+  PNID_PROF_COMPOSITE,		/* compositing onto the widget */
+  PNID_PROF_N_PHASES
+};
+
+/* pnid_prof_counter: counted events of a frame */
+enum pnid_prof_counter {
+  PNID_PROF_DRAWN = 0,		/* objects drawn */
+  PNID_PROF_TILE_HIT,		/* cached renderings reused */
+  PNID_PROF_TILE_MISS,		/* cached renderings rebuilt */
+  PNID_PROF_NODES,		/* index nodes visited */
+  PNID_PROF_N_COUNTERS
+};
+
+/* pnid_prof_frame: a single profiled frame, times are in
+   microseconds. */
+struct pnid_prof_frame {
+  double        start;		/* since the profiler was created */
+  double        total;
+  double        phase[PNID_PROF_N_PHASES];
+  unsigned long count[PNID_PROF_N_COUNTERS];
+};
+
+/* #PnidProf: a ring buffer of the most recent frames. Only enabled
+   should be read directly, it is checked by the PNID_PROF_ macros
+   so that a disabled profiler costs a single branch. */
+typedef struct pnid_prof PnidProf;
+struct pnid_prof {
+  int                     enabled;
+  int                     in_frame;
+  struct pnid_prof_frame *frames;
+  size_t                  len;	/* ring size */
+  size_t                  head;	/* next frame to be written */
+  size_t                  n;	/* frames recorded */
+  double                  epoch;
+  double                  t0[PNID_PROF_N_PHASES];
+};
+
+#define PNID_PROF_ENABLED(p)       ((p) && (p)->enabled)
+#define PNID_PROF_FRAME_BEGIN(p)   do { if (PNID_PROF_ENABLED(p)) pnid_prof_frame_begin(p); } while (0)
+#define PNID_PROF_FRAME_END(p)     do { if (PNID_PROF_ENABLED(p)) pnid_prof_frame_end(p); } while (0)
+#define PNID_PROF_BEGIN(p, ph)     do { if (PNID_PROF_ENABLED(p)) pnid_prof_begin((p), (ph)); } while (0)
+#define PNID_PROF_END(p, ph)       do { if (PNID_PROF_ENABLED(p)) pnid_prof_end((p), (ph)); } while (0)
+#define PNID_PROF_COUNT(p, c, x)   do { if (PNID_PROF_ENABLED(p)) pnid_prof_count((p), (c), (x)); } while (0)
+
+/* Create and destroy a profiler holding up to len frames */
+PnidProf *pnid_prof_new(size_t len);
+void      pnid_prof_destroy(PnidProf *p);
+
+/* Enable or disable recording, recorded frames are kept */
+void      pnid_prof_enable(PnidProf *p, int enabled);
+
+/* Record a frame, prefer the PNID_PROF_ macros */
+void      pnid_prof_frame_begin(PnidProf *p);
+void      pnid_prof_frame_end(PnidProf *p);
+void      pnid_prof_begin(PnidProf *p, enum pnid_prof_phase phase);
+void      pnid_prof_end(PnidProf *p, enum pnid_prof_phase phase);
+void      pnid_prof_count(PnidProf *p, enum pnid_prof_counter counter, unsigned long n);
+
+/* Recorded frames */
+const struct pnid_prof_frame *pnid_prof_last(const PnidProf *p);
+int       pnid_prof_mean(const PnidProf *p, struct pnid_prof_frame *mean);
+int       pnid_prof_dump(const PnidProf *p, FILE *f);
+
+#endif /* __PNID_PROF_H */
@@ -0,0 +1,660 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_render.c - render pnid drawings to PNG, PDF and SVG
+
+   pnid-render [-j JOBS] [-M MB] [-T LIST] [-f FORMAT] [-p PAPER] [-l]
+	       [-m MARGIN] [-r DPI] [-R X,Y,WIDTH,HEIGHT] [-F] [-o OUTPUT]
+	       FILE...
+
+   Each FILE, with any edits journalled since it was last compacted,
+   is bulk loaded into an index and its page drawn onto a cairo image,
+   PDF or SVG surface. The result is written to FILE with its
+   extension replaced by the format's, or to OUTPUT when a single FILE
+   is given. The page is drawn by the same #PnidSheet code as the
+   canvas, but nothing here needs GTK or a display, so that drawings
+   can be rendered in bulk on headless machines.
+
+   Raster output is drawn at DPI with the canvas's level of detail.
+   Vector output draws every object, with symbols as paths, and DPI
+   only sets the resolution of any images. Lengths are in points and
+   the region, by default the whole page, is measured from the top
+   left of the page.
+
+   Drawings are rendered JOBS at once, by default one for each
+   processor, each worker taking the next drawing as it finishes the
+   last so that a few large drawings do not hold up the rest. Every
+   worker loads its own drawing, index and surface, and shapes labels
+   into its own text cache kept from one drawing to the next, while
+   the symbol cache is prepared once up front and only read after. A worker
+   waits to start a drawing until an estimate of the memory it needs
+   fits within MB alongside those being rendered, so that output is
+   written with bounded memory however many drawings are queued. FILE
+   may be a glob pattern, and further drawings listed one per line in
+   LIST. The time taken to load and to draw each drawing is
+   reported. */
+
+#include <cairo.h>
+#include <cairo-pdf.h>
+#include <cairo-svg.h>
+#include <errno.h>
+#include <glib.h>
+#include <glob.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_rtree.h"
+#include "pnid_symcache.h"
+#include "pnid_textcache.h"
+#include "pnid_sheet.h"
+#include "pnid_file.h"
+#include "pnid_journal.h"
+#include "pnid_import.h"
+#include "pnid_pack.h"
+
+#define RENDER_FILE_RATIO   2	/* bytes loaded per byte of drawing file */
+#define RENDER_PACKED_RATIO 8	/* and of packed drawing */
+#define RENDER_TEXT_BYTES   (4 << 20) /* labels cached by each worker */
+
+/* format: the surfaces rendered to */
+enum format {
+    FORMAT_PNG = 0,
+    FORMAT_PDF,
+    FORMAT_SVG
+};
+
+/* paper: a named paper size, portrait, in points */
+struct paper {
+    const char *name;
+    double      width;
+    double      height;
+};
+
+/* timing: how long rendering a drawing took, in microseconds */
+struct timing {
+    guint   objects;
+    gint64  load;		/* reading and indexing */
+    gint64  draw;		/* drawing and writing */
+};
+
+/* drawing: a drawing loaded to be rendered */
+struct drawing {
+    GHashTable *ids;		/* object id -> PnidObj, owned */
+    GPtrArray  *strings;	/* GStringChunk of the objects' attributes */
+    PnidFile   *file;		/* mapped drawing, holds object strings */
+    PnidRtree  *index;
+};
+
+static void render_job(gpointer data, gpointer user_data);
+static int  render(const char *path, const char *out, struct timing *t);
+static void draw(struct drawing *d, cairo_t *cr);
+static guint64 estimate(const char *path);
+static void reserve(guint64 bytes);
+static void release(guint64 bytes);
+static int  load(struct drawing *d, const char *path);
+static int  load_file(struct drawing *d, const char *path);
+static int  load_pack(struct drawing *d, const char *path);
+static int  load_batch(PnidObj **objs, size_t n, GStringChunk *strings, double progress,
+		       void *data);
+static void replay_entry(enum pnid_journal_op op, const PnidObj *obj, void *data);
+static void unload(struct drawing *d);
+static int  parse_format(const char *name, enum format *fmt);
+static int  parse_page(enum format fmt);
+static int  expand(GPtrArray *paths, int argc, char **argv);
+
+static const struct paper papers[] = {
+    { "a0", 2384, 3370 }, { "a1", 1684, 2384 }, { "a2", 1191, 1684 },
+    { "a3", 842, 1191 }, { "a4", 595, 842 }, { "letter", 612, 792 },
+    { "legal", 612, 1008 }, { "tabloid", 792, 1224 },
+};
+static const char *extensions[] = { ".png", ".pdf", ".svg" };
+
+static int       jobs = 0;
+static int       memory = 1024;
+static char     *list = NULL;
+static char     *format = NULL;
+static char     *paper = "a4";
+static int       landscape = 0;
+static double    margin = 18;
+static double    dpi = 150;
+static char     *region = NULL;
+static int       frame = 0;
+static char     *output = NULL;
+static enum format fmt = FORMAT_PDF;
+static PnidSheet sheet;
+static PnidBox   clip;		/* region of the page rendered */
+static PnidSymcache *symbols;	/* shared by every worker, read only */
+static GPrivate  texts = G_PRIVATE_INIT((GDestroyNotify)pnid_textcache_destroy);
+static int       failed = 0;
+static GMutex    budget_lock;
+static GCond     budget_cond;
+static guint64   budget;	/* bytes of drawings rendered at once */
+static guint64   in_flight;
+
+static GOptionEntry entries[] = {
+    { "jobs", 'j', 0, G_OPTION_ARG_INT, &jobs, "Render N drawings at once", "N" },
+    { "memory", 'M', 0, G_OPTION_ARG_INT, &memory,
+      "Megabytes of drawings held at once", "MB" },
+    { "list", 'T', 0, G_OPTION_ARG_FILENAME, &list,
+      "Also render the drawings listed in LIST, - for stdin", "LIST" },
+    { "format", 'f', 0, G_OPTION_ARG_STRING, &format, "png, pdf or svg", "FORMAT" },
+    { "paper", 'p', 0, G_OPTION_ARG_STRING, &paper,
+      "a0 to a4, letter, legal, tabloid or WIDTHxHEIGHT", "PAPER" },
+    { "landscape", 'l', 0, G_OPTION_ARG_NONE, &landscape, "Turn the paper sideways", NULL },
+    { "margin", 'm', 0, G_OPTION_ARG_DOUBLE, &margin, "Margin around the page", "MARGIN" },
+    { "dpi", 'r', 0, G_OPTION_ARG_DOUBLE, &dpi, "Device pixels per inch", "DPI" },
+    { "region", 'R', 0, G_OPTION_ARG_STRING, &region, "Part of the page to render",
+      "X,Y,WIDTH,HEIGHT" },
+    { "frame", 'F', 0, G_OPTION_ARG_NONE, &frame, "Outline the margins", NULL },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &output, "Write a single drawing to OUTPUT",
+      "OUTPUT" },
+    { NULL }
+};
+
+int main
+(int argc, char **argv)
+{
+    GOptionContext *context;
+    GThreadPool *pool;
+    GError *error = NULL;
+    GPtrArray *paths;
+    const char *ext;
+    gint64 start;
+    guint i;
+
+    context = g_option_context_new("FILE... - render drawings to PNG, PDF or SVG");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+	g_option_context_free(context);
+	return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if ((format && parse_format(format, &fmt) < 0)
+	|| (!format && output && (ext = strrchr(output, '.')) && parse_format(ext + 1, &fmt) < 0)) {
+	g_printerr("%s: not png, pdf or svg\n", format ? format : output);
+	return EXIT_FAILURE;
+    }
+    if (dpi <= 0 || parse_page(fmt) < 0)
+	return EXIT_FAILURE;
+
+    paths = g_ptr_array_new_with_free_func(g_free);
+    if (expand(paths, argc, argv) < 0) {
+	g_ptr_array_unref(paths);
+	return EXIT_FAILURE;
+    }
+    if (output && paths->len != 1) {
+	g_printerr("--output needs a single FILE\n");
+	g_ptr_array_unref(paths);
+	return EXIT_FAILURE;
+    }
+
+    /* prepared once, then only read by the workers */
+    if (!(symbols = pnid_symcache_new())) {
+	g_printerr("%s\n", g_strerror(ENOMEM));
+	g_ptr_array_unref(paths);
+	return EXIT_FAILURE;
+    }
+    if (!sheet.vector)
+	pnid_symcache_prepare(symbols, sheet.scale);
+
+    if (jobs <= 0)
+	jobs = g_get_num_processors();
+    budget = (guint64)MAX(memory, 1) << 20;
+    start = g_get_monotonic_time();
+    pool = g_thread_pool_new(render_job, NULL, jobs, TRUE, NULL);
+    for (i = 0; i < paths->len; i++)
+	g_thread_pool_push(pool, g_ptr_array_index(paths, i), NULL);
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    if (paths->len > 1)
+	g_print("%u drawings, %d failed, %.1f s\n", paths->len, g_atomic_int_get(&failed),
+		(g_get_monotonic_time() - start) / 1e6);
+    pnid_symcache_destroy(symbols);
+    g_ptr_array_unref(paths);
+
+    return g_atomic_int_get(&failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* render_job(): #GFunc, render the drawing at path data on a pool
+   thread once its memory can be reserved, reporting how long it
+   took */
+static void
+render_job(gpointer data, gpointer user_data)
+{
+    const char *path = data;
+    struct timing t = { 0 };
+    const char *ext;
+    guint64 bytes;
+    char *out;
+    int res;
+
+    if (output)
+	out = g_strdup(output);
+    else if ((ext = strrchr(path, '.')) && !strchr(ext, '/'))
+	out = g_strdup_printf("%.*s%s", (int)(ext - path), path, extensions[fmt]);
+    else
+	out = g_strconcat(path, extensions[fmt], NULL);
+
+    bytes = estimate(path);
+    reserve(bytes);
+    res = render(path, out, &t);
+    release(bytes);
+
+    if (res < 0) {
+	g_printerr("%s: %s\n", path, g_strerror(-res));
+	g_atomic_int_inc(&failed);
+    } else {
+	g_print("%s: %u objects, load %.1f ms, draw %.1f ms\n", out, t.objects,
+		t.load / 1e3, t.draw / 1e3);
+    }
+    g_free(out);
+}
+
+/* render(): render the drawing at path into out, noting the time
+   taken in t */
+static int
+render(const char *path, const char *out, struct timing *t)
+{
+    struct drawing d = { NULL };
+    cairo_surface_t *surface;
+    cairo_status_t status;
+    cairo_t *cr;
+    double width, height;
+    gint64 start;
+    int res;
+
+    start = g_get_monotonic_time();
+    if ((res = load(&d, path)) < 0) {
+	unload(&d);
+	return res;
+    }
+    t->objects = g_hash_table_size(d.ids);
+    t->load = g_get_monotonic_time() - start;
+
+    start = g_get_monotonic_time();
+    width = pnid_box_width(&clip);
+    height = pnid_box_height(&clip);
+    switch (fmt) {
+    case FORMAT_PNG:
+	surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
+					     ceil(width * sheet.scale), ceil(height * sheet.scale));
+	cairo_surface_set_device_scale(surface, sheet.scale, sheet.scale);
+	break;
+    case FORMAT_PDF:
+	surface = cairo_pdf_surface_create(out, width, height);
+	break;
+    case FORMAT_SVG:
+    default:
+	surface = cairo_svg_surface_create(out, width, height);
+	break;
+    }
+
+    cr = cairo_create(surface);
+    draw(&d, cr);
+    cairo_destroy(cr);
+    status = cairo_surface_status(surface);
+    if (!status && fmt == FORMAT_PNG)
+	status = cairo_surface_write_to_png(surface, out);
+    cairo_surface_finish(surface);
+    if (!status)
+	status = cairo_surface_status(surface);
+    if (status)
+	res = status == CAIRO_STATUS_NO_MEMORY ? -ENOMEM : -EIO;
+    cairo_surface_destroy(surface);
+    unload(&d);
+    t->draw = g_get_monotonic_time() - start;
+
+    return res;
+}
+
+/* draw(): draw the region of the page of d rendered onto cr */
+static void
+draw(struct drawing *d, cairo_t *cr)
+{
+    PnidSheet s = sheet;
+
+    /* labels shaped by this worker's own cache */
+    if (!(s.texts = g_private_get(&texts))) {
+	s.texts = pnid_textcache_new(RENDER_TEXT_BYTES);
+	g_private_set(&texts, s.texts);
+    }
+
+    cairo_translate(cr, -(double)pnid_box_get_left(&clip), -(double)pnid_box_get_top(&clip));
+    cairo_rectangle(cr, pnid_box_get_left(&clip), pnid_box_get_top(&clip),
+		    pnid_box_width(&clip), pnid_box_height(&clip));
+    cairo_clip(cr);
+    pnid_sheet_draw_page(&s, cr);
+    if (frame)
+	pnid_sheet_draw_margins(&s, cr);
+    pnid_sheet_draw(&s, cr, d->index, symbols, &clip);
+}
+
+/*********************
+ * Memory
+*******************/
+
+/* estimate(): roughly how many bytes rendering the drawing at path
+   holds at once, its objects and index and, for PNG, the image */
+static guint64
+estimate(const char *path)
+{
+    guint64 bytes = 0;
+    struct stat st;
+
+    if (stat(path, &st) == 0)
+	bytes = (guint64)st.st_size
+	    * (g_str_has_suffix(path, PNID_PACK_EXT) ? RENDER_PACKED_RATIO : RENDER_FILE_RATIO);
+    if (fmt == FORMAT_PNG)
+	bytes += (guint64)4 * ceil(pnid_box_width(&clip) * sheet.scale)
+	    * ceil(pnid_box_height(&clip) * sheet.scale);
+
+    return bytes;
+}
+
+/* reserve(): wait until bytes more fit within the memory budget, or
+   nothing else is being rendered, and take them */
+static void
+reserve(guint64 bytes)
+{
+    g_mutex_lock(&budget_lock);
+    while (in_flight && in_flight + bytes > budget)
+	g_cond_wait(&budget_cond, &budget_lock);
+    in_flight += bytes;
+    g_mutex_unlock(&budget_lock);
+}
+
+/* release(): return bytes taken by reserve() to the budget */
+static void
+release(guint64 bytes)
+{
+    g_mutex_lock(&budget_lock);
+    in_flight -= bytes;
+    g_cond_broadcast(&budget_cond);
+    g_mutex_unlock(&budget_lock);
+}
+
+/*********************
+ * Loading
+*******************/
+
+/* load(): read the drawing at path into d and index it. Returns 0 or
+   -errno. */
+static int
+load(struct drawing *d, const char *path)
+{
+    GHashTableIter iter;
+    PnidObj **objs;
+    gpointer obj;
+    size_t n = 0;
+    int res;
+
+    d->ids = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+				   (GDestroyNotify)pnid_obj_delete);
+    d->strings = g_ptr_array_new_with_free_func((GDestroyNotify)g_string_chunk_free);
+
+    if (g_str_has_suffix(path, PNID_PACK_EXT))
+	res = load_pack(d, path);
+    else if (pnid_import_format(path))
+	res = pnid_import(path, 0, load_batch, d);
+    else
+	res = load_file(d, path);
+    if (res < 0)
+	return res;
+
+    if (!(d->index = pnid_rtree_new()))
+	return -ENOMEM;
+    objs = g_new(PnidObj *, MAX(g_hash_table_size(d->ids), 1));
+    g_hash_table_iter_init(&iter, d->ids);
+    while (g_hash_table_iter_next(&iter, NULL, &obj))
+	objs[n++] = obj;
+    res = pnid_rtree_load(d->index, objs, n);
+    g_free(objs);
+
+    return res < 0 ? res : 0;
+}
+
+/* load_file(): read every object of the drawing file at path, then
+   replay any journal next to it. Returns 0 or -errno. */
+static int
+load_file(struct drawing *d, const char *path)
+{
+    PnidObj *obj;
+    char *jpath;
+    size_t i, n;
+    int res;
+
+    if ((res = pnid_file_map(path, &d->file)) < 0)
+	return res;
+
+    n = pnid_file_len(d->file);
+    for (i = 0; i < n; i++) {
+	if (!(obj = pnid_obj_new()))
+	    return -ENOMEM;
+	pnid_file_obj(d->file, i, obj);
+	g_hash_table_replace(d->ids, GUINT_TO_POINTER(obj->id), obj);
+    }
+
+    /* read only, the editor may still be writing the journal */
+    jpath = g_strconcat(path, ".journal", NULL);
+    g_ptr_array_add(d->strings, g_string_chunk_new(4096));
+    res = pnid_journal_replay(jpath, pnid_file_journal(d->file), replay_entry, d);
+    g_free(jpath);
+
+    return res;
+}
+
+/* load_pack(): read every chunk of the packed drawing at path.
+   Returns 0 or -errno. */
+static int
+load_pack(struct drawing *d, const char *path)
+{
+    GStringChunk *strings;
+    PnidObj **objs;
+    PnidPack *pack;
+    unsigned i;
+    size_t n;
+    int res;
+
+    if ((res = pnid_pack_open(path, &pack)) < 0)
+	return res;
+    for (i = 0; i < pnid_pack_len(pack); i++) {
+	if ((res = pnid_pack_read(pack, i, &objs, &n, &strings)) < 0)
+	    break;
+	load_batch(objs, n, strings, 0, d);
+    }
+    pnid_pack_close(pack);
+
+    return res;
+}
+
+/* load_batch(): #PnidImportFunc, take a batch of objects and their
+   strings into the drawing in data */
+static int
+load_batch(PnidObj **objs, size_t n, GStringChunk *strings, double progress, void *data)
+{
+    struct drawing *d = data;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+	g_hash_table_replace(d->ids, GUINT_TO_POINTER(objs[i]->id), objs[i]);
+    g_free(objs);
+    if (strings)
+	g_ptr_array_add(d->strings, strings);
+
+    return 0;
+}
+
+/* replay_entry(): #PnidJournalFunc, apply an edit from the journal
+   to the drawing in data, copying its strings into the last string
+   chunk */
+static void
+replay_entry(enum pnid_journal_op op, const PnidObj *obj, void *data)
+{
+    struct drawing *d = data;
+    GStringChunk *strings = g_ptr_array_index(d->strings, d->strings->len - 1);
+    PnidObj *cur;
+    int k;
+
+    switch (op) {
+    case PNID_JOURNAL_INSERT:
+    case PNID_JOURNAL_UPDATE:
+	if (!(cur = pnid_obj_new()))
+	    return;
+	*cur = *obj;
+	for (k = 0; k < PNID_N_ATTRS; k++)
+	    if (cur->attr[k])
+		cur->attr[k] = g_string_chunk_insert_const(strings, cur->attr[k]);
+	g_hash_table_replace(d->ids, GUINT_TO_POINTER(cur->id), cur);
+	break;
+    case PNID_JOURNAL_DELETE:
+	g_hash_table_remove(d->ids, GUINT_TO_POINTER(obj->id));
+	break;
+    }
+}
+
+/* unload(): free everything loaded into d */
+static void
+unload(struct drawing *d)
+{
+    pnid_rtree_free(d->index);
+    g_clear_pointer(&d->ids, g_hash_table_destroy);
+    g_clear_pointer(&d->strings, g_ptr_array_unref);
+    g_clear_pointer(&d->file, pnid_file_unmap);
+}
+
+/*********************
+ * Options
+*******************/
+
+/* parse_format(): the format named name. Returns -EINVAL if there is
+   none. */
+static int
+parse_format(const char *name, enum format *fmt)
+{
+    int i;
+
+    for (i = 0; i < (int)G_N_ELEMENTS(extensions); i++)
+	if (!g_ascii_strcasecmp(name, extensions[i] + 1)) {
+	    *fmt = i;
+	    return 0;
+	}
+
+    return -EINVAL;
+}
+
+/* parse_page(): set up the sheet and the region rendered to fmt from
+   the options, reporting any that are invalid. Returns -EINVAL or
+   0. */
+static int
+parse_page(enum format fmt)
+{
+    double width = 0, height = 0, x, y, w, h, t;
+    size_t i;
+
+    for (i = 0; i < G_N_ELEMENTS(papers); i++)
+	if (!g_ascii_strcasecmp(paper, papers[i].name)) {
+	    width = papers[i].width;
+	    height = papers[i].height;
+	}
+    if (!width && (sscanf(paper, "%lfx%lf", &width, &height) != 2 || width < 1 || height < 1)) {
+	g_printerr("%s: unknown paper\n", paper);
+	return -EINVAL;
+    }
+    if (landscape) {
+	t = width;
+	width = height;
+	height = t;
+    }
+    if (margin < 0 || 2 * margin >= MIN(width, height)) {
+	g_printerr("%g: margin does not fit the paper\n", margin);
+	return -EINVAL;
+    }
+
+    sheet.page_width = width;
+    sheet.page_height = height;
+    sheet.top_margin = sheet.bottom_margin = margin;
+    sheet.left_margin = sheet.right_margin = margin;
+    sheet.scale = dpi / 72.0;
+    sheet.vector = fmt != FORMAT_PNG;
+    if (!sheet.vector) {
+	/* as the canvas draws by default */
+	sheet.lod_object_px = 3.0;
+	sheet.lod_node_px = 2.0;
+	sheet.lod_line_scale = 1.0;
+	sheet.lod_text_scale = 1.0;
+    }
+
+    x = y = 0;
+    w = width;
+    h = height;
+    if (region && (sscanf(region, "%lf,%lf,%lf,%lf", &x, &y, &w, &h) != 4
+		   || x < 0 || y < 0 || w < 1 || h < 1)) {
+	g_printerr("%s: not X,Y,WIDTH,HEIGHT\n", region);
+	return -EINVAL;
+    }
+    pnid_box_set_left(&clip, floor(x));
+    pnid_box_set_top(&clip, floor(y));
+    pnid_box_set_right(&clip, ceil(x + w));
+    pnid_box_set_bottom(&clip, ceil(y + h));
+
+    return 0;
+}
+
+/* expand(): add the drawing paths of argv and of the list option to
+   paths, expanding any glob patterns the shell did not. Returns
+   -ENOENT, having reported why, or 0. */
+static int
+expand(GPtrArray *paths, int argc, char **argv)
+{
+    GIOChannel *channel;
+    GError *error = NULL;
+    char *line;
+    gsize len;
+    glob_t g;
+    size_t j;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+	if (!strpbrk(argv[i], "*?[")) {
+	    g_ptr_array_add(paths, g_strdup(argv[i]));
+	    continue;
+	}
+	if (glob(argv[i], 0, NULL, &g) != 0) {
+	    g_printerr("%s: no drawings match\n", argv[i]);
+	    return -ENOENT;
+	}
+	for (j = 0; j < g.gl_pathc; j++)
+	    g_ptr_array_add(paths, g_strdup(g.gl_pathv[j]));
+	globfree(&g);
+    }
+
+    if (!list)
+	return 0;
+    channel = strcmp(list, "-") ? g_io_channel_new_file(list, "r", &error)
+				: g_io_channel_unix_new(STDIN_FILENO);
+    if (!channel) {
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+	return -ENOENT;
+    }
+    while (g_io_channel_read_line(channel, &line, &len, NULL, NULL) == G_IO_STATUS_NORMAL) {
+	g_strstrip(line);
+	if (*line)
+	    g_ptr_array_add(paths, line);
+	else
+	    g_free(line);
+    }
+    g_io_channel_unref(channel);
+
+    return 0;
+}
@@ -100,7 +100,17 @@ static int      delete(PnidRtree *tr, const Entry *e);
 static Node    *findleaf(Node *t, const Entry *e);
 static int      condensetree(struct pnid_rtree *tr, Node *n, Node *q);
 /* search algorithms */
+static Node    *packtree(PnidObj **tuples, size_t n, int *h);
+static int      graft(PnidRtree *tr, Node *t, int h);
+static size_t   pack(void **buf, size_t len, int type);
+static int      cmpx(const void *a, const void *b);
+static int      cmpy(const void *a, const void *b);
+
 static Results *search(struct pnid_rtree *tr, const Node *t, const Box *s);
+static int      walk(const Node *t, const Box *s, PnidRtreeNodeFunc node,
+		     PnidRtreeTupleFunc tuple, void *data);
+/* destruction */
+static void     destroy(Node *n, int tuples);
 /* results stack */
 static int      push(Results *stack, PnidObj *tuple);
 static PnidObj *pop(Results *stack);
@@ -120,6 +130,7 @@ static void     checkparent(const Node *n);
 static void     checkdegree(const Node *n);
 static void     checkbalance(const Node *n, int depth, int *max); 
 static void     printtree(const Node *n, int depth);
+static void     check(const Node *n);
 
 /*********************
  * R-tree Interface:
@@ -138,10 +149,45 @@ pnid_rtree_new(void)
     return NULL;
   if (!(tr->root = calloc(1, sizeof *tr->root)))
     return NULL;
+  if (!(tr->res = calloc(1, sizeof *tr->res)))
+    return NULL;
+  if (!(tr->res->buf = malloc(STACKMIN * sizeof *tr->res->buf)))
+    return NULL;
+  tr->res->len = tr->res->rem = STACKMIN;
   
   return tr;
 }
 
+/* pnid_rtree_destroy(): free the r-tree along with every tuple stored
+   in it. */
+void
+pnid_rtree_destroy(struct pnid_rtree *tr)
+{
+  if (!tr)
+    return;
+
+  destroy(tr->root, 1);
+  if (tr->res)
+    free(tr->res->buf);
+  free(tr->res);
+  free(tr);
+}
+
+/* pnid_rtree_free(): free the r-tree alone, leaving the tuples stored
+   in it to whatever owns them. */
+void
+pnid_rtree_free(struct pnid_rtree *tr)
+{
+  if (!tr)
+    return;
+
+  destroy(tr->root, 0);
+  if (tr->res)
+    free(tr->res->buf);
+  free(tr->res);
+  free(tr);
+}
+
 /* pnid_rtree_insert(): insert tuple into tr. Returns less than zero
    on error. */
 int
@@ -165,10 +211,25 @@ pnid_rtree_insert(struct pnid_rtree *tr, PnidObj *tuple)
   return 0;
 }
 
-/* pnid_rtree_delete(): remove tuple from the r-tree. Returns less
-   than zero on error */
+/* pnid_rtree_delete(): remove tuple from the r-tree and free
+   it. Returns less than zero on error */
 int
 pnid_rtree_delete(struct pnid_rtree *tr, PnidObj *tuple)
+{
+  int res;
+
+  if ((res = pnid_rtree_remove(tr, tuple)) < 0)
+    return res;
+  pnid_obj_delete(tuple);
+
+  return 0;
+}
+
+/* pnid_rtree_remove(): remove tuple from the r-tree, ownership of it
+   returns to the caller. Its bounding box must not have changed since
+   it was inserted. Returns less than zero on error */
+int
+pnid_rtree_remove(struct pnid_rtree *tr, PnidObj *tuple)
 {
   Entry e;
 
@@ -178,12 +239,77 @@ pnid_rtree_delete(struct pnid_rtree *tr, PnidObj *tuple)
   if (delete(tr, &e) < 0)
     return -ENOMEM;
 
-  pnid_obj_delete(tuple);
   pnid_rtree_check(tr);
 
   return 0;
 }
 
+/* pnid_rtree_load(): insert n tuples into tr. The tuples are packed
+   bottom up into a subtree using sort-tile-recursive, giving well
+   filled nodes with little overlap in O(n log n). An empty tree is
+   replaced by the subtree, otherwise it is grafted in whole so that
+   loading in batches costs no more than loading at once. Returns less
+   than zero on error, when tr is left unchanged and the tuples still
+   belong to the caller. */
+int
+pnid_rtree_load(struct pnid_rtree *tr, PnidObj **tuples, size_t n)
+{
+  Node *t;			/* subtree packed from tuples */
+  int h, res;			/* height of t, status */
+
+  if (!n)
+    return 0;
+  if (!(t = packtree(tuples, n, &h)))
+    return -ENOMEM;
+  check(t);
+
+  if (!tr->root->E[0]) {
+    free(tr->root);
+    tr->root = t;
+  } else if ((res = graft(tr, t, h)) < 0) {
+    destroy(t, 0);
+    return res;
+  }
+
+  return 0;
+}
+
+/* pnid_rtree_search(): find every tuple whose bounding box overlaps
+   the search rectangle s. Returns the number of tuples found, which
+   are then retrieved with pnid_rtree_next(), or less than zero on
+   error. Any results remaining from a previous search are
+   discarded. */
+int
+pnid_rtree_search(struct pnid_rtree *tr, const PnidBox *s)
+{
+  tr->res->rem = tr->res->len;
+
+  if (!search(tr, tr->root, s))
+    return -ENOMEM;
+
+  return tr->res->len - tr->res->rem;
+}
+
+/* pnid_rtree_next(): pop the next result of the last search, returns
+   NULL when all results have been retrieved. */
+PnidObj *
+pnid_rtree_next(struct pnid_rtree *tr)
+{
+  return pop(tr->res);
+}
+
+/* pnid_rtree_walk(): visit every node and tuple beneath the root
+   overlapping s. The node function, if provided, is called with the
+   mbr of each branch or leaf node before it is entered and the node
+   is skipped when it returns zero, this allows a caller to handle a
+   whole subtree at once. Returns the number of nodes entered. */
+int
+pnid_rtree_walk(struct pnid_rtree *tr, const PnidBox *s,
+		PnidRtreeNodeFunc node, PnidRtreeTupleFunc tuple, void *data)
+{
+  return walk(tr->root, s, node, tuple, data);
+}
+
 /* pnid_rtree_print(): print the tree to stdout preorder. */
 void
 pnid_rtree_print(PnidRtree *tr)
@@ -195,14 +321,7 @@ pnid_rtree_print(PnidRtree *tr)
    does nothing when NDEBUG is defined.  */
 void pnid_rtree_check(struct pnid_rtree *tr)
 {
-  #ifndef NDEBUG
-  int leaf_depth = 0;
-
-  checkparent(tr->root);
-  checkdegree(tr->root);
-  checkbalance(tr->root, 0, &leaf_depth); 
-  checkmbr(tr->root); 
-  #endif
+  check(tr->root);
 }
 
 /*********************
@@ -230,9 +349,19 @@ insert(PnidRtree *tr, Node *n, void *e)
     *tr->buf = e;
     memcpy(tr->buf+1, n->E, RTMAX * sizeof *tr->buf);
     memset(n->E,  0,    RTMAX * sizeof *tr->buf);
+    nn->type = n->type;
     splitnode(n, nn, tr->buf);
   }
 
+  /* a node inserted into a branch, or split from one, is adopted */
+  if (n->type == BRANCH) {
+    for (cur = n->E; *cur; cur++)
+      ((Node *)*cur)->parent = n;
+    if (nn)
+      for (cur = nn->E; *cur; cur++)
+	((Node *)*cur)->parent = nn;
+  }
+
   /* propagate any splits up the tree, adjusting mbr's as
      required. The root will change as the tree grows. */
   r = tr->root;
@@ -488,7 +617,7 @@ delete(struct pnid_rtree *tr, const Entry *e)
       return -1;
 
   /* the root will change as the tree condenses  */
-  assert(r->E[0] && "root is empty");
+  assert((r->type == LEAF || r->E[0]) && "root is empty");
   if (r->type == BRANCH && !r->E[1]) {
     tr->root = tr->root->E[0];
     free(r);
@@ -571,25 +700,64 @@ condensetree(struct pnid_rtree *tr, Node *n, Node *q)
 *******************/
 
 /* search(): populates a list of all entries beneath t whose bounding
-   box overlaps the search rectangle s. */
+   box overlaps the search rectangle s. Returns NULL on memory
+   error. */
 static Results *
 search(struct pnid_rtree *tr, const Node *t, const Box *s)
 {
-  return NULL;
+  void * const *cur;		/* current index entry */
+
+  for (cur = t->E; *cur; cur++) {
+    if (!overlaps(*cur, s))
+      continue;
+    if (t->type == BRANCH) {
+      if (!search(tr, *cur, s))
+	return NULL;
+    } else if (push(tr->res, ((Entry *)*cur)->tuple) < 0) {
+      return NULL;
+    }
+  }
+
+  return tr->res;
+}
+
+/* walk(): enter node t, calling node for each overlapping child and
+   tuple for each overlapping entry. Returns the number of nodes
+   entered. */
+static int
+walk(const Node *t, const Box *s, PnidRtreeNodeFunc node,
+     PnidRtreeTupleFunc tuple, void *data)
+{
+  void * const *cur;		/* current index entry */
+  int n;			/* nodes entered */
+
+  for (n = 1, cur = t->E; *cur; cur++) {
+    if (!overlaps(*cur, s))
+      continue;
+    if (t->type == LEAF)
+      tuple(((Entry *)*cur)->tuple, data);
+    else if (!node || node(*cur, data))
+      n += walk(*cur, s, node, tuple, data);
+  }
+
+  return n;
 }
 
 /* push(): push tuple to the top of stack. */
 static int
 push(Results *stack, PnidObj *tuple)
 {
+  PnidObj **buf;
+
   if (!stack->rem) {
+    if (!(buf = realloc(stack->buf, 2 * stack->len * sizeof *buf)))
+      return -ENOMEM;
+    stack->buf = buf;
     stack->rem = stack->len;
     stack->len *= 2; 
-    if (!(stack->buf = realloc(stack->buf, stack->len * sizeof tuple)))
-      return -ENOMEM;
   }
 
-  stack->buf[stack->len - stack->rem] = tuple;
+  stack->buf[stack->len - stack->rem--] = tuple;
 
   return 0;
 }
@@ -598,14 +766,218 @@ push(Results *stack, PnidObj *tuple)
 static PnidObj *
 pop(Results *stack)
 {
-  return stack->rem == stack->len ? NULL : stack->buf[stack->len - stack->rem++];
+  return stack->rem == stack->len ? NULL : stack->buf[stack->len - ++stack->rem];
 }
 
 /* peak(): peak top of stack, returns null if empty */
 static PnidObj *
 peak(Results *stack)
 {
-  return stack->rem == stack->len ? NULL : stack->buf[stack->len - stack->rem];
+  return stack->rem == stack->len ? NULL : stack->buf[stack->len - stack->rem - 1];
+}
+
+/*********************
+ * Bulk Loading
+*******************/
+
+/* packtree(): pack n tuples bottom up into a new subtree, storing its
+   height above the leaf level in h. Returns the root of the subtree
+   or NULL on memory error. */
+static Node *
+packtree(PnidObj **tuples, size_t n, int *h)
+{
+  void **buf;			/* index entries of current level */
+  Node *t;
+  size_t i, len;
+  int type;
+
+  if (!(buf = malloc(n * sizeof *buf)))
+    return NULL;
+  for (i = 0; i < n; i++) {
+    Entry *e;
+    if (!(e = calloc(1, sizeof *e))) {
+      while (i--)
+	free(buf[i]);
+      free(buf);
+      return NULL;
+    }
+    e->I = pnid_obj_bbox(tuples[i]);
+    e->tuple = tuples[i];
+    buf[i] = e;
+  }
+
+  for (len = n, type = LEAF, *h = 0; ; type = BRANCH, ++*h) {
+    if (!(i = pack(buf, len, type))) {
+      while (len--)
+	if (type == LEAF)
+	  free(buf[len]);
+	else
+	  destroy(buf[len], 0);
+      free(buf);
+      return NULL;
+    }
+    if ((len = i) == 1)
+      break;
+  }
+
+  t = buf[0];
+  free(buf);
+  return t;
+}
+
+/* graft(): merge the subtree t of height h into the non-empty tree
+   tr. The shorter of the two is inserted as an index entry at its own
+   height in the taller, or they become siblings beneath a new root
+   when of equal height. A lone entry, which cannot make a node of its
+   own, is inserted as usual. Returns less than zero on error, when
+   tr and t are unchanged. */
+static int
+graft(PnidRtree *tr, Node *t, int h)
+{
+  Node *r, *s, *n;		/* root of tr, shorter tree, its parent */
+  int hr, hs, res;		/* heights of r, s and status */
+
+  r = tr->root;
+  for (hr = 0, n = r; n->type == BRANCH; n = n->E[0])
+    hr++;
+
+  if (!t->E[1]) {
+    if ((res = insert(tr, chooseleaf(r, t->E[0]), t->E[0])) < 0)
+      return res;
+    free(t);
+    return 0;
+  }
+  if (!r->E[1]) {
+    tr->root = t;
+    if ((res = insert(tr, chooseleaf(t, r->E[0]), r->E[0])) < 0) {
+      tr->root = r;
+      return res;
+    }
+    free(r);
+    return 0;
+  }
+
+  if (h == hr) {
+    if (!(n = calloc(1, sizeof *n)))
+      return -ENOMEM;
+    n->type = BRANCH;
+    n->E[0] = r;
+    n->E[1] = t;
+    r->parent = t->parent = n;
+    adjust(n);
+    tr->root = n;
+    return 0;
+  }
+
+  if (h < hr) {
+    s = t;
+    hs = h;
+  } else {
+    tr->root = t;
+    s = r;
+    hs = hr;
+    hr = h;
+  }
+  for (n = tr->root; hr > hs + 1; hr--)
+    n = choosenode(n, &s->I);
+  if ((res = insert(tr, n, s)) < 0) {
+    tr->root = r;
+    return res;
+  }
+
+  return 0;
+}
+
+/* pack(): pack the len index entries in buf, of nodes of the given
+   type, into ceil(len/RTMAX) new nodes, which replace them at the
+   start of buf. Entries are sorted into vertical slices by x and
+   then by y within each slice, before being dealt out evenly so that
+   every node holds at least RTMIN entries. Returns the number of new
+   nodes, or zero on error when buf is unchanged. */
+static size_t
+pack(void **buf, size_t len, int type)
+{
+  Node **nodes;
+  size_t m, s, i, j, k;
+
+  m = (len + RTMAX - 1) / RTMAX;
+  if (!(nodes = malloc(m * sizeof *nodes)))
+    return 0;
+  for (j = 0; j < m; j++)
+    if (!(nodes[j] = calloc(1, sizeof **nodes))) {
+      while (j--)
+	free(nodes[j]);
+      free(nodes);
+      return 0;
+    }
+
+  for (s = 1; s * s < m; s++)
+    ;
+  qsort(buf, len, sizeof *buf, cmpx);
+  for (i = 0; i < len; i += s * RTMAX)
+    qsort(buf + i, len - i < s * RTMAX ? len - i : s * RTMAX,
+	  sizeof *buf, cmpy);
+
+  /* node j takes entries j*len/m up to (j+1)*len/m, never fewer than
+     its own index, so it is stored over entries already taken */
+  for (j = 0, i = 0; j < m; j++) {
+    nodes[j]->type = type;
+    for (k = 0; i < (j + 1) * len / m; i++, k++) {
+      nodes[j]->E[k] = buf[i];
+      if (type == BRANCH)
+	((Node *)buf[i])->parent = nodes[j];
+    }
+    adjust(nodes[j]);
+    buf[j] = nodes[j];
+  }
+
+  free(nodes);
+  return m;
+}
+
+/* cmpx(): order index entries by the centre of their mbr in x */
+static int
+cmpx(const void *a, const void *b)
+{
+  const Box *p = *(void * const *)a, *q = *(void * const *)b;
+  unsigned long x = (unsigned long)p->nw.x + p->se.x;
+  unsigned long y = (unsigned long)q->nw.x + q->se.x;
+
+  return (x > y) - (x < y);
+}
+
+/* cmpy(): order index entries by the centre of their mbr in y */
+static int
+cmpy(const void *a, const void *b)
+{
+  const Box *p = *(void * const *)a, *q = *(void * const *)b;
+  unsigned long x = (unsigned long)p->nw.y + p->se.y;
+  unsigned long y = (unsigned long)q->nw.y + q->se.y;
+
+  return (x > y) - (x < y);
+}
+
+/*********************
+ * Destruction
+*******************/
+
+/* destroy(): free n and everything beneath it, including the tuples
+   held in its leaves when tuples is non-zero. */
+static void
+destroy(Node *n, int tuples)
+{
+  void **cur;			/* current index entry */
+
+  for (cur = n->E; *cur; cur++) {
+    if (n->type == BRANCH) {
+      destroy(*cur, tuples);
+    } else {
+      if (tuples)
+	pnid_obj_delete(((Entry *)*cur)->tuple);
+      free(*cur);
+    }
+  }
+  free(n);
 }
 
 /*********************
@@ -762,6 +1134,20 @@ checkdegree(const Node *n)
       checkdegree(*cur);
 }
  
+/* check(): assert that the tree beneath n is correctly formed */
+static void
+check(const Node *n)
+{
+  #ifndef NDEBUG
+  int leaf_depth = 0;
+
+  checkparent(n);
+  checkdegree(n);
+  checkbalance(n, 0, &leaf_depth); 
+  checkmbr(n); 
+  #endif
+}
+
 /* printtree(): from node n in preorder */
 static void
 printtree(const Node *n, int depth)
@@ -8,6 +8,8 @@
 #ifndef __PNID_RTREE_H
 #define __PNID_RTREE_H
 
+#include <stddef.h>
+
 #include "pnid_obj.h"
 #include "pnid_box.h"
 
@@ -17,12 +19,28 @@ typedef struct pnid_rtree PnidRtree;
 /* Create and destroy the entire database */
 PnidRtree *pnid_rtree_new(void);
 void       pnid_rtree_destroy(PnidRtree *tr); 
+void       pnid_rtree_free(PnidRtree *tr);
 
 /* Add and remove individual entries to and from the database*/
 int pnid_rtree_insert(PnidRtree *tr, PnidObj *tuple);
 int pnid_rtree_delete(PnidRtree *tr, PnidObj *tuple);
-
-/* Query the database */
+int pnid_rtree_remove(PnidRtree *tr, PnidObj *tuple);
+
+/* Bulk load many tuples at once, or in batches, packing them bottom up */
+int pnid_rtree_load(PnidRtree *tr, PnidObj **tuples, size_t n);
+
+/* Query the database, results of a search are retrieved one at a
+   time with pnid_rtree_next() until it returns NULL */
+int      pnid_rtree_search(PnidRtree *tr, const PnidBox *s);
+PnidObj *pnid_rtree_next(PnidRtree *tr);
+
+/* Walk the database, visiting the nodes and tuples overlapping a
+   region. A node function returning zero prunes that node's
+   subtree. */
+typedef int  (*PnidRtreeNodeFunc)  (const PnidBox *mbr, void *data);
+typedef void (*PnidRtreeTupleFunc) (PnidObj *tuple, void *data);
+int pnid_rtree_walk(PnidRtree *tr, const PnidBox *s,
+		    PnidRtreeNodeFunc node, PnidRtreeTupleFunc tuple, void *data);
 
 /* Debugging and testing: */
 
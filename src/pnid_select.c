@@ -0,0 +1,360 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_select.c - selections of pnid drawing objects
+
+   A selection is a dense bitset over the slots of the object store,
+   sixty four to a word. Only the span of words which may have a bit
+   set is kept track of, so that clearing a selection or combining it
+   with another costs one operation per word of that span however
+   large the store, and nothing for the words beyond it.
+
+   Rubber bands and lassos are matched against an object's geometry
+   rather than its bounding box, a line being only the diagonal of its
+   box and a symbol the box itself. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_objstore.h"
+#include "pnid_select.h"
+
+#define WORD(h) (PNID_OBJ_HANDLE_SLOT(h) / 64)
+#define BIT(h)  ((uint64_t)1 << PNID_OBJ_HANDLE_SLOT(h) % 64)
+
+struct pnid_select {
+  uint64_t *words;
+  uint32_t  nwords;
+  uint32_t  lo;			/* words which may have bits set */
+  uint32_t  hi;
+};
+
+/* point: a point of a rubber band, lasso or object's geometry */
+struct point {
+  double x;
+  double y;
+};
+
+static int      grow(PnidSelect *s, uint32_t n);
+static void     span(PnidSelect *s, uint32_t lo, uint32_t hi);
+static unsigned segments(const PnidObj *obj, struct point seg[4][2]);
+static double   orient(struct point a, struct point b, struct point c);
+static int      crosses(struct point a, struct point b, struct point c, struct point d);
+static int      inside(struct point p, const PnidCoord *poly, size_t n);
+
+/*********************
+ * Creation and Destruction
+*******************/
+
+/* pnid_select_new(): create an empty selection. Returns NULL if out
+   of memory. */
+PnidSelect *
+pnid_select_new(void)
+{
+  return calloc(1, sizeof(PnidSelect));
+}
+
+/* pnid_select_destroy(): free s */
+void
+pnid_select_destroy(PnidSelect *s)
+{
+  if (!s)
+    return;
+
+  free(s->words);
+  free(s);
+}
+
+/*********************
+ * Selecting
+*******************/
+
+/* pnid_select_add(): select obj. Returns -ENOMEM or 0. */
+int
+pnid_select_add(PnidSelect *s, PnidObjHandle obj)
+{
+  int res;
+
+  if ((res = grow(s, WORD(obj) + 1)) < 0)
+    return res;
+  s->words[WORD(obj)] |= BIT(obj);
+  span(s, WORD(obj), WORD(obj) + 1);
+
+  return 0;
+}
+
+/* pnid_select_remove(): deselect obj */
+void
+pnid_select_remove(PnidSelect *s, PnidObjHandle obj)
+{
+  if (WORD(obj) < s->nwords)
+    s->words[WORD(obj)] &= ~BIT(obj);
+}
+
+/* pnid_select_clear(): deselect everything */
+void
+pnid_select_clear(PnidSelect *s)
+{
+  if (s->lo < s->hi)
+    memset(s->words + s->lo, 0, (s->hi - s->lo) * sizeof *s->words);
+  s->lo = s->hi = 0;
+}
+
+/* pnid_select_apply(): combine the objects of with into s by op.
+   Returns -ENOMEM, leaving s unchanged, or 0. */
+int
+pnid_select_apply(PnidSelect *s, const PnidSelect *with, enum pnid_select_op op)
+{
+  uint32_t i;
+  int res;
+
+  if (op != PNID_SELECT_SUBTRACT && (res = grow(s, with->hi)) < 0)
+    return res;
+
+  switch (op) {
+  case PNID_SELECT_REPLACE:
+    pnid_select_clear(s);
+    if (with->lo < with->hi)
+      memcpy(s->words + with->lo, with->words + with->lo,
+	     (with->hi - with->lo) * sizeof *s->words);
+    span(s, with->lo, with->hi);
+    break;
+  case PNID_SELECT_ADD:
+    for (i = with->lo; i < with->hi; i++)
+      s->words[i] |= with->words[i];
+    span(s, with->lo, with->hi);
+    break;
+  case PNID_SELECT_TOGGLE:
+    for (i = with->lo; i < with->hi; i++)
+      s->words[i] ^= with->words[i];
+    span(s, with->lo, with->hi);
+    break;
+  case PNID_SELECT_SUBTRACT:
+    for (i = with->lo > s->lo ? with->lo : s->lo; i < with->hi && i < s->hi; i++)
+      s->words[i] &= ~with->words[i];
+    break;
+  }
+
+  return 0;
+}
+
+/*********************
+ * Querying
+*******************/
+
+/* pnid_select_has(): non-zero if obj is selected */
+int
+pnid_select_has(const PnidSelect *s, PnidObjHandle obj)
+{
+  return WORD(obj) < s->nwords && (s->words[WORD(obj)] & BIT(obj));
+}
+
+/* pnid_select_len(): the number of objects selected */
+size_t
+pnid_select_len(const PnidSelect *s)
+{
+  size_t n = 0;
+  uint32_t i;
+
+  for (i = s->lo; i < s->hi; i++)
+    n += __builtin_popcountll(s->words[i]);
+
+  return n;
+}
+
+/* pnid_select_foreach(): call func with the slot of each object
+   selected, in slot order */
+void
+pnid_select_foreach(const PnidSelect *s, PnidSelectFunc func, void *data)
+{
+  uint64_t w;
+  uint32_t i;
+
+  for (i = s->lo; i < s->hi; i++)
+    for (w = s->words[i]; w; w &= w - 1)
+      func(i * 64 + __builtin_ctzll(w), data);
+}
+
+/*********************
+ * Hit Testing
+*******************/
+
+/* pnid_select_hit_box(): non-zero if obj lies within box in mode.
+   Lines overlap a box only where their diagonal crosses it. */
+int
+pnid_select_hit_box(const PnidObj *obj, const PnidBox *box, enum pnid_select_mode mode)
+{
+  struct point seg[4][2], c[4];
+  double side;
+  int i, above = 0, below = 0;
+
+  if (mode == PNID_SELECT_CONTAIN)
+    return pnid_box_is_subset(&obj->bbox, box);
+  if (pnid_box_is_separate(&obj->bbox, box))
+    return 0;
+  if (obj->type == PNID_OBJ_SYMBOL)
+    return 1;
+
+  /* the boxes overlap, so the diagonal crosses the box unless every
+     corner lies to one side of it */
+  segments(obj, seg);
+  c[0] = (struct point){ box->nw.x, box->nw.y };
+  c[1] = (struct point){ box->se.x, box->nw.y };
+  c[2] = (struct point){ box->se.x, box->se.y };
+  c[3] = (struct point){ box->nw.x, box->se.y };
+  for (i = 0; i < 4; i++) {
+    side = orient(seg[0][0], seg[0][1], c[i]);
+    above |= side >= 0;
+    below |= side <= 0;
+  }
+
+  return above && below;
+}
+
+/* pnid_select_hit_lasso(): non-zero if obj lies wholly within the
+   polygon of the n points of lasso, closed from last to first. It
+   does when one point of it is inside and no edge of the lasso
+   crosses or touches it. */
+int
+pnid_select_hit_lasso(const PnidObj *obj, const PnidCoord *lasso, size_t n)
+{
+  struct point seg[4][2], a, b;
+  unsigned i, nseg;
+  size_t j;
+
+  if (n < 3)
+    return 0;
+
+  nseg = segments(obj, seg);
+  if (!inside(seg[0][0], lasso, n))
+    return 0;
+  for (j = 0; j < n; j++) {
+    a = (struct point){ lasso[j].x, lasso[j].y };
+    b = (struct point){ lasso[(j + 1) % n].x, lasso[(j + 1) % n].y };
+    for (i = 0; i < nseg; i++)
+      if (crosses(a, b, seg[i][0], seg[i][1]))
+	return 0;
+  }
+
+  return 1;
+}
+
+/*********************
+ * Utilities
+*******************/
+
+/* grow(): make room for at least n words, doubling. Returns -ENOMEM
+   or 0. */
+static int
+grow(PnidSelect *s, uint32_t n)
+{
+  uint64_t *words;
+  uint32_t len = s->nwords ? s->nwords : 64;
+
+  if (n <= s->nwords)
+    return 0;
+  while (len < n)
+    len *= 2;
+  if (!(words = realloc(s->words, len * sizeof *words)))
+    return -ENOMEM;
+  memset(words + s->nwords, 0, (len - s->nwords) * sizeof *words);
+  s->words = words;
+  s->nwords = len;
+
+  return 0;
+}
+
+/* span(): widen the words which may have bits set to include lo to
+   hi */
+static void
+span(PnidSelect *s, uint32_t lo, uint32_t hi)
+{
+  if (lo >= hi)
+    return;
+  if (s->lo >= s->hi) {
+    s->lo = lo;
+    s->hi = hi;
+    return;
+  }
+  if (lo < s->lo)
+    s->lo = lo;
+  if (hi > s->hi)
+    s->hi = hi;
+}
+
+/* segments(): store the segments drawn by obj in seg, the diagonal of
+   a line or the sides of a symbol. Returns how many. */
+static unsigned
+segments(const PnidObj *obj, struct point seg[4][2])
+{
+  const PnidBox *b = &obj->bbox;
+  struct point nw = { b->nw.x, b->nw.y }, ne = { b->se.x, b->nw.y };
+  struct point se = { b->se.x, b->se.y }, sw = { b->nw.x, b->se.y };
+
+  switch (obj->type) {
+  case PNID_OBJ_LINE:
+    seg[0][0] = nw, seg[0][1] = se;
+    return 1;
+  case PNID_OBJ_LINE_RISE:
+    seg[0][0] = sw, seg[0][1] = ne;
+    return 1;
+  default:
+    seg[0][0] = nw, seg[0][1] = ne;
+    seg[1][0] = ne, seg[1][1] = se;
+    seg[2][0] = se, seg[2][1] = sw;
+    seg[3][0] = sw, seg[3][1] = nw;
+    return 4;
+  }
+}
+
+/* orient(): twice the signed area of a, b, c, positive when c lies to
+   the left of a to b */
+static double
+orient(struct point a, struct point b, struct point c)
+{
+  return (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+}
+
+/* crosses(): non-zero if segments a to b and c to d cross or
+   touch */
+static int
+crosses(struct point a, struct point b, struct point c, struct point d)
+{
+  double d1 = orient(c, d, a), d2 = orient(c, d, b);
+  double d3 = orient(a, b, c), d4 = orient(a, b, d);
+
+#define ON(p, q, r) ((r).x >= MIN_((p).x, (q).x) && (r).x <= MAX_((p).x, (q).x) \
+		     && (r).y >= MIN_((p).y, (q).y) && (r).y <= MAX_((p).y, (q).y))
+#define MIN_(a, b) ((a) < (b) ? (a) : (b))
+#define MAX_(a, b) ((a) > (b) ? (a) : (b))
+  if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0))
+      && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0)))
+    return 1;
+  return (d1 == 0 && ON(c, d, a)) || (d2 == 0 && ON(c, d, b))
+    || (d3 == 0 && ON(a, b, c)) || (d4 == 0 && ON(a, b, d));
+#undef MAX_
+#undef MIN_
+#undef ON
+}
+
+/* inside(): non-zero if p lies inside the polygon of the n points of
+   poly, by the even-odd rule */
+static int
+inside(struct point p, const PnidCoord *poly, size_t n)
+{
+  size_t i, j;
+  int in = 0;
+
+  for (i = 0, j = n - 1; i < n; j = i++)
+    if ((poly[i].y > p.y) != (poly[j].y > p.y)
+	&& p.x < ((double)poly[j].x - poly[i].x) * (p.y - poly[i].y)
+	   / ((double)poly[j].y - poly[i].y) + poly[i].x)
+      in = !in;
+
+  return in;
+}
@@ -0,0 +1,57 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_select.h - selections of pnid drawing objects */
+
+#ifndef __PNID_SELECT_H
+#define __PNID_SELECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_objstore.h"
+
+/* pnid_select_op: how objects found are combined with a selection */
+enum pnid_select_op {
+  PNID_SELECT_REPLACE = 0,
+  PNID_SELECT_ADD,
+  PNID_SELECT_TOGGLE,
+  PNID_SELECT_SUBTRACT
+};
+
+/* pnid_select_mode: which objects a rubber band selects */
+enum pnid_select_mode {
+  PNID_SELECT_OVERLAP = 0,	/* any part within the band */
+  PNID_SELECT_CONTAIN		/* wholly within the band */
+};
+
+/* #PnidSelect: a set of objects of a #PnidObjStore, one bit for each
+   slot. Objects must be removed before they are released. */
+typedef struct pnid_select PnidSelect;
+
+/* pnid_select_func(): called with the slot of each object selected */
+typedef void (*PnidSelectFunc) (uint32_t slot, void *data);
+
+/* Create and destroy a selection */
+PnidSelect *pnid_select_new(void);
+void        pnid_select_destroy(PnidSelect *s);
+
+/* Select and deselect objects */
+int         pnid_select_add(PnidSelect *s, PnidObjHandle obj);
+void        pnid_select_remove(PnidSelect *s, PnidObjHandle obj);
+void        pnid_select_clear(PnidSelect *s);
+int         pnid_select_apply(PnidSelect *s, const PnidSelect *with, enum pnid_select_op op);
+
+/* Query a selection */
+int         pnid_select_has(const PnidSelect *s, PnidObjHandle obj);
+size_t      pnid_select_len(const PnidSelect *s);
+void        pnid_select_foreach(const PnidSelect *s, PnidSelectFunc func, void *data);
+
+/* Test whether objects lie within a rubber band or lasso */
+int         pnid_select_hit_box(const PnidObj *obj, const PnidBox *box, enum pnid_select_mode mode);
+int         pnid_select_hit_lasso(const PnidObj *obj, const PnidCoord *lasso, size_t n);
+
+#endif /* __PNID_SELECT_H */
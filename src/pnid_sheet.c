@@ -0,0 +1,277 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_sheet.c - drawing a sheet of a pnid drawing with cairo
+
+   The page, its margins and the objects upon it are drawn here for
+   the canvas and for anything else rendering a drawing, such as
+   pnid-render, without a widget or display. Only cairo and the index
+   are needed.
+
+   Detail is reduced with scale as it is by the canvas. Objects
+   smaller than lod_object_px device pixels are drawn as a dot, whole
+   r-tree subtrees smaller than lod_node_px are filled as a single
+   rectangle without visiting their leaves and symbols are drawn as
+   outlines below lod_line_scale. Drawn for a vector surface, symbols
+   are appended as paths rather than stamped from a raster.
+
+   The tag of a symbol and the line number of a line are drawn
+   centred on the object, clipped to within PNID_SHEET_LABEL_PAD_PT
+   of its box, and are dropped below lod_text_scale. Labels are
+   shaped once by the sheet's #PnidTextcache rather than each time
+   they are drawn. */
+
+#include <cairo.h>
+#include <glib.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_rtree.h"
+#include "pnid_symcache.h"
+#include "pnid_symdef.h"
+#include "pnid_textcache.h"
+#include "pnid_draw.h"
+#include "pnid_sheet.h"
+
+/* collect: the objects and fills of a pnid_sheet_draw() */
+struct collect {
+  const PnidSheet *sheet;
+  GArray          *fills;	/* cairo_rectangle_t, dots and summaries */
+  GPtrArray       *objs;	/* PnidObj, drawn above a dot */
+};
+
+static int  collect_node(const PnidBox *mbr, void *data);
+static void collect_object(PnidObj *obj, void *data);
+static void collect_fill(struct collect *c, double x, double y, double width, double height);
+
+/*********************
+ * Drawing
+*******************/
+
+/* pnid_sheet_draw_page(): fill the page white */
+void
+pnid_sheet_draw_page(const PnidSheet *sheet, cairo_t *cr)
+{
+  cairo_save(cr);
+  cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+  cairo_rectangle(cr, 0, 0, sheet->page_width, sheet->page_height);
+  cairo_fill(cr);
+  cairo_restore(cr);
+}
+
+/* pnid_sheet_draw_margins(): outline the printable area within the
+   margins of the page */
+void
+pnid_sheet_draw_margins(const PnidSheet *sheet, cairo_t *cr)
+{
+  cairo_save(cr);
+  cairo_set_source_rgb(cr, 0.75, 0.75, 0.75);
+  cairo_translate(cr, sheet->left_margin, sheet->top_margin);
+  cairo_rectangle(cr, 0, 0,
+		  sheet->page_width - sheet->left_margin - sheet->right_margin,
+		  sheet->page_height - sheet->top_margin - sheet->bottom_margin);
+  cairo_stroke(cr);
+  cairo_restore(cr);
+}
+
+/* pnid_sheet_draw_object(): draw obj at its level of detail with the
+   source and line width of cr */
+void
+pnid_sheet_draw_object(const PnidSheet *sheet, cairo_t *cr, PnidSymcache *sc,
+		       const PnidObj *obj)
+{
+  const double z = sheet->scale;
+  enum pnid_sheet_lod lod = pnid_sheet_lod(sheet, &obj->bbox);
+
+  /* lines have no outline, drawn the same at any size they resolve */
+  if (obj->type != PNID_OBJ_SYMBOL && lod != PNID_SHEET_DOT) {
+    cairo_save(cr);
+    cairo_translate(cr, pnid_box_get_left(&obj->bbox), pnid_box_get_top(&obj->bbox));
+    pnid_draw_line(cr, obj->type, pnid_box_width(&obj->bbox), pnid_box_height(&obj->bbox));
+    cairo_restore(cr);
+    cairo_stroke(cr);
+    pnid_sheet_draw_label(sheet, cr, obj);
+    return;
+  }
+
+  switch (lod) {
+  case PNID_SHEET_DOT:
+    cairo_rectangle(cr,
+		    pnid_box_get_left(&obj->bbox) + pnid_box_width(&obj->bbox) / 2.0,
+		    pnid_box_get_top(&obj->bbox) + pnid_box_height(&obj->bbox) / 2.0,
+		    1.0 / z, 1.0 / z);
+    cairo_fill(cr);
+    break;
+  case PNID_SHEET_OUTLINE:
+    cairo_rectangle(cr, pnid_box_get_left(&obj->bbox), pnid_box_get_top(&obj->bbox),
+		    pnid_box_width(&obj->bbox), pnid_box_height(&obj->bbox));
+    cairo_stroke(cr);
+    break;
+  case PNID_SHEET_FULL:
+    if (sheet->vector)
+      pnid_symcache_path(sc, cr, obj->symbol, &obj->bbox);
+    else
+      pnid_symcache_stamp(sc, cr, obj->symbol, &obj->bbox, z);
+    break;
+  }
+  if (lod != PNID_SHEET_DOT)
+    pnid_sheet_draw_label(sheet, cr, obj);
+}
+
+/* pnid_sheet_draw_label(): draw the tag of a symbol or line number
+   of a line centred on obj with the source of cr, if it has one and
+   the scale resolves it */
+void
+pnid_sheet_draw_label(const PnidSheet *sheet, cairo_t *cr, const PnidObj *obj)
+{
+  const PnidBox *b = &obj->bbox;
+  const char *text;
+
+  text = pnid_symdef_attr(obj, obj->type == PNID_OBJ_SYMBOL ? PNID_ATTR_TAG : PNID_ATTR_LINE);
+  if (!text || !sheet->texts || sheet->scale < sheet->lod_text_scale)
+    return;
+
+  cairo_save(cr);
+  cairo_rectangle(cr,
+		  (double)pnid_box_get_left(b) - PNID_SHEET_LABEL_PAD_PT,
+		  (double)pnid_box_get_top(b) - PNID_SHEET_LABEL_PAD_PT,
+		  pnid_box_width(b) + 2 * PNID_SHEET_LABEL_PAD_PT,
+		  pnid_box_height(b) + 2 * PNID_SHEET_LABEL_PAD_PT);
+  cairo_clip(cr);
+  if (sheet->vector)
+    pnid_textcache_path(sheet->texts, cr, text, PNID_SHEET_LABEL_FONT,
+			pnid_box_get_left(b) + pnid_box_width(b) / 2.0,
+			pnid_box_get_top(b) + pnid_box_height(b) / 2.0);
+  else
+    pnid_textcache_show(sheet->texts, cr, text, PNID_SHEET_LABEL_FONT,
+			pnid_box_get_left(b) + pnid_box_width(b) / 2.0,
+			pnid_box_get_top(b) + pnid_box_height(b) / 2.0, sheet->scale);
+  cairo_restore(cr);
+}
+
+/* pnid_sheet_draw(): draw every object of index overlapping region,
+   or whose label may, the dots and subtree summaries filled together
+   beneath the rest. Returns the number of index nodes visited. */
+int
+pnid_sheet_draw(const PnidSheet *sheet, cairo_t *cr, PnidRtree *index,
+		PnidSymcache *sc, const PnidBox *region)
+{
+  struct collect c = { sheet };
+  cairo_rectangle_t *r;
+  PnidBox search = *region;
+  guint i;
+  int nodes;
+
+  if (sheet->texts && sheet->scale >= sheet->lod_text_scale)
+    pnid_sheet_label_region(&search);
+
+  c.fills = g_array_new(FALSE, FALSE, sizeof(cairo_rectangle_t));
+  c.objs = g_ptr_array_new();
+  nodes = pnid_rtree_walk(index, &search, collect_node, collect_object, &c);
+
+  cairo_save(cr);
+  cairo_new_path(cr);
+  for (r = (cairo_rectangle_t *)c.fills->data;
+       r < (cairo_rectangle_t *)c.fills->data + c.fills->len; r++)
+    cairo_rectangle(cr, r->x, r->y, r->width, r->height);
+  cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 0.5);
+  cairo_fill(cr);
+
+  cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
+  cairo_set_line_width(cr, 1.0 / sheet->scale);
+  for (i = 0; i < c.objs->len; i++)
+    pnid_sheet_draw_object(sheet, cr, sc, g_ptr_array_index(c.objs, i));
+  cairo_restore(cr);
+
+  g_array_free(c.fills, TRUE);
+  g_ptr_array_free(c.objs, TRUE);
+
+  return nodes;
+}
+
+/* pnid_sheet_label_region(): grow region to take in the objects
+   whose labels may overhang it */
+void
+pnid_sheet_label_region(PnidBox *region)
+{
+  pnid_box_set_left(region, MAX((int)pnid_box_get_left(region) - PNID_SHEET_LABEL_PAD_PT, 0));
+  pnid_box_set_top(region, MAX((int)pnid_box_get_top(region) - PNID_SHEET_LABEL_PAD_PT, 0));
+  pnid_box_set_right(region, pnid_box_get_right(region) + PNID_SHEET_LABEL_PAD_PT);
+  pnid_box_set_bottom(region, pnid_box_get_bottom(region) + PNID_SHEET_LABEL_PAD_PT);
+}
+
+/*********************
+ * Level of Detail
+*******************/
+
+/* pnid_sheet_lod(): the level of detail to draw an object bounded by
+   bbox at */
+enum pnid_sheet_lod
+pnid_sheet_lod(const PnidSheet *sheet, const PnidBox *bbox)
+{
+  if (MAX(pnid_box_width(bbox), pnid_box_height(bbox)) * sheet->scale
+      < sheet->lod_object_px)
+    return PNID_SHEET_DOT;
+  if (sheet->scale < sheet->lod_line_scale)
+    return PNID_SHEET_OUTLINE;
+  return PNID_SHEET_FULL;
+}
+
+/* pnid_sheet_summarise(): non-zero when a subtree bounded by mbr is
+   too small for its contents to be drawn */
+int
+pnid_sheet_summarise(const PnidSheet *sheet, const PnidBox *mbr)
+{
+  return MAX(pnid_box_width(mbr), pnid_box_height(mbr)) * sheet->scale
+    < sheet->lod_node_px;
+}
+
+/*********************
+ * Utilities
+*******************/
+
+/* collect_node(): #PnidRtreeNodeFunc, a subtree too small to resolve
+   is summarised by its mbr rather than being entered. */
+static int
+collect_node(const PnidBox *mbr, void *data)
+{
+  struct collect *c = data;
+
+  if (!pnid_sheet_summarise(c->sheet, mbr))
+    return 1;
+
+  collect_fill(c, pnid_box_get_left(mbr), pnid_box_get_top(mbr),
+	       pnid_box_width(mbr), pnid_box_height(mbr));
+  return 0;
+}
+
+/* collect_object(): #PnidRtreeTupleFunc, an object too small to
+   resolve is reduced to a dot. */
+static void
+collect_object(PnidObj *obj, void *data)
+{
+  struct collect *c = data;
+
+  if (pnid_sheet_lod(c->sheet, &obj->bbox) == PNID_SHEET_DOT)
+    collect_fill(c,
+		 pnid_box_get_left(&obj->bbox) + pnid_box_width(&obj->bbox) / 2.0,
+		 pnid_box_get_top(&obj->bbox) + pnid_box_height(&obj->bbox) / 2.0,
+		 0, 0);
+  else
+    g_ptr_array_add(c->objs, obj);
+}
+
+/* collect_fill(): add a rectangle in points, at least one device
+   pixel in size, to be filled. */
+static void
+collect_fill(struct collect *c, double x, double y, double width, double height)
+{
+  cairo_rectangle_t r;
+
+  r.x = x;
+  r.y = y;
+  r.width = MAX(width, 1.0 / c->sheet->scale);
+  r.height = MAX(height, 1.0 / c->sheet->scale);
+  g_array_append_val(c->fills, r);
+}
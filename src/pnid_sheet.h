@@ -0,0 +1,61 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_sheet.h - drawing a sheet of a pnid drawing with cairo */
+
+#ifndef __PNID_SHEET_H
+#define __PNID_SHEET_H
+
+#include <cairo.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_rtree.h"
+#include "pnid_symcache.h"
+#include "pnid_textcache.h"
+
+#define PNID_SHEET_LABEL_FONT   "Sans 6" /* Tags and line numbers */
+#define PNID_SHEET_LABEL_PAD_PT 5	 /* Labels overhang their object by */
+
+/* pnid_sheet_lod: the level of detail an object is drawn at */
+enum pnid_sheet_lod {
+  PNID_SHEET_DOT = 0,		/* single pixel */
+  PNID_SHEET_OUTLINE,		/* bounding box hairline */
+  PNID_SHEET_FULL		/* symbol */
+};
+
+/* #PnidSheet: the page a drawing is drawn on and the scale and
+   detail it is drawn at. Lengths are in points. */
+typedef struct pnid_sheet {
+  double page_width;
+  double page_height;
+  double top_margin;
+  double bottom_margin;
+  double left_margin;
+  double right_margin;
+  double scale;			/* device pixels per point */
+  double lod_object_px;		/* objects smaller are dots */
+  double lod_node_px;		/* subtrees smaller are one rectangle */
+  double lod_line_scale;	/* symbols are outlines below */
+  double lod_text_scale;	/* labels are dropped below */
+  int    vector;		/* symbols are paths, not stamped rasters */
+  PnidTextcache *texts;		/* labels are shaped by, none if NULL */
+} PnidSheet;
+
+/* Draw the page and the objects upon it, cr's origin being the top
+   left of the page in points */
+void                pnid_sheet_draw_page(const PnidSheet *sheet, cairo_t *cr);
+void                pnid_sheet_draw_margins(const PnidSheet *sheet, cairo_t *cr);
+void                pnid_sheet_draw_object(const PnidSheet *sheet, cairo_t *cr, PnidSymcache *sc,
+					   const PnidObj *obj);
+void                pnid_sheet_draw_label(const PnidSheet *sheet, cairo_t *cr, const PnidObj *obj);
+int                 pnid_sheet_draw(const PnidSheet *sheet, cairo_t *cr, PnidRtree *index,
+				    PnidSymcache *sc, const PnidBox *region);
+void                pnid_sheet_label_region(PnidBox *region);
+
+/* Choose the detail to draw at */
+enum pnid_sheet_lod pnid_sheet_lod(const PnidSheet *sheet, const PnidBox *bbox);
+int                 pnid_sheet_summarise(const PnidSheet *sheet, const PnidBox *mbr);
+
+#endif /* __PNID_SHEET_H */
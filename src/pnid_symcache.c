@@ -0,0 +1,354 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_symcache.c - cache of symbol paths and rasters.
+
+   Each symbol's path is built once, at a nominal size, and copied
+   from a recording surface. The path is then rasterised into an
+   alpha mask once for every drawing scale it is requested at, so
+   that instances of the symbol are stamped with cairo_mask_surface()
+   rather than being tessellated again.
+
+   Image resources are decoded once and a copy resampled for each
+   scale is kept in the same way.
+
+   The cache is not locked. Once prepared for a scale it is only read
+   when stamping symbols at that scale, or drawing their paths, and
+   may then be shared between threads. */
+
+#include <cairo.h>
+#include <gio/gio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_draw.h"
+#include "pnid_symcache.h"
+
+#define SYMBOL_SIZE_PT  20	/* nominal size of symbol rasters */
+#define SYMBOL_LINE_PT  1.0	/* symbol line width */
+#define SYMBOL_PAD_PT   1.0	/* raster border for the line width */
+#define MAXSCALES       8	/* rasters kept of each symbol */
+
+typedef struct raster Raster;
+
+/* raster: a symbol or image rendered for a single drawing scale */
+struct raster {
+  double           scale;
+  cairo_surface_t *s;
+};
+
+/* symbol: a symbol's path and its rasters, when all rasters are
+   occupied they are replaced in turn starting from next. */
+struct symbol {
+  cairo_path_t *path;
+  Raster        r[MAXSCALES];
+  size_t        next;
+};
+
+/* image: a decoded image resource and its resampled rasters */
+struct image {
+  cairo_surface_t *decoded;
+  Raster           r[MAXSCALES];
+  size_t           next;
+};
+
+struct pnid_symcache {
+  struct symbol  sym[PNID_N_SYMBOLS];
+  GHashTable    *images;	/* resource path -> struct image */
+};
+
+/* png_stream: closure reading a png from memory */
+struct png_stream {
+  const unsigned char *data;
+  size_t               len;
+  size_t               pos;
+};
+
+static Raster          *lookup(Raster *r, size_t *next, double scale);
+static cairo_surface_t *rasterise(const cairo_path_t *path, double scale);
+static cairo_surface_t *resample(cairo_surface_t *decoded, double scale);
+static cairo_surface_t *decode(const char *path);
+static cairo_status_t   read_png(void *closure, unsigned char *data, unsigned int length);
+static void             free_rasters(Raster *r);
+static void             free_image(gpointer data);
+
+/* pnid_symcache_new(): create a cache holding the path of every
+   symbol. Returns NULL on error. */
+PnidSymcache *
+pnid_symcache_new(void)
+{
+  PnidSymcache *sc;
+  cairo_surface_t *rec;
+  cairo_t *cr;
+  unsigned i;
+
+  if (!(sc = calloc(1, sizeof *sc)))
+    return NULL;
+
+  rec = cairo_recording_surface_create(CAIRO_CONTENT_ALPHA, NULL);
+  cr = cairo_create(rec);
+  for (i = 0; i < PNID_N_SYMBOLS; i++) {
+    cairo_new_path(cr);
+    pnid_draw_symbol(cr, i, SYMBOL_SIZE_PT, SYMBOL_SIZE_PT);
+    sc->sym[i].path = cairo_copy_path(cr);
+  }
+  cairo_destroy(cr);
+  cairo_surface_destroy(rec);
+
+  sc->images = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_image);
+
+  for (i = 0; i < PNID_N_SYMBOLS; i++)
+    if (sc->sym[i].path->status != CAIRO_STATUS_SUCCESS) {
+      pnid_symcache_destroy(sc);
+      return NULL;
+    }
+
+  return sc;
+}
+
+/* pnid_symcache_destroy(): free the cache with all of its paths and
+   rasters. */
+void
+pnid_symcache_destroy(PnidSymcache *sc)
+{
+  unsigned i;
+
+  if (!sc)
+    return;
+
+  for (i = 0; i < PNID_N_SYMBOLS; i++) {
+    cairo_path_destroy(sc->sym[i].path);
+    free_rasters(sc->sym[i].r);
+  }
+  g_hash_table_destroy(sc->images);
+  free(sc);
+}
+
+/* pnid_symcache_prepare(): rasterise every symbol for scale ahead of
+   it being stamped. */
+void
+pnid_symcache_prepare(PnidSymcache *sc, double scale)
+{
+  struct symbol *sym;
+  Raster *r;
+  unsigned i;
+
+  for (i = 0; i < PNID_N_SYMBOLS; i++) {
+    sym = &sc->sym[i];
+    r = lookup(sym->r, &sym->next, scale);
+    if (!r->s) {
+      r->s = rasterise(sym->path, scale);
+      r->scale = scale;
+    }
+  }
+}
+
+/* pnid_symcache_stamp(): draw an instance of symbol filling bbox by
+   masking the source of cr with the symbol's raster for scale. */
+void
+pnid_symcache_stamp(PnidSymcache *sc, cairo_t *cr, unsigned symbol,
+		    const PnidBox *bbox, double scale)
+{
+  struct symbol *sym;
+  Raster *r;
+
+  if (!pnid_box_width(bbox) || !pnid_box_height(bbox))
+    return;
+  if (symbol >= PNID_N_SYMBOLS)
+    symbol = PNID_SYMBOL_NONE;
+
+  sym = &sc->sym[symbol];
+  r = lookup(sym->r, &sym->next, scale);
+  if (!r->s) {
+    r->s = rasterise(sym->path, scale);
+    r->scale = scale;
+  }
+
+  cairo_save(cr);
+  cairo_translate(cr, pnid_box_get_left(bbox), pnid_box_get_top(bbox));
+  cairo_scale(cr,
+	      pnid_box_width(bbox)  / (double)SYMBOL_SIZE_PT,
+	      pnid_box_height(bbox) / (double)SYMBOL_SIZE_PT);
+  cairo_mask_surface(cr, r->s, -SYMBOL_PAD_PT, -SYMBOL_PAD_PT);
+  cairo_restore(cr);
+}
+
+/* pnid_symcache_path(): draw an instance of symbol filling bbox by
+   stroking the symbol's path, which stays a path on vector
+   surfaces. */
+void
+pnid_symcache_path(PnidSymcache *sc, cairo_t *cr, unsigned symbol, const PnidBox *bbox)
+{
+  if (!pnid_box_width(bbox) || !pnid_box_height(bbox))
+    return;
+  if (symbol >= PNID_N_SYMBOLS)
+    symbol = PNID_SYMBOL_NONE;
+
+  cairo_save(cr);
+  cairo_translate(cr, pnid_box_get_left(bbox), pnid_box_get_top(bbox));
+  cairo_scale(cr,
+	      pnid_box_width(bbox)  / (double)SYMBOL_SIZE_PT,
+	      pnid_box_height(bbox) / (double)SYMBOL_SIZE_PT);
+  cairo_new_path(cr);
+  cairo_append_path(cr, sc->sym[symbol].path);
+  cairo_set_line_width(cr, SYMBOL_LINE_PT);
+  cairo_stroke(cr);
+  cairo_restore(cr);
+}
+
+/* pnid_symcache_image(): return the image resource at path resampled
+   for scale. The image is only decoded the first time it is
+   requested. */
+cairo_surface_t *
+pnid_symcache_image(PnidSymcache *sc, const char *path, double scale)
+{
+  struct image *img;
+  Raster *r;
+
+  if (!(img = g_hash_table_lookup(sc->images, path))) {
+    img = g_new0(struct image, 1);
+    img->decoded = decode(path);
+    g_hash_table_insert(sc->images, g_strdup(path), img);
+  }
+  if (!img->decoded)
+    return NULL;
+
+  r = lookup(img->r, &img->next, scale);
+  if (!r->s) {
+    r->s = resample(img->decoded, scale);
+    r->scale = scale;
+  }
+
+  return r->s;
+}
+
+/* lookup(): find the raster for scale in r, otherwise return an empty
+   raster to hold it, replacing the next one in turn if r is full. */
+static Raster *
+lookup(Raster *r, size_t *next, double scale)
+{
+  Raster *cur;
+
+  for (cur = r; cur < r + MAXSCALES && cur->s; cur++)
+    if (cur->scale == scale)
+      return cur;
+  if (cur < r + MAXSCALES)
+    return cur;
+
+  cur = r + (*next)++ % MAXSCALES;
+  cairo_surface_destroy(cur->s);
+  cur->s = NULL;
+
+  return cur;
+}
+
+/* rasterise(): stroke path into an alpha mask of scale device pixels
+   per point. */
+static cairo_surface_t *
+rasterise(const cairo_path_t *path, double scale)
+{
+  cairo_surface_t *s;
+  cairo_t *cr;
+  int px;
+
+  px = ceil((SYMBOL_SIZE_PT + 2 * SYMBOL_PAD_PT) * scale);
+  s = cairo_image_surface_create(CAIRO_FORMAT_A8, px, px);
+  cairo_surface_set_device_scale(s, scale, scale);
+
+  cr = cairo_create(s);
+  cairo_translate(cr, SYMBOL_PAD_PT, SYMBOL_PAD_PT);
+  cairo_append_path(cr, path);
+  cairo_set_line_width(cr, SYMBOL_LINE_PT);
+  cairo_stroke(cr);
+  cairo_destroy(cr);
+
+  return s;
+}
+
+/* resample(): copy of decoded at scale device pixels per image
+   pixel. */
+static cairo_surface_t *
+resample(cairo_surface_t *decoded, double scale)
+{
+  cairo_surface_t *s;
+  cairo_t *cr;
+
+  s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+				 ceil(cairo_image_surface_get_width(decoded) * scale),
+				 ceil(cairo_image_surface_get_height(decoded) * scale));
+  cairo_surface_set_device_scale(s, scale, scale);
+
+  cr = cairo_create(s);
+  cairo_set_source_surface(cr, decoded, 0, 0);
+  cairo_paint(cr);
+  cairo_destroy(cr);
+
+  return s;
+}
+
+/* decode(): decode the png resource at path, returns NULL on
+   error. */
+static cairo_surface_t *
+decode(const char *path)
+{
+  GBytes *bytes;
+  struct png_stream png;
+  cairo_surface_t *s;
+
+  if (!(bytes = g_resources_lookup_data(path, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL)))
+    return NULL;
+
+  png.data = g_bytes_get_data(bytes, &png.len);
+  png.pos = 0;
+  s = cairo_image_surface_create_from_png_stream(read_png, &png);
+  g_bytes_unref(bytes);
+
+  if (cairo_surface_status(s) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(s);
+    return NULL;
+  }
+
+  return s;
+}
+
+/* read_png(): cairo_read_func_t reading from a png_stream */
+static cairo_status_t
+read_png(void *closure, unsigned char *data, unsigned int length)
+{
+  struct png_stream *png = closure;
+
+  if (png->len - png->pos < length)
+    return CAIRO_STATUS_READ_ERROR;
+
+  memcpy(data, png->data + png->pos, length);
+  png->pos += length;
+
+  return CAIRO_STATUS_SUCCESS;
+}
+
+/* free_rasters(): destroy every raster surface in r */
+static void
+free_rasters(Raster *r)
+{
+  Raster *cur;
+
+  for (cur = r; cur < r + MAXSCALES; cur++)
+    if (cur->s)
+      cairo_surface_destroy(cur->s);
+}
+
+/* free_image(): GDestroyNotify for struct image */
+static void
+free_image(gpointer data)
+{
+  struct image *img = data;
+
+  free_rasters(img->r);
+  if (img->decoded)
+    cairo_surface_destroy(img->decoded);
+  g_free(img);
+}
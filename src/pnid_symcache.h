@@ -0,0 +1,41 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_symcache.h - cache of symbol paths and their rasters at each
+   drawing scale */
+
+#ifndef __PNID_SYMCACHE_H
+#define __PNID_SYMCACHE_H
+
+#include <cairo.h>
+
+#include "pnid_box.h"
+
+/* #PnidSymcache: symbol and image cache */
+typedef struct pnid_symcache PnidSymcache;
+
+/* Create and destroy the cache */
+PnidSymcache    *pnid_symcache_new(void);
+void             pnid_symcache_destroy(PnidSymcache *sc);
+
+/* pnid_symcache_prepare(): rasterise every symbol for scale. Stamping
+   at only that scale afterwards just reads the cache, from any number
+   of threads at once. */
+void             pnid_symcache_prepare(PnidSymcache *sc, double scale);
+
+/* pnid_symcache_stamp(): draw symbol with the source of cr to fill
+   bbox, scale is the number of device pixels per point in cr. */
+void             pnid_symcache_stamp(PnidSymcache *sc, cairo_t *cr, unsigned symbol,
+				     const PnidBox *bbox, double scale);
+
+/* pnid_symcache_path(): draw symbol with the source of cr to fill
+   bbox as a path, for vector surfaces. */
+void             pnid_symcache_path(PnidSymcache *sc, cairo_t *cr, unsigned symbol,
+				    const PnidBox *bbox);
+
+/* pnid_symcache_image(): the image resource at path decoded and
+   resampled for scale, owned by the cache. Returns NULL on error. */
+cairo_surface_t *pnid_symcache_image(PnidSymcache *sc, const char *path, double scale);
+
+#endif /* __PNID_SYMCACHE_H */
@@ -0,0 +1,235 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_symdef.c - symbol definitions shared by their instances
+
+   A placed symbol holds only its symbol number, its box, which places
+   and scales the definition, and the attributes it overrides. The
+   rest is held once in its definition: the nominal size it is placed
+   at, the ports lines connect to and its default attributes.
+
+   Definitions are read from the symbols.xml resource the first time
+   one is needed. A symbol it does not define, or every symbol when
+   the resource is not linked in, keeps a bare definition of its name
+   and a nominal size. */
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <math.h>
+#include <string.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_symdef.h"
+
+#define NOMINAL_PT 20		/* size of symbols not defined */
+
+/* parse: state of the definitions parser */
+struct parse {
+  PnidSymdef *def;		/* symbol being defined */
+  int         attr;		/* attribute being read, or -1 */
+};
+
+static void load(void);
+static void start_element(GMarkupParseContext *context, const char *element,
+			  const char **names, const char **values,
+			  gpointer data, GError **error);
+static void end_element(GMarkupParseContext *context, const char *element,
+			gpointer data, GError **error);
+static void text(GMarkupParseContext *context, const char *text, gsize len,
+		 gpointer data, GError **error);
+
+static PnidSymdef defs[PNID_N_SYMBOLS] = {
+  [PNID_SYMBOL_NONE]       = { "none",       NOMINAL_PT, NOMINAL_PT },
+  [PNID_SYMBOL_VALVE]      = { "valve",      NOMINAL_PT, NOMINAL_PT },
+  [PNID_SYMBOL_INSTRUMENT] = { "instrument", NOMINAL_PT, NOMINAL_PT },
+  [PNID_SYMBOL_PUMP]       = { "pump",       NOMINAL_PT, NOMINAL_PT },
+};
+
+static const char *attr_names[PNID_N_ATTRS] = {
+  [PNID_ATTR_TAG]     = "tag",
+  [PNID_ATTR_LINE]    = "line",
+  [PNID_ATTR_SERVICE] = "service",
+  [PNID_ATTR_SIZE]    = "size",
+  [PNID_ATTR_SPEC]    = "spec",
+};
+
+/*********************
+ * Definitions
+*******************/
+
+/* pnid_symdef_get(): the definition of symbol, that of
+   PNID_SYMBOL_NONE if it is out of range */
+const PnidSymdef *
+pnid_symdef_get(unsigned symbol)
+{
+  load();
+
+  return &defs[symbol < PNID_N_SYMBOLS ? symbol : PNID_SYMBOL_NONE];
+}
+
+/* pnid_symdef_lookup(): the symbol named name, PNID_SYMBOL_NONE if
+   there is none */
+unsigned
+pnid_symdef_lookup(const char *name)
+{
+  unsigned i;
+
+  for (i = 0; i < PNID_N_SYMBOLS; i++)
+    if (!g_ascii_strcasecmp(defs[i].name, name))
+      return i;
+
+  return PNID_SYMBOL_NONE;
+}
+
+/*********************
+ * Instances
+*******************/
+
+/* pnid_symdef_place(): the box of an instance of symbol at its
+   nominal size times scale, centred on x, y */
+PnidBox
+pnid_symdef_place(unsigned symbol, unsigned x, unsigned y, double scale)
+{
+  const PnidSymdef *def = pnid_symdef_get(symbol);
+  unsigned w = lround(def->width * scale), h = lround(def->height * scale);
+  PnidBox box;
+
+  box.nw.x = x > w / 2 ? x - w / 2 : 0;
+  box.nw.y = y > h / 2 ? y - h / 2 : 0;
+  box.se.x = box.nw.x + w;
+  box.se.y = box.nw.y + h;
+
+  return box;
+}
+
+/* pnid_symdef_attr(): attribute attr of obj, its own if it overrides
+   it or else its symbol's default. Returns NULL if neither is set. */
+const char *
+pnid_symdef_attr(const PnidObj *obj, enum pnid_attr attr)
+{
+  if (obj->attr[attr] || obj->type != PNID_OBJ_SYMBOL)
+    return obj->attr[attr];
+
+  return pnid_symdef_get(obj->symbol)->attr[attr];
+}
+
+/* pnid_symdef_port(): store where port of obj lies in at. Returns
+   -ERANGE if obj is not a symbol with that port, or 0. */
+int
+pnid_symdef_port(const PnidObj *obj, unsigned port, PnidCoord *at)
+{
+  const PnidSymdef *def;
+
+  if (obj->type != PNID_OBJ_SYMBOL
+      || port >= (def = pnid_symdef_get(obj->symbol))->nports)
+    return -ERANGE;
+
+  at->x = obj->bbox.nw.x + lround(def->port[port].x * pnid_box_width(&obj->bbox));
+  at->y = obj->bbox.nw.y + lround(def->port[port].y * pnid_box_height(&obj->bbox));
+
+  return 0;
+}
+
+/*********************
+ * Loading
+*******************/
+
+/* load(): read the definitions resource, once */
+static void
+load(void)
+{
+  static gsize loaded = 0;
+  static const GMarkupParser parser = { start_element, end_element, text, NULL, NULL };
+  struct parse p = { NULL, -1 };
+  GMarkupParseContext *context;
+  GError *error = NULL;
+  GBytes *bytes;
+  gsize len;
+  const char *xml;
+
+  if (!g_once_init_enter(&loaded))
+    return;
+
+  if ((bytes = g_resources_lookup_data(PNID_SYMDEF_RESOURCE, G_RESOURCE_LOOKUP_FLAGS_NONE, NULL))) {
+    xml = g_bytes_get_data(bytes, &len);
+    context = g_markup_parse_context_new(&parser, 0, &p, NULL);
+    if (!g_markup_parse_context_parse(context, xml, len, &error)
+	|| !g_markup_parse_context_end_parse(context, &error)) {
+      g_warning("Failed to read symbol definitions: %s", error->message);
+      g_error_free(error);
+    }
+    g_markup_parse_context_free(context);
+    g_bytes_unref(bytes);
+  }
+
+  g_once_init_leave(&loaded, 1);
+}
+
+/* start_element(): #GMarkupParser, begin a symbol definition or add
+   a port or default attribute to it */
+static void
+start_element(GMarkupParseContext *context, const char *element,
+	      const char **names, const char **values,
+	      gpointer data, GError **error)
+{
+  struct parse *p = data;
+  const char *name = NULL, *w = NULL, *h = NULL, *x = NULL, *y = NULL;
+  unsigned symbol;
+  int i;
+
+  if (!g_markup_collect_attributes(element, names, values, error,
+				   G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "name", &name,
+				   G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "width", &w,
+				   G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "height", &h,
+				   G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "x", &x,
+				   G_MARKUP_COLLECT_STRING | G_MARKUP_COLLECT_OPTIONAL, "y", &y,
+				   G_MARKUP_COLLECT_INVALID))
+    return;
+
+  if (!strcmp(element, "symbol") && name) {
+    symbol = pnid_symdef_lookup(name);
+    if (symbol == PNID_SYMBOL_NONE && g_ascii_strcasecmp(name, defs[symbol].name)) {
+      p->def = NULL;		/* not a symbol pnid draws */
+      return;
+    }
+    p->def = &defs[symbol];
+    if (w)
+      p->def->width = g_ascii_strtod(w, NULL);
+    if (h)
+      p->def->height = g_ascii_strtod(h, NULL);
+  } else if (!strcmp(element, "port") && p->def && x && y
+	     && p->def->nports < PNID_SYMDEF_MAX_PORTS) {
+    p->def->port[p->def->nports].x = g_ascii_strtod(x, NULL);
+    p->def->port[p->def->nports].y = g_ascii_strtod(y, NULL);
+    p->def->nports++;
+  } else if (!strcmp(element, "attr") && p->def && name) {
+    for (i = 0; i < PNID_N_ATTRS; i++)
+      if (!strcmp(attr_names[i], name))
+	p->attr = i;
+  }
+}
+
+/* end_element(): #GMarkupParser, end a symbol or attribute */
+static void
+end_element(GMarkupParseContext *context, const char *element,
+	    gpointer data, GError **error)
+{
+  struct parse *p = data;
+
+  if (!strcmp(element, "symbol"))
+    p->def = NULL;
+  p->attr = -1;
+}
+
+/* text(): #GMarkupParser, the value of a default attribute */
+static void
+text(GMarkupParseContext *context, const char *text, gsize len,
+     gpointer data, GError **error)
+{
+  struct parse *p = data;
+
+  if (p->def && p->attr >= 0)
+    p->def->attr[p->attr] = g_strndup(text, len);
+}
@@ -0,0 +1,44 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_symdef.h - symbol definitions shared by their instances */
+
+#ifndef __PNID_SYMDEF_H
+#define __PNID_SYMDEF_H
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+
+#define PNID_SYMDEF_RESOURCE  "/cymru/ert/pnid/data/symbols.xml"
+#define PNID_SYMDEF_MAX_PORTS 4
+
+/* pnid_symdef_port: where lines connect to a symbol, as fractions of
+   its box from the top left */
+struct pnid_symdef_port {
+  double x;
+  double y;
+};
+
+/* #PnidSymdef: what every instance of a symbol shares. The symbol's
+   path is drawn by pnid_draw_symbol() and rasterised once for all of
+   them by the #PnidSymcache. */
+typedef struct pnid_symdef {
+  const char              *name;
+  double                   width;	/* nominal size, points */
+  double                   height;
+  unsigned                 nports;
+  struct pnid_symdef_port  port[PNID_SYMDEF_MAX_PORTS];
+  const char              *attr[PNID_N_ATTRS]; /* defaults */
+} PnidSymdef;
+
+/* Look up the definition of a symbol, by number or name */
+const PnidSymdef *pnid_symdef_get(unsigned symbol);
+unsigned          pnid_symdef_lookup(const char *name);
+
+/* Place an instance, and find what it shares with its definition */
+PnidBox           pnid_symdef_place(unsigned symbol, unsigned x, unsigned y, double scale);
+const char       *pnid_symdef_attr(const PnidObj *obj, enum pnid_attr attr);
+int               pnid_symdef_port(const PnidObj *obj, unsigned port, PnidCoord *at);
+
+#endif /* __PNID_SYMDEF_H */
@@ -0,0 +1,294 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_textcache.c - cache of shaped labels and their rasters.
+
+   Shaping text is far dearer than drawing it, and the tags and line
+   numbers of a drawing are drawn again every frame. Each label is
+   shaped into a #PangoLayout once, keyed by its font and text, and
+   the layout is rasterised into an alpha mask once for every drawing
+   scale it is requested at, so that a label already seen is stamped
+   with cairo_mask_surface() alone.
+
+   Labels are laid out in points, independent of the surface they are
+   drawn on, with metrics unhinted so that they are the same size at
+   every scale. The cache holds about limit bytes of rasters and
+   layouts, dropping the least recently drawn labels beyond it.
+
+   The cache is not locked and its layouts belong to the thread it was
+   created on, so each thread drawing labels keeps its own. */
+
+#include <cairo.h>
+#include <glib.h>
+#include <math.h>
+#include <pango/pangocairo.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_textcache.h"
+
+#define LABEL_PAD_PT    1.0	/* raster border for antialiasing */
+#define LABEL_BYTES     256	/* estimated size of a layout */
+#define MAXSCALES       4	/* rasters kept of each label */
+
+typedef struct raster Raster;
+
+/* raster: a label rendered for a single drawing scale */
+struct raster {
+  double           scale;
+  cairo_surface_t *s;
+};
+
+/* text: a shaped label and its rasters, when all rasters are
+   occupied they are replaced in turn starting from next. */
+struct text {
+  char        *key;		/* font, newline, text */
+  PangoLayout *layout;
+  double       width;		/* logical extents in points */
+  double       height;
+  Raster       r[MAXSCALES];
+  size_t       next;
+  size_t       bytes;		/* of layout and rasters */
+  GList        link;		/* in recent, data is the text */
+};
+
+struct pnid_textcache {
+  PangoContext *context;
+  GHashTable   *texts;		/* key -> struct text */
+  GQueue        recent;		/* most recently drawn first */
+  size_t        bytes;
+  size_t        limit;
+};
+
+static struct text     *lookup(PnidTextcache *tc, const char *text, const char *font);
+static Raster          *lookup_raster(PnidTextcache *tc, struct text *t, double scale);
+static struct text     *shape(PnidTextcache *tc, char *key, const char *text, const char *font);
+static cairo_surface_t *rasterise(const struct text *t, double scale);
+static size_t           raster_bytes(cairo_surface_t *s);
+static void             trim(PnidTextcache *tc, const struct text *keep);
+static void             free_text(gpointer data);
+
+/* pnid_textcache_new(): create an empty cache holding about limit
+   bytes. Returns NULL on error. */
+PnidTextcache *
+pnid_textcache_new(size_t limit)
+{
+  PnidTextcache *tc;
+  cairo_font_options_t *options;
+
+  if (!(tc = calloc(1, sizeof *tc)))
+    return NULL;
+
+  /* a point is a unit of the layout, however the label is scaled */
+  tc->context = pango_font_map_create_context(pango_cairo_font_map_get_default());
+  pango_cairo_context_set_resolution(tc->context, 72.0);
+  options = cairo_font_options_create();
+  cairo_font_options_set_hint_metrics(options, CAIRO_HINT_METRICS_OFF);
+  pango_cairo_context_set_font_options(tc->context, options);
+  cairo_font_options_destroy(options);
+
+  tc->texts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, free_text);
+  g_queue_init(&tc->recent);
+  tc->limit = limit;
+
+  return tc;
+}
+
+/* pnid_textcache_destroy(): free the cache with all of its layouts
+   and rasters. */
+void
+pnid_textcache_destroy(PnidTextcache *tc)
+{
+  if (!tc)
+    return;
+
+  g_hash_table_destroy(tc->texts);
+  g_object_unref(tc->context);
+  free(tc);
+}
+
+/* pnid_textcache_show(): draw text centred on x, y by masking the
+   source of cr with the label's raster for scale. */
+void
+pnid_textcache_show(PnidTextcache *tc, cairo_t *cr, const char *text,
+		    const char *font, double x, double y, double scale)
+{
+  struct text *t;
+  Raster *r;
+
+  if (!*text || !(t = lookup(tc, text, font)) || !(r = lookup_raster(tc, t, scale)))
+    return;
+
+  cairo_mask_surface(cr, r->s,
+		     x - t->width / 2.0 - LABEL_PAD_PT,
+		     y - t->height / 2.0 - LABEL_PAD_PT);
+}
+
+/* pnid_textcache_path(): draw text centred on x, y by filling the
+   outline of the label's layout, which stays a path on vector
+   surfaces. */
+void
+pnid_textcache_path(PnidTextcache *tc, cairo_t *cr, const char *text,
+		    const char *font, double x, double y)
+{
+  struct text *t;
+
+  if (!*text || !(t = lookup(tc, text, font)))
+    return;
+
+  cairo_save(cr);
+  cairo_new_path(cr);
+  cairo_move_to(cr, x - t->width / 2.0, y - t->height / 2.0);
+  pango_cairo_layout_path(cr, t->layout);
+  cairo_fill(cr);
+  cairo_restore(cr);
+}
+
+/*********************
+ * Utilities
+*******************/
+
+/* lookup(): find text in font, shaping it if it is not cached, and
+   mark it the most recently drawn. Returns NULL if out of memory. */
+static struct text *
+lookup(PnidTextcache *tc, const char *text, const char *font)
+{
+  struct text *t;
+  char *key;
+
+  key = g_strconcat(font, "\n", text, NULL);
+  if ((t = g_hash_table_lookup(tc->texts, key))) {
+    g_free(key);
+    g_queue_unlink(&tc->recent, &t->link);
+    g_queue_push_head_link(&tc->recent, &t->link);
+    return t;
+  }
+
+  return shape(tc, key, text, font);
+}
+
+/* lookup_raster(): find the raster of t for scale, rasterising it if
+   it is not cached, replacing the next one in turn if all are
+   occupied. Returns NULL on error. */
+static Raster *
+lookup_raster(PnidTextcache *tc, struct text *t, double scale)
+{
+  Raster *cur;
+
+  for (cur = t->r; cur < t->r + MAXSCALES && cur->s; cur++)
+    if (cur->scale == scale)
+      return cur;
+  if (cur == t->r + MAXSCALES) {
+    cur = t->r + t->next++ % MAXSCALES;
+    t->bytes -= raster_bytes(cur->s);
+    tc->bytes -= raster_bytes(cur->s);
+    cairo_surface_destroy(cur->s);
+    cur->s = NULL;
+  }
+
+  cur->s = rasterise(t, scale);
+  if (cairo_surface_status(cur->s) != CAIRO_STATUS_SUCCESS) {
+    cairo_surface_destroy(cur->s);
+    cur->s = NULL;
+    return NULL;
+  }
+  cur->scale = scale;
+  t->bytes += raster_bytes(cur->s);
+  tc->bytes += raster_bytes(cur->s);
+  trim(tc, t);
+
+  return cur;
+}
+
+/* shape(): lay out text in font and add it to the cache under key,
+   which the cache takes. Returns NULL if out of memory. */
+static struct text *
+shape(PnidTextcache *tc, char *key, const char *text, const char *font)
+{
+  PangoFontDescription *desc;
+  PangoRectangle logical;
+  struct text *t;
+
+  if (!(t = calloc(1, sizeof *t))) {
+    g_free(key);
+    return NULL;
+  }
+
+  t->key = key;
+  t->layout = pango_layout_new(tc->context);
+  desc = pango_font_description_from_string(font);
+  pango_layout_set_font_description(t->layout, desc);
+  pango_font_description_free(desc);
+  pango_layout_set_text(t->layout, text, -1);
+  pango_layout_get_extents(t->layout, NULL, &logical);
+  t->width = (double)logical.width / PANGO_SCALE;
+  t->height = (double)logical.height / PANGO_SCALE;
+  t->bytes = LABEL_BYTES + strlen(key);
+  t->link.data = t;
+
+  g_hash_table_insert(tc->texts, t->key, t);
+  g_queue_push_head_link(&tc->recent, &t->link);
+  tc->bytes += t->bytes;
+  trim(tc, t);
+
+  return t;
+}
+
+/* rasterise(): fill t's layout into an alpha mask of scale device
+   pixels per point. */
+static cairo_surface_t *
+rasterise(const struct text *t, double scale)
+{
+  cairo_surface_t *s;
+  cairo_t *cr;
+
+  s = cairo_image_surface_create(CAIRO_FORMAT_A8,
+				 ceil((t->width + 2 * LABEL_PAD_PT) * scale),
+				 ceil((t->height + 2 * LABEL_PAD_PT) * scale));
+  cairo_surface_set_device_scale(s, scale, scale);
+
+  cr = cairo_create(s);
+  cairo_move_to(cr, LABEL_PAD_PT, LABEL_PAD_PT);
+  pango_cairo_show_layout(cr, t->layout);
+  cairo_destroy(cr);
+
+  return s;
+}
+
+/* raster_bytes(): the size of the pixels of raster s */
+static size_t
+raster_bytes(cairo_surface_t *s)
+{
+  return (size_t)cairo_image_surface_get_stride(s) * cairo_image_surface_get_height(s);
+}
+
+/* trim(): drop the least recently drawn labels, other than keep,
+   until the cache is within its limit */
+static void
+trim(PnidTextcache *tc, const struct text *keep)
+{
+  struct text *t;
+
+  while (tc->bytes > tc->limit && tc->recent.tail
+	 && (t = tc->recent.tail->data) != keep) {
+    g_queue_unlink(&tc->recent, &t->link);
+    tc->bytes -= t->bytes;
+    g_hash_table_remove(tc->texts, t->key);
+  }
+}
+
+/* free_text(): GDestroyNotify for struct text */
+static void
+free_text(gpointer data)
+{
+  struct text *t = data;
+  Raster *cur;
+
+  for (cur = t->r; cur < t->r + MAXSCALES; cur++)
+    if (cur->s)
+      cairo_surface_destroy(cur->s);
+  g_object_unref(t->layout);
+  g_free(t->key);
+  free(t);
+}
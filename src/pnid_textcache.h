@@ -0,0 +1,32 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_textcache.h - cache of shaped labels and their rasters at each
+   drawing scale */
+
+#ifndef __PNID_TEXTCACHE_H
+#define __PNID_TEXTCACHE_H
+
+#include <stddef.h>
+#include <cairo.h>
+
+/* #PnidTextcache: label layout and raster cache */
+typedef struct pnid_textcache PnidTextcache;
+
+/* Create and destroy the cache, holding about limit bytes */
+PnidTextcache *pnid_textcache_new(size_t limit);
+void           pnid_textcache_destroy(PnidTextcache *tc);
+
+/* pnid_textcache_show(): draw text in font with the source of cr,
+   centred on x, y in points. scale is the number of device pixels
+   per point in cr. */
+void           pnid_textcache_show(PnidTextcache *tc, cairo_t *cr, const char *text,
+				   const char *font, double x, double y, double scale);
+
+/* pnid_textcache_path(): draw text in font with the source of cr,
+   centred on x, y in points, as a path for vector surfaces. */
+void           pnid_textcache_path(PnidTextcache *tc, cairo_t *cr, const char *text,
+				   const char *font, double x, double y);
+
+#endif /* __PNID_TEXTCACHE_H */
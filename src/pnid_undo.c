@@ -0,0 +1,513 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_undo.c - bounded log of edits to undo and redo
+
+   Each edit is recorded as the difference it made, not a copy of the
+   drawing: the object inserted or deleted, an object before and after
+   a change, or the bounding boxes of the objects moved. Entries are
+   packed end to end in a ring buffer of the log's limit in bytes,
+   each framed by its size at both ends so the log can be stepped
+   through in either direction. An entry which would not fit before
+   the end of the buffer starts again at the front, the end of the
+   last entry before it is kept as the wrap point. Entries at the
+   front always end short of the oldest, so that a position is never
+   both. Room is made for a new entry by dropping the oldest.
+
+   Entries before the cursor are undone, those after it redone. A
+   move of the same objects as the newest entry, made soon after it,
+   updates that entry rather than adding another, so a drag is undone
+   in one step. */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+#include "pnid_undo.h"
+
+#define FRAME (2 * sizeof(uint32_t)) /* size at each end of an entry */
+
+/* head: the start of an entry, after its leading size */
+struct head {
+  uint32_t op;			/* enum pnid_undo_op */
+  uint32_t n;			/* objects */
+  int64_t  time;		/* of a move, microseconds */
+};
+
+/* record: an object as recorded, followed by its attribute strings
+   without terminators */
+struct record {
+  PnidBox  bbox;
+  uint32_t id;
+  uint32_t type;
+  uint32_t symbol;
+  uint32_t len[PNID_N_ATTRS];	/* of each string, UINT32_MAX if NULL */
+};
+
+/* move: an object moved, from and to a bounding box */
+struct move {
+  uint32_t id;
+  PnidBox  from;
+  PnidBox  to;
+};
+
+struct pnid_undo {
+  unsigned char *buf;
+  size_t         limit;		/* of buf */
+  size_t         tail;		/* oldest entry */
+  size_t         cursor;	/* end of newest entry not undone */
+  size_t         head;		/* end of newest entry */
+  size_t         wrap;		/* end of entries before the front */
+  int            wrapped;	/* entries at the front follow wrap */
+  size_t         nundo;
+  size_t         nredo;
+};
+
+static unsigned char *append(PnidUndo *u, size_t size);
+static void           drop_oldest(PnidUndo *u);
+static size_t         record_size(const PnidObj *obj);
+static unsigned char *record_put(unsigned char *p, const PnidObj *obj);
+static const unsigned char *record_get(const unsigned char *p, PnidObj *obj, char **strings);
+static void           apply(const unsigned char *entry, int undo, PnidUndoFunc func, void *data);
+static uint32_t       size_at(const PnidUndo *u, size_t pos);
+
+/*********************
+ * Creation and Destruction
+*******************/
+
+/* pnid_undo_new(): create an empty log holding at most limit
+   bytes. Returns NULL if out of memory. */
+PnidUndo *
+pnid_undo_new(size_t limit)
+{
+  PnidUndo *new;
+
+  if (!(new = calloc(1, sizeof *new)))
+    return NULL;
+  if (limit && !(new->buf = malloc(limit))) {
+    free(new);
+    return NULL;
+  }
+  new->limit = limit;
+
+  return new;
+}
+
+/* pnid_undo_destroy(): free u */
+void
+pnid_undo_destroy(PnidUndo *u)
+{
+  if (!u)
+    return;
+
+  free(u->buf);
+  free(u);
+}
+
+/* pnid_undo_set_limit(): hold at most limit bytes, keeping the newest
+   edits that fit and discarding those that could be redone. Returns
+   -ENOMEM, leaving u unchanged, or 0. */
+int
+pnid_undo_set_limit(PnidUndo *u, size_t limit)
+{
+  unsigned char *buf = NULL;
+  size_t pos, size, len = 0, n = 0;
+
+  if (limit && !(buf = malloc(limit)))
+    return -ENOMEM;
+
+  /* the newest entries that fit, copied in order to the front */
+  for (pos = u->cursor; n < u->nundo; n++) {
+    if (pos == 0 && u->wrapped)
+      pos = u->wrap;
+    size = size_at(u, pos - sizeof(uint32_t));
+    if (len + size > limit)
+      break;
+    len += size;
+    pos -= size;
+  }
+  for (size = 0; size < len; ) {
+    if (pos == u->wrap && u->wrapped)
+      pos = 0;
+    memcpy(buf + size, u->buf + pos, size_at(u, pos));
+    size += size_at(u, pos);
+    pos += size_at(u, pos);
+  }
+
+  free(u->buf);
+  u->buf = buf;
+  u->limit = limit;
+  u->tail = 0;
+  u->cursor = u->head = len;
+  u->wrapped = 0;
+  u->nundo = n;
+  u->nredo = 0;
+
+  return 0;
+}
+
+/* pnid_undo_size(): bytes of edits held */
+size_t
+pnid_undo_size(const PnidUndo *u)
+{
+  if (!u->nundo && !u->nredo)
+    return 0;
+  return u->wrapped ? u->wrap - u->tail + u->head : u->head - u->tail;
+}
+
+/*********************
+ * Recording
+*******************/
+
+/* pnid_undo_insert(): record that obj was inserted. Returns -E2BIG if
+   the entry is larger than the log, which is then emptied, or 0. */
+int
+pnid_undo_insert(PnidUndo *u, const PnidObj *obj)
+{
+  unsigned char *p;
+
+  if (!(p = append(u, sizeof(struct head) + record_size(obj))))
+    return -E2BIG;
+  memcpy(p, &(struct head){ PNID_UNDO_INSERT, 1, 0 }, sizeof(struct head));
+  record_put(p + sizeof(struct head), obj);
+
+  return 0;
+}
+
+/* pnid_undo_delete(): record that obj is being deleted. Returns
+   -E2BIG if the entry is larger than the log, or 0. */
+int
+pnid_undo_delete(PnidUndo *u, const PnidObj *obj)
+{
+  unsigned char *p;
+
+  if (!(p = append(u, sizeof(struct head) + record_size(obj))))
+    return -E2BIG;
+  memcpy(p, &(struct head){ PNID_UNDO_DELETE, 1, 0 }, sizeof(struct head));
+  record_put(p + sizeof(struct head), obj);
+
+  return 0;
+}
+
+/* pnid_undo_change(): record that an object was changed from before
+   to after. Returns -E2BIG if the entry is larger than the log, or
+   0. */
+int
+pnid_undo_change(PnidUndo *u, const PnidObj *before, const PnidObj *after)
+{
+  unsigned char *p;
+
+  if (!(p = append(u, sizeof(struct head) + record_size(before) + record_size(after))))
+    return -E2BIG;
+  memcpy(p, &(struct head){ PNID_UNDO_CHANGE, 2, 0 }, sizeof(struct head));
+  record_put(record_put(p + sizeof(struct head), before), after);
+
+  return 0;
+}
+
+/* pnid_undo_move(): record that the n objects of objs were moved to
+   their bounding boxes from those of from at time. When the newest
+   entry is a move of the same objects within PNID_UNDO_COALESCE_US,
+   it is extended instead. Returns -E2BIG if the entry is larger than
+   the log, or 0. */
+int
+pnid_undo_move(PnidUndo *u, PnidObj *const *objs, const PnidBox *from, size_t n,
+	       int64_t time)
+{
+  struct head h;
+  struct move m;
+  unsigned char *p;
+  size_t i, pos;
+
+  /* the newest entry, if it has not been undone */
+  if (u->nundo && !u->nredo) {
+    pos = u->cursor == 0 && u->wrapped ? u->wrap : u->cursor;
+    p = u->buf + pos - size_at(u, pos - sizeof(uint32_t)) + sizeof(uint32_t);
+    memcpy(&h, p, sizeof h);
+    if (h.op == PNID_UNDO_MOVE && h.n == n && time - h.time < PNID_UNDO_COALESCE_US) {
+      for (i = 0; i < n; i++) {
+	memcpy(&m, p + sizeof h + i * sizeof m, sizeof m);
+	if (m.id != objs[i]->id)
+	  break;
+      }
+      if (i == n) {
+	for (i = 0; i < n; i++) {
+	  memcpy(&m, p + sizeof h + i * sizeof m, sizeof m);
+	  m.to = objs[i]->bbox;
+	  memcpy(p + sizeof h + i * sizeof m, &m, sizeof m);
+	}
+	h.time = time;
+	memcpy(p, &h, sizeof h);
+	return 0;
+      }
+    }
+  }
+
+  if (!(p = append(u, sizeof h + n * sizeof m)))
+    return -E2BIG;
+  h = (struct head){ PNID_UNDO_MOVE, n, time };
+  memcpy(p, &h, sizeof h);
+  for (i = 0; i < n; i++) {
+    m = (struct move){ objs[i]->id, from[i], objs[i]->bbox };
+    memcpy(p + sizeof h + i * sizeof m, &m, sizeof m);
+  }
+
+  return 0;
+}
+
+/*********************
+ * Undo and Redo
+*******************/
+
+/* pnid_undo_undo(): undo the newest edit not yet undone, calling
+   func with each object it changed. Returns -ENOENT if there is none,
+   or 0. */
+int
+pnid_undo_undo(PnidUndo *u, PnidUndoFunc func, void *data)
+{
+  size_t pos;
+
+  if (!u->nundo)
+    return -ENOENT;
+
+  pos = u->cursor == 0 && u->wrapped ? u->wrap : u->cursor;
+  u->cursor = pos - size_at(u, pos - sizeof(uint32_t));
+  u->nundo--;
+  u->nredo++;
+  apply(u->buf + u->cursor + sizeof(uint32_t), 1, func, data);
+
+  return 0;
+}
+
+/* pnid_undo_redo(): redo the oldest edit undone, calling func with
+   each object it changed. Returns -ENOENT if there is none, or 0. */
+int
+pnid_undo_redo(PnidUndo *u, PnidUndoFunc func, void *data)
+{
+  size_t pos;
+
+  if (!u->nredo)
+    return -ENOENT;
+
+  pos = u->cursor == u->wrap && u->wrapped ? 0 : u->cursor;
+  u->cursor = pos + size_at(u, pos);
+  u->nundo++;
+  u->nredo--;
+  apply(u->buf + pos + sizeof(uint32_t), 0, func, data);
+
+  return 0;
+}
+
+/* pnid_undo_can_undo(), pnid_undo_can_redo(): non-zero if there is
+   an edit to undo or redo */
+int
+pnid_undo_can_undo(const PnidUndo *u)
+{
+  return u->nundo > 0;
+}
+
+int
+pnid_undo_can_redo(const PnidUndo *u)
+{
+  return u->nredo > 0;
+}
+
+/*********************
+ * Ring Buffer
+*******************/
+
+/* append(): make room for a new entry of size bytes, framed, after
+   discarding those which could be redone. Returns where it is to be
+   written, or NULL if it can never fit, the log then being empty. */
+static unsigned char *
+append(PnidUndo *u, size_t size)
+{
+  size_t pos;
+
+  /* edits undone can no longer be redone, nor can those at the front
+     once the cursor is back before the wrap point */
+  u->nredo = 0;
+  if (u->wrapped && (u->cursor == 0 || u->cursor >= u->tail)) {
+    if (u->cursor == 0)
+      u->cursor = u->wrap;
+    u->wrapped = 0;
+  }
+  u->head = u->cursor;
+
+  size += FRAME;
+  if (size > u->limit) {
+    u->tail = u->cursor = u->head = 0;
+    u->wrapped = 0;
+    u->nundo = 0;
+    return NULL;
+  }
+
+  for (;;) {
+    if (!u->nundo) {
+      u->tail = u->head = 0;
+      u->wrapped = 0;
+    }
+    if (!u->wrapped && u->head + size <= u->limit) {
+      pos = u->head;
+      break;
+    }
+    if (!u->wrapped && size < u->tail) {
+      u->wrap = u->head;
+      u->wrapped = 1;
+      pos = 0;
+      break;
+    }
+    if (u->wrapped && u->head + size < u->tail) {
+      pos = u->head;
+      break;
+    }
+    drop_oldest(u);
+  }
+
+  memcpy(u->buf + pos, &(uint32_t){ size }, sizeof(uint32_t));
+  memcpy(u->buf + pos + size - sizeof(uint32_t), &(uint32_t){ size }, sizeof(uint32_t));
+  u->cursor = u->head = pos + size;
+  u->nundo++;
+
+  return u->buf + pos + sizeof(uint32_t);
+}
+
+/* drop_oldest(): discard the oldest entry */
+static void
+drop_oldest(PnidUndo *u)
+{
+  u->tail += size_at(u, u->tail);
+  u->nundo--;
+  if (u->wrapped && u->tail == u->wrap) {
+    u->tail = 0;
+    u->wrapped = 0;
+  }
+}
+
+/* size_at(): the size framing an entry at pos */
+static uint32_t
+size_at(const PnidUndo *u, size_t pos)
+{
+  uint32_t size;
+
+  memcpy(&size, u->buf + pos, sizeof size);
+  return size;
+}
+
+/*********************
+ * Records
+*******************/
+
+/* record_size(): bytes needed to record obj */
+static size_t
+record_size(const PnidObj *obj)
+{
+  size_t size = sizeof(struct record);
+  int k;
+
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (obj->attr[k])
+      size += strlen(obj->attr[k]);
+
+  return size;
+}
+
+/* record_put(): record obj at p, returning the end of the record */
+static unsigned char *
+record_put(unsigned char *p, const PnidObj *obj)
+{
+  struct record r = { obj->bbox, obj->id, obj->type, obj->symbol };
+  int k;
+
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    r.len[k] = obj->attr[k] ? strlen(obj->attr[k]) : UINT32_MAX;
+  memcpy(p, &r, sizeof r);
+  p += sizeof r;
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (obj->attr[k]) {
+      memcpy(p, obj->attr[k], r.len[k]);
+      p += r.len[k];
+    }
+
+  return p;
+}
+
+/* record_get(): read the record at p into obj, its strings copied
+   terminated to *strings, which is advanced past them. Returns the
+   end of the record. */
+static const unsigned char *
+record_get(const unsigned char *p, PnidObj *obj, char **strings)
+{
+  struct record r;
+  int k;
+
+  memcpy(&r, p, sizeof r);
+  p += sizeof r;
+  memset(obj, 0, sizeof *obj);
+  obj->bbox = r.bbox;
+  obj->id = r.id;
+  obj->type = r.type;
+  obj->symbol = r.symbol;
+  for (k = 0; k < PNID_N_ATTRS; k++)
+    if (r.len[k] != UINT32_MAX) {
+      memcpy(*strings, p, r.len[k]);
+      (*strings)[r.len[k]] = '\0';
+      obj->attr[k] = *strings;
+      *strings += r.len[k] + 1;
+      p += r.len[k];
+    }
+
+  return p;
+}
+
+/* apply(): call func with the objects of the entry at p, before and
+   after for an edit being redone and the reverse when undone */
+static void
+apply(const unsigned char *p, int undo, PnidUndoFunc func, void *data)
+{
+  uint32_t size;
+  struct head h;
+  struct move m;
+  PnidObj a, b;
+  char *strings, *s;
+  uint32_t i;
+
+  memcpy(&size, p - sizeof size, sizeof size);
+  memcpy(&h, p, sizeof h);
+  p += sizeof h;
+
+  switch ((enum pnid_undo_op)h.op) {
+  case PNID_UNDO_INSERT:
+  case PNID_UNDO_DELETE:
+  case PNID_UNDO_CHANGE:
+    /* the strings of the entry, each now terminated */
+    if (!(s = strings = malloc(size + PNID_N_ATTRS * 2)))
+      return;
+    p = record_get(p, &a, &s);
+    if (h.op == PNID_UNDO_INSERT)
+      undo ? func(h.op, &a, NULL, data) : func(h.op, NULL, &a, data);
+    else if (h.op == PNID_UNDO_DELETE)
+      undo ? func(h.op, NULL, &a, data) : func(h.op, &a, NULL, data);
+    else {
+      record_get(p, &b, &s);
+      undo ? func(h.op, &b, &a, data) : func(h.op, &a, &b, data);
+    }
+    free(strings);
+    break;
+  case PNID_UNDO_MOVE:
+    memset(&a, 0, sizeof a);
+    memset(&b, 0, sizeof b);
+    for (i = 0; i < h.n; i++) {
+      memcpy(&m, p + i * sizeof m, sizeof m);
+      a.id = b.id = m.id;
+      a.bbox = m.from;
+      b.bbox = m.to;
+      undo ? func(h.op, &b, &a, data) : func(h.op, &a, &b, data);
+    }
+    break;
+  }
+}
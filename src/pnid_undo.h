@@ -0,0 +1,57 @@
+/* This file is part of pnid
+   Copyright (C) 2021 Ellis Rhys Thomas <e.rhys.thomas@gmail.com>
+   See COPYING file for licence details */
+
+/* pnid_undo.h - bounded log of edits to undo and redo */
+
+#ifndef __PNID_UNDO_H
+#define __PNID_UNDO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pnid_box.h"
+#include "pnid_obj.h"
+
+#define PNID_UNDO_COALESCE_US 500000 /* moves of the same objects merged */
+
+/* pnid_undo_op: the kinds of edit recorded */
+enum pnid_undo_op {
+  PNID_UNDO_INSERT = 1,
+  PNID_UNDO_DELETE,
+  PNID_UNDO_CHANGE,
+  PNID_UNDO_MOVE
+};
+
+/* #PnidUndo: the edits to a drawing, oldest dropped first once they
+   exceed the log's limit */
+typedef struct pnid_undo PnidUndo;
+
+/* pnid_undo_func(): called with each object of an edit being undone
+   or redone, as it is and as it is to become. from is NULL for an
+   object to be inserted and to for one to be deleted. For a move,
+   only the id and bounding box are set. Strings are valid only during
+   the call. */
+typedef void (*PnidUndoFunc) (enum pnid_undo_op op, const PnidObj *from,
+			      const PnidObj *to, void *data);
+
+/* Create and destroy a log of at most limit bytes */
+PnidUndo *pnid_undo_new(size_t limit);
+void      pnid_undo_destroy(PnidUndo *u);
+int       pnid_undo_set_limit(PnidUndo *u, size_t limit);
+size_t    pnid_undo_size(const PnidUndo *u);
+
+/* Record edits, discarding any that could have been redone */
+int       pnid_undo_insert(PnidUndo *u, const PnidObj *obj);
+int       pnid_undo_delete(PnidUndo *u, const PnidObj *obj);
+int       pnid_undo_change(PnidUndo *u, const PnidObj *before, const PnidObj *after);
+int       pnid_undo_move(PnidUndo *u, PnidObj *const *objs, const PnidBox *from, size_t n,
+			 int64_t time);
+
+/* Step back and forward through the edits recorded */
+int       pnid_undo_undo(PnidUndo *u, PnidUndoFunc func, void *data);
+int       pnid_undo_redo(PnidUndo *u, PnidUndoFunc func, void *data);
+int       pnid_undo_can_undo(const PnidUndo *u);
+int       pnid_undo_can_redo(const PnidUndo *u);
+
+#endif /* __PNID_UNDO_H */
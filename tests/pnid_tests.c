@@ -8,20 +8,904 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <assert.h>
+#include <errno.h>
 
 #include "pnid_box.h"
 #include "pnid_obj.h"
+#include "pnid_objstore.h"
+#include "pnid_attrindex.h"
+#include "pnid_graph.h"
+#include "pnid_undo.h"
+#include "pnid_select.h"
+#include "pnid_symdef.h"
 #include "pnid_rtree.h" 
+#include "pnid_prof.h"
+#include "pnid_file.h"
+#include "pnid_journal.h"
+#include "pnid_import.h"
+#include "pnid_pack.h"
 
 #include "pnid_tests.h"
 
 #define NOBJ 100 
 
-PnidRtree tr;
-PnidObj   o[NOBJ];
-
 int main(void)
 {
-  
+  test_rtree();
+  test_rtree_walk();
+  test_rtree_load();
+  test_objstore();
+  test_attrindex();
+  test_graph();
+  test_undo();
+  test_select();
+  test_symdef();
+  test_file();
+  test_journal();
+  test_import();
+  test_pack();
+  test_prof();
+
+  puts("pnid_tests: all tests passed");
+  return 0;
+}
+
+/* randbox(): a random box within 200 by 200 */
+static PnidBox
+randbox(void)
+{
+  PnidBox a;
+
+  pnid_box_set_left(&a, RAND100);
+  pnid_box_set_top(&a, RAND100);
+  pnid_box_set_right(&a, pnid_box_get_left(&a) + RAND100);
+  pnid_box_set_bottom(&a, pnid_box_get_top(&a) + RAND100);
+
+  return a;
+}
+
+/* test_rtree(): a region search returns exactly those objects which
+   overlap it */
+void
+test_rtree(void)
+{
+  PnidRtree *tr;
+  PnidObj *o[NOBJ], *res;
+  PnidBox s;
+  int i, n, found[NOBJ] = { 0 };
+
+  assert((tr = pnid_rtree_new()));
+  for (i = 0; i < NOBJ; i++) {
+    assert((o[i] = pnid_obj_new()));
+    o[i]->bbox = randbox();
+    assert(pnid_rtree_insert(tr, o[i]) == 0);
+  }
+
+  s = randbox();
+  assert((n = pnid_rtree_search(tr, &s)) >= 0);
+  while ((res = pnid_rtree_next(tr)))
+    for (i = 0; i < NOBJ; i++)
+      if (o[i] == res)
+	found[i]++, n--;
+  assert(n == 0);
+
+  for (i = 0; i < NOBJ; i++)
+    assert(found[i] == !pnid_box_is_separate(&o[i]->bbox, &s));
+
+  pnid_rtree_destroy(tr);
+}
+
+/* count_node(), count_tuple(): r-tree walk callbacks counting into
+   data, count_node() prunes every node when data is negative */
+static int
+count_node(const PnidBox *mbr, void *data)
+{
+  return *(int *)data >= 0;
+}
+
+static void
+count_tuple(PnidObj *tuple, void *data)
+{
+  (*(int *)data)++;
+}
+
+/* test_rtree_walk(): an unpruned walk visits the same tuples as a
+   search, a walk pruning every node visits none */
+void
+test_rtree_walk(void)
+{
+  PnidRtree *tr;
+  PnidObj *o;
+  PnidBox s;
+  int i, n;
+
+  assert((tr = pnid_rtree_new()));
+  for (i = 0; i < NOBJ; i++) {
+    assert((o = pnid_obj_new()));
+    o->bbox = randbox();
+    assert(pnid_rtree_insert(tr, o) == 0);
+  }
+
+  s = randbox();
+  n = 0;
+  assert(pnid_rtree_walk(tr, &s, count_node, count_tuple, &n) > 1);
+  assert(n == pnid_rtree_search(tr, &s));
+
+  n = -1;
+  assert(pnid_rtree_walk(tr, &s, count_node, count_tuple, &n) == 1);
+  assert(n == -1);
+
+  pnid_rtree_destroy(tr);
+}
+
+/* test_rtree_load(): a tree bulk loaded at once or in batches is well
+   formed and a search finds the same tuples as a brute force scan */
+void
+test_rtree_load(void)
+{
+  PnidRtree *tr;
+  PnidObj *o[NOBJ * 10];
+  PnidBox s;
+  int i, n, m;
+
+  assert((tr = pnid_rtree_new()));
+  for (i = 0; i < NOBJ * 10; i++) {
+    assert((o[i] = pnid_obj_new()));
+    o[i]->bbox = randbox();
+  }
+  assert(pnid_rtree_load(tr, o, NOBJ * 10) == 0);
+  pnid_rtree_check(tr);
+
+  s = randbox();
+  for (n = 0, i = 0; i < NOBJ * 10; i++)
+    n += !pnid_box_is_separate(&o[i]->bbox, &s);
+  assert(pnid_rtree_search(tr, &s) == n);
+
+  pnid_rtree_destroy(tr);
+
+  /* batches of any size are grafted into a non-empty tree */
+  assert((tr = pnid_rtree_new()));
+  for (i = 0; i < NOBJ * 10; i++) {
+    assert((o[i] = pnid_obj_new()));
+    o[i]->bbox = randbox();
+  }
+  for (i = 0, m = 1; i < NOBJ * 10; i += m, m = m * 3 % 97 + 1) {
+    if (m > NOBJ * 10 - i)
+      m = NOBJ * 10 - i;
+    assert(pnid_rtree_load(tr, o + i, m) == 0);
+    pnid_rtree_check(tr);
+  }
+  s = randbox();
+  for (n = 0, i = 0; i < NOBJ * 10; i++)
+    n += !pnid_box_is_separate(&o[i]->bbox, &s);
+  assert(pnid_rtree_search(tr, &s) == n);
+
+  pnid_rtree_destroy(tr);
+}
+
+/* count_obj(): object store callback counting into data */
+static void
+count_obj(PnidObj *obj, void *data)
+{
+  (*(size_t *)data)++;
+}
+
+/* test_objstore(): handles find their objects until released, stale
+   handles are refused even once a slot is reused, and iteration
+   visits exactly the objects held */
+void
+test_objstore(void)
+{
+  const size_t nobj = 3 << PNID_OBJSTORE_SLAB_BITS;
+  PnidObjStore *st;
+  PnidObj **o, *reused;
+  PnidObjHandle *h, stale;
+  size_t i, n;
+
+  assert((st = pnid_objstore_new()));
+  o = malloc(nobj * sizeof *o);
+  h = malloc(nobj * sizeof *h);
+  assert(pnid_objstore_reserve(st, nobj) == 0);
+  for (i = 0; i < nobj; i++) {
+    assert((o[i] = pnid_objstore_alloc(st)));
+    assert(o[i]->id == 0);
+    o[i]->id = i;
+    h[i] = pnid_objstore_handle(st, o[i]);
+    assert(h[i] != PNID_OBJ_HANDLE_NONE);
+  }
+  assert(pnid_objstore_len(st) == nobj);
+  for (i = 0; i < nobj; i++)
+    assert(pnid_objstore_get(st, h[i]) == o[i]);
+
+  /* release every other object, whose handles go stale */
+  for (i = 0; i < nobj; i += 2)
+    pnid_objstore_release(st, o[i]);
+  assert(pnid_objstore_len(st) == nobj / 2);
+  for (i = 0; i < nobj; i++)
+    assert(pnid_objstore_get(st, h[i]) == (i % 2 ? o[i] : NULL));
+  n = 0;
+  pnid_objstore_foreach(st, count_obj, &n);
+  assert(n == nobj / 2);
+  assert(pnid_objstore_slots(st) == nobj);
+  for (i = n = 0; i < pnid_objstore_slots(st); i++)
+    n += pnid_objstore_at(st, i) != NULL;
+  assert(n == nobj / 2);
+
+  /* a released slot is reused first, under a new handle */
+  stale = h[nobj - 2];
+  assert((reused = pnid_objstore_add(st, o[1])) == o[nobj - 2]);
+  assert(reused->id == 1);
+  assert(pnid_objstore_get(st, stale) == NULL);
+  assert(pnid_objstore_get(st, pnid_objstore_handle(st, reused)) == reused);
+  assert(pnid_objstore_get(st, PNID_OBJ_HANDLE_NONE) == NULL);
+
+  free(h);
+  free(o);
+  pnid_objstore_destroy(st);
+}
+
+/* test_attrindex(): every object holding a value is found by it, and
+   changing or clearing an object's value moves it between values */
+void
+test_attrindex(void)
+{
+  const size_t nobj = 100000, nval = 5000;
+  PnidObjStore *st;
+  PnidAttrIndex *ix;
+  PnidObjHandle *h;
+  const PnidObjHandle *found;
+  char value[32];
+  size_t i, j, n;
+
+  assert((st = pnid_objstore_new()));
+  assert((ix = pnid_attrindex_new()));
+  h = malloc(nobj * sizeof *h);
+  for (i = 0; i < nobj; i++) {
+    h[i] = pnid_objstore_handle(st, pnid_objstore_alloc(st));
+    snprintf(value, sizeof value, "FV-%zu", i % nval);
+    assert(pnid_attrindex_set(ix, h[i], value) == 0);
+  }
+
+  for (j = 0; j < nval; j += 97) {
+    snprintf(value, sizeof value, "FV-%zu", j);
+    assert((n = pnid_attrindex_lookup(ix, value, &found)) == nobj / nval);
+    for (i = 0; i < n; i++)
+      assert(PNID_OBJ_HANDLE_SLOT(found[i]) % nval == j);
+  }
+  assert(pnid_attrindex_lookup(ix, "FV-X", &found) == 0);
+
+  /* move one object to a new value and clear another */
+  assert(pnid_attrindex_set(ix, h[0], "PV-1") == 0);
+  assert(strcmp(pnid_attrindex_get(ix, h[0]), "PV-1") == 0);
+  assert(pnid_attrindex_lookup(ix, "PV-1", &found) == 1 && found[0] == h[0]);
+  assert(pnid_attrindex_set(ix, h[nval], NULL) == 0);
+  assert(pnid_attrindex_get(ix, h[nval]) == NULL);
+  assert(pnid_attrindex_lookup(ix, "FV-0", &found) == nobj / nval - 2);
+  for (i = 0; i < nobj / nval - 2; i++)
+    assert(found[i] != h[0] && found[i] != h[nval]);
+  assert(strcmp(pnid_attrindex_get(ix, h[2 * nval]), "FV-0") == 0);
+
+  free(h);
+  pnid_attrindex_destroy(ix);
+  pnid_objstore_destroy(st);
+}
+
+/* visit_obj(): graph trace callback recording each object's depth by
+   slot in data, and stopping at slot 50 */
+static int
+visit_obj(PnidObjHandle obj, unsigned depth, void *data)
+{
+  ((int *)data)[PNID_OBJ_HANDLE_SLOT(obj)] = depth;
+  return PNID_OBJ_HANDLE_SLOT(obj) != 50;
+}
+
+/* test_graph(): a trace along a chain reaches each object at its
+   distance from the start and stops where told, connections broken
+   split the chain, and the same holds once the deltas are folded
+   into rows */
+void
+test_graph(void)
+{
+  const int nobj = 10000;
+  PnidObjStore *st;
+  PnidGraph *g;
+  PnidObjHandle *h;
+  int i, *depth;
+
+  assert((st = pnid_objstore_new()));
+  assert((g = pnid_graph_new()));
+  h = malloc(nobj * sizeof *h);
+  depth = malloc(nobj * sizeof *depth);
+  for (i = 0; i < nobj; i++)
+    h[i] = pnid_objstore_handle(st, pnid_objstore_alloc(st));
+
+  /* a chain long enough to be rebuilt into rows along the way */
+  for (i = 1; i < nobj; i++)
+    assert(pnid_graph_connect(g, h[i - 1], h[i]) == 0);
+  assert(pnid_graph_connect(g, h[1], h[0]) == -EEXIST);
+  assert(pnid_graph_connect(g, h[1], h[1]) == -EINVAL);
+  assert(pnid_graph_len(g) == (size_t)nobj - 1);
+  assert(pnid_graph_degree(g, h[0]) == 1 && pnid_graph_degree(g, h[5]) == 2);
+
+  memset(depth, -1, nobj * sizeof *depth);
+  assert(pnid_graph_trace(g, h[10], PNID_GRAPH_BREADTH_FIRST, visit_obj, depth) == 51);
+  for (i = 0; i < nobj; i++)
+    assert(depth[i] == (i <= 50 ? abs(i - 10) : -1));
+  memset(depth, -1, nobj * sizeof *depth);
+  assert(pnid_graph_trace(g, h[60], PNID_GRAPH_DEPTH_FIRST, visit_obj, depth) == nobj - 50);
+  assert(depth[50] == 10 && depth[49] == -1 && depth[nobj - 1] == nobj - 61);
+
+  /* break the chain twice */
+  assert(pnid_graph_disconnect(g, h[30], h[31]) == 0);
+  assert(pnid_graph_disconnect(g, h[30], h[31]) == -ENOENT);
+  pnid_graph_isolate(g, h[20]);
+  assert(pnid_graph_degree(g, h[20]) == 0 && pnid_graph_degree(g, h[19]) == 1);
+  assert(pnid_graph_len(g) == (size_t)nobj - 4);
+  memset(depth, -1, nobj * sizeof *depth);
+  assert(pnid_graph_trace(g, h[25], PNID_GRAPH_BREADTH_FIRST, visit_obj, depth) == 10);
+  assert(depth[21] == 4 && depth[30] == 5 && depth[20] == -1 && depth[31] == -1);
+
+  free(depth);
+  free(h);
+  pnid_graph_destroy(g);
+  pnid_objstore_destroy(st);
+}
+
+/* undone: the last object passed to an undo callback */
+struct undone {
+  enum pnid_undo_op op;
+  unsigned          id;
+  int               from;	/* non-zero if set */
+  int               to;
+  PnidBox           bbox;	/* of to, or from if deleted */
+  char              tag[16];
+};
+
+/* undo_entry(): undo callback, keeps the last object in data */
+static void
+undo_entry(enum pnid_undo_op op, const PnidObj *from, const PnidObj *to, void *data)
+{
+  struct undone *u = data;
+  const PnidObj *o = to ? to : from;
+
+  u->op = op;
+  u->id = o->id;
+  u->from = from != NULL;
+  u->to = to != NULL;
+  u->bbox = o->bbox;
+  snprintf(u->tag, sizeof u->tag, "%s", o->attr[PNID_ATTR_TAG] ? o->attr[PNID_ATTR_TAG] : "");
+}
+
+/* test_undo(): edits are undone and redone in order, moves of the
+   same objects coalesce, and the oldest edits are dropped to stay
+   within the limit */
+void
+test_undo(void)
+{
+  PnidUndo *u;
+  PnidObj o = { 0 }, c, *p = &o;
+  PnidBox from;
+  struct undone d;
+  int i, n;
+
+  assert((u = pnid_undo_new(4096)));
+  assert(pnid_undo_undo(u, undo_entry, &d) == -ENOENT);
+
+  o.id = 1;
+  o.bbox = randbox();
+  o.attr[PNID_ATTR_TAG] = "FV-1203";
+  assert(pnid_undo_insert(u, &o) == 0);
+  c = o;
+  c.attr[PNID_ATTR_TAG] = "FV-1204";
+  assert(pnid_undo_change(u, &o, &c) == 0);
+
+  assert(pnid_undo_undo(u, undo_entry, &d) == 0);
+  assert(d.op == PNID_UNDO_CHANGE && d.from && d.to && !strcmp(d.tag, "FV-1203"));
+  assert(pnid_undo_undo(u, undo_entry, &d) == 0);
+  assert(d.op == PNID_UNDO_INSERT && d.from && !d.to && d.id == 1);
+  assert(!pnid_undo_can_undo(u));
+  assert(pnid_undo_redo(u, undo_entry, &d) == 0);
+  assert(d.op == PNID_UNDO_INSERT && !d.from && d.to && !strcmp(d.tag, "FV-1203"));
+  assert(pnid_undo_redo(u, undo_entry, &d) == 0);
+  assert(!strcmp(d.tag, "FV-1204"));
+  assert(pnid_undo_redo(u, undo_entry, &d) == -ENOENT);
+
+  /* a drag is undone in one step */
+  from = o.bbox;
+  for (i = 0; i < 10; i++) {
+    PnidBox b = o.bbox;
+    o.bbox.nw.x++, o.bbox.se.x++;
+    assert(pnid_undo_move(u, &p, &b, 1, i * 1000) == 0);
+  }
+  assert(pnid_undo_undo(u, undo_entry, &d) == 0);
+  assert(d.op == PNID_UNDO_MOVE && !memcmp(&d.bbox, &from, sizeof from));
+  assert(pnid_undo_redo(u, undo_entry, &d) == 0);
+  assert(!memcmp(&d.bbox, &o.bbox, sizeof o.bbox));
+
+  /* a new edit discards those undone */
+  assert(pnid_undo_undo(u, undo_entry, &d) == 0);
+  assert(pnid_undo_delete(u, &o) == 0);
+  assert(!pnid_undo_can_redo(u));
+  assert(pnid_undo_undo(u, undo_entry, &d) == 0);
+  assert(d.op == PNID_UNDO_DELETE && !d.from && d.to);
+
+  /* the oldest are dropped as the ring wraps, the newest kept */
+  for (i = 0; i < NOBJ * 10; i++) {
+    o.id = i;
+    assert(pnid_undo_insert(u, &o) == 0);
+    assert(pnid_undo_size(u) <= 4096);
+  }
+  for (n = 0; pnid_undo_undo(u, undo_entry, &d) == 0; n++)
+    assert(d.id == (unsigned)(NOBJ * 10 - 1 - n));
+  assert(n > 1 && n < NOBJ * 10);
+  for (i = 0; pnid_undo_redo(u, undo_entry, &d) == 0; i++)
+    assert(d.id == (unsigned)(NOBJ * 10 - n + i));
+  assert(i == n);
+
+  /* a smaller limit keeps the newest that fit */
+  assert(pnid_undo_set_limit(u, 1024) == 0);
+  assert(pnid_undo_size(u) <= 1024 && pnid_undo_can_undo(u));
+  assert(pnid_undo_undo(u, undo_entry, &d) == 0);
+  assert(d.id == NOBJ * 10 - 1);
+
+  /* an edit larger than the log can not be undone */
+  assert(pnid_undo_set_limit(u, 16) == 0);
+  assert(pnid_undo_insert(u, &o) == -E2BIG);
+  assert(!pnid_undo_can_undo(u));
+
+  pnid_undo_destroy(u);
+}
+
+/* count_slot(): selection callback, counts slots into data and
+   checks they are visited in order */
+static void
+count_slot(uint32_t slot, void *data)
+{
+  int64_t *last = data;
+
+  assert((int64_t)slot > last[0]);
+  last[0] = slot;
+  last[1]++;
+}
+
+/* test_select(): set operations agree with a plain array of flags,
+   and bands and lassos hit only what the object draws */
+void
+test_select(void)
+{
+  PnidSelect *a, *b;
+  char flags[NOBJ * 50] = { 0 }, in[NOBJ * 50];
+  int64_t seen[2];
+  PnidObj o = { 0 };
+  PnidBox band;
+  const PnidCoord tri[] = { { 0, 0 }, { 100, 0 }, { 0, 100 } };
+  int i, n, op;
+
+  assert((a = pnid_select_new()) && (b = pnid_select_new()));
+  for (op = PNID_SELECT_REPLACE; op <= PNID_SELECT_SUBTRACT; op++) {
+    pnid_select_clear(b);
+    memset(in, 0, sizeof in);
+    for (i = 0; i < NOBJ * 10; i++) {
+      n = rand() % (NOBJ * 50);
+      in[n] = 1;
+      assert(pnid_select_add(b, n) == 0);
+    }
+    assert(pnid_select_apply(a, b, op) == 0);
+    for (i = 0; i < NOBJ * 50; i++) {
+      switch (op) {
+      case PNID_SELECT_REPLACE:  flags[i] = in[i]; break;
+      case PNID_SELECT_ADD:      flags[i] |= in[i]; break;
+      case PNID_SELECT_TOGGLE:   flags[i] ^= in[i]; break;
+      case PNID_SELECT_SUBTRACT: flags[i] &= !in[i]; break;
+      }
+      assert(!pnid_select_has(a, i) == !flags[i]);
+    }
+  }
+  for (i = n = 0; i < NOBJ * 50; i++)
+    n += flags[i];
+  assert(pnid_select_len(a) == (size_t)n);
+  seen[0] = -1, seen[1] = 0;
+  pnid_select_foreach(a, count_slot, seen);
+  assert(seen[1] == n);
+  pnid_select_clear(a);
+  assert(pnid_select_len(a) == 0);
+
+  /* handles of different generations share a slot */
+  assert(pnid_select_add(a, (3u << PNID_OBJSTORE_INDEX_BITS) | 7) == 0);
+  assert(pnid_select_has(a, 7));
+  pnid_select_remove(a, 7);
+  assert(!pnid_select_has(a, 7));
+
+  /* a band over the empty corner of a line's box misses it */
+  o.type = PNID_OBJ_LINE;
+  o.bbox = (PnidBox){ { 0, 0 }, { 100, 100 } };
+  band = (PnidBox){ { 70, 0 }, { 100, 20 } };
+  assert(!pnid_select_hit_box(&o, &band, PNID_SELECT_OVERLAP));
+  o.type = PNID_OBJ_LINE_RISE;
+  assert(pnid_select_hit_box(&o, &band, PNID_SELECT_OVERLAP));
+  assert(!pnid_select_hit_box(&o, &band, PNID_SELECT_CONTAIN));
+  band = (PnidBox){ { 0, 0 }, { 100, 100 } };
+  assert(pnid_select_hit_box(&o, &band, PNID_SELECT_CONTAIN));
+
+  /* a lasso takes only what it wholly encloses */
+  o.type = PNID_OBJ_SYMBOL;
+  o.bbox = (PnidBox){ { 10, 10 }, { 20, 20 } };
+  assert(pnid_select_hit_lasso(&o, tri, 3));
+  o.bbox = (PnidBox){ { 40, 40 }, { 60, 60 } };
+  assert(!pnid_select_hit_lasso(&o, tri, 3));
+  o.type = PNID_OBJ_LINE;
+  assert(!pnid_select_hit_lasso(&o, tri, 3));
+  o.bbox = (PnidBox){ { 10, 10 }, { 30, 30 } };
+  assert(pnid_select_hit_lasso(&o, tri, 3));
+  assert(!pnid_select_hit_lasso(&o, tri, 2));
+
+  pnid_select_destroy(a);
+  pnid_select_destroy(b);
+}
+
+/* test_symdef(): an instance is placed at its definition's size,
+   falls back to its default attributes and finds its ports within
+   its box */
+void
+test_symdef(void)
+{
+  const PnidSymdef *def;
+  PnidObj o = { 0 };
+  PnidCoord at;
+  unsigned i;
+
+  for (i = 0; i < PNID_N_SYMBOLS; i++)
+    assert(pnid_symdef_lookup(pnid_symdef_get(i)->name) == i);
+  assert(pnid_symdef_lookup("no such symbol") == PNID_SYMBOL_NONE);
+
+  def = pnid_symdef_get(PNID_SYMBOL_VALVE);
+  o.type = PNID_OBJ_SYMBOL;
+  o.symbol = PNID_SYMBOL_VALVE;
+  o.bbox = pnid_symdef_place(PNID_SYMBOL_VALVE, 1000, 1000, 2.0);
+  assert(pnid_box_width(&o.bbox) == (unsigned)(def->width * 2));
+  assert(pnid_box_height(&o.bbox) == (unsigned)(def->height * 2));
+
+  assert(pnid_symdef_attr(&o, PNID_ATTR_SPEC) == def->attr[PNID_ATTR_SPEC]);
+  o.attr[PNID_ATTR_SPEC] = "B2";
+  assert(strcmp(pnid_symdef_attr(&o, PNID_ATTR_SPEC), "B2") == 0);
+
+  for (i = 0; i < def->nports; i++) {
+    assert(pnid_symdef_port(&o, i, &at) == 0);
+    assert(at.x >= o.bbox.nw.x && at.x <= o.bbox.se.x);
+    assert(at.y >= o.bbox.nw.y && at.y <= o.bbox.se.y);
+  }
+  assert(pnid_symdef_port(&o, def->nports, &at) == -ERANGE);
+}
+
+/* test_file(): objects written to a drawing file are mapped back
+   unchanged, with repeated attribute strings stored once */
+void
+test_file(void)
+{
+  char path[] = "/tmp/pnid_testsXXXXXX";
+  PnidFileWriter *w;
+  PnidFile *f;
+  PnidObj o[NOBJ], r;
+  int i, fd;
+
+  assert((fd = mkstemp(path)) >= 0);
+  close(fd);
+
+  memset(o, 0, sizeof o);
+  assert(pnid_file_writer_open(path, &w) == 0);
+  for (i = 0; i < NOBJ; i++) {
+    o[i].bbox = randbox();
+    o[i].symbol = i % PNID_N_SYMBOLS;
+    o[i].attr[PNID_ATTR_TAG] = i % 2 ? "FV-1203" : NULL;
+    o[i].attr[PNID_ATTR_LINE] = "6\"-P-1001";
+    assert(pnid_file_writer_add(w, &o[i]) == 0);
+  }
+  assert(pnid_file_writer_close(w, 0) == 0);
+
+  assert(pnid_file_map(path, &f) == 0);
+  assert(pnid_file_len(f) == NOBJ);
+  for (i = 0; i < NOBJ; i++) {
+    pnid_file_obj(f, i, &r);
+    assert(!memcmp(&r.bbox, &o[i].bbox, sizeof r.bbox));
+    assert(r.symbol == o[i].symbol);
+    assert(!r.attr[PNID_ATTR_SPEC]);
+    assert(!o[i].attr[PNID_ATTR_TAG] == !r.attr[PNID_ATTR_TAG]);
+    assert(!strcmp(r.attr[PNID_ATTR_LINE], "6\"-P-1001"));
+  }
+  assert(pnid_file_record(f, 0)->attr[PNID_ATTR_LINE]
+	 == pnid_file_record(f, NOBJ - 1)->attr[PNID_ATTR_LINE]);
+  pnid_file_unmap(f);
+
+  /* truncated files are rejected */
+  assert(truncate(path, sizeof(struct pnid_file_header) + 8) == 0);
+  assert(pnid_file_map(path, &f) == -EPROTO);
+
+  /* records of an unknown symbol are rejected */
+  assert(pnid_file_writer_open(path, &w) == 0);
+  o[0].symbol = PNID_N_SYMBOLS;
+  assert(pnid_file_writer_add(w, &o[0]) == 0);
+  assert(pnid_file_writer_close(w, 0) == 0);
+  assert(pnid_file_map(path, &f) == -EPROTO);
+
+  unlink(path);
+}
+
+/* count_entry(): journal replay callback, counts each op into data
+   and checks attributes survive */
+static void
+count_entry(enum pnid_journal_op op, const PnidObj *obj, void *data)
+{
+  ((int *)data)[op]++;
+  if (op != PNID_JOURNAL_DELETE)
+    assert(!strcmp(obj->attr[PNID_ATTR_TAG], "FV-1203") && !obj->attr[PNID_ATTR_LINE]);
+}
+
+/* test_journal(): edits are replayed after the base file's sequence
+   number, a torn entry is cut off and truncation empties the
+   journal */
+void
+test_journal(void)
+{
+  char path[] = "/tmp/pnid_testsXXXXXX";
+  PnidJournal *j;
+  PnidObj o = { .id = 7, .attr[PNID_ATTR_TAG] = "FV-1203" };
+  struct stat st;
+  off_t size;
+  int i, fd, n[4] = { 0 };
+
+  assert((fd = mkstemp(path)) >= 0);
+  close(fd);
+
+  assert(pnid_journal_open(path, 0, count_entry, n, &j) == 0);
+  for (i = 0; i < NOBJ; i++) {
+    o.bbox = randbox();
+    assert(pnid_journal_append(j, i ? PNID_JOURNAL_UPDATE : PNID_JOURNAL_INSERT, &o) == 0);
+  }
+  assert(pnid_journal_append(j, PNID_JOURNAL_DELETE, &o) == 0);
+  assert(pnid_journal_sync(j) == 0);
+  assert(pnid_journal_seq(j) == NOBJ + 1);
+  assert(pnid_journal_close(j) == 0);
+
+  /* a torn entry at the end is skipped by a reader, and left in place */
+  assert((fd = open(path, O_WRONLY | O_APPEND)) >= 0);
+  assert(write(fd, "torn", 4) == 4);
+  close(fd);
+  assert(stat(path, &st) == 0);
+  assert(pnid_journal_replay(path, 1, count_entry, n) == 0);
+  assert(n[PNID_JOURNAL_UPDATE] == NOBJ - 1 && n[PNID_JOURNAL_DELETE] == 1);
+  size = st.st_size;
+  assert(stat(path, &st) == 0 && st.st_size == size);
+
+  /* and discarded once opened for writing */
+
+  memset(n, 0, sizeof n);
+  assert(pnid_journal_open(path, 1, count_entry, n, &j) == 0);
+  assert(n[PNID_JOURNAL_INSERT] == 0);
+  assert(n[PNID_JOURNAL_UPDATE] == NOBJ - 1);
+  assert(n[PNID_JOURNAL_DELETE] == 1);
+  assert(pnid_journal_seq(j) == NOBJ + 1);
+
+  assert(pnid_journal_truncate(j, NOBJ) == -EAGAIN);
+  assert(pnid_journal_truncate(j, NOBJ + 1) == 0);
+  assert(pnid_journal_size(j) == 0);
+  assert(pnid_journal_close(j) == 0);
+
+  memset(n, 0, sizeof n);
+  assert(pnid_journal_open(path, NOBJ + 1, count_entry, n, &j) == 0);
+  assert(!n[1] && !n[2] && !n[3]);
+  assert(pnid_journal_close(j) == 0);
+
+  unlink(path);
+  assert(pnid_journal_replay(path, 0, count_entry, n) == 0);
+}
+
+/* keep_batch(): import callback, keeps the objects in a GPtrArray
+   and their strings in a list to be freed */
+static GSList *import_strings;
+
+static int
+keep_batch(PnidObj **objs, size_t n, GStringChunk *strings, double progress, void *data)
+{
+  size_t i;
+
+  assert(progress > 0.0 && progress <= 1.0);
+  for (i = 0; i < n; i++)
+    g_ptr_array_add(data, objs[i]);
+  g_free(objs);
+  import_strings = g_slist_prepend(import_strings, strings);
+  return 0;
+}
+
+/* import_text(): import text written to a temporary file with
+   extension ext, returning the objects in objs */
+static int
+import_text(const char *text, const char *ext, GPtrArray *objs)
+{
+  char path[64];
+  int fd, res;
+
+  snprintf(path, sizeof path, "/tmp/pnid_testsXXXXXX%s", ext);
+  assert((fd = mkstemps(path, strlen(ext))) >= 0);
+  assert(write(fd, text, strlen(text)) == (ssize_t)strlen(text));
+  close(fd);
+  res = pnid_import(path, 1.0, keep_batch, objs);
+  unlink(path);
+
+  return res;
+}
+
+/* test_import(): dxf blocks become symbols sized by their
+   definitions with their attributes, y is flipped and unsupported
+   entities skipped; svg transforms are applied */
+void
+test_import(void)
+{
+  const char *dxf =
+    "0\nSECTION\n2\nBLOCKS\n"
+    "0\nBLOCK\n2\nGATE_VALVE\n10\n0\n20\n0\n"
+    "0\nLINE\n10\n-5\n20\n-2\n11\n5\n21\n2\n"
+    "0\nENDBLK\n0\nENDSEC\n"
+    "0\nSECTION\n2\nENTITIES\n"
+    "0\nLINE\n10\n0\n20\n0\n11\n100\n21\n50\n"
+    "0\nINSERT\n2\nGATE_VALVE\n66\n1\n10\n50\n20\n25\n41\n2\n"
+    "0\nATTRIB\n2\nTAG\n1\nFV-1203\n"
+    "0\nSEQEND\n0\nTEXT\n1\nnote\n"
+    "0\nENDSEC\n0\nEOF\n";
+  const char *svg =
+    "<svg viewBox=\"0 0 400 300\"><g transform=\"translate(10,20) scale(2)\">"
+    "<line x1=\"0\" y1=\"0\" x2=\"100\" y2=\"0\"/>"
+    "<use href=\"#pump\" x=\"50\" y=\"50\" data-tag=\"P-101\"/>"
+    "</g><circle r=\"3\"/></svg>";
+  GPtrArray *objs;
+  PnidObj *o;
+
+  objs = g_ptr_array_new_with_free_func((GDestroyNotify)pnid_obj_delete);
+  assert(import_text(dxf, ".dxf", objs) == 1);
+  assert(objs->len == 2);
+  o = g_ptr_array_index(objs, 0);
+  assert(o->type == PNID_OBJ_LINE_RISE);
+  assert(pnid_box_get_right(&o->bbox) == 100 && pnid_box_get_bottom(&o->bbox) == 50);
+  o = g_ptr_array_index(objs, 1);
+  assert(o->type == PNID_OBJ_SYMBOL && o->symbol == PNID_SYMBOL_VALVE);
+  assert(pnid_box_width(&o->bbox) == 20 && pnid_box_height(&o->bbox) == 4);
+  assert(!strcmp(o->attr[PNID_ATTR_TAG], "FV-1203"));
+
+  g_ptr_array_set_size(objs, 0);
+  assert(import_text(svg, ".svg", objs) == 1);
+  assert(objs->len == 2);
+  o = g_ptr_array_index(objs, 0);
+  assert(o->type == PNID_OBJ_LINE && pnid_box_get_left(&o->bbox) == 10);
+  assert(pnid_box_get_right(&o->bbox) == 210 && pnid_box_get_top(&o->bbox) == 20);
+  o = g_ptr_array_index(objs, 1);
+  assert(o->symbol == PNID_SYMBOL_PUMP && !strcmp(o->attr[PNID_ATTR_TAG], "P-101"));
+  assert(pnid_box_width(&o->bbox) == 40);
+
+  assert(import_text(svg, ".txt", objs) == -ENOTSUP);
+
+  g_ptr_array_unref(objs);
+  g_slist_free_full(import_strings, (GDestroyNotify)g_string_chunk_free);
+  import_strings = NULL;
+}
+
+/* count_chunk(): pack query callback, counts chunks found */
+static void
+count_chunk(unsigned chunk, void *data)
+{
+  (*(unsigned *)data)++;
+}
+
+/* test_pack(): every object of a drawing file is read back from its
+   chunks with its attributes, and a query of a small region finds
+   fewer chunks than the whole */
+void
+test_pack(void)
+{
+  char path[] = "/tmp/pnid_testsXXXXXX", *packed;
+  const PnidBox all = {{0, 0}, {UINT32_MAX, UINT32_MAX}};
+  const PnidBox corner = {{0, 0}, {10, 10}};
+  const int nobj = 3 * PNID_PACK_CHUNK;
+  PnidFileWriter *w;
+  PnidFile *f;
+  PnidPack *p;
+  PnidObj o = { 0 }, **objs;
+  struct pnid_pack_header hdr;
+  struct pnid_pack_entry e;
+  GStringChunk *strings;
+  unsigned i, found, seen = 0;
+  size_t j, n;
+  char *ids;
+  int fd;
+
+  assert((fd = mkstemp(path)) >= 0);
+  close(fd);
+  assert(pnid_file_writer_open(path, &w) == 0);
+  for (i = 0; i < (unsigned)nobj; i++) {
+    o.bbox = (PnidBox){{i % 64 * 100, i / 64 * 100}, {i % 64 * 100 + 10, i / 64 * 100 + 10}};
+    o.id = i;
+    o.attr[PNID_ATTR_TAG] = i % 2 ? "FV-1203" : NULL;
+    assert(pnid_file_writer_add(w, &o) == 0);
+  }
+  assert(pnid_file_writer_close(w, 0) == 0);
+
+  packed = g_strconcat(path, PNID_PACK_EXT, NULL);
+  assert(pnid_file_map(path, &f) == 0);
+  assert(pnid_pack_write(f, packed) == 0);
+  pnid_file_unmap(f);
+
+  assert(pnid_pack_open(packed, &p) == 0);
+  assert(pnid_pack_len(p) == 3 && pnid_pack_objects(p) == (size_t)nobj);
+  assert(pnid_pack_next_id(p) == (unsigned)nobj);
+  ids = g_malloc0(nobj);
+  for (i = 0; i < pnid_pack_len(p); i++) {
+    assert(pnid_pack_read(p, i, &objs, &n, &strings) == 0);
+    for (j = 0; j < n; j++) {
+      assert(!ids[objs[j]->id]);
+      ids[objs[j]->id] = 1;
+      assert(!(objs[j]->id % 2) == !objs[j]->attr[PNID_ATTR_TAG]);
+      pnid_obj_delete(objs[j]);
+    }
+    seen += n;
+    g_free(objs);
+    g_string_chunk_free(strings);
+  }
+  assert(seen == (unsigned)nobj);
+  g_free(ids);
+
+  found = 0;
+  pnid_pack_query(p, &all, count_chunk, &found);
+  assert(found == 3);
+  found = 0;
+  pnid_pack_query(p, &corner, count_chunk, &found);
+  assert(found >= 1 && found < 3);
+  pnid_pack_close(p);
+
+  /* an entry claiming more than a chunk can hold is refused */
+  assert((fd = open(packed, O_RDWR)) >= 0);
+  assert(pread(fd, &hdr, sizeof hdr, 0) == sizeof hdr);
+  assert(pread(fd, &e, sizeof e, hdr.index) == sizeof e);
+  e.usize = UINT32_MAX;
+  assert(pwrite(fd, &e, sizeof e, hdr.index) == sizeof e);
+  close(fd);
+  assert(pnid_pack_open(packed, &p) == -EPROTO);
+
+  assert(truncate(packed, sizeof(struct pnid_pack_header)) == 0);
+  assert(pnid_pack_open(packed, &p) == -EPROTO);
+
+  unlink(packed);
+  unlink(path);
+  g_free(packed);
+}
+
+/* test_prof(): the profiler ring keeps only the latest frames and
+   records nothing while disabled */
+void
+test_prof(void)
+{
+  PnidProf *p;
+  struct pnid_prof_frame mean;
+  int i;
+
+  assert((p = pnid_prof_new(4)));
+
+  PNID_PROF_FRAME_BEGIN(p);
+  PNID_PROF_FRAME_END(p);
+  assert(!pnid_prof_last(p));
+
+  pnid_prof_enable(p, 1);
+  for (i = 1; i <= 6; i++) {
+    PNID_PROF_FRAME_BEGIN(p);
+    PNID_PROF_COUNT(p, PNID_PROF_DRAWN, i);
+    PNID_PROF_FRAME_END(p);
+  }
+  assert(pnid_prof_last(p)->count[PNID_PROF_DRAWN] == 6);
+  assert(pnid_prof_mean(p, &mean) == 0);
+  assert(mean.count[PNID_PROF_DRAWN] == (3 + 4 + 5 + 6) / 4);
 
+  pnid_prof_destroy(p);
 }
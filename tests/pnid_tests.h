@@ -11,6 +11,19 @@
 #define RAND100 ((rand() % 100)) 
 
 void test_rtree (void);
+void test_rtree_walk (void);
+void test_rtree_load (void);
+void test_objstore (void);
+void test_attrindex (void);
+void test_graph (void);
+void test_undo (void);
+void test_select (void);
+void test_symdef (void);
+void test_file  (void);
+void test_journal (void);
+void test_import (void);
+void test_pack  (void);
+void test_prof  (void);
 void test_bst   (void);
 
 #endif /* __PNID_TESTS_H */